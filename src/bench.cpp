@@ -0,0 +1,144 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "bench.h"
+#include "cache.h"
+#include "demo.h"
+#include "dprint.h"
+#include "game.h"
+#include "lisp.h"
+#include "lisp_vm.h"
+
+int bench_on = 0;
+
+static char *bench_file = NULL;
+static int bench_max_ticks = 0, bench_ticks = 0;
+static int bench_level = 0;   // running a level with no input, not a demo
+
+// Phases nest (lisp called from an object tick, cache loads from drawing),
+// each one is only charged for its own time
+#define BENCH_DEPTH 32
+static int bench_stack[BENCH_DEPTH], bench_depth = 0;
+static double bench_ms[BENCH_PHASES];
+static Timer bench_timer, bench_total;
+
+static char const *bench_names[BENCH_PHASES] =
+{
+    "other", "lisp", "tick", "collide", "light", "draw", "cache"
+};
+
+int bench_init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-bench") && i + 1 < argc)
+            bench_file = argv[++i];
+        else if (!strcmp(argv[i], "-ticks") && i + 1 < argc)
+            bench_max_ticks = atoi(argv[++i]);
+    }
+    bench_on = bench_file != NULL;
+    return bench_on;
+}
+
+int bench_start()
+{
+    int len = strlen(bench_file);
+    bench_level = len > 4 && !strcmp(bench_file + len - 4, ".spe");
+    if (bench_level)
+    {
+        if (bench_max_ticks <= 0)
+        {
+            dprintf("bench: a level needs -ticks\n");
+            return 0;
+        }
+        the_game->load_level(bench_file);
+        the_game->set_state(RUN_STATE);
+    }
+    else if (!demo_man.set_state(demo_manager::PLAYING, bench_file))
+    {
+        dprintf("bench: unable to play demo %s\n", bench_file);
+        return 0;
+    }
+
+    memset(bench_ms, 0, sizeof(bench_ms));
+    bench_depth = 0;
+    bench_ticks = 0;
+    bench_timer.GetMs();
+    bench_total.GetMs();
+    return 1;
+}
+
+int bench_done()
+{
+    if (bench_max_ticks > 0 && bench_ticks >= bench_max_ticks)
+        return 1;
+    return !bench_level && demo_man.current_state() != demo_manager::PLAYING;
+}
+
+void bench_tick()
+{
+    bench_ticks++;
+}
+
+void bench_push(int phase)
+{
+    int top = bench_depth ? bench_stack[Min(bench_depth, BENCH_DEPTH) - 1]
+                          : BENCH_OTHER;
+    bench_ms[top] += bench_timer.GetMs();
+    if (bench_depth < BENCH_DEPTH)
+        bench_stack[bench_depth] = phase;
+    bench_depth++;
+}
+
+void bench_pop()
+{
+    int top = bench_stack[Min(bench_depth, BENCH_DEPTH) - 1];
+    bench_ms[top] += bench_timer.GetMs();
+    bench_depth--;
+}
+
+void bench_report()
+{
+    if (!bench_depth)
+        bench_ms[BENCH_OTHER] += bench_timer.GetMs();
+    float total = bench_total.PollMs();
+
+    // One JSON object per line so runs can simply be appended to a log
+    printf("{\"bench\":\"");
+    for (char const *s = bench_file; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        putchar(*s);
+    }
+    printf("\",\"ticks\":%d,\"ms\":%.1f,\"ticks_per_sec\":%.1f",
+           bench_ticks, total, total > 0.f ? bench_ticks * 1000.f / total : 0.f);
+    for (int i = 0; i < BENCH_PHASES; i++)
+        printf(",\"%s_ms\":%.1f", bench_names[i], bench_ms[i]);
+
+    int hits, misses, stalls;
+    cache.prefetch_stats(hits, misses, stalls);
+    printf(",\"prefetch_hits\":%d,\"prefetch_misses\":%d,\"prefetch_stalls\":%d",
+           hits, misses, stalls);
+    printf(",\"bytecode_runs\":%d", LBytecode::runs);
+    printf("}\n");
+    fflush(stdout);
+}
+
@@ -0,0 +1,53 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __BENCH_HPP_
+#define __BENCH_HPP_
+
+// Headless benchmark: "-bench demo.dat -ticks N" replays a demo as fast
+// as possible without a window and prints one JSON line per run. Given a
+// level instead, it runs it for N ticks with nobody at the controls.
+
+enum bench_phase
+{
+    BENCH_OTHER,
+    BENCH_LISP,     // object callbacks into lisp
+    BENCH_TICK,     // level::tick outside of the other phases
+    BENCH_COLLIDE,
+    BENCH_LIGHT,
+    BENCH_DRAW,     // drawing to the offscreen image
+    BENCH_CACHE,    // loading cache items from disk
+    BENCH_PHASES
+};
+
+extern int bench_on;
+
+int bench_init(int argc, char **argv);     // returns non 0 if -bench was given
+int bench_start();                         // start the demo, 0 on failure
+int bench_done();                          // tick limit reached or demo over
+void bench_tick();
+void bench_report();
+
+void bench_push(int phase);
+void bench_pop();
+
+// Time spent inside one of these is charged to its phase instead of the
+// enclosing one
+class bench_scope
+{
+public:
+    bench_scope(int phase) : on(bench_on) { if (on) bench_push(phase); }
+    ~bench_scope() { if (on) bench_pop(); }
+private:
+    int on;
+};
+
+#endif
+
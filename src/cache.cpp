@@ -19,6 +19,8 @@
 #include <fcntl.h>
 #include <string.h>
 
+#include "SDL.h"
+
 #include "common.h"
 
 #include "cache.h"
@@ -35,9 +37,17 @@
 #include "dev.h"
 #include "specache.h"
 #include "netface.h"
+#include "bench.h"
+#include "workers.h"
+#include "pack.h"
+#include "trace.h"
 
 #define touch(x) { (x)->last_access=last_access++; \
-           if ((x)->last_access<0) { normalize(); (x)->last_access=1; } }
+           if ((x)->last_access<0) { normalize(); (x)->last_access=1; } \
+           lru_touch(x); }
+
+#define LRU_END -1    // lru_prev/lru_next at either end of the list
+#define LRU_OFF -2    // not on the list: not loaded or never thrown out
 
 CrcManager crc_manager;
 
@@ -187,8 +197,644 @@ void CrcManager::set_crc(int filenumber, uint32_t crc)
   files[filenumber]->crc=crc;
 }
 
+/*
+ * Background prefetching: a loader thread decodes the items the level's
+ * cache profile asks for and the tiles the views are scrolling towards,
+ * and the main thread adopts them in prefetch_poll(). Requests and results
+ * go through two single producer, single consumer rings so neither side
+ * ever takes a lock. The loader only reads mapped files and only builds
+ * objects that need no shared state, sounds and palettes stay synchronous.
+ */
+
+#define PREFETCH_RING 64     // requests in flight, a power of two
+#define PREFETCH_AHEAD 8     // ticks of view movement to look ahead
+
+enum
+{
+    PREFETCH_NONE,
+    PREFETCH_BACKLOG,        // waiting to be sent to the loader
+    PREFETCH_QUEUED,         // owned by the loader
+    PREFETCH_LOADED          // adopted, not used yet
+};
+
+struct PrefetchSlot
+{
+    int id;
+    uint8_t type;
+    int16_t file_number;
+    int32_t offset;
+    char const *filename;
+    void *data;
+};
+
+struct PrefetchRing
+{
+    PrefetchSlot slot[PREFETCH_RING];
+    SDL_atomic_t head, tail; // each written by one side only
+};
+
+static int prefetch_on = 0;
+static PrefetchRing prefetch_requests, prefetch_results;
+static SDL_sem *prefetch_wake, *prefetch_done;
+static int prefetch_in_flight = 0;
+
+// Ids waiting for room in the ring, newest first so that where the views
+// are going is loaded before the rest of the profile
+static int *prefetch_backlog = NULL, prefetch_pending = 0, prefetch_size = 0;
+
+static int prefetch_hits = 0, prefetch_misses = 0, prefetch_stalls = 0;
+
+static int ring_push(PrefetchRing *r, PrefetchSlot const *s)
+{
+    int head = SDL_AtomicGet(&r->head);
+    if (head - SDL_AtomicGet(&r->tail) >= PREFETCH_RING)
+        return 0;
+    r->slot[(unsigned)head % PREFETCH_RING] = *s;
+    SDL_AtomicAdd(&r->head, 1); // publishes the slot
+    return 1;
+}
+
+static int ring_pop(PrefetchRing *r, PrefetchSlot *s)
+{
+    int tail = SDL_AtomicGet(&r->tail);
+    if (tail == SDL_AtomicGet(&r->head))
+        return 0;
+    *s = r->slot[(unsigned)tail % PREFETCH_RING];
+    SDL_AtomicAdd(&r->tail, 1); // hands the slot back
+    return 1;
+}
+
+static int prefetchable(int type)
+{
+    switch (type)
+    {
+        case SPEC_BACKTILE :
+        case SPEC_FORETILE :
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 :
+        case SPEC_IMAGE :
+        case SPEC_PARTICLE : return 1;
+    }
+    return 0;
+}
+
+static void *prefetch_decode(bFILE *fp, int type)
+{
+    trace_zone tz("cache decode", spec_types[type]);
+    switch (type)
+    {
+        case SPEC_BACKTILE : return new backtile(fp);
+        case SPEC_FORETILE : return new foretile(fp);
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 : return new figure(fp, type);
+        case SPEC_IMAGE : return new image(fp);
+        case SPEC_PARTICLE : return new part_frame(fp);
+    }
+    return NULL;
+}
+
+static int prefetch_main(void *)
+{
+    image::SetUnlisted(true);
+
+    mFILE *fp = NULL;
+    int file_number = -1;
+    for (;;)
+    {
+        SDL_SemWait(prefetch_wake);
+
+        PrefetchSlot s;
+        if (!ring_pop(&prefetch_requests, &s))
+            continue;
+
+        // jFILE reads of the main spe share its descriptor with the game,
+        // so only a mapping is safe to read from here
+        if (s.file_number != file_number)
+        {
+            delete fp;
+            fp = new mFILE(s.filename);
+            file_number = s.file_number;
+        }
+
+        // bFILE::seek() always returns 1, so check the offset by hand
+        s.data = NULL;
+        if (!fp->open_failure() && s.offset >= 0
+             && s.offset < fp->file_size())
+        {
+            fp->seek(s.offset, SEEK_SET);
+            s.data = prefetch_decode(fp, s.type);
+        }
+
+        // Let go of the file before the last result is seen, file numbers
+        // are reused once the main thread has flushed
+        if (SDL_AtomicGet(&prefetch_requests.tail)
+             == SDL_AtomicGet(&prefetch_requests.head))
+        {
+            delete fp;
+            fp = NULL;
+            file_number = -1;
+        }
+
+        ring_push(&prefetch_results, &s); // never full, see prefetch_poll()
+        SDL_SemPost(prefetch_done);
+    }
+    return 0;
+}
+
+void CacheList::prefetch_init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-prefetch"))
+            prefetch_on = 1;
+    if (!prefetch_on)
+        return;
+
+    prefetch_wake = SDL_CreateSemaphore(0);
+    prefetch_done = SDL_CreateSemaphore(0);
+    SDL_Thread *t = NULL;
+    if (prefetch_wake && prefetch_done)
+        t = SDL_CreateThread(prefetch_main, "prefetch", NULL);
+    if (!t)
+    {
+        dprintf("prefetch: unable to start loader: %s\n", SDL_GetError());
+        prefetch_on = 0;
+        return;
+    }
+    SDL_DetachThread(t);
+}
+
+void CacheList::prefetch_push(int id)
+{
+    if (prefetch_pending == prefetch_size)
+    {
+        prefetch_size += 256;
+        prefetch_backlog = (int *)realloc(prefetch_backlog,
+                                          sizeof(int) * prefetch_size);
+    }
+    prefetch_backlog[prefetch_pending++] = id;
+    list[id].prefetch = PREFETCH_BACKLOG;
+}
+
+void CacheList::prefetch_tiles(int x1, int y1, int x2, int y2, int fg)
+{
+    int w = fg ? current_level->foreground_width()
+               : current_level->background_width();
+    int h = fg ? current_level->foreground_height()
+               : current_level->background_height();
+    x1 = Max(x1, 0); y1 = Max(y1, 0);
+    x2 = Min(x2, w - 1); y2 = Min(y2, h - 1);
+
+    for (int y = y1; y <= y2; y++)
+    {
+        uint16_t *line = fg ? current_level->get_fgline(y)
+                            : current_level->get_bgline(y);
+        for (int x = x1; x <= x2; x++)
+        {
+            int id = -1, n = fg ? fgvalue(line[x]) : bgvalue(line[x]);
+            if (fg && n < nforetiles)
+                id = foretiles[n];
+            else if (!fg && n < nbacktiles)
+                id = backtiles[n];
+
+            if (id >= 0 && id < total && list[id].file_number >= 0
+                 && list[id].last_access < 0 && !list[id].prefetch)
+                prefetch_push(id);
+        }
+    }
+}
+
+void CacheList::prefetch_view(view *v)
+{
+    if (!prefetch_on || !current_level || !v->drawable())
+        return;
+
+    // The interpolated offset lags half a tick behind, so this is the
+    // distance covered in PREFETCH_AHEAD ticks at the current speed
+    int32_t x = v->xoff(), y = v->yoff();
+    int32_t dx = (x - v->interpolated_xoff()) * 2 * PREFETCH_AHEAD;
+    int32_t dy = (y - v->interpolated_yoff()) * 2 * PREFETCH_AHEAD;
+
+    int32_t x1 = x + Min(dx, 0), y1 = y + Min(dy, 0);
+    int32_t x2 = x + v->m_bb.x - v->m_aa.x + Max(dx, 0);
+    int32_t y2 = y + v->m_bb.y - v->m_aa.y + Max(dy, 0);
+
+    int bw = the_game->btile_width(), bh = the_game->btile_height();
+    prefetch_tiles(x1 * bg_xmul / bg_xdiv / bw - 1,
+                   y1 * bg_ymul / bg_ydiv / bh - 1,
+                   x2 * bg_xmul / bg_xdiv / bw + 1,
+                   y2 * bg_ymul / bg_ydiv / bh + 1, 0);
+
+    int fw = the_game->ftile_width(), fh = the_game->ftile_height();
+    prefetch_tiles(x1 / fw - 1, y1 / fh - 1, x2 / fw + 1, y2 / fh + 1, 1);
+}
+
+int CacheList::prefetch_drain()
+{
+    int n = 0;
+    PrefetchSlot s;
+    while (ring_pop(&prefetch_results, &s))
+    {
+        SDL_SemTryWait(prefetch_done);
+        prefetch_in_flight--;
+        n++;
+
+        // The item may have been loaded, dropped or reused meanwhile
+        CacheItem *me = s.id < total ? list + s.id : NULL;
+        if (me && me->prefetch == PREFETCH_QUEUED
+             && me->file_number == s.file_number && me->offset == s.offset)
+        {
+            if (s.data && me->last_access < 0)
+            {
+                me->data = s.data;
+                touch(me);
+                charge(me);
+                me->prefetch = PREFETCH_LOADED;
+                continue;
+            }
+            me->prefetch = PREFETCH_NONE;
+        }
+
+        if (s.data)
+        {
+            CacheItem tmp;
+            tmp.type = s.type;
+            tmp.data = s.data;
+            tmp.lru_prev = tmp.lru_next = LRU_OFF;
+            tmp.bytes = 0;
+            unmalloc(&tmp);
+        }
+    }
+    return n;
+}
+
+void CacheList::prefetch_poll()
+{
+    if (!prefetch_on)
+        return;
+
+    prefetch_drain();
+
+    // prefetch_in_flight bounds both rings, so pushing can't fail
+    while (prefetch_pending && prefetch_in_flight < PREFETCH_RING)
+    {
+        int id = prefetch_backlog[--prefetch_pending];
+        if (id >= total || list[id].prefetch != PREFETCH_BACKLOG)
+            continue;
+
+        CacheItem *me = list + id;
+        if (me->file_number < 0 || me->last_access >= 0)
+        {
+            me->prefetch = PREFETCH_NONE;
+            continue;
+        }
+
+        PrefetchSlot s;
+        s.id = id;
+        s.type = me->type;
+        s.file_number = me->file_number;
+        s.offset = me->offset;
+        s.filename = crc_manager.get_filename(me->file_number);
+        s.data = NULL;
+        ring_push(&prefetch_requests, &s);
+        SDL_SemPost(prefetch_wake);
+
+        me->prefetch = PREFETCH_QUEUED;
+        prefetch_in_flight++;
+    }
+}
+
+void CacheList::prefetch_check(CacheItem *me)
+{
+    if (me->prefetch == PREFETCH_LOADED)
+        prefetch_hits++;
+    else if (me->prefetch == PREFETCH_QUEUED)
+    {
+        // Needed before the loader got to it, wait rather than load twice
+        trace_zone tz("cache stall", spec_types[me->type]);
+        bench_scope bs(BENCH_CACHE);
+        prefetch_stalls++;
+        while (me->prefetch == PREFETCH_QUEUED)
+            if (!prefetch_drain())
+                SDL_SemWait(prefetch_done);
+    }
+    me->prefetch = PREFETCH_NONE;
+}
+
+void CacheList::prefetch_flush()
+{
+    if (!prefetch_on)
+        return;
+
+    while (prefetch_pending)
+    {
+        int id = prefetch_backlog[--prefetch_pending];
+        if (id < total && list[id].prefetch == PREFETCH_BACKLOG)
+            list[id].prefetch = PREFETCH_NONE;
+    }
+
+    while (prefetch_in_flight)
+        if (!prefetch_drain())
+            SDL_SemWait(prefetch_done);
+}
+
+void CacheList::prefetch_stats(int &hits, int &misses, int &stalls)
+{
+    hits = prefetch_hits;
+    misses = prefetch_misses;
+    stalls = prefetch_stalls;
+}
+
+// Builds an item from its pack blob, see pack.h
+static void *pack_decode(uint8_t const *p, int type)
+{
+    trace_zone tz("pack decode", spec_types[type]);
+    switch (type)
+    {
+        case SPEC_BACKTILE : return new backtile(p);
+        case SPEC_FORETILE : return new foretile(p);
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 : return new figure(p);
+        case SPEC_IMAGE : return pack_read_image(p);
+    }
+    return NULL;
+}
+
+PackFile *CacheList::pack(int file_number)
+{
+    if (file_number >= tpacks)
+    {
+        int n = file_number + 16;
+        packs = (PackFile **)realloc(packs, sizeof(PackFile *) * n);
+        memset(packs + tpacks, 0, sizeof(PackFile *) * (n - tpacks));
+        tpacks = n;
+    }
+
+    if (!packs[file_number])
+    {
+        char const *spe = crc_manager.get_filename(file_number);
+        char *name = pack_filename(spe);
+        PackFile *pk = new PackFile(name);
+        if (!pk->open_failure())
+        {
+            bFILE *fp = open_file(spe, "rb");
+            if (!pk->matches(fp))
+            {
+                dprintf("%s was not made from %s, ignoring it\n", name, spe);
+                pk->error = "out of date";
+            }
+            delete fp;
+        }
+        free(name);
+        packs[file_number] = pk;
+    }
+    return packs[file_number];
+}
+
+// Packs hold items at their original size, scaled ones still need the .spe
+uint8_t const *CacheList::pack_blob(CacheItem *me)
+{
+    if (scale_mult != 1 || scale_div != 1)
+        return NULL;
+
+    PackFile *pk = pack(me->file_number);
+    if (pk->open_failure())
+        return NULL;
+    PackEntry *e = pk->find_source(me->offset);
+    if (!e || e->type != me->type)
+        return NULL;
+    // the readers trust the sizes inside the blob
+    if (!pk->check(e))
+    {
+        dprintf("pack: CRC mismatch for %s, loading it from the .spe\n",
+                e->name);
+        return NULL;
+    }
+    return pk->blob(e);
+}
+
+/*
+ * Level loads decode everything the profile asks for in one go. Parts are
+ * sorted by file and offset so each file is mapped once and swept from
+ * start to end, decoded on the worker pool through their own view of the
+ * mapping, then adopted in the order they were asked for so ids and
+ * access stamps come out as if they were loaded one by one.
+ */
+
+struct DecodePart
+{
+    int id;
+    uint8_t type;
+    int16_t file_number;
+    int32_t offset;
+    mFILE *file;
+    uint8_t const *blob;
+    void *data;
+};
+
+static int part_compare(void const *a, void const *b)
+{
+    DecodePart const *p = (DecodePart const *)a, *q = (DecodePart const *)b;
+    if (p->file_number != q->file_number)
+        return p->file_number < q->file_number ? -1 : 1;
+    return p->offset < q->offset ? -1 : p->offset > q->offset;
+}
+
+static void decode_part(void *data, int index)
+{
+    DecodePart *p = (DecodePart *)data + index;
+    p->data = NULL;
+
+    image::SetUnlisted(true);
+    if (p->blob)
+        p->data = pack_decode(p->blob, p->type);
+    else if (!p->file->open_failure())
+    {
+        // bFILE::seek() always returns 1, so check the offset by hand
+        long size = p->file->file_size();
+        mFILE fp(p->file->mapped(0, size), size);
+        if (p->offset >= 0 && p->offset < size)
+        {
+            fp.seek(p->offset, SEEK_SET);
+            p->data = prefetch_decode(&fp, p->type);
+        }
+    }
+    image::SetUnlisted(false);
+}
+
+void CacheList::decode_batch(int *ids, int count)
+{
+    if (!count)
+        return;
+
+    trace_zone tz("cache batch");
+    bench_scope bs(BENCH_CACHE);
+    DecodePart *parts = (DecodePart *)malloc(sizeof(DecodePart) * count);
+    for (int i = 0; i < count; i++)
+    {
+        parts[i].id = ids[i];
+        parts[i].type = list[ids[i]].type;
+        parts[i].file_number = list[ids[i]].file_number;
+        parts[i].offset = list[ids[i]].offset;
+        parts[i].blob = pack_blob(list + ids[i]);
+    }
+    qsort(parts, count, sizeof(DecodePart), part_compare);
+
+    mFILE *file = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        if (!i || parts[i].file_number != parts[i - 1].file_number)
+            file = new mFILE(crc_manager.get_filename(parts[i].file_number));
+        parts[i].file = file;
+    }
+
+    workers_run(decode_part, parts, count);
+
+    // Back in id order, the mappings go once their last part is seen
+    void **data = (void **)malloc(sizeof(void *) * total);
+    for (int i = 0; i < count; i++)
+    {
+        data[parts[i].id] = parts[i].data;
+        if (i == count - 1 || parts[i + 1].file != parts[i].file)
+            delete parts[i].file;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        CacheItem *me = list + ids[i];
+        misses++;
+        touch(me);
+        me->data = data[ids[i]];
+        if (!me->data)
+        {
+            printf("Ooch. Could not load item from %s\n",
+                   crc_manager.get_filename(me->file_number));
+            exit(0);
+        }
+        charge(me);
+    }
+    used = 1;
+
+    free(data);
+    free(parts);
+}
+
+// Memory held by a loaded item
+static size_t item_bytes(void *data, int type)
+{
+  switch (type)
+  {
+    case SPEC_BACKTILE :
+    {
+      ivec2 s=((backtile *)data)->im->Size();
+      return sizeof(backtile)+sizeof(image)+s.x*s.y;
+    }
+    case SPEC_FORETILE :
+    {
+      foretile *f=(foretile *)data;
+      size_t n=sizeof(foretile)+f->im->DiskUsage()+f->points->size();
+      if (f->micro_image)
+        n+=sizeof(image)+f->micro_image->Size().x*f->micro_image->Size().y;
+      return n;
+    }
+    case SPEC_CHARACTER2 :
+    case SPEC_CHARACTER : return ((figure *)data)->MemUsage();
+    case SPEC_IMAGE :
+    {
+      ivec2 s=((image *)data)->Size();
+      return sizeof(image)+s.x*s.y;
+    }
+    case SPEC_EXTERN_SFX : return sizeof(sound_effect)+((sound_effect *)data)->MemUsage();
+    case SPEC_PARTICLE : return sizeof(part_frame)+((part_frame *)data)->t*sizeof(part);
+    case SPEC_PALETTE : return sizeof(char_tint);
+  }
+  return 0;
+}
+
+// Only what is looked up again every time it is used can be thrown out:
+// images are kept by their users and sounds may still be playing
+static int evictable(int type)
+{
+  return type==SPEC_BACKTILE || type==SPEC_FORETILE || type==SPEC_CHARACTER ||
+         type==SPEC_CHARACTER2 || type==SPEC_PARTICLE;
+}
+
+void CacheList::lru_unlink(CacheItem *ci)
+{
+  if (ci->lru_prev==LRU_OFF)
+    return;
+  if (ci->lru_prev==LRU_END) lru_head=ci->lru_next;
+  else list[ci->lru_prev].lru_next=ci->lru_next;
+  if (ci->lru_next==LRU_END) lru_tail=ci->lru_prev;
+  else list[ci->lru_next].lru_prev=ci->lru_prev;
+  ci->lru_prev=ci->lru_next=LRU_OFF;
+}
+
+void CacheList::lru_touch(CacheItem *ci)
+{
+  if (ci->lru_prev==LRU_OFF || ci->lru_prev==LRU_END)
+    return;       // not on the list or already first
+  lru_unlink(ci);
+  int32_t id=ci-list;
+  ci->lru_prev=LRU_END;
+  ci->lru_next=lru_head;
+  list[lru_head].lru_prev=id;
+  lru_head=id;
+}
+
+void CacheList::charge(CacheItem *ci)
+{
+  ci->bytes=item_bytes(ci->data,ci->type);
+  resident+=ci->bytes;
+  if (!evictable(ci->type) || ci->lru_prev!=LRU_OFF)
+    return;
+
+  int32_t id=ci-list;
+  ci->lru_prev=LRU_END;
+  ci->lru_next=lru_head;
+  if (lru_head!=LRU_END) list[lru_head].lru_prev=id;
+  else lru_tail=id;
+  lru_head=id;
+}
+
+void CacheList::budget_init(int argc, char **argv)
+{
+  for (int i=1; i<argc-1; i++)
+    if (!strcmp(argv[i],"-cache-mb"))
+      budget=(size_t)atoi(argv[i+1])*1024*1024;
+}
+
+void CacheList::trim()
+{
+  // Whatever was used since the last call may still be pointed to, and
+  // throwing it out would only mean loading it again for the next tick
+  while (budget && resident>budget && lru_tail!=LRU_END
+         && list[lru_tail].last_access<frame_access)
+  {
+    unmalloc(list+lru_tail);
+    evictions++;
+  }
+  frame_access=last_access;
+}
+
+void CacheList::show_stats()
+{
+  int n=0;
+  for (int i=0; i<total; i++)
+    if (list[i].file_number>=0 && list[i].data)
+      n++;
+  int32_t lookups=hits+misses;
+  dprintf("cache : %d items, %ld KB resident",n,(long)(resident/1024));
+  if (budget)
+    dprintf(" of %ld KB",(long)(budget/1024));
+  dprintf(", %d%% hits (%d of %d), %d evicted\n",
+          lookups ? (int)((int64_t)hits*100/lookups) : 100,hits,lookups,evictions);
+}
+
 void CacheList::unmalloc(CacheItem *i)
 {
+  lru_unlink(i);
+  resident-=i->bytes;
+  i->bytes=0;
+
   switch (i->type)
   {
     case SPEC_CHARACTER2 :
@@ -205,6 +851,7 @@ void CacheList::unmalloc(CacheItem *i)
   }
   i->data=NULL;
   i->last_access=-1;
+  i->prefetch=PREFETCH_NONE;
 }
 
 
@@ -474,6 +1121,8 @@ void CacheList::preload_cache(level *lev)
 
 void CacheList::load_cache_prof_info(char *filename, level *lev)
 {
+  prefetch_flush();                  // forget what the last level wanted
+
   int j;
   for (j=0; j<this->total; j++)
     if (list[j].last_access>=0)      // reset all loaded cache items to 0, all non-load to -1
@@ -482,6 +1131,7 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
   preload_cache(lev);                // preliminary guesses at stuff to load
 
   int load_fail=1;
+  int *batch=(int *)malloc(sizeof(int)*total),nbatch=0;  // decoded together
   bFILE *fp=open_file(filename,"rb");
   if (!fp->open_failure())
   {
@@ -560,7 +1210,17 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
       if (list[j].file_number>=0 && list[j].last_access==-2)
       {
         list[j].last_access=-1;
-        if (!ful)
+        if (!ful && prefetch_on && prefetchable(list[j].type))
+        {
+          prefetch_push(j);
+          tcached++;
+        }
+        else if (!ful && prefetchable(list[j].type))
+        {
+          batch[nbatch++]=j;
+          tcached++;
+        }
+        else if (!ful)
         {
           switch (list[j].type)
           {
@@ -578,6 +1238,7 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
         }
       }
     }
+    decode_batch(batch,nbatch);
     load_fail=0;
 //    if (full())
 //      dprintf("Cache filled while loading\n");
@@ -586,6 +1247,7 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
       tmatches=tsaved+1;
 
     last_access=tmatches+1;
+    frame_access=0;
     for (i=0; i<tsaved; i++)      // reorder the last access of each cache to reflect prioirties
     {
       if (priority[i]!=-1)
@@ -613,7 +1275,11 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
       if (list[j].file_number>=0 && list[j].last_access==-2)
       {
     list[j].last_access=-1;
-    if (!ful)
+    if (!ful && prefetch_on && prefetchable(list[j].type))
+      prefetch_push(j);
+    else if (!ful && prefetchable(list[j].type))
+      batch[nbatch++]=j;
+    else if (!ful)
     {
       switch (list[j].type)
       {
@@ -630,9 +1296,11 @@ void CacheList::load_cache_prof_info(char *filename, level *lev)
     }
       }
     }
+    decode_batch(batch,nbatch);
     if (full())
       dprintf("Cache filled while loading\n");
   }
+  free(batch);
   delete fp;
 }
 
@@ -679,6 +1347,14 @@ CacheList::CacheList()
     last_dir = NULL;
     last_file = -1;
     prof_data = NULL;
+    lru_head = lru_tail = LRU_END;
+    frame_access = 0;
+    resident = budget = 0;
+    hits = misses = evictions = 0;
+    dup_hash = NULL;
+    dup_mask = dup_used = 0;
+    packs = NULL;
+    tpacks = 0;
 }
 
 CacheList::~CacheList()
@@ -687,12 +1363,17 @@ CacheList::~CacheList()
 
 void CacheList::empty()
 {
+  prefetch_flush();
   for (int i=0; i<total; i++)
   {
     if (list[i].file_number>=0 && list[i].last_access!=-1)
       unmalloc(&list[i]);
   }
   free(list);
+  free(dup_hash);
+  for (int i=0; i<tpacks; i++)
+    delete packs[i];
+  free(packs);
   if (fp) delete fp;
   if (last_dir) delete last_dir;
 
@@ -712,6 +1393,13 @@ void CacheList::empty()
   last_dir=NULL;
   last_file=-1;
   prof_data=NULL;
+  lru_head=lru_tail=LRU_END;
+  frame_access=0;
+  resident=0;
+  dup_hash=NULL;
+  dup_mask=dup_used=0;
+  packs=NULL;
+  tpacks=0;
 }
 
 void CacheList::locate(CacheItem *i, int local_only)
@@ -722,7 +1410,7 @@ void CacheList::locate(CacheItem *i, int local_only)
     if (fp) delete fp;
     if (last_dir) delete last_dir;
     if (local_only)
-      fp=new jFILE(crc_manager.get_filename(i->file_number),"rb");
+      fp=open_mapped_file(crc_manager.get_filename(i->file_number));
     else
       fp=open_file(crc_manager.get_filename(i->file_number),"rb");
 
@@ -777,6 +1465,9 @@ int CacheList::AllocId()
                 list[total + i].file_number = -1; // mark new entries as new
                 list[total + i].last_access = -1;
                 list[total + i].data = NULL;
+                list[total + i].prefetch = PREFETCH_NONE;
+                list[total + i].lru_prev = list[total + i].lru_next = LRU_OFF;
+                list[total + i].bytes = 0;
             }
             ret = total;
             // If new id's have been added, old prof_data size won't work
@@ -808,6 +1499,50 @@ int CacheList::reg_object(char const *filename, LObject *object,
 
 extern int total_files_open;
 
+static inline uint32_t dup_slot(int fn, int32_t offset)
+{
+    return ((uint32_t)offset * 2654435761u) ^ ((uint32_t)fn * 40503u);
+}
+
+void CacheList::dup_insert(int id)
+{
+    if ((dup_used + 1) * 2 > dup_mask + 1)
+    {
+        // Rehash the live items only, which also drops the stale slots
+        uint32_t n = 64;
+        while (n < (uint32_t)total * 2)
+            n <<= 1;
+        free(dup_hash);
+        dup_hash = (int32_t *)malloc(sizeof(int32_t) * n);
+        memset(dup_hash, 0xff, sizeof(int32_t) * n);
+        dup_mask = n - 1;
+        dup_used = 0;
+        for (int i = 0; i < total; i++)
+            if (i != id && list[i].file_number >= 0)
+                dup_insert(i);
+    }
+
+    uint32_t h = dup_slot(list[id].file_number, list[id].offset) & dup_mask;
+    while (dup_hash[h] >= 0)
+        h = (h + 1) & dup_mask;
+    dup_hash[h] = id;
+    dup_used++;
+}
+
+int CacheList::dup_find(int fn, int32_t offset)
+{
+    if (!dup_hash)
+        return -1;
+    for (uint32_t h = dup_slot(fn, offset) & dup_mask; dup_hash[h] >= 0;
+         h = (h + 1) & dup_mask)
+    {
+        CacheItem *ci = &list[dup_hash[h]];
+        if (ci->file_number == fn && ci->offset == offset)
+            return dup_hash[h];
+    }
+    return -1;
+}
+
 int CacheList::reg(char const *filename, char const *name, int type, int rm_dups)
 {
     int fn = crc_manager.get_filenumber(filename);
@@ -874,9 +1609,9 @@ int CacheList::reg(char const *filename, char const *name, int type, int rm_dups
     // file and offset, and return it as a shortcut.
     if (rm_dups)
     {
-        for (int i = 0; i < total; i++)
-            if (list[i].file_number == fn && list[i].offset == offset)
-                return i;
+        int dup = dup_find(fn, offset);
+        if (dup >= 0)
+            return dup;
     }
 
     int id = AllocId();
@@ -888,6 +1623,10 @@ int CacheList::reg(char const *filename, char const *name, int type, int rm_dups
     list[id].data = NULL;
     list[id].offset = offset;
     list[id].type = type;
+    list[id].prefetch = PREFETCH_NONE;
+    list[id].lru_prev = list[id].lru_next = LRU_OFF;
+    list[id].bytes = 0;
+    dup_insert(id);
 
     return id;
 }
@@ -906,6 +1645,7 @@ void CacheList::normalize()
       last_access=ci->last_access;
   }
   last_access++;
+  frame_access=0;     // nothing is old enough to throw out until the next trim()
 }
 
 backtile *CacheList::backt(int id)
@@ -913,17 +1653,32 @@ backtile *CacheList::backt(int id)
   CacheItem *me=list+id;
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
 
+  if (me->prefetch)
+    prefetch_check(me);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);
     return (backtile *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    if (prefetch_on)
+      prefetch_misses++;
+    misses++;
     touch(me);
-    locate(me);
-    me->data=(void *)new backtile(fp);
-    last_offset=fp->tell();
+    uint8_t const *blob=pack_blob(me);
+    if (blob)
+      me->data=pack_decode(blob,me->type);
+    else
+    {
+      locate(me);
+      me->data=(void *)new backtile(fp);
+      last_offset=fp->tell();
+    }
+    charge(me);
     return (backtile *)me->data;
   }
 }
@@ -934,17 +1689,32 @@ foretile *CacheList::foret(int id)
   CacheItem *me=list+id;
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
 
+  if (me->prefetch)
+    prefetch_check(me);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);
     return (foretile *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    if (prefetch_on)
+      prefetch_misses++;
+    misses++;
     touch(me);
-    locate(me);
-    me->data=(void *)new foretile(fp);
-    last_offset=fp->tell();
+    uint8_t const *blob=pack_blob(me);
+    if (blob)
+      me->data=pack_decode(blob,me->type);
+    else
+    {
+      locate(me);
+      me->data=(void *)new foretile(fp);
+      last_offset=fp->tell();
+    }
+    charge(me);
     return (foretile *)me->data;
   }
 }
@@ -953,17 +1723,32 @@ figure *CacheList::fig(int id)
 {
   CacheItem *me=list+id;
 //  CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
+  if (me->prefetch)
+    prefetch_check(me);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);
     return (figure *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    if (prefetch_on)
+      prefetch_misses++;
+    misses++;
     touch(me);
-    locate(me);
-    me->data=(void *)new figure(fp,me->type);
-     last_offset=fp->tell();
+    uint8_t const *blob=pack_blob(me);
+    if (blob)
+      me->data=pack_decode(blob,me->type);
+    else
+    {
+      locate(me);
+      me->data=(void *)new figure(fp,me->type);
+      last_offset=fp->tell();
+    }
+    charge(me);
     return (figure *)me->data;
   }
 }
@@ -972,18 +1757,32 @@ image *CacheList::img(int id)
 {
   CacheItem *me=list+id;
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
+  if (me->prefetch)
+    prefetch_check(me);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);
     return (image *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    if (prefetch_on)
+      prefetch_misses++;
+    misses++;
     touch(me);                                           // hold me, feel me, be me!
-    locate(me);
-    image *im=new image(fp);
-    me->data=(void *)im;
-    last_offset=fp->tell();
+    uint8_t const *blob=pack_blob(me);
+    if (blob)
+      me->data=pack_decode(blob,me->type);
+    else
+    {
+      locate(me);
+      me->data=(void *)new image(fp);
+      last_offset=fp->tell();
+    }
+    charge(me);
 
     return (image *)me->data;
   }
@@ -995,14 +1794,19 @@ sound_effect *CacheList::sfx(int id)
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);                                           // hold me, feel me, be me!
     return (sound_effect *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    misses++;
     touch(me);                                           // hold me, feel me, be me!
     char *fn=crc_manager.get_filename(me->file_number);
     me->data=(void *)new sound_effect(fn);
+    charge(me);
     return (sound_effect *)me->data;
   }
 }
@@ -1012,16 +1816,25 @@ part_frame *CacheList::part(int id)
 {
   CacheItem *me=list+id;
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id");
+  if (me->prefetch)
+    prefetch_check(me);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);                                           // hold me, feel me, be me!
     return (part_frame *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    if (prefetch_on)
+      prefetch_misses++;
+    misses++;
     touch(me);
     locate(me);
     me->data=(void *)new part_frame(fp);
+    charge(me);
     last_offset=fp->tell();
     return (part_frame *)me->data;
   }
@@ -1039,22 +1852,13 @@ CacheList cache;
 
 void CacheList::free_oldest()
 {
-  int32_t old_time = last_access;
-  CacheItem *ci=list,*oldest=NULL;
   ful=1;
-
-  for (int i = 0; i < total; i++, ci++)
-  {
-    if (ci->data && ci->last_access < old_time)
-    {
-      oldest = ci;
-      old_time = ci->last_access;
-    }
-  }
-  if (oldest)
+  if (lru_tail!=LRU_END)
   {
+    CacheItem *oldest=list+lru_tail;
     dprintf("mem_maker : freeing %s\n",spec_types[oldest->type]);
     unmalloc(oldest);
+    evictions++;
   }
   else
   {
@@ -1109,14 +1913,19 @@ char_tint *CacheList::ctint(int id)
   CONDITION(id<total && id>=0 && me->file_number>=0,"Bad id" && me->type==SPEC_PALETTE);
   if (me->last_access>=0)
   {
+    hits++;
     touch(me);
     return (char_tint *)me->data;
   }
   else
   {
+    trace_zone tz("cache miss", spec_types[me->type]);
+    bench_scope bs(BENCH_CACHE);
+    misses++;
     touch(me);
     locate(me);
     me->data=(void *)new char_tint(fp);
+    charge(me);
     last_offset=fp->tell();
     return (char_tint *)me->data;
   }
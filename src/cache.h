@@ -21,6 +21,8 @@
 #include "particle.h"
 
 class level;
+class view;
+class PackFile;
 
 class CrcedFile
 {
@@ -74,6 +76,9 @@ protected:
     uint8_t type;
     int16_t file_number;
     int32_t offset;
+    uint8_t prefetch; // PREFETCH_* state, see cache.cpp
+    int32_t lru_prev, lru_next; // on the eviction list, LRU_OFF if not
+    uint32_t bytes;   // memory held by data, counted against -cache-mb
 };
 
 class CacheList
@@ -95,14 +100,39 @@ private:
     int used, // flag set when disk is accessed
         ful;  // set when stuff has to be thrown out
     int *prof_data; // holds counts for each id
+
+    // Loaded items that may be thrown out, most recently used first
+    int32_t lru_head, lru_tail, frame_access;
+    size_t resident, budget;
+    int32_t hits, misses, evictions;
+    void lru_unlink(CacheItem *ci);
+    void lru_touch(CacheItem *ci);
+    void charge(CacheItem *ci);     // count a freshly loaded item
+    // Ids by file and offset so reg() can spot duplicates without a scan.
+    // Slots go stale on unreg() and are checked against list[] on lookup.
+    int32_t *dup_hash;
+    uint32_t dup_mask, dup_used;
+    void dup_insert(int id);
+    int dup_find(int fn, int32_t offset);
     void preload_cache_object(int type);
     void preload_cache(level *lev);
+    void prefetch_push(int id);
+    void prefetch_tiles(int x1, int y1, int x2, int y2, int fg);
+    int prefetch_drain();
+    void prefetch_check(CacheItem *me);
+    PackFile **packs;   // by file number, looked for on first use
+    int tpacks;
+    PackFile *pack(int file_number);
+    uint8_t const *pack_blob(CacheItem *me);
 
 public:
     CacheList();
     ~CacheList();
 
     void free_oldest();
+    void budget_init(int argc, char **argv);   // "-cache-mb <n>"
+    void trim();          // between ticks: evict until under budget
+    void show_stats();
     int in_use() { if (used) { used = 0; return 1; } else return 0; }
     int full() { if (ful) { ful = 0; return 1; } else return 0; }
     int reg_object(char const *filename, LObject *object, int type,
@@ -112,6 +142,7 @@ public:
     int loaded(int id);
     void unreg(int id);
     void note_need(int id);
+    void decode_batch(int *ids, int count);    // load them all at once, like a level load
 
     backtile *backt(int id);
     foretile *foret(int id);
@@ -138,6 +169,13 @@ public:
 
     void show_accessed();
     void empty();
+
+    // Background loading, enabled with "-prefetch"
+    void prefetch_init(int argc, char **argv);
+    void prefetch_view(view *v);   // queue tiles the view is heading to
+    void prefetch_poll();          // adopt loaded items, send more requests
+    void prefetch_flush();         // drop requests and wait for the loader
+    void prefetch_stats(int &hits, int &misses, int &stalls);
 };
 
 extern CacheList cache;
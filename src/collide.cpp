@@ -12,10 +12,13 @@
 #   include "config.h"
 #endif
 
+#include <string.h>
+
 #include "common.h"
 
 #include "level.h"
 #include "intsect.h"
+#include "trace.h"
 
 class collide_patch
 {
@@ -160,26 +163,188 @@ void add_collide(collide_patch *&first, int32_t x1, int32_t y1, int32_t x2, int3
 
 
 
+// collision statistics for the last tick, shown with the fps counter
+int32_t collide_pairs=0,collide_candidates=0,collide_hits=0;
+
+// broad phase for check_collisions: the picture space of every target,
+// sorted along x so each attacker only has to look at the targets whose
+// boxes could overlap its own
+struct collide_box
+{
+  int32_t x1,y1,x2,y2;
+  int index;                 // index into the level's target list
+};
+
+// the targets sorted by address, to find the index of a moved attacker
+struct collide_object
+{
+  game_object *o;
+  int index;
+};
+
+static collide_box *sorted_targets=NULL;
+static int *collide_candidate_list=NULL;
+static int32_t *sorted_x1=NULL;      // x1 of each target's box, by index
+static collide_object *sorted_objects=NULL;
+static int sorted_size=0;
+static int32_t max_target_width=0;
+
+static int collide_box_compare(void const *a, void const *b)
+{
+  collide_box const *b1=(collide_box const *)a,*b2=(collide_box const *)b;
+  if (b1->x1!=b2->x1)
+    return b1->x1<b2->x1 ? -1 : 1;
+  return b1->index-b2->index;
+}
+
+static int collide_index_compare(void const *a, void const *b)
+{
+  return *(int const *)a-*(int const *)b;
+}
+
+static int collide_object_compare(void const *a, void const *b)
+{
+  game_object *o1=((collide_object const *)a)->o,*o2=((collide_object const *)b)->o;
+  return o1<o2 ? -1 : o1>o2 ? 1 : 0;
+}
+
+static void sort_targets(game_object **list, int total)
+{
+  if (total>sorted_size)
+  {
+    sorted_size=total;
+    sorted_targets=(collide_box *)realloc(sorted_targets,sizeof(collide_box)*sorted_size);
+    collide_candidate_list=(int *)realloc(collide_candidate_list,sizeof(int)*sorted_size);
+    sorted_x1=(int32_t *)realloc(sorted_x1,sizeof(int32_t)*sorted_size);
+    sorted_objects=(collide_object *)realloc(sorted_objects,sizeof(collide_object)*sorted_size);
+  }
+
+  max_target_width=0;
+  for (int j=0; j<total; j++)
+  {
+    collide_box *b=sorted_targets+j;
+    list[j]->picture_space(b->x1,b->y1,b->x2,b->y2);
+    b->index=j;
+    sorted_x1[j]=b->x1;
+    sorted_objects[j].o=list[j];
+    sorted_objects[j].index=j;
+    max_target_width=Max(max_target_width,b->x2-b->x1);
+  }
+  qsort(sorted_targets,total,sizeof(collide_box),collide_box_compare);
+  qsort(sorted_objects,total,sizeof(collide_object),collide_object_compare);
+}
+
+// index of an object in the target list, or -1 if it is not a target
+static int target_index(int total, game_object *o)
+{
+  collide_object key;
+  key.o=o;
+  collide_object *p=(collide_object *)bsearch(&key,sorted_objects,total,
+                      sizeof(collide_object),collide_object_compare);
+  return p ? p->index : -1;
+}
+
+// first sorted box in [lo,hi) that does not come before the given one
+static int find_box(collide_box *box, int lo, int hi)
+{
+  while (lo<hi)
+  {
+    int mid=(lo+hi)/2;
+    if (collide_box_compare(sorted_targets+mid,box)<0)
+      lo=mid+1;
+    else hi=mid;
+  }
+  return lo;
+}
+
+// a target moved or changed frame: update its box and slide it to its new
+// place instead of sorting every target again
+static void move_target(game_object **list, int total, int index)
+{
+  collide_box box;
+  box.x1=sorted_x1[index];
+  box.index=index;
+  int from=find_box(&box,0,total);
+
+  list[index]->picture_space(box.x1,box.y1,box.x2,box.y2);
+  sorted_x1[index]=box.x1;
+  max_target_width=Max(max_target_width,box.x2-box.x1);
+
+  int to;
+  if (collide_box_compare(&box,sorted_targets+from)<0)
+  {
+    to=find_box(&box,0,from);
+    memmove(sorted_targets+to+1,sorted_targets+to,sizeof(collide_box)*(from-to));
+  }
+  else
+  {
+    to=find_box(&box,from+1,total)-1;
+    memmove(sorted_targets+from,sorted_targets+from+1,sizeof(collide_box)*(to-from));
+  }
+  sorted_targets[to]=box;
+}
+
+// fills collide_candidate_list with the indexes of every target whose box
+// overlaps the given one, in target list order
+static int find_targets(int total, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+  int lo=0,hi=total;      // find the first box that could still reach x1
+  while (lo<hi)
+  {
+    int mid=(lo+hi)/2;
+    if (sorted_targets[mid].x1<x1-max_target_width)
+      lo=mid+1;
+    else hi=mid;
+  }
+
+  int t=0;
+  for (collide_box *b=sorted_targets+lo; b<sorted_targets+total && b->x1<=x2; b++)
+    if (!(x2<b->x1 || y2<b->y1 || x1>b->x2 || y1>b->y2))
+      collide_candidate_list[t++]=b->index;
+
+  qsort(collide_candidate_list,t,sizeof(int),collide_index_compare);
+  return t;
+}
+
 void level::check_collisions()
 {
+  trace_zone tz("level::check_collisions");
   game_object *target,*rec,*subject;
   int32_t sx1,sy1,sx2,sy2,tx1,ty1,tx2,ty2,hitx=0,hity=0,t_centerx;
 
+  collide_pairs=attack_total*target_total;
+  collide_candidates=collide_hits=0;
+  if (!attack_total || !target_total)
+    return;
+
+  // pushing and damage can move targets or change their frame, so the
+  // boxes involved are updated before the next attacker
+  sort_targets(target_list,target_total);
+
   for (int l=0; l<attack_total; l++)
   {
     subject=attack_list[l];
     subject->picture_space(sx1,sy1,sx2,sy2);
     rec=NULL;
+    int moved=0;
 
+    int total=find_targets(target_total,sx1,sy1,sx2,sy2);
+    collide_candidates+=total;
 
-    for (int j=0; j<target_total && !rec; j++)
+    for (int c=0; c<total && !rec; c++)
     {
-      target=target_list[j];
+      target=target_list[collide_candidate_list[c]];
       target->picture_space(tx1,ty1,tx2,ty2);
       if (!(sx2<tx1 || sy2<ty1 || sx1>tx2 || sy1>ty2))  // check to see if picture spaces collide
       {
 
+    int pushed=subject->pushable() && target->pushable();
     try_pushback(subject,target);
+    if (pushed)
+    {
+      move_target(target_list,target_total,collide_candidate_list[c]);
+      moved=1;
+    }
 
     if (subject->can_hurt(target))    // see if we can hurt him before calculating
     {
@@ -233,8 +398,25 @@ void level::check_collisions()
     }
     if (rec)
     {
+      collide_hits++;
+      // a lisp damage function can push, move or spawn anything, so every
+      // box is rebuilt after it runs; the built-in one only touches rec
+      int scripted=figures[rec->otype]->get_fun(OFUN_DAMAGE)!=NULL;
       rec->do_damage((int)subject->current_figure()->hit_damage,subject,hitx,hity,0,0);
       subject->note_attack(rec);
+      if (scripted)
+      {
+        sort_targets(target_list,target_total);
+        continue;
+      }
+      move_target(target_list,target_total,target_index(target_total,rec));
+      moved=1;
+    }
+    if (moved)
+    {
+      int self=target_index(target_total,subject);
+      if (self>=0)
+        move_target(target_list,target_total,self);
     }
   }
 }
@@ -27,12 +27,26 @@ uint16_t calc_crc(void *buf, size_t len)
 
 
 
+uint32_t crc_update(uint32_t crc, void const *buf, size_t len)
+{
+  uint8_t crc1=crc,crc2=crc>>8,crc3=crc>>16,crc4=crc>>24;
+  uint8_t const *c=(uint8_t const *)buf;
+  for (; len; len--,c++)
+  {
+    crc1+=*c;
+    crc2+=crc1;
+    crc3+=crc2;
+    crc4+=crc3;
+  }
+  return (crc1|(crc2<<8)|(crc3<<16)|((uint32_t)crc4<<24));
+}
+
 uint32_t crc_file(bFILE *fp)
 {
-  uint8_t crc1=0,crc2=0,crc3=0,crc4=0;
+  uint32_t crc=0;
 
   int size=0x1000;
-  uint8_t *buffer=(uint8_t *)malloc(size),*c;
+  uint8_t *buffer=(uint8_t *)malloc(size);
   long l=fp->file_size();
   long cur_pos=fp->tell();
   fp->seek(0,0);
@@ -43,16 +57,10 @@ uint32_t crc_file(bFILE *fp)
     else
     {
       l-=nr;
-      for (c=buffer; nr; nr--,c++)
-      {
-    crc1+=*c;
-    crc2+=crc1;
-    crc3+=crc2;
-    crc4+=crc3;
-      }
+      crc=crc_update(crc,buffer,nr);
     }
   }
   fp->seek(cur_pos,0);
   free(buffer);
-  return (crc1|(crc2<<8)|(crc3<<16)|(crc4<<24));
+  return crc;
 }
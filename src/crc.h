@@ -15,6 +15,8 @@
 
 uint16_t calc_crc(void *buf, size_t len);
 uint32_t crc_file(bFILE *fp);
+// Continues a crc_file() checksum, start from 0
+uint32_t crc_update(uint32_t crc, void const *buf, size_t len);
 
 #endif
 
@@ -0,0 +1,117 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "dedicated.h"
+#include "nfserver.h"
+#include "dprint.h"
+
+int dedicated_on = 0;
+
+static float tick_ms = 1000.0f / 15;
+static Timer tick_timer, work_timer;
+
+// Durations of the ticks since the last report
+static float *samples = NULL;
+static int total_samples = 0, report_every = 0, total_ticks = 0, total_late = 0;
+
+int dedicated_init(int argc, char **argv)
+{
+    int server = 0, rate = 15;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-dedicated"))
+            dedicated_on = 1;
+        else if (!strcmp(argv[i], "-server"))
+            server = 1;
+        else if (!strcmp(argv[i], "-tickrate") && i + 1 < argc)
+            rate = atoi(argv[++i]);
+    }
+    if (!dedicated_on)
+        return 0;
+
+    if (!server)
+    {
+        dprintf("-dedicated needs -server <level>\n");
+        exit(1);
+    }
+    if (rate < 1 || rate > 1000)
+    {
+        dprintf("bad value for -tickrate, use 1..1000\n");
+        rate = 15;
+    }
+    tick_ms = 1000.0f / rate;
+    report_every = rate * 60;
+    samples = (float *)malloc(report_every * sizeof(float));
+    tick_timer.GetMs();
+    return 1;
+}
+
+void dedicated_tick_start()
+{
+    work_timer.GetMs();
+}
+
+static int compare_ms(void const *a, void const *b)
+{
+    float x = *(float const *)a, y = *(float const *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static float percentile(int p)
+{
+    return samples[Min(total_samples - 1, total_samples * p / 100)];
+}
+
+void dedicated_report()
+{
+    if (!total_samples)
+        return;
+
+    qsort(samples, total_samples, sizeof(float), compare_ms);
+    printf("dedicated: %d ticks, tick ms p50 %.2f p90 %.2f p99 %.2f max %.2f,"
+           " %d over %.1f ms\n", total_ticks, percentile(50), percentile(90),
+           percentile(99), samples[total_samples - 1], total_late, tick_ms);
+    fflush(stdout);
+    total_samples = 0;
+    total_late = 0;
+}
+
+void dedicated_tick_end()
+{
+    float ms = work_timer.PollMs();
+    samples[total_samples++] = ms;
+    total_ticks++;
+    if (ms > tick_ms)
+        total_late++;
+    if (total_samples == report_every)
+        dedicated_report();
+
+    // Sleep in the network layer so clients are answered in the meantime
+    for (;;)
+    {
+        float left = tick_ms - tick_timer.PollMs();
+        if (left < 1.0f)
+            break;
+        service_net_request((int)left);
+    }
+    tick_timer.WaitMs(tick_ms);
+    tick_timer.GetMs();
+}
+
@@ -0,0 +1,27 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __DEDICATED_HPP_
+#define __DEDICATED_HPP_
+
+// Dedicated server: "-dedicated -server level.spe" hosts a net game with
+// no window, sound, drawing or lighting. The level ticks at a fixed rate
+// ("-tickrate N", default 15 a second) and the time the ticks took is
+// printed as percentiles once a minute.
+
+extern int dedicated_on;
+
+int dedicated_init(int argc, char **argv);  // returns non 0 if -dedicated was given
+void dedicated_tick_start();
+void dedicated_tick_end();                  // answers the network until the next tick is due
+void dedicated_report();
+
+#endif
+
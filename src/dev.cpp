@@ -1114,6 +1114,9 @@ void dev_controll::do_command(char const *command, Event &ev)
     else show_mem();
   }
 
+  if (!strcmp(fword,"cache"))
+    cache.show_stats();
+
   if (!strcmp(fword,"esave"))
   {
     dprintf(symbol_str("esave"));
@@ -3363,6 +3366,7 @@ void dev_controll::show_mem()
     s+=get_char_mem(i,0);
   }
   dprintf("%d character=%d bytes\n",t,s);
+  cache.show_stats();
 
 }
 
@@ -3378,6 +3382,7 @@ void dev_cleanup()
     free(listable_objs);
     listable_objs=NULL;
   }
+  cache.prefetch_flush();   // the loader may still use the file names
   crc_manager.clean_up();
 
 }
@@ -68,6 +68,11 @@
 #include "chat.h"
 #include "demo.h"
 #include "netcfg.h"
+#include "bench.h"
+#include "dedicated.h"
+#include "workers.h"
+#include "rollback.h"
+#include "trace.h"
 
 #define SHIFT_RIGHT_DEFAULT 0
 #define SHIFT_DOWN_DEFAULT 30
@@ -151,7 +156,7 @@ void handle_no_space()
 
 void Game::play_sound(int id, int vol, int32_t x, int32_t y)
 {
-    if(!(sound_avail & SFX_INITIALIZED))
+    if(!(sound_avail & SFX_INITIALIZED) || replaying)
         return;
     if(vol < 1)
         return;
@@ -517,6 +522,7 @@ void Game::set_level(level *nl)
 
 void Game::load_level(char const *name)
 {
+    rollback_reset();
     if(current_level)
       delete current_level;
 
@@ -652,6 +658,7 @@ static void post_render()
 
 void Game::draw_map(view *v, int interpolate)
 {
+  trace_zone tz("Game::draw_map");
   backtile *bt;
   int x1, y1, x2, y2, x, y, xo, yo, nxoff, nyoff;
   ivec2 caa, cbb;
@@ -745,8 +752,13 @@ void Game::draw_map(view *v, int interpolate)
 
   int xinc, yinc, draw_x, draw_y;
 
+  // Outside of the editor the tiles are kept from one frame to the next
+  int cached = !(dev & (MAP_MODE | EDIT_MODE)) && (dev & DRAW_BG_LAYER)
+                && (dev & DRAW_FG_LAYER) && xoff >= 0 && yoff >= 0;
 
-  if(!(dev & MAP_MODE) && (dev & DRAW_BG_LAYER))
+  if(cached)
+    draw_tile_layer(v, xoff, yoff, nxoff, nyoff);
+  else if(!(dev & MAP_MODE) && (dev & DRAW_BG_LAYER))
   {
     xinc = btile_width();
     yinc = btile_height();
@@ -867,6 +879,16 @@ void Game::draw_map(view *v, int interpolate)
 
       if(dev & EDIT_MODE)
         current_level->draw_areas(v);
+    } else if(cached)
+    {
+      // only look for the tiles drawn above the characters
+      for(y = y1; y <= y2; y++)
+      {
+        uint16_t *cl = current_level->get_fgline(y)+x1;
+        for(x = x1; x <= x2; x++, cl++)
+          if(above_tile(*cl))
+            rescan = 1;
+      }
     } else
     {
 
@@ -1021,7 +1043,10 @@ void Game::draw_map(view *v, int interpolate)
     {
       if(small_render)
       {
-    double_light_screen(main_screen, xoff, yoff, white_light, v->ambient, old_screen, old_aa.x, old_aa.y);
+    {
+      bench_scope bs(BENCH_LIGHT);
+      double_light_screen(main_screen, xoff, yoff, white_light, v->ambient, old_screen, old_aa.x, old_aa.y);
+    }
 
     v->m_aa = old_aa;
     v->m_bb = old_bb;
@@ -1029,6 +1054,7 @@ void Game::draw_map(view *v, int interpolate)
       } else
       {
     main_screen->dirt_on();
+    bench_scope bs(BENCH_LIGHT);
     if(xres * yres <= 64000)
           light_screen(main_screen, xoff, yoff, white_light, v->ambient);
     else light_screen(main_screen, xoff, yoff, white_light, 63);            // no lighting for hi - rez
@@ -1059,6 +1085,103 @@ void Game::draw_map(view *v, int interpolate)
   sbar.draw_update();
 }
 
+// Compose the background and foreground tiles of a view into v->m_tiles
+// and copy that to the screen. When both layers moved by the same amount,
+// which is most vertical scrolling, the old picture is scrolled and only
+// the uncovered strips are drawn; when nothing moved it is reused as is.
+// With parallax the tiles are drawn straight to the screen, as before.
+void Game::draw_tile_layer(view *v, int32_t xoff, int32_t yoff,
+                           int32_t nxoff, int32_t nyoff)
+{
+    ivec2 size = v->m_bb - v->m_aa + ivec2(1);
+    ivec2 pos(xoff, yoff), bgpos(nxoff, nyoff);
+    ivec2 d = pos - v->m_tiles_pos;
+
+    // With parallax the layer cannot be scrolled, drawing it and copying
+    // it would cost more than drawing straight to the screen
+    if (bgpos - v->m_tiles_bgpos != d)
+    {
+        draw_tiles(main_screen, v->m_aa, ivec2(0), size,
+                   xoff, yoff, nxoff, nyoff);
+        v->m_tiles_pos = pos;
+        v->m_tiles_bgpos = bgpos;
+        v->m_tiles_changes = level_tile_changes - 1;
+        return;
+    }
+
+    image *im = v->m_tiles;
+    if (!im || im->Size() != size)
+    {
+        delete im;
+        im = v->m_tiles = new image(size);
+        v->m_tiles_changes = level_tile_changes - 1;
+    }
+
+    if (v->m_tiles_changes != level_tile_changes
+         || abs(d.x) >= size.x || abs(d.y) >= size.y)
+        draw_tiles(im, ivec2(0), ivec2(0), size, xoff, yoff, nxoff, nyoff);
+    else if (d != ivec2(0))
+    {
+        im->SetClip(ivec2(0), size);
+        im->scroll(0, 0, size.x - 1, size.y - 1, -d.x, -d.y);
+        if (d.x > 0)
+            draw_tiles(im, ivec2(0), ivec2(size.x - d.x, 0), size,
+                       xoff, yoff, nxoff, nyoff);
+        else if (d.x < 0)
+            draw_tiles(im, ivec2(0), ivec2(0), ivec2(-d.x, size.y),
+                       xoff, yoff, nxoff, nyoff);
+        if (d.y > 0)
+            draw_tiles(im, ivec2(0), ivec2(0, size.y - d.y), size,
+                       xoff, yoff, nxoff, nyoff);
+        else if (d.y < 0)
+            draw_tiles(im, ivec2(0), ivec2(0), ivec2(size.x, -d.y),
+                       xoff, yoff, nxoff, nyoff);
+    }
+
+    v->m_tiles_pos = pos;
+    v->m_tiles_bgpos = bgpos;
+    v->m_tiles_changes = level_tile_changes;
+
+    main_screen->PutImage(im, v->m_aa);
+}
+
+// Draw the tiles covering [aa, bb) of a view whose corner is at "at" in
+// the image, except the foreground tiles that go above the characters
+void Game::draw_tiles(image *im, ivec2 at, ivec2 aa, ivec2 bb,
+                      int32_t xoff, int32_t yoff, int32_t nxoff, int32_t nyoff)
+{
+    im->SetClip(at + aa, at + bb);
+
+    int bw = btile_width(), bh = btile_height();
+    int bg_w = current_level->background_width(),
+        bg_h = current_level->background_height();
+    for (int y = (nyoff + aa.y) / bh; y <= (nyoff + bb.y - 1) / bh; y++)
+        for (int x = (nxoff + aa.x) / bw; x <= (nxoff + bb.x - 1) / bw; x++)
+        {
+            int num = x < bg_w && y < bg_h ? current_level->get_bgline(y)[x]
+                                           : 0;
+            im->PutImage(get_bg(num)->im,
+                         at + ivec2(x * bw - nxoff, y * bh - nyoff));
+        }
+
+    int fw = ftile_width(), fh = ftile_height();
+    int x2 = Min((xoff + bb.x - 1) / fw, current_level->foreground_width() - 1),
+        y2 = Min((yoff + bb.y - 1) / fh, current_level->foreground_height() - 1);
+    for (int y = (yoff + aa.y) / fh; y <= y2; y++)
+    {
+        uint16_t *cl = current_level->get_fgline(y);
+        for (int x = (xoff + aa.x) / fw; x <= x2; x++)
+        {
+            int num = fgvalue(cl[x]);
+            if (above_tile(cl[x]) || num == BLACK)
+                continue;
+            get_fg(num)->im->PutImage(im, at + ivec2(x * fw - xoff,
+                                                     y * fh - yoff));
+            cl[x] |= 0x8000; // mark as has - been - seen
+        }
+    }
+}
+
 void Game::PutFg(ivec2 pos, int type)
 {
     if (current_level->GetFg(pos) == type)
@@ -1282,6 +1405,7 @@ Game::Game(int argc, char **argv)
   top_menu = joy_win = NULL;
   old_view = first_view = NULL;
   nplayers = 1;
+  replaying = 0;
 
   help_text_frames = 0;
   strcpy(help_text, "");
@@ -1397,12 +1521,14 @@ Game::Game(int argc, char **argv)
 
   // load_data loaded the mouse cursor, use it in case gamma_correct needs to show UI
   wm->SetMouseShape(cache.img(c_normal)->copy(), ivec2(1));
-  gamma_correct(pal);
+  // the gamma menu would wait forever for input without a window
+  if((!bench_on && !dedicated_on) || LSymbol::Find("darkest_gray"))
+    gamma_correct(pal);
 
   if(main_net_cfg == NULL || (main_net_cfg->state != net_configuration::SERVER &&
                  main_net_cfg->state != net_configuration::CLIENT))
   {
-    if(!start_edit && !net_start())
+    if(!start_edit && !net_start() && !bench_on)
       do_title();
   } else if(main_net_cfg && main_net_cfg->state == net_configuration::SERVER)
   {
@@ -1453,10 +1579,21 @@ void Game::show_time()
 
     sprintf(str, "%d", total_active);
     console_font->PutString(main_screen, first_view->m_aa + ivec2(0, 10), str);
+
+    char cstr[48];
+    sprintf(cstr, "%d/%d %d", (int)collide_candidates, (int)collide_pairs,
+            (int)collide_hits);
+    console_font->PutString(main_screen, first_view->m_aa + ivec2(0, 20), cstr);
+
+    sprintf(cstr, "gc %d/%d %dk %.1f/%.1f", Lisp::gc_minor, Lisp::gc_full,
+            (int)(Lisp::gc_copied >> 10), Lisp::gc_last_ms, Lisp::gc_max_ms);
+    console_font->PutString(main_screen, first_view->m_aa + ivec2(0, 30), cstr);
 }
 
 void Game::update_screen()
 {
+  trace_zone tz("Game::update_screen");
+  bench_scope bs(BENCH_DRAW);
   if(state == HELP_STATE)
     draw_help();
   else if(current_level)
@@ -1540,7 +1677,7 @@ int Game::calc_speed()
         // that we don't exceed 30FPS in edit mode and hog the CPU.
         frame_timer.WaitMs(33);
     }
-    else if (avg_ms < 1000.0f / 15 && need_delay)
+    else if (avg_ms < 1000.0f / 15 && need_delay && !net_catching_up())
     {
         frame_panic = 0;
         if (!no_delay)
@@ -1825,7 +1962,7 @@ void Game::get_input()
 }
 
 
-void net_send(int force = 0)
+void net_send(int force)
 {
     // XXX: this was added to avoid crashing on the PS3.
     if(!player_list)
@@ -1854,11 +1991,23 @@ void net_send(int force = 0)
       p->get_input();
 
 
-      base->packet.write_uint8(SCMD_SYNC);
-      base->packet.write_uint16(make_sync());
+      // with rollback this tick may be a guess, so the sync sent is that
+      // of an older tick every peer has the real input for (see rollback.h)
+      int32_t sync = !rollback_on ? make_sync() : !current_level ? -1
+                     : rollback_sync(current_level->tick_counter());
+      if(sync >= 0)
+      {
+        base->packet.write_uint8(SCMD_SYNC);
+        base->packet.write_uint16(sync);
+      }
 
       if(base->join_list)
-      base->packet.write_uint8(SCMD_RELOAD);
+      {
+        if(rollback_on)
+          base->packet.write_uint8(SCMD_RELOAD);
+        else
+          write_join_commands();
+      }
 
       //      printf("save tick %d, pk size=%d, rand_on=%d, sync=%d\n", current_level->tick_counter(),
       //         base->packet.packet_size(), rand_on, make_sync());
@@ -1888,12 +2037,13 @@ void net_receive()
     }
 
     process_packet_commands(buf, size);
+    send_join_snapshots();
   }
 }
 
-void Game::step()
+// puts the objects around every view in the active list for the next tick
+void Game::activate_views()
 {
-  LSpace::Tmp.Clear();
   if(current_level)
   {
     current_level->unactivate_all();
@@ -1914,6 +2064,14 @@ void Game::step()
       }
     }
   }
+}
+
+void Game::step()
+{
+  trace_zone tz("Game::step");
+  LSpace::Tmp.Clear();
+  cache.trim();
+  activate_views();
 
   if(state == RUN_STATE)
   {
@@ -1936,10 +2094,17 @@ void Game::step()
       ambient_ramp = 0;
       view *v;
       for(v = first_view; v; v = v->next)
+      {
         v->update_scroll();
+        cache.prefetch_view(v);
+      }
 
+      cache.prefetch_poll();
       cache.prof_poll_start();
-      current_level->tick();
+      {
+        bench_scope bs(BENCH_TICK);
+        current_level->tick();
+      }
       sbar.step();
     } else
       dev_scroll();
@@ -1956,6 +2121,50 @@ void Game::step()
     finished = true;
 }
 
+// A tick simulated again by the rollback code, the part of step() that
+// changes the level and nothing else
+void Game::replay_step()
+{
+  LSpace::Tmp.Clear();
+  activate_views();
+
+  if(state == RUN_STATE && !(dev & EDIT_MODE))
+  {
+    ambient_ramp = 0;
+    for(view *v = first_view; v; v = v->next)
+      v->update_scroll();
+    replaying = 1;
+    current_level->tick();
+    replaying = 0;
+  }
+}
+
+static level_snapshot rollback_states[ROLLBACK_MAX];
+
+void rollback_save_state(int slot)
+{
+  if(current_level)
+    current_level->save_snapshot(&rollback_states[slot]);
+}
+
+int rollback_load_state(int slot)
+{
+  return current_level && current_level->load_snapshot(&rollback_states[slot]);
+}
+
+void rollback_replay_tick(uint8_t *pk, int size)
+{
+  if(!current_level)
+    return;
+  process_packet_commands(pk, size);
+  the_game->replay_step();
+}
+
+uint16_t rollback_state_sync()
+{
+  return make_sync();
+}
+
 extern void *current_demo;
 
 Game::~Game()
@@ -2248,15 +2457,6 @@ void music_check()
   }
 }
 
-void setup(int argc, char **argv);
-
-void share_end();
-void show_end();
-
-void show_sell(int abortable);
-
-extern pmenu *dev_menu;
-
 void game_net_init(int argc, char **argv)
 {
   int nonet=!net_init(argc, argv);
@@ -2284,224 +2484,3 @@ void game_net_init(int argc, char **argv)
     }
   }
 }
-
-int main(int argc, char *argv[])
-{
-    start_argc = argc;
-    start_argv = argv;
-
-    for (int i = 0; i < argc; i++)
-    {
-        if (!strcmp(argv[i], "-cprint"))
-            external_print = 1;
-    }
-
-#if (defined(__APPLE__) && !defined(__MACH__))
-    unsigned char km[16];
-
-    fprintf(stderr, "Mac Options: ");
-    xres = 320; yres = 200;
-    GetKeys((uint32_t*)&km);
-    if ((km[ 0x3a >>3] >> (0x3a & 7)) &1 != 0)
-    {
-        dev|=EDIT_MODE;
-        start_edit = 1;
-        start_running = 1;
-        disable_autolight = 1;
-        fprintf(stderr, "Edit Mode...");
-    }
-    if ((km[ 0x3b >>3] >> (0x3b & 7)) &1 != 0)
-    {
-        PixMult = 1;
-        fprintf(stderr, "Single Pixel...");
-    }
-    else
-    {
-        PixMult = 2;
-        fprintf(stderr, "Double Pixel...");
-    }
-    if ((km[ 0x38 >>3] >> (0x38 & 7)) &1 != 0)
-    {
-        xres *= 2;  yres *= 2;
-        fprintf(stderr, "Double Size...");
-    }
-    fprintf(stderr, "\n");
-
-    if (tcpip.installed())
-        fprintf(stderr, "Using %s\n", tcpip.name());
-#endif
-
-    set_dprinter(game_printer);
-    set_dgetter(game_getter);
-    set_no_space_handler(handle_no_space);
-
-    setup(argc, argv);
-
-    show_startup();
-
-    start_sound(argc, argv);
-
-    stat_man = new text_status_manager();
-
-#if !defined __CELLOS_LV2__
-    // look to see if we are supposed to fetch the data elsewhere
-    if (getenv("ABUSE_PATH"))
-        set_filename_prefix(getenv("ABUSE_PATH"));
-
-    // look to see if we are supposed to save the data elsewhere
-    if (getenv("ABUSE_SAVE_PATH"))
-        set_save_filename_prefix(getenv("ABUSE_SAVE_PATH"));
-#endif
-
-    jrand_init();
-    jrand(); // so compiler doesn't complain
-
-    set_spec_main_file("abuse.spe");
-    check_for_lisp(argc, argv);
-
-    do
-    {
-        if (main_net_cfg && !main_net_cfg->notify_reset())
-        {
-            sound_uninit();
-            exit(0);
-        }
-
-        game_net_init(argc, argv);
-        Lisp::Init();
-
-        dev_init(argc, argv);
-
-        Game *g = new Game(argc, argv);
-
-        dev_cont = new dev_controll();
-        dev_cont->load_stuff();
-
-        g->get_input(); // prime the net
-
-        for (int i = 1; i + 1 < argc; i++)
-        {
-            if (!strcmp(argv[i], "-server"))
-            {
-                if (!become_server(argv[i + 1]))
-                {
-                    dprintf("unable to become a server\n");
-                    exit(0);
-                }
-                break;
-            }
-        }
-
-        if (main_net_cfg)
-            wait_min_players();
-
-        net_send(1);
-        if (net_start())
-        {
-            g->step(); // process all the objects in the world
-            g->calc_speed();
-            g->update_screen(); // redraw the screen with any changes
-        }
-
-        while (!g->done())
-        {
-            music_check();
-
-            if (req_end)
-            {
-                delete current_level; current_level = NULL;
-
-                show_end();
-
-                the_game->set_state(MENU_STATE);
-                req_end = 0;
-            }
-
-            if (demo_man.current_state() == demo_manager::NORMAL)
-                net_receive();
-
-            // see if a request for a level load was made during the last tick
-            if (req_name[0])
-            {
-                g->load_level(req_name);
-                req_name[0] = 0;
-                g->draw(g->state == SCENE_STATE);
-            }
-
-            //if (demo_man.current_state() != demo_manager::PLAYING)
-                g->get_input();
-
-            if (demo_man.current_state() == demo_manager::NORMAL)
-                net_send();
-            else
-                demo_man.do_inputs();
-
-            service_net_request();
-
-            // process all the objects in the world
-            g->step();
-            server_check();
-            g->calc_speed();
-
-            // see if a request for a level load was made during the last tick
-            if (!req_name[0])
-                g->update_screen(); // redraw the screen with any changes
-        }
-
-        net_uninit();
-
-        if (net_crcs)
-            net_crcs->clean_up();
-        delete net_crcs; net_crcs = NULL;
-
-        delete chat;
-
-        Timer tmp; tmp.WaitMs(500);
-
-        delete small_render; small_render = NULL;
-
-        if (current_song)
-            current_song->stop();
-        delete current_song; current_song = NULL;
-
-        cache.empty();
-
-        delete dev_console; dev_console = NULL;
-        delete dev_menu; dev_menu = NULL;
-        delete g; g = NULL;
-        delete old_pal; old_pal = NULL;
-
-        compiled_uninit();
-        delete_all_lights();
-        free(white_light_initial);
-
-        for (int i = 0; i < TTINTS; i++)
-            free(tints[i]);
-
-        dev_cleanup();
-        delete dev_cont; dev_cont = NULL;
-        delete stat_man; stat_man = new text_status_manager();
-
-        if (!(main_net_cfg && main_net_cfg->restart_state()))
-        {
-            LSymbol *end_msg = LSymbol::FindOrCreate("end_msg");
-            if (DEFINEDP(end_msg->GetValue()))
-                printf("%s\n", lstring_value(end_msg->GetValue()));
-        }
-
-        Lisp::Uninit();
-
-        base->packet.packet_reset();
-    }
-    while (main_net_cfg && main_net_cfg->restart_state());
-
-    delete stat_man;
-    delete main_net_cfg; main_net_cfg = NULL;
-
-    set_filename_prefix(NULL);  // dealloc this mem if there was any
-    set_save_filename_prefix(NULL);
-
-    sound_uninit();
-
-    return 0;
-}
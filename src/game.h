@@ -60,6 +60,20 @@ extern int demo_start,idle_ticks;
 
 extern FILE *open_FILE(char const *filename, char const *mode);
 
+/* Startup and main loop helpers, used by main() */
+extern int external_print, req_end;
+extern char req_name[100];
+void game_printer(char *st);
+void game_getter(char *st, int max);
+void handle_no_space();
+void show_startup();
+void start_sound(int argc, char **argv);
+void check_for_lisp(int argc, char **argv);
+void music_check();
+void game_net_init(int argc, char **argv);
+void net_send(int force = 0);
+void net_receive();
+
 class Game
 {
 public:
@@ -91,8 +105,11 @@ public :
   int nplayers;
   view *first_view,*old_view;
   int state,zoom;
+  int replaying;                             // no sound while rollback replays ticks
 
   void step();
+  void replay_step();
+  void activate_views();
   void show_help(char const *st);
   void draw_value(image *screen, int x, int y, int w, int h, int val, int max);
   unsigned char get_color(int x) { return x; }
@@ -127,6 +144,10 @@ public :
     void PutFg(ivec2 pos, int type);
     void PutBg(ivec2 pos, int type);
   void draw_map(view *v, int interpolate=0);
+  void draw_tile_layer(view *v, int32_t xoff, int32_t yoff,
+                       int32_t nxoff, int32_t nyoff);
+  void draw_tiles(image *im, ivec2 at, ivec2 aa, ivec2 bb,
+                  int32_t xoff, int32_t yoff, int32_t nxoff, int32_t nyoff);
   void dev_scroll();
 
   int in_area(Event &ev, int x1, int y1, int x2, int y2);
@@ -136,7 +157,7 @@ public :
     tile_type GetMapBg(ivec2 pos) { return current_level->GetBg(pos); }
     tile_type GetMapFg(ivec2 pos) { return current_level->GetFg(pos); }
   void end_session();
-  void need_refresh() { refresh=1; }       // for development mode only
+  void need_refresh() { refresh=1; level_tile_changes++; } // for development mode only
   palette *current_palette() { return pal; }
 
   void update_screen();
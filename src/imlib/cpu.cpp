@@ -0,0 +1,40 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include "cpu.h"
+
+static int cpu_detect()
+{
+#if HAVE_X86_KERNELS
+    __builtin_cpu_init();
+#   if HAVE_AVX512_KERNELS
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512bw")
+         && __builtin_cpu_supports("avx512vbmi"))
+        return CPU_AVX512;
+#   endif
+    if (__builtin_cpu_supports("avx2"))
+        return CPU_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return CPU_SSE2;
+#endif
+    return CPU_C;
+}
+
+// Kernels pick their level during static initialisation, so this cannot
+// rely on a static initialised at file scope
+int cpu_level()
+{
+    static int level = cpu_detect();
+    return level;
+}
@@ -0,0 +1,31 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __CPU_HPP_
+#define __CPU_HPP_
+
+// Kernels for newer instruction sets are built with target attributes
+// and picked at run time, so the binary still runs on any x86
+#if (defined __GNUC__) && (defined __x86_64__ || defined __i386__)
+#   include <immintrin.h>
+#   define HAVE_X86_KERNELS 1
+#   if defined __x86_64__
+#       define HAVE_AVX512_KERNELS 1
+#   endif
+#endif
+
+// Instruction set levels, each one implies the ones before it. CPU_AVX512
+// stands for AVX-512 with its byte (BW) and byte permute (VBMI) parts.
+enum { CPU_C, CPU_SSE2, CPU_AVX2, CPU_AVX512 };
+
+// The best level this CPU supports, CPU_C on other architectures
+int cpu_level();
+
+#endif
@@ -14,6 +14,7 @@
 
 #include "common.h"
 
+#include "cpu.h"
 #include "image.h"
 #include "filter.h"
 
@@ -173,3 +174,81 @@ int ColorFilter::Write(bFILE *fp)
     return fp->write(m_table, bytes) == bytes;
 }
 
+/*  Palette expansion kernels
+ *
+ *  The AVX2 version looks up eight pixels at a time with a gather; the
+ *  table is only 1 KiB so it stays in L1 either way.
+ */
+
+static void ExpandC(uint32_t *dst, uint8_t const *src, int count,
+                    uint32_t const *lut)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32_t a = lut[src[i]], b = lut[src[i + 1]];
+        uint32_t c = lut[src[i + 2]], d = lut[src[i + 3]];
+        dst[i] = a; dst[i + 1] = b; dst[i + 2] = c; dst[i + 3] = d;
+    }
+    for (; i < count; i++)
+        dst[i] = lut[src[i]];
+}
+
+#if HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+static void ExpandAVX2(uint32_t *dst, uint8_t const *src, int count,
+                       uint32_t const *lut)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i p = _mm_loadu_si128((__m128i const *)(src + i));
+        __m256i a = _mm256_cvtepu8_epi32(p);
+        __m256i b = _mm256_cvtepu8_epi32(_mm_srli_si128(p, 8));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_i32gather_epi32((int const *)lut, a, 4));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8),
+                            _mm256_i32gather_epi32((int const *)lut, b, 4));
+    }
+    for (; i < count; i++)
+        dst[i] = lut[src[i]];
+}
+#endif
+
+static int ExpandMaxLevel()
+{
+    return cpu_level() >= CPU_AVX2 ? 1 : 0;
+}
+
+typedef void (*ExpandFunc)(uint32_t *, uint8_t const *, int,
+                           uint32_t const *);
+
+static ExpandFunc ExpandKernel(int level)
+{
+#if HAVE_X86_KERNELS
+    if (level >= 1)
+        return ExpandAVX2;
+#endif
+    return ExpandC;
+}
+
+static int expand_max_level = ExpandMaxLevel();
+static ExpandFunc expand = ExpandKernel(expand_max_level);
+
+int set_expand_level(int level)
+{
+    level = Max(0, Min(level, expand_max_level));
+    expand = ExpandKernel(level);
+    return level;
+}
+
+void expand_rect(uint32_t *dst, int dst_pitch, uint8_t const *src,
+                 int src_pitch, int w, int h, uint32_t const *lut)
+{
+    for (int y = 0; y < h; y++)
+    {
+        expand(dst, src, w, lut);
+        dst = (uint32_t *)((uint8_t *)dst + dst_pitch);
+        src += src_pitch;
+    }
+}
@@ -51,5 +51,12 @@ private:
     uint8_t *m_table;
 };
 
+// Expand a block of 8-bit pixels to 32-bit ones through a 256 entry
+// table, pitches are in bytes. set_expand_level() picks the kernel, 0 for
+// plain C and 1 for AVX2 when available, and returns the level in use.
+void expand_rect(uint32_t *dst, int dst_pitch, uint8_t const *src,
+                 int src_pitch, int w, int h, uint32_t const *lut);
+int set_expand_level(int level);
+
 #endif
 
@@ -20,6 +20,12 @@
 #include "image.h"
 
 linked_list image_list; // FIXME: only jwindow.cpp needs this
+static thread_local bool image_unlisted = false;
+
+void image::SetUnlisted(bool unlisted)
+{
+    image_unlisted = unlisted;
+}
 
 image_descriptor::image_descriptor(ivec2 size,
                                    int keep_dirties, int static_memory)
@@ -58,7 +64,8 @@ image::~image()
         Unlock();
     }
 
-    image_list.unlink(this);
+    if (m_listed)
+        image_list.unlink(this);
     DeletePage();
     delete m_special;
 }
@@ -92,7 +99,9 @@ image::image(ivec2 size, uint8_t *page_buffer, int create_descriptor)
         m_special = new image_descriptor(size, create_descriptor == 2,
                                          (page_buffer != NULL));
     MakePage(size, page_buffer);
-    image_list.add_end(this);
+    m_listed = !image_unlisted;
+    if (m_listed)
+        image_list.add_end(this);
     m_locked = false;
 }
 
@@ -104,9 +113,20 @@ image::image(bFILE *fp, spec_entry *e /* = NULL */)
     m_size.y = fp->read_uint16();
     m_special = NULL;
     MakePage(m_size, NULL);
-    for (int i = 0; i < m_size.y; i++)
-        fp->read(scan_line(i), m_size.x);
-    image_list.add_end(this);
+    long size = (long)m_size.x * m_size.y;
+    uint8_t const *src = (uint8_t const *)fp->mapped(fp->tell(), size);
+    if (src)
+    {
+        for (int i = 0; i < m_size.y; i++, src += m_size.x)
+            memcpy(scan_line(i), src, m_size.x);
+        fp->seek(size, SEEK_CUR);
+    }
+    else
+        for (int i = 0; i < m_size.y; i++)
+            fp->read(scan_line(i), m_size.x);
+    m_listed = !image_unlisted;
+    if (m_listed)
+        image_list.add_end(this);
     m_locked = false;
 }
 
@@ -316,7 +336,7 @@ void image::SetClip(ivec2 aa, ivec2 bb)
     // If the image does not already have an Image descriptor, allocate one
     // with no dirty rectangle keeping.
     if (!m_special)
-        m_special = new image_descriptor(m_size.x, m_size.y, 0);
+        m_special = new image_descriptor(m_size, 0);
 
     // set the image descriptor what the clip
     // should be it will adjust to fit within the image.
@@ -350,7 +370,7 @@ void image::SetClip(int x1, int y1, int x2, int y2)
    // If the image does not already have an Image descriptor, allocate one
    // with no dirty rectangle keeping.
    if (!m_special)
-       m_special = new image_descriptor(m_size.x, m_size.y, 0);
+       m_special = new image_descriptor(m_size, 0);
 
    // set the image descriptor what the clip
    // should be it will adjust to fit within the image.
@@ -734,7 +754,7 @@ void image::scroll(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t xd, i
     m_special->GetClip(caa, cbb);
     x1=Max(x1, caa.x); y1=Max(caa.y, y1); x2=Min(x2, cbb.x - 1); y2=Min(y2, cbb.y - 1);
   }
-  int16_t xsrc, ysrc, xdst, ydst, xtot=x2-x1-abs(xd)+1, ytot, xt;
+  int16_t xsrc, ysrc, xdst, ydst, xtot=x2-x1-abs(xd)+1, ytot;
   uint8_t *src, *dst;
   if (xd<0) { xsrc=x1-xd; xdst=x1; } else { xsrc=x2-xd; xdst=x2; }
   if (yd<0) { ysrc=y1-yd; ydst=y1; } else { ysrc=y2-yd; ydst=y2; }
@@ -742,10 +762,9 @@ void image::scroll(int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t xd, i
   { src=scan_line(ysrc)+xsrc;
     dst=scan_line(ydst)+xdst;
     if (xd<0)
-      for (xt = 0; xt < xtot; xt++)
-        *dst++ = *src++;
-      else for (xt = 0; xt < xtot; xt++)
-        *dst-- = *src--;
+      memmove(dst, src, xtot);
+    else
+      memmove(dst - xtot + 1, src - xtot + 1, xtot);
     if (yd<0) { ysrc++; ydst++; } else { ysrc--; ydst--; }
   }
   AddDirty(ivec2(x1, y1), ivec2(x2 + 1, y2 + 1));
@@ -98,6 +98,7 @@ private:
     uint8_t *m_data;
     ivec2 m_size;
     bool m_locked;
+    bool m_listed;    // in image_list, whichever thread deletes it
 
     void MakePage(ivec2 size, uint8_t *page_buffer);
     void DeletePage();
@@ -174,6 +175,10 @@ public:
     void unpack_scanline(int16_t line, char bitsperpixel = 1);
     void FlipX();
     void FlipY();
+
+    // Images created by the calling thread from now on are kept out of the
+    // global image list, for loader threads that must not touch it
+    static void SetUnlisted(bool unlisted);
 };
 
 class image_controller
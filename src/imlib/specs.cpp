@@ -23,6 +23,9 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#if defined HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #ifdef WIN32
 # include <io.h>
 #endif
@@ -79,6 +82,8 @@ static jFILE spec_main_jfile((FILE*)0);
 static int spec_main_fd = -1;
 static long spec_main_offset = -1;
 static spec_directory spec_main_sd;
+static uint8_t *spec_main_map = NULL;
+static size_t spec_main_map_size = 0;
 
 void set_filename_prefix(char const *prefix)
 {
@@ -240,8 +245,8 @@ int bFILE::write(void const *buf, size_t count)      // returns number of bytes
     unsigned long ret=unbuffered_write(buf,count);
     if (ret!=count && no_space_handle_fun)
       no_space_handle_fun();
+    return ret;
   }
-  return 0;
 }
 
 int bFILE::seek(long offset, int whence) // whence=SEEK_SET, SEEK_CUR, SEEK_END, ret=0=success
@@ -272,6 +277,26 @@ int bFILE::tell()
 int bFILE::allow_read_buffering() { return 1; }
 int bFILE::allow_write_buffering() { return 1; }
 
+void const *bFILE::mapped(long offset, size_t count) { return NULL; }
+
+// Map a whole file read-only, returns NULL on failure or for empty files
+static uint8_t *map_fd(int fd, size_t &size)
+{
+#if defined HAVE_SYS_MMAN_H
+  struct stat st;
+  if (fstat(fd,&st)<0 || st.st_size<=0)
+    return NULL;
+
+  void *p=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  if (p==MAP_FAILED)
+    return NULL;
+  size=st.st_size;
+  return (uint8_t *)p;
+#else
+  return NULL;
+#endif
+}
+
 void set_spec_main_file(char const *filename, int Search_order)
 {
   dprintf("Specs : main file set to %s\n",filename);
@@ -283,6 +308,25 @@ void set_spec_main_file(char const *filename, int Search_order)
   if (spec_main_fd==-1)
     return;
   spec_main_sd.startup(&spec_main_jfile);
+  spec_main_sd.build_index();   // searched from the prefetch thread too
+  spec_main_map=map_fd(spec_main_fd,spec_main_map_size);
+}
+
+static void prefixed_name(char *dst, char const *filename)
+{
+#ifdef WIN32
+  // Need to make sure it's not an absolute Windows path
+  if (spec_prefix && filename[0] != '/' && (filename[0] != '\0' && filename[1] != ':'))
+#else
+  if (spec_prefix && filename[0] != '/')
+#endif
+  {
+    sprintf(dst,"%s%s",spec_prefix,filename);
+  }
+  else
+  {
+    strcpy(dst,filename);
+  }
 }
 
 jFILE::jFILE(FILE *file_pointer)                       // assumes fp is at begining of file
@@ -298,19 +342,7 @@ void jFILE::open_external(char const *filename, char const *mode, int flags)
 {
   int skip_size=0;
   char tmp_name[200];
-#ifdef WIN32
-  // Need to make sure it's not an absolute Windows path
-  if (spec_prefix && filename[0] != '/' && (filename[0] != '\0' && filename[1] != ':'))
-#else
-  if (spec_prefix && filename[0] != '/')
-#endif
-  {
-    sprintf(tmp_name,"%s%s",spec_prefix,filename);
-  }
-  else
-  {
-    strcpy(tmp_name,filename);
-  }
+  prefixed_name(tmp_name,filename);
 
 //  int old_mask=umask(S_IRWXU | S_IRWXG | S_IRWXO);
   if (flags&O_WRONLY)
@@ -383,6 +415,10 @@ bFILE *open_file(char const *filename, char const *mode)
     {
       return open_file_fun(filename,mode);
     }
+    else if (!strpbrk(mode,"wWaA+"))
+    {
+      return open_mapped_file(filename);
+    }
     else
     {
       return new jFILE(filename,mode);
@@ -394,6 +430,16 @@ bFILE *open_file(char const *filename, char const *mode)
   }
 }
 
+bFILE *open_mapped_file(char const *filename)
+{
+  mFILE *fp=new mFILE(filename);
+  if (!fp->open_failure())
+    return fp;
+
+  delete fp;
+  return new jFILE(filename,"rb");
+}
+
 void jFILE::open_internal(char const *filename, char const *mode, int flags)
 {
   int wr=0;
@@ -541,6 +587,177 @@ int jFILE::unbuffered_seek(long offset, int whence) // whence=SEEK_SET, SEEK_CUR
 }
 
 
+mFILE::mFILE(char const *filename)
+{
+  // Nothing is buffered, the mapping already is the buffer
+  free(rbuf); free(wbuf);
+  rbuf=wbuf=NULL;
+  rbuf_size=wbuf_size=0;
+
+  map_base=NULL;
+  map_size=0;
+  data=NULL;
+  data_size=current_offset=0;
+
+  if (search_order==SPEC_SEARCH_OUTSIDE_INSIDE)
+    open_external(filename);
+
+  if (!data)
+    open_internal(filename);
+
+  if (!data && search_order==SPEC_SEARCH_INSIDE_OUTSIDE)
+    open_external(filename);
+}
+
+mFILE::mFILE(void const *buf, long size)
+{
+  free(rbuf); free(wbuf);
+  rbuf=wbuf=NULL;
+  rbuf_size=wbuf_size=0;
+
+  map_base=NULL;
+  map_size=0;
+  data=(uint8_t const *)buf;
+  data_size=size;
+  current_offset=0;
+}
+
+void mFILE::open_external(char const *filename)
+{
+  char tmp_name[200];
+  prefixed_name(tmp_name,filename);
+
+  int fd=open(tmp_name,O_BINARY|O_RDONLY);
+  if (fd<0)
+    return;
+
+  // The mapping stays valid once the descriptor is closed
+  map_base=map_fd(fd,map_size);
+  close(fd);
+  if (map_base)
+  {
+    data=map_base;
+    data_size=map_size;
+  }
+}
+
+void mFILE::open_internal(char const *filename)
+{
+  if (!spec_main_map)
+    return;
+
+  spec_entry *se=spec_main_sd.find(filename);
+  if (se && se->offset+se->size<=spec_main_map_size)
+  {
+    data=spec_main_map+se->offset;
+    data_size=se->size;
+  }
+}
+
+mFILE::~mFILE()
+{
+#if defined HAVE_SYS_MMAN_H
+  if (map_base)
+    munmap(map_base,map_size);
+#endif
+}
+
+int mFILE::unbuffered_read(void *buf, size_t count)
+{
+  if (current_offset>=data_size)
+    return 0;
+  if (count>(size_t)(data_size-current_offset))
+    count=data_size-current_offset;
+  memcpy(buf,data+current_offset,count);
+  current_offset+=count;
+  return count;
+}
+
+int mFILE::unbuffered_seek(long offset, int whence) // whence=SEEK_SET, SEEK_CUR, SEEK_END, ret=0=success
+{
+  switch (whence)
+  {
+    case SEEK_SET : break;
+    case SEEK_END : offset=data_size-offset; break;
+    case SEEK_CUR : offset+=current_offset; break;
+    default : return -1;
+  }
+  if (offset<0)
+    return -1;
+  current_offset=offset;
+  return offset;
+}
+
+void const *mFILE::mapped(long offset, size_t count)
+{
+  if (offset<0 || offset>data_size || count>(size_t)(data_size-offset))
+    return NULL;
+  return data+offset;
+}
+
+memFILE::memFILE()
+{
+  free(rbuf); free(wbuf);
+  rbuf=wbuf=NULL;
+  rbuf_size=wbuf_size=0;
+
+  buf=NULL;
+  buf_size=data_size=current_offset=0;
+}
+
+memFILE::~memFILE()
+{
+  free(buf);
+}
+
+int memFILE::unbuffered_read(void *dst, size_t count)
+{
+  if (current_offset>=data_size)
+    return 0;
+  if (count>(size_t)(data_size-current_offset))
+    count=data_size-current_offset;
+  memcpy(dst,buf+current_offset,count);
+  current_offset+=count;
+  return count;
+}
+
+int memFILE::unbuffered_write(void const *src, size_t count)
+{
+  if (current_offset+(long)count>buf_size)
+  {
+    long size=buf_size ? buf_size : 0x10000;
+    while (size<current_offset+(long)count)
+      size*=2;
+    uint8_t *grown=(uint8_t *)realloc(buf,size);
+    if (!grown)
+      return 0;
+    buf=grown;
+    buf_size=size;
+  }
+  if (current_offset>data_size)    // seeked past the end, fill the gap
+    memset(buf+data_size,0,current_offset-data_size);
+  memcpy(buf+current_offset,src,count);
+  current_offset+=count;
+  if (current_offset>data_size)
+    data_size=current_offset;
+  return count;
+}
+
+int memFILE::unbuffered_seek(long offset, int whence)
+{
+  switch (whence)
+  {
+    case SEEK_SET : break;
+    case SEEK_END : offset=data_size-offset; break;
+    case SEEK_CUR : offset+=current_offset; break;
+    default : return -1;
+  }
+  if (offset<0)
+    return -1;
+  current_offset=offset;
+  return offset;
+}
+
 uint8_t bFILE::read_uint8()
 { uint8_t x;
   read(&x,1);
@@ -597,7 +814,7 @@ double bFILE::read_double()
 
 spec_directory::~spec_directory()
 {
-
+  free(index);
   if (total)
   {
     free(data);
@@ -655,34 +872,74 @@ void spec_directory::calc_offsets()
     }
 }
 
+// FNV-1a, directory names are short so this costs about one strcmp
+static uint32_t name_hash(char const *name)
+{
+  uint32_t h=2166136261u;
+  for (; *name; name++)
+    h=(h^(uint8_t)*name)*16777619u;
+  return h;
+}
+
+void spec_directory::build_index()
+{
+  uint32_t n=16;
+  while (n<(uint32_t)total*2)
+    n<<=1;
+  free(index);
+  index=(int32_t *)malloc(sizeof(int32_t)*n);
+  memset(index,0xff,sizeof(int32_t)*n);      // -1 marks an empty slot
+  index_mask=n-1;
+
+  // Linear probing with entries inserted in order keeps duplicate names
+  // in directory order along the probe chain, so lookups still return the
+  // first match like the old linear scan did.
+  for (int i=0; i<total; i++)
+  {
+    uint32_t h=name_hash(entries[i]->name)&index_mask;
+    while (index[h]>=0)
+      h=(h+1)&index_mask;
+    index[h]=i;
+  }
+}
+
+void spec_directory::drop_index()
+{
+  free(index);
+  index=NULL;
+}
+
+long spec_directory::lookup(char const *name, int type)
+{
+  if (!total)
+    return -1;
+  if (!index)
+    build_index();
+
+  for (uint32_t h=name_hash(name)&index_mask; index[h]>=0; h=(h+1)&index_mask)
+  {
+    spec_entry *e=entries[index[h]];
+    if ((type==-1 || e->type==type) && !strcmp(e->name,name))
+      return index[h];
+  }
+  return -1;
+}
+
 spec_entry *spec_directory::find(char const *name, int type)
 {
-  int i;
-  spec_entry **e;
-  for (i=0,e=entries; i<total; i++,e++)
-    if (!strcmp((*e)->name,name) && (*e)->type==type)
-      return (*e);
-  return NULL;
+  long i=lookup(name,type);
+  return i<0 ? NULL : entries[i];
 }
 
 spec_entry *spec_directory::find(char const *name)
 {
-  int i;
-  spec_entry **e;
-  for (i=0,e=entries; i<total; i++,e++)
-    if (!strcmp((*e)->name,name))
-      return (*e);
-  return NULL;
+  long i=lookup(name,-1);
+  return i<0 ? NULL : entries[i];
 }
 
 long spec_directory::find_number(char const *name)
 {
-  int i;
-  spec_entry **e;
-  for (i=0,e=entries; i<total; i++,e++)
-    if (!strcmp((*e)->name,name))
-      return i;
-  return -1;
+  return lookup(name,-1);
 }
 
 spec_entry *spec_directory::find(int type)
@@ -726,6 +983,7 @@ void spec_directory::print()
 
 void spec_directory::startup(bFILE *fp)
 {
+  index=NULL;
   char buf[256];
   memset(buf,0,256);
   fp->read(buf,8);
@@ -794,6 +1052,7 @@ spec_directory::spec_directory()
   total=0;
   data=NULL;
   entries=NULL;
+  index=NULL;
 }
 
 /*
@@ -922,6 +1181,7 @@ void spec_directory::remove(spec_entry *e)
 
   if (entries[i]==e)                                 // make sre it was found
   {
+    drop_index();
     delete e;
     total--;
     for (; i<total; i++)                               // compact the pointer array
@@ -936,6 +1196,7 @@ void spec_directory::remove(spec_entry *e)
 
 void spec_directory::add_by_hand(spec_entry *e)
 {
+  drop_index();
   total++;
   entries=(spec_entry **)realloc(entries,sizeof(spec_entry *)*total);
   entries[total-1]=e;
@@ -944,6 +1205,7 @@ void spec_directory::add_by_hand(spec_entry *e)
 void spec_directory::delete_entries()   // if the directory was created by hand instead of by file
 {
   int i;
+  drop_index();
   for (i=0; i<total; i++)
     delete entries[i];
 
@@ -114,6 +114,10 @@ class bFILE     // base file type which other files should be derived from (jFIL
   int tell();
   virtual int file_size() = 0;
 
+  // Direct pointer to count bytes at offset, or NULL if the file is not
+  // memory mapped (the caller then has to seek and read)
+  virtual void const *mapped(long offset, size_t count);
+
   virtual ~bFILE();
 
     // read and write using little-endianness
@@ -155,6 +159,50 @@ public :
   virtual ~jFILE();
 } ;
 
+class mFILE : public bFILE     // read-only file mapped in memory, also inside a spe
+{
+  uint8_t *map_base;              // NULL for files inside the main spe
+  size_t map_size;
+  uint8_t const *data;
+  long data_size,current_offset;
+
+  void open_external(char const *filename);
+  void open_internal(char const *filename);
+
+public :
+  mFILE(char const *filename);
+  mFILE(void const *buf, long size);     // wraps a buffer the caller keeps alive
+  virtual int open_failure() { return data==NULL; }
+  virtual int unbuffered_read(void *buf, size_t count);
+  virtual int unbuffered_write(void const *buf, size_t count) { return 0; }
+  virtual int unbuffered_seek(long offset, int whence);
+  virtual int unbuffered_tell() { return current_offset; }
+  virtual int allow_read_buffering() { return 0; }
+  virtual int allow_write_buffering() { return 0; }
+  virtual int file_size() { return data_size; }
+  virtual void const *mapped(long offset, size_t count);
+  virtual ~mFILE();
+} ;
+
+class memFILE : public bFILE   // growable file in memory, e.g. a level saved for the net
+{
+  uint8_t *buf;
+  long buf_size,data_size,current_offset;
+
+public :
+  memFILE();
+  virtual int open_failure() { return 0; }
+  virtual int unbuffered_read(void *buf, size_t count);
+  virtual int unbuffered_write(void const *buf, size_t count);
+  virtual int unbuffered_seek(long offset, int whence);
+  virtual int unbuffered_tell() { return current_offset; }
+  virtual int allow_read_buffering() { return 0; }
+  virtual int allow_write_buffering() { return 0; }
+  virtual int file_size() { return data_size; }
+  uint8_t *data() { return buf; }
+  virtual ~memFILE();
+} ;
+
 class spec_entry
 {
 public:
@@ -200,10 +248,21 @@ public :
   void print();
   void delete_entries();   // if the directory was created by hand instead of by file
 
+    // Name lookups go through a hash of entry indices, built on first use.
+    // Call drop_index() after changing entries[] or names by hand.
+    void build_index();
+    void drop_index();
+
     int total;
     spec_entry **entries;
     void *data;
     size_t size;
+
+private:
+    long lookup(char const *name, int type); // first match, any type if -1
+
+    int32_t *index;
+    uint32_t index_mask;
 };
 
 /*jFILE *add_directory_entry(char *filename,
@@ -224,5 +283,6 @@ void set_spec_main_file(char *filename, int Search_order);
 void set_file_opener(bFILE *(*open_fun)(char const *, char const *));
 void set_no_space_handler(void (*handle_fun)());
 bFILE *open_file(char const *filename, char const *mode);
+bFILE *open_mapped_file(char const *filename);   // local file, mapped if possible
 #endif
 
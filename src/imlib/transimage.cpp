@@ -17,8 +17,189 @@
 
 #include "common.h"
 
+#include "cpu.h"
 #include "transimage.h"
 
+/*  Span kernels for solid runs
+ *
+ *  Runs are short (sprites are rarely wider than 64 pixels), so the copy
+ *  kernels win by replacing the call to memcpy() with a few unaligned
+ *  moves, or a single masked one with AVX-512. Remapping needs a 256 byte
+ *  table lookup per pixel: VBMI does 64 of them with two vpermi2b over the
+ *  table held in four registers. Below that, looking up 16 byte slices of
+ *  the table with pshufb was measured slower than the scalar loop, so
+ *  SSE2 and AVX2 keep it.
+ */
+
+struct SpanKernels
+{
+    void (*copy)(uint8_t *dst, uint8_t const *src, int count);
+    void (*remap)(uint8_t *dst, uint8_t const *src, int count,
+                  uint8_t const *map);
+    // Sprite area from which double remapping composes its tables
+    int compose;
+};
+
+static void CopyC(uint8_t *dst, uint8_t const *src, int count)
+{
+    memcpy(dst, src, count);
+}
+
+static void RemapC(uint8_t *dst, uint8_t const *src, int count,
+                   uint8_t const *map)
+{
+    while (count--)
+        *dst++ = map[*src++];
+}
+
+#if HAVE_X86_KERNELS
+// Short copies use two possibly overlapping moves of the largest size
+// that fits, so there is no loop at all below 32 bytes
+static inline void CopySmall(uint8_t *dst, uint8_t const *src, int count)
+{
+    if (count >= 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, src, 8);
+        memcpy(&b, src + count - 8, 8);
+        memcpy(dst, &a, 8);
+        memcpy(dst + count - 8, &b, 8);
+    }
+    else if (count >= 4)
+    {
+        uint32_t a, b;
+        memcpy(&a, src, 4);
+        memcpy(&b, src + count - 4, 4);
+        memcpy(dst, &a, 4);
+        memcpy(dst + count - 4, &b, 4);
+    }
+    else
+        while (count--)
+            *dst++ = *src++;
+}
+
+__attribute__((target("sse2")))
+static void CopySSE2(uint8_t *dst, uint8_t const *src, int count)
+{
+    if (count < 16)
+    {
+        CopySmall(dst, src, count);
+        return;
+    }
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_loadu_si128((__m128i const *)(src + i)));
+    if (i < count)
+        _mm_storeu_si128((__m128i *)(dst + count - 16),
+                         _mm_loadu_si128((__m128i const *)(src + count - 16)));
+}
+
+__attribute__((target("avx2")))
+static void CopyAVX2(uint8_t *dst, uint8_t const *src, int count)
+{
+    if (count < 32)
+    {
+        if (count >= 16)
+        {
+            __m128i a = _mm_loadu_si128((__m128i const *)src);
+            __m128i b = _mm_loadu_si128((__m128i const *)(src + count - 16));
+            _mm_storeu_si128((__m128i *)dst, a);
+            _mm_storeu_si128((__m128i *)(dst + count - 16), b);
+        }
+        else
+            CopySmall(dst, src, count);
+        return;
+    }
+
+    int i = 0;
+    for (; i + 32 <= count; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_loadu_si256((__m256i const *)(src + i)));
+    if (i < count)
+        _mm256_storeu_si256((__m256i *)(dst + count - 32),
+                            _mm256_loadu_si256((__m256i const *)(src + count - 32)));
+}
+#endif
+
+#if HAVE_AVX512_KERNELS
+// Bytes past count are masked off, they are neither read nor written
+static inline __mmask64 TailMask(int count)
+{
+    return count >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << count) - 1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void CopyAVX512(uint8_t *dst, uint8_t const *src, int count)
+{
+    for (int i = 0; i < count; i += 64)
+    {
+        __mmask64 m = TailMask(count - i);
+        _mm512_mask_storeu_epi8(dst + i, m,
+                                _mm512_maskz_loadu_epi8(m, src + i));
+    }
+}
+
+// Each vpermi2b looks the low 7 bits up in one half of the table, the
+// top bit of the pixel picks the half
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void RemapAVX512(uint8_t *dst, uint8_t const *src, int count,
+                        uint8_t const *map)
+{
+    __m512i t0 = _mm512_loadu_si512(map), t1 = _mm512_loadu_si512(map + 64);
+    __m512i t2 = _mm512_loadu_si512(map + 128);
+    __m512i t3 = _mm512_loadu_si512(map + 192);
+    for (int i = 0; i < count; i += 64)
+    {
+        __mmask64 m = TailMask(count - i);
+        __m512i x = _mm512_maskz_loadu_epi8(m, src + i);
+        __m512i lo = _mm512_permutex2var_epi8(t0, x, t1);
+        __m512i hi = _mm512_permutex2var_epi8(t2, x, t3);
+        _mm512_mask_storeu_epi8(dst + i, m, _mm512_mask_blend_epi8(
+                                    _mm512_movepi8_mask(x), lo, hi));
+    }
+}
+#endif
+
+// Composing the two maps costs 256 lookups, worth it on big sprites
+// unless they are vectorised too
+static SpanKernels const span_c = { CopyC, RemapC, 1024 };
+#if HAVE_X86_KERNELS
+static SpanKernels const span_sse2 = { CopySSE2, RemapC, 1024 };
+static SpanKernels const span_avx2 = { CopyAVX2, RemapC, 1024 };
+#endif
+#if HAVE_AVX512_KERNELS
+static SpanKernels const span_avx512 = { CopyAVX512, RemapAVX512, 0 };
+#endif
+
+static int span_level = CPU_C;
+static SpanKernels spans = span_c;
+
+int TransImage::SetSpanLevel(int level)
+{
+    span_level = Max((int)CPU_C, Min(level, cpu_level()));
+    switch (span_level)
+    {
+#if HAVE_AVX512_KERNELS
+    case CPU_AVX512: spans = span_avx512; break;
+#endif
+#if HAVE_X86_KERNELS
+    case CPU_AVX2: spans = span_avx2; break;
+    case CPU_SSE2: spans = span_sse2; break;
+#endif
+    default: spans = span_c; break;
+    }
+    return span_level;
+}
+
+int TransImage::GetSpanLevel()
+{
+    return span_level;
+}
+
+static int span_init = TransImage::SetSpanLevel(CPU_AVX512);
+
 TransImage::TransImage(image *im, char const *name)
 {
     m_size = im->Size();
@@ -92,6 +273,13 @@ TransImage::TransImage(image *im, char const *name)
     im->Unlock();
 }
 
+TransImage::TransImage(ivec2 size, uint8_t const *data, size_t bytes)
+{
+    m_size = size;
+    m_data = (uint8_t *)malloc(bytes);
+    memcpy(m_data, data, bytes);
+}
+
 TransImage::~TransImage()
 {
     free(m_data);
@@ -122,7 +310,7 @@ uint8_t *TransImage::ClipToLine(image *screen, ivec2 pos1, ivec2 pos2,
 
     // Number of lines to skip, number of lines to draw, first line to draw
     int skiplines = Max(pos1.y - pos.y, 0);
-    ysteps = Min(pos2.y - pos.y, m_size.y - skiplines);
+    ysteps = Min(pos2.y - pos.y, m_size.y) - skiplines;
     pos.y += skiplines;
 
     while (skiplines--)
@@ -183,6 +371,15 @@ void TransImage::PutImageGeneric(image *screen, ivec2 pos, uint8_t color,
     if (N == PREDATOR)
         ysteps = Min(ysteps, pos2.y - 1 - pos.y - 2);
 
+    // map2[map[x]] is the first map remapped by the second one
+    uint8_t composed[256];
+    if (N == REMAP2 && ysteps * m_size.x >= spans.compose)
+    {
+        spans.remap(composed, map, 256, map2);
+        map = composed;
+        map2 = NULL;
+    }
+
     screen->Lock();
 
     screen_line = screen->scan_line(pos.y) + pos.x;
@@ -222,7 +419,7 @@ void TransImage::PutImageGeneric(image *screen, ivec2 pos, uint8_t color,
 
             if (N == NORMAL || N == SCANLINE)
             {
-                memcpy(screen_line, datap, count);
+                spans.copy(screen_line, datap, count);
             }
             else if (N == COLOR)
             {
@@ -232,11 +429,9 @@ void TransImage::PutImageGeneric(image *screen, ivec2 pos, uint8_t color,
             {
                 memcpy(screen_line, screen_line + 2 * m_size.x, count);
             }
-            else if (N == REMAP)
+            else if (N == REMAP || (N == REMAP2 && !map2))
             {
-                uint8_t *sl = screen_line, *sl2 = datap;
-                while (count--)
-                    *sl++ = map[*sl2++];
+                spans.remap(screen_line, datap, count, map);
             }
             else if (N == REMAP2)
             {
@@ -341,23 +536,27 @@ void TransImage::PutScanLine(image *screen, ivec2 pos, int line)
                               line, 1, NULL, NULL, NULL);
 }
 
-size_t TransImage::DiskUsage()
+size_t TransImage::DataSize()
 {
     uint8_t *d = m_data;
-    size_t ret = 0;
 
     for (int y = 0; y < m_size.y; y++)
     {
-        for (int x = 0; x < m_size.x; x++)
+        for (int x = 0; x < m_size.x; )
         {
-            x += *d++; ret++;
+            x += *d++;
 
             if (x >= m_size.x)
                 break;
 
-            size_t run = *d++; ret += run + 1; d += run; x += run;
+            size_t run = *d++; d += run; x += run;
         }
     }
-    return ret + sizeof(void *) + sizeof(ivec2);
+    return d - m_data;
+}
+
+size_t TransImage::DiskUsage()
+{
+    return DataSize() + sizeof(void *) + sizeof(ivec2);
 }
 
@@ -28,6 +28,7 @@ class TransImage
 {
 public:
     TransImage(image *im, char const *name);
+    TransImage(ivec2 size, uint8_t const *data, size_t bytes); // copies data
     ~TransImage();
 
     inline ivec2 Size() { return m_size; }
@@ -49,8 +50,14 @@ public:
                   int blend_amount, ColorFilter *f, palette *pal);
     void PutScanLine(image *screen, ivec2 pos, int line);
 
+    size_t DataSize(); // bytes of RLE data
     size_t DiskUsage();
 
+    // Span kernels, one of the CPU_ levels from cpu.h. The best one the
+    // CPU supports is used by default, asking for more gives the best one.
+    static int SetSpanLevel(int level);
+    static int GetSpanLevel();
+
 private:
     uint8_t *ClipToLine(image *screen, ivec2 pos1, ivec2 pos2,
                         ivec2 &posy, int &ysteps);
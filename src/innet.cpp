@@ -33,6 +33,8 @@
 #include "net/gclient.h"
 #include "dprint.h"
 #include "netcfg.h"
+#include "rollback.h"
+#include "lz.h"
 
 /*
 
@@ -130,6 +132,8 @@ int net_init(int argc, char **argv)
         }
     }
 
+    rollback_init(argc, argv);
+
     net_protocol *n = net_protocol::first, *usable = NULL;     // find a usable protocol from installed list
     int total_usable = 0;
     for( ; n; n = n->next )                                    // show a list of usables, just to be cute
@@ -212,6 +216,7 @@ int kill_net()
 
 void net_uninit()
 {
+  rollback_report();
   kill_net();
 }
 
@@ -295,12 +300,12 @@ long NF_tell(int fd)
 #endif
 
 
-void service_net_request()
+void service_net_request(int wait_ms)
 {
 #if HAVE_NETWORK
   if (prot)
   {
-    if (prot->select(0))  // anything happening net-wise?
+    if (prot->wait(wait_ms)>0)  // anything happening net-wise?
     {
       if (comm_sock && comm_sock->ready_to_read())  // new connection?
       {
@@ -483,11 +488,128 @@ int reload_end()
 }
 
 
+// Adds a view and a character for a player that joined the running game
+static void add_joined_player(int client_id, char const *name)
+{
+  view *f=player_list;
+  for (; f && f->next; f=f->next);      // find last player, add one for pn
+
+  game_object *o=create(current_start_type,0,0);
+  game_object *start=current_level->get_random_start(320,NULL);
+  if (start) { o->x=start->x; o->y=start->y; }
+  else { o->x=100; o->y=100; }
+
+  f->next=new view(o,NULL,client_id);
+  strcpy(f->next->name,name);
+  o->set_controller(f->next);
+  f->next->set_tint(f->next->player_number);
+  if (start)
+    current_level->add_object_after(o,start);
+  else
+    current_level->add_object(o);
+
+  view *v = f->next;
+  v->m_aa = ivec2(5);
+  v->m_bb = ivec2(319, 199) - ivec2(5);
+}
+
+/*
+  Without rollback a late joiner does not make everyone reload netstart.spe.
+  The server puts an SCMD_JOIN in its input, every peer adds the player
+  when it processes that packet, then the server saves the level as it is
+  at the end of the packet into memory and queues it, compressed, for the
+  joiner only. The packets the joiner misses while loading follow it over
+  the same connection and it replays them until its own input catches up
+  with the tick being collected. Nobody else stops.
+*/
+
+static uint8_t join_snapshot_wanted[MAX_JOINERS];
+
+void write_join_commands()
+{
+  for (join_struct *j=base->join_list; j; j=j->next)
+  {
+    uint8_t len=strlen(j->name);
+    base->packet.write_uint8(SCMD_JOIN);
+    base->packet.write_uint8(j->client_id);
+    base->packet.write_uint8(len);
+    base->packet.add_to_packet(j->name,len);
+  }
+  base->join_list=NULL;
+}
+
+void net_join(int client_id, char const *name)
+{
+  if (!current_level)
+    return;
+  for (view *v=player_list; v; v=v->next)
+    if (v->player_number==client_id)
+      return;
+
+  add_joined_player(client_id,name);
+  if (prot && !net_server && client_id<MAX_JOINERS)
+    join_snapshot_wanted[client_id]=1;
+}
+
+void send_join_snapshots()
+{
+  int i;
+  for (i=0; i<MAX_JOINERS && !join_snapshot_wanted[i]; i++);
+  if (i==MAX_JOINERS || !current_level)
+    return;
+
+  Timer t;
+  memFILE fp;
+  current_level->save(&fp);
+  int raw_size=fp.file_size();
+  uint8_t *packed=(uint8_t *)malloc(lz_bound(raw_size));
+  int size=lz_compress(fp.data(),raw_size,packed);
+
+  for (; i<MAX_JOINERS; i++)
+    if (join_snapshot_wanted[i])
+    {
+      game_face->send_level(i,packed,size,raw_size);
+      join_snapshot_wanted[i]=0;
+    }
+  free(packed);
+
+  if (prot->debug_level(net_protocol::DB_IMPORTANT_EVENT))
+    fprintf(stderr,"level snapshot %d bytes, %d sent, %.1f ms\n",raw_size,size,t.GetMs());
+}
+
+int net_catching_up()
+{
+  return prot && game_face->catching_up();
+}
+
+// A late joiner's level comes straight from the server's memory
+static int load_join_snapshot()
+{
+  int raw_size;
+  uint8_t *buf=game_face->receive_level(raw_size);
+  if (!buf)
+    return 0;
+
+  mFILE fp(buf,raw_size);
+  spec_directory sd(&fp);
+  current_level=new level(&sd,&fp,NET_STARTFILE);
+  free(buf);
+  base->current_tick=(current_level->tick_counter()&0xff);
+  return 1;
+}
+
 void net_reload()
 {
   if (prot)
   {
-    if (net_server)
+    if (net_server && !current_level && !rollback_on)
+    {
+      if (!load_join_snapshot())
+      {
+        fprintf(stderr,"unable to get the level from the server\n");
+        exit(0);
+      }
+    } else if (net_server)
     {
       if (current_level)
         delete current_level;
@@ -521,38 +643,8 @@ void net_reload()
     } else if (current_level)
     {
 
-      join_struct *join_list=base->join_list;
-
-
-      while (join_list)
-      {
-
-                view *f=player_list;
-                for (; f && f->next; f=f->next);      // find last player, add one for pn
-                int i,st=0;
-                for (i=0; i<total_objects; i++)
-                if (!strcmp(object_names[i],"START"))
-                st=i;
-
-                game_object *o=create(current_start_type,0,0);
-                game_object *start=current_level->get_random_start(320,NULL);
-                if (start) { o->x=start->x; o->y=start->y; }
-                else { o->x=100; o->y=100; }
-
-                f->next=new view(o,NULL,join_list->client_id);
-                strcpy(f->next->name,join_list->name);
-                o->set_controller(f->next);
-                f->next->set_tint(f->next->player_number);
-                if (start)
-                current_level->add_object_after(o,start);
-                else
-                current_level->add_object(o);
-
-                view *v = f->next;
-                v->m_aa = ivec2(5);
-                v->m_bb = ivec2(319, 199) - ivec2(5);
-                join_list = join_list->next;
-      }
+      for (join_struct *j=base->join_list; j; j=j->next)
+        add_joined_player(j->client_id,j->name);
       base->join_list=NULL;
       current_level->save(NET_STARTFILE,1);
       base->mem_lock=0;
@@ -573,7 +665,7 @@ void net_reload()
       // wait for all client to reload the level with the new players
       do
       {
-                service_net_request();
+                service_net_request(10);
                 if (wm->IsPending())
                 {
                   Event ev;
@@ -600,6 +692,7 @@ void net_reload()
       base->input_state=INPUT_COLLECTING;
 
     }
+    rollback_reset();
   }
 }
 
@@ -614,6 +707,18 @@ void send_local_request()
     if (current_level)
       base->current_tick=(current_level->tick_counter()&0xff);
     game_face->add_engine_input();
+
+    if (rollback_on && current_level)
+    {
+      uint32_t remote=0;
+      for (view *v=player_list; v; v=v->next)
+        if (!v->local_player() && v->player_number<ROLLBACK_PLAYERS)
+          remote|=1u<<v->player_number;
+      rollback_players(remote);
+      rollback_local(current_level->tick_counter(),client_number(),
+                     base->packet.packet_data(),base->packet.packet_size());
+      game_face->send_input();
+    }
   } else base->input_state=INPUT_PROCESSING;
 
 }
@@ -631,23 +736,44 @@ void kill_slackers()
   }
 }
 
+int net_packet::write_bundle(uint8_t tick, int player, int resend)
+{
+  int size=rollback_bundle(tick,player,resend,packet_data(),
+                           PACKET_MAX_SIZE-packet_prefix_size());
+  set_packet_size(size);
+  set_tick_received(tick);
+  calc_checksum();
+  return size;
+}
+
+// with rollback we only wait once we are too far ahead of someone
+static int input_waiting()
+{
+  if (rollback_on)
+    return !rollback_ready();
+  return base->input_state!=INPUT_PROCESSING;
+}
+
 int get_inputs_from_server(unsigned char *buf)
 {
-  if (prot && base->input_state!=INPUT_PROCESSING)      // if input is not here, wait on it
+  if (prot && input_waiting())      // if input is not here, wait on it
   {
     time_marker start;
 
     int total_retry=0;
     Jwindow *abort=NULL;
 
-    while (base->input_state!=INPUT_PROCESSING)
+    while (input_waiting())
     {
       if (!prot)
       {
     base->input_state=INPUT_PROCESSING;
     return 1;
       }
-      service_net_request();
+      // sleep until something arrives or it is time to ask for a resend
+      time_marker waited;
+      int left=(int)((0.05-waited.diff_time(&start))*1000);
+      service_net_request(left>0 ? left : 0);
 
       time_marker now;                   // if this is taking to long, the packet was probably lost, ask for it to be resent
 
@@ -699,6 +825,13 @@ int get_inputs_from_server(unsigned char *buf)
   }
 
 
+  if (prot && rollback_on)
+  {
+    base->packet.packet_reset();
+    base->mem_lock=0;
+    return rollback_inputs(buf);
+  }
+
   memcpy(base->last_packet.data,base->packet.data,base->packet.packet_size()+base->packet.packet_prefix_size());
 
   int size=base->packet.packet_size();
@@ -15,189 +15,13 @@
 #include "common.h"
 
 #include "items.h"
+#include "pack.h"
 #include "lisp.h"
 #include "dev.h"
 
 
 extern palette *pal;
 
-boundary::boundary(bFILE *fp, char const *er_name) : point_list(fp)
-{
-  int x1,y1,x2,y2,checkx,checky,i;
-  if (tot)
-  {
-    if (!(data[0]==data[(tot-1)*2] &&
-      data[1]==data[tot*2-1]))
-    {
-      printf("%s : Endpoints of foretile do not match start points\n",er_name);
-      exit(0);
-    }
-
-    inside=(uint8_t *)malloc(tot);
-  }
-
-  uint8_t *point_on;
-
-  for (i=0,point_on=data; i<tot-1; i++)
-  {
-    x1=*(point_on++);
-    y1=*(point_on++);
-    x2=point_on[0];
-    y2=point_on[1];
-
-    checkx=(x1+x2)/2;
-    checky=(y1+y2)/2;
-
-    int j,xp1,yp1,xp2,yp2,maxx,maxy,minx,miny;
-    uint8_t *point2,segs_left=0,segs_right=0,segs_down=0;
-    int skip_next=0;
-    int check_left=0,check_right=0,check_down=0;
-
-
-    if (y1==y2) check_down=1;
-    else if (x1==x2) check_left=1;
-    else
-    {
-      check_down=1;
-      if (x1<x2)
-        if (y1<y2) check_left=1;
-        else check_right=1;
-      else if (y1<y2) check_right=1;
-      else check_left=1;
-    }
-
-    maxx=Max(x1,x2);
-    maxy=Max(y1,y2);
-    minx=Min(x1,x2);
-    miny=Min(y1,y2);
-
-    if (skip_next)
-      skip_next=0;
-    else
-    {
-      for (j=0,point2=data; j<tot-1; j++,point2+=2)
-      {
-    if (skip_next)
-      skip_next=0;
-    else
-    {
-      if (j!=i)           // make sure we are not looking at ourself
-      {
-        xp1=point2[0];
-        yp1=point2[1];
-        xp2=point2[2];
-        yp2=point2[3];
-
-        if ((checkx>=xp1 && checkx<=xp2) || (checkx>=xp2 &&  checkx<=xp1))
-            {
-            if (check_down && (yp1>miny && yp2>miny))
-        segs_down++;
-          if (checkx==xp2) skip_next=1;
-        } else if ((checky>=yp1 && checky<=yp2) || (checky>=yp2 &&  checky<=yp1))
-        {
-          if (check_left && xp1<maxx && xp2<maxx)
-        segs_left++;
-          if (check_right && xp1>minx && xp2>minx)
-            segs_right++;
-          if (checky==yp2) skip_next=1;
-        }
-      }
-    }
-      }
-    }
-    if (!check_down) segs_down=1;
-    if (!check_right) segs_right=1;
-    if (!check_left) segs_left=1;
-
-    inside[i]=!(((segs_left&1)&&(segs_right&1)&&(segs_down&1)));
-  }
-}
-
-boundary::boundary(boundary *p) : point_list(p->tot,p->data)
-{
-  int x1,y1,x2,y2,checkx,checky,i;
-  uint8_t *point_on;
-  if (tot)
-  {
-    inside=(uint8_t *)malloc(tot);
-  } else inside=NULL;
-  for (i=0,point_on=data; i<tot-1; i++)
-  {
-    x1=*(point_on++);
-    y1=*(point_on++);
-    x2=point_on[0];
-    y2=point_on[1];
-
-    checkx=(x1+x2)/2;
-    checky=(y1+y2)/2;
-
-    int j,xp1,yp1,xp2,yp2,maxx,maxy,minx,miny;
-    uint8_t *point2,segs_left=0,segs_right=0,segs_down=0;
-    int skip_next=0;
-    int check_left=0,check_right=0,check_down=0;
-
-
-    if (y1==y2) check_down=1;
-    else if (x1==x2) check_right=1;
-    else
-    {
-      check_down=1;
-      if (x1<x2)
-        if (y1<y2) check_left=1;
-        else check_right=1;
-      else if (y1<y2) check_right=1;
-      else check_left=1;
-    }
-
-
-
-    maxx=Max(x1,x2);
-    maxy=Max(y1,y2);
-    minx=Min(x1,x2);
-    miny=Min(y1,y2);
-
-    if (skip_next)
-      skip_next=0;
-    else
-    {
-      for (j=0,point2=data; j<tot-1; j++,point2+=2)
-      {
-    if (skip_next)
-      skip_next=0;
-    else
-    {
-      if (j!=i)           // make sure we are not looking at ourself
-      {
-        xp1=point2[0];
-        yp1=point2[1];
-        xp2=point2[2];
-        yp2=point2[3];
-
-        if ((checkx>=xp1 && checkx<=xp2) || (checkx>=xp2 &&  checkx<=xp1))
-            {
-            if (check_down && (yp1>miny && yp2>miny))
-        segs_down++;
-          if (checkx==xp2) skip_next=1;
-        } else if ((checky>=yp1 && checky<=yp2) || (checky>=yp2 &&  checky<=yp1))
-        {
-          if (check_left && xp1<maxx && xp2<maxx)
-        segs_left++;
-          if (check_right && xp1>minx && xp2>minx)
-            segs_right++;
-          if (checky==yp2) skip_next=1;
-        }
-      }
-    }
-      }
-    }
-    if (!check_down) segs_down=1;
-    if (!check_right) segs_right=1;
-    if (!check_left) segs_left=1;
-
-    inside[i]=!(((segs_left&1)&&(segs_right&1)&&(segs_down&1)));
-  }
-}
-
 backtile::backtile(bFILE *fp)
 {
   im=load_image(fp);
@@ -210,15 +34,17 @@ backtile::backtile(spec_entry *e, bFILE *fp)
   next=fp->read_uint16();
 }
 
-foretile::foretile(bFILE *fp)
+backtile::backtile(uint8_t const *&p)
 {
-    uint8_t *sl;
-    image *img = load_image(fp);
-
-    // create the micro image of the fore tile by averaging the color values
-    // in 2×2 space and storing the closest match
+  im=pack_read_image(p);
+  next=pack_u16(p);
+}
 
-    //uint8_t *buffer=(uint8_t *)&micro_image;
+// The micro image of a fore tile averages the color values over each
+// AUTOTILE_WIDTH x AUTOTILE_HEIGHT cell and stores the closest match
+static image *micro_tile(image *img)
+{
+    uint8_t *sl;
     int x, y, w = img->Size().x, h = img->Size().y, l;
     int r[AUTOTILE_WIDTH * AUTOTILE_HEIGHT],
         g[AUTOTILE_WIDTH * AUTOTILE_HEIGHT],
@@ -253,15 +79,20 @@ foretile::foretile(bFILE *fp)
       t[l]++;
     }
   }
-  micro_image = new image(ivec2(AUTOTILE_WIDTH, AUTOTILE_HEIGHT));
+  image *micro = new image(ivec2(AUTOTILE_WIDTH, AUTOTILE_HEIGHT));
 
   for (l=0; l<AUTOTILE_WIDTH*AUTOTILE_HEIGHT; l++)
-    micro_image->PutPixel(ivec2(l % AUTOTILE_WIDTH, l / AUTOTILE_WIDTH),
+    micro->PutPixel(ivec2(l % AUTOTILE_WIDTH, l / AUTOTILE_WIDTH),
        color_table->Lookup((r[l]/(t[l]*4/5))>>3,
                  (g[l]/(t[l]*4/5))>>3,
                  (b[l]/(t[l]*4/5))>>3));
+  return micro;
+}
 
-
+foretile::foretile(bFILE *fp)
+{
+  image *img = load_image(fp);
+  micro_image = micro_tile(img);
   im=new TransImage(img,"foretile");
   delete img;
 
@@ -274,6 +105,19 @@ foretile::foretile(bFILE *fp)
 
 }
 
+// The micro image depends on the palette in use, so packs don't keep it
+foretile::foretile(uint8_t const *&p)
+{
+  im=pack_read_trans(p);
+  next=pack_u16(p);
+  damage=pack_u8(p);
+  points=pack_read_boundary(p);
+
+  image *img=im->ToImage();
+  micro_image=micro_tile(img);
+  delete img;
+}
+
 size_t figure::MemUsage()
 {
     return forward->DiskUsage() + backward->DiskUsage() + hit->size()
@@ -305,6 +149,18 @@ figure::figure(bFILE *fp, int type)
   hit=new point_list(fp);
 }
 
+figure::figure(uint8_t const *&p)
+{
+  forward=pack_read_trans(p);
+  backward=pack_read_trans(p);
+  hit_damage=pack_u8(p);
+  xcfg=pack_u8(p);
+  advance=(int8_t)pack_u8(p);
+  f_damage=pack_read_boundary(p);
+  b_damage=pack_read_boundary(p);
+  hit=pack_read_points(p);
+}
+
 
 char_tint::char_tint(bFILE *fp)  // se should be a palette entry
 {
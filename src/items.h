@@ -20,15 +20,6 @@
 #define AUTOTILE_WIDTH 6
 #define AUTOTILE_HEIGHT 3
 
-class boundary : public point_list      //  a list of points with
-{
-public :
-  boundary(bFILE *fp,char const *er_name);
-  uint8_t *inside;     // tells which side of the line is on the inside
-  boundary(boundary *p);      // flips the *inside list
-  ~boundary() { if (tot) free(inside); }
-} ;
-
 class backtile
 {
 public :
@@ -36,6 +27,7 @@ public :
   image *im;
   backtile(spec_entry *e, bFILE *fp);
   backtile(bFILE *fp);
+  backtile(uint8_t const *&p);  // from a pack blob, see pack.h
   int32_t size() { ivec2 s = im->Size(); return 2 + 4 + s.x * s.y; }
   ~backtile() { delete im; }
 } ;
@@ -53,6 +45,7 @@ public :
   image *micro_image;
 
   foretile(bFILE *fp);
+  foretile(uint8_t const *&p);
   int32_t size() { return im->Size().x*im->Size().y+4+2+1+points->size(); }
   ~foretile() { delete im; delete points; delete micro_image; }
 } ;
@@ -68,6 +61,7 @@ public :
   size_t MemUsage();
 
   figure(bFILE *fp, int type);
+  figure(uint8_t const *&p);
   int width() { return forward->Size().x; }
   int height() { return forward->Size().y; }
 
@@ -39,11 +39,13 @@
 #include "dev.h"
 #include "demo.h"
 #include "pcxread.h"
+#include "trace.h"
 #include "profile.h"
 #include "sbar.h"
 #include "cop.h"
 #include "nfserver.h"
 #include "lisp_gc.h"
+#include "bench.h"
 
 level *current_level;
 
@@ -83,6 +85,7 @@ game_object *level::main_character()
 
 void level::load_fail()
 {
+  level_tile_changes++;
   if (map_fg)    free(map_fg);   map_fg=NULL;
   if (map_bg)    free(map_bg);   map_bg=NULL;
   if (Name)      free(Name);     Name=NULL;
@@ -122,6 +125,8 @@ level::~level()
   if (target_list) free(target_list);
   if (block_list) free(block_list);
   if (all_block_list) free(all_block_list);
+  if (grid) free(grid);
+  if (grid_hits) free(grid_hits);
   if (first_name) free(first_name);
 }
 
@@ -182,14 +187,99 @@ void level::next_focus()
 void level::unactivate_all()
 {
   first_active=NULL;
-  game_object *o=first;
   attack_total=0;  // reset the attack list
   target_total=0;
   block_total=0;
   all_block_total=0;
 
-  for (; o; o=o->next)
+  rebuild_grid();
+}
+
+void level::clear_active_list()
+{
+  first_active=NULL;
+  rebuild_grid();
+}
+
+// puts every object into the grid cell under it and marks it not active.
+// objects move around freely during a tick, so rather than chasing every
+// change to x/y the grid is rebuilt in the single pass over the object list
+// that resetting the active flags needs anyway, which leaves the per view
+// work in add_actives/add_drawables proportional to what is near the view
+void level::rebuild_grid()
+{
+  int w=((fg_width*the_game->ftile_width())>>GRID_SHIFT)+1,
+      h=((fg_height*the_game->ftile_height())>>GRID_SHIFT)+1;
+  if (w!=grid_width || h!=grid_height)
+  {
+    grid_width=w;
+    grid_height=h;
+    grid=(game_object **)realloc(grid,sizeof(game_object *)*w*h);
+  }
+  memset(grid,0,sizeof(game_object *)*w*h);
+  grid_big=NULL;
+
+  int32_t order=0;
+  for (game_object *o=first; o; o=o->next)
+  {
     o->active=0;
+    o->grid_order=order++;
+
+    CharacterType *f=figures[o->otype];
+    if (abs(f->rangex)>GRID_SIZE || abs(f->rangey)>GRID_SIZE ||
+        abs(f->draw_rangex)>GRID_SIZE || abs(f->draw_rangey)>GRID_SIZE)
+    {
+      o->grid_next=grid_big;
+      grid_big=o;
+    } else
+    {
+      int cx=Max(0,Min(grid_width-1,(int)(o->x>>GRID_SHIFT))),
+          cy=Max(0,Min(grid_height-1,(int)(o->y>>GRID_SHIFT)));
+      o->grid_next=grid[cx+cy*grid_width];
+      grid[cx+cy*grid_width]=o;
+    }
+  }
+}
+
+static int grid_order_compare(void const *a, void const *b)
+{
+  return (*(game_object * const *)a)->grid_order-(*(game_object * const *)b)->grid_order;
+}
+
+// collects every object whose range could reach the area into grid_hits,
+// sorted back into level order so activation and drawing order don't change
+int level::grid_query(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+  int cx1=Max(0,Min(grid_width-1,(int)((x1-GRID_SIZE)>>GRID_SHIFT))),
+      cy1=Max(0,Min(grid_height-1,(int)((y1-GRID_SIZE)>>GRID_SHIFT))),
+      cx2=Max(0,Min(grid_width-1,(int)((x2+GRID_SIZE)>>GRID_SHIFT))),
+      cy2=Max(0,Min(grid_height-1,(int)((y2+GRID_SIZE)>>GRID_SHIFT)));
+
+  int t=0;
+  for (int cy=cy1; cy<=cy2; cy++)
+    for (int cx=cx1; cx<=cx2; cx++)
+      for (game_object *o=grid[cx+cy*grid_width]; o; o=o->grid_next)
+      {
+        if (t>=grid_hits_size)
+        {
+          grid_hits_size+=256;
+          grid_hits=(game_object **)realloc(grid_hits,sizeof(game_object *)*grid_hits_size);
+        }
+        grid_hits[t++]=o;
+      }
+
+  for (game_object *o=grid_big; o; o=o->grid_next)
+  {
+    if (t>=grid_hits_size)
+    {
+      grid_hits_size+=256;
+      grid_hits=(game_object **)realloc(grid_hits,sizeof(game_object *)*grid_hits_size);
+    }
+    grid_hits[t++]=o;
+  }
+
+  qsort(grid_hits,t,sizeof(game_object *),grid_order_compare);
+  return t;
 }
 
 
@@ -224,9 +314,10 @@ int level::add_actives(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
   if (first_active)
     for (last_active=first_active; last_active->next_active; last_active=last_active->next_active);
 
-  game_object *o=first;
-  for (; o; o=o->next)
+  int total=grid_query(x1,y1,x2,y2);
+  for (int i=0; i<total; i++)
   {
+    game_object *o=grid_hits[i];
     if (!o->active)
     {
       int32_t xr=figures[o->otype]->rangex,
@@ -261,19 +352,19 @@ int level::add_actives(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
 }
 
 
+// expects clear_active_list() to have been called before the first view
 int level::add_drawables(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
 {
-  int t=0,ft=0;
+  int t=0;
   game_object *last_active=NULL;
   if (first_active)
-  {
     for (last_active=first_active; last_active->next_active; last_active=last_active->next_active);
-  } else ft=1;
 
-  game_object *o=first;
-  for (; o; o=o->next)
+  int total=grid_query(x1,y1,x2,y2);
+  for (int i=0; i<total; i++)
   {
-    if (ft || !o->active)
+    game_object *o=grid_hits[i];
+    if (!o->active)
     {
       int32_t xr=figures[o->otype]->draw_rangex,
       yr=figures[o->otype]->draw_rangey;
@@ -287,7 +378,7 @@ int level::add_drawables(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
     last_active->next_active=o;
     last_active=o;
     o->active=1;
-      } else if (ft) o->active=0;  // if this is the first pass, then mark objects not in this ranges as not active
+      }
     }
   }
   if (last_active)
@@ -615,6 +706,7 @@ extern int sshot_fcount,screen_shot_on;
 
 int level::tick()
 {
+  trace_zone tz("level::tick");
   game_object *o,*l=NULL,  // l is last, used for delete
               *cur;        // cur is current object, NULL if object deletes it's self
   int ret=1;
@@ -760,7 +852,10 @@ int level::tick()
   }
   tick_panims();
 
-  check_collisions();
+  {
+    bench_scope bs(BENCH_COLLIDE);
+    check_collisions();
+  }
 //  wall_push();
 
   set_tick_counter(tick_counter()+1);
@@ -830,6 +925,7 @@ void level::set_size(int w, int h)
     the_game->show_help(symbol_str("too_big"));
     return ;
   }
+  level_tile_changes++;
 
   uint16_t *new_fg,*new_bg;
   new_fg=(uint16_t *)malloc(w*h*sizeof(int16_t));
@@ -1274,6 +1370,7 @@ level::level(spec_directory *sd, bFILE *fp, char const *lev_name)
 {
   spec_entry *e;
   area_list=NULL;
+  level_tile_changes++;
 
   attack_list=NULL;
   attack_list_size=attack_total=0;
@@ -1286,6 +1383,12 @@ level::level(spec_directory *sd, bFILE *fp, char const *lev_name)
 
   all_block_list=NULL;
   all_block_list_size=all_block_total=0;
+
+  grid=NULL;
+  grid_width=grid_height=0;
+  grid_big=NULL;
+  grid_hits=NULL;
+  grid_hits_size=0;
   first_name=NULL;
 
   the_game->need_refresh();
@@ -1516,6 +1619,18 @@ void level::level_loaded_notify()
 
 bFILE *level::create_dir(char *filename, int save_all,
              object_node *save_list, object_node *exclude_list)
+{
+  jFILE *fp=new jFILE(filename,"wb");
+  if (fp->open_failure() || !write_dir(fp,save_all,save_all,save_list,exclude_list))
+  {
+    delete fp;
+    return NULL;
+  }
+  return fp;
+}
+
+int level::write_dir(bFILE *fp, int save_all, int thumb,
+             object_node *save_list, object_node *exclude_list)
 {
   spec_directory sd;
   sd.add_by_hand(new spec_entry(SPEC_DATA_ARRAY,"Copyright 1995 Crack dot Com, All Rights reserved",NULL,0,0));
@@ -1624,12 +1739,13 @@ bFILE *level::create_dir(char *filename, int save_all,
       name_len+=strlen(v->name)+2;
     sd.add_by_hand(new spec_entry(SPEC_DATA_ARRAY,"player_names",NULL,name_len,0));
 
-    sd.add_by_hand(new spec_entry(SPEC_IMAGE,"thumb nail",NULL,4+160*(100+wm->font()->Size().y*2),0));
+    if (thumb)
+      sd.add_by_hand(new spec_entry(SPEC_IMAGE,"thumb nail",NULL,4+160*(100+wm->font()->Size().y*2),0));
   }
 
   sd.calc_offsets();
 
-  return sd.write(filename);
+  return sd.write(fp);
 }
 
 void scale_put(image *im, image *screen, int x, int y, short new_width, short new_height);
@@ -2193,6 +2309,87 @@ void level::load_cache_info(spec_directory *sd, bFILE *fp)
 }
 
 
+void level::write_contents( bFILE *fp, int save_all, int thumb,
+                            object_node *save_list, object_node *exclude_list )
+{
+    if( first_name )
+    {
+        fp->write_uint8( strlen( first_name ) + 1 );
+        fp->write( first_name, strlen( first_name ) + 1 );
+    }
+    else
+    {
+        fp->write_uint8( 1 );
+        fp->write_uint8( 0 );
+    }
+
+    fp->write_uint32( fg_width );
+    fp->write_uint32( fg_height );
+
+    int t  = fg_width * fg_height;
+    uint16_t *rm = map_fg;
+    for (; t; t--,rm++)
+    {
+        uint16_t x = *rm;
+        x = lstl(x);            // convert to intel endianess
+        *rm = x;
+    }
+
+    fp->write( (char *)map_fg, 2 * fg_width * fg_height );
+    t = fg_width * fg_height;
+    rm = map_fg;
+    for (; t; t--,rm++)
+    {
+        uint16_t x = *rm;
+        x = lstl( x );            // convert to intel endianess
+        *rm = x;
+    }
+
+    fp->write_uint32( bg_width );
+    fp->write_uint32( bg_height );
+    t = bg_width * bg_height;
+    rm = map_bg;
+
+    for (; t; t--,rm++)
+    {
+        uint16_t x=*rm;
+        x = lstl( x );        // convert to intel endianess
+        *rm = x;
+    }
+
+    fp->write( (char *)map_bg, 2 * bg_width * bg_height );
+    rm = map_bg;
+    t = bg_width*bg_height;
+
+    for (; t; t--,rm++)
+    {
+        uint16_t x = *rm;
+        x = lstl( x );        // convert to intel endianess
+        *rm = x;
+    }
+
+    write_options( fp );
+    write_objects( fp, save_list );
+    write_lights( fp );
+    write_links( fp, save_list, exclude_list );
+    if( save_all )
+    {
+        write_player_info( fp, save_list );
+        if( thumb )
+            write_thumb_nail( fp,main_screen );
+    }
+}
+
+int level::save( bFILE *fp )
+{
+    object_node *objs = make_not_list( NULL );
+    int ret = write_dir( fp, 1, 0, objs, NULL );
+    if( ret )
+        write_contents( fp, 1, 0, objs, NULL );
+    delete_object_list( objs );
+    return ret;
+}
+
 int level::save(char const *filename, int save_all)
 {
     char name[255], bkname[255];
@@ -2251,71 +2448,7 @@ int level::save(char const *filename, int save_all)
     {
         if( !fp->open_failure() )
         {
-            if( first_name )
-            {
-                fp->write_uint8( strlen( first_name ) + 1 );
-                fp->write( first_name, strlen( first_name ) + 1 );
-            }
-            else
-            {
-                fp->write_uint8( 1 );
-                fp->write_uint8( 0 );
-            }
-
-            fp->write_uint32( fg_width );
-            fp->write_uint32( fg_height );
-
-            int t  = fg_width * fg_height;
-            uint16_t *rm = map_fg;
-            for (; t; t--,rm++)
-            {
-                uint16_t x = *rm;
-                x = lstl(x);            // convert to intel endianess
-                *rm = x;
-            }
-
-            fp->write( (char *)map_fg, 2 * fg_width * fg_height );
-            t = fg_width * fg_height;
-            rm = map_fg;
-            for (; t; t--,rm++)
-            {
-                uint16_t x = *rm;
-                x = lstl( x );            // convert to intel endianess
-                *rm = x;
-            }
-
-            fp->write_uint32( bg_width );
-            fp->write_uint32( bg_height );
-            t = bg_width * bg_height;
-            rm = map_bg;
-
-            for (; t; t--,rm++)
-            {
-                uint16_t x=*rm;
-                x = lstl( x );        // convert to intel endianess
-                *rm = x;
-            }
-
-            fp->write( (char *)map_bg, 2 * bg_width * bg_height );
-            rm = map_bg;
-            t = bg_width*bg_height;
-
-            for (; t; t--,rm++)
-            {
-                uint16_t x = *rm;
-                x = lstl( x );        // convert to intel endianess
-                *rm = x;
-            }
-
-            write_options( fp );
-            write_objects( fp, objs );
-            write_lights( fp );
-            write_links( fp, objs, players );
-            if( save_all )
-            {
-                write_player_info( fp, objs );
-                write_thumb_nail( fp,main_screen );
-            }
+            write_contents( fp, save_all, save_all, objs, players );
 
             delete fp;
 #if (defined(__MACH__) || !defined(__APPLE__)) && (!defined(WIN32))
@@ -2348,6 +2481,7 @@ int level::save(char const *filename, int save_all)
 level::level(int width, int height, char const *name)
 {
   the_game->need_refresh();
+  level_tile_changes++;
   area_list=NULL;
   set_tick_counter(0);
 
@@ -2363,6 +2497,12 @@ level::level(int width, int height, char const *name)
   all_block_list=NULL;
   all_block_list_size=all_block_total=0;
 
+  grid=NULL;
+  grid_width=grid_height=0;
+  grid_big=NULL;
+  grid_hits=NULL;
+  grid_hits_size=0;
+
   Name=NULL;
   first_name=NULL;
 
@@ -2596,10 +2736,37 @@ game_object *level::find_object(int32_t x, int32_t y)
 }
 
 int32_t last_tile_hit_x,last_tile_hit_y;
+int32_t level_tile_changes=0;
 
 #define remapx(x) (x==0 ? -1 : x==tl-1 ? tl+1 : x)
 #define remapy(y) (y==0 ? -1 : y==th-1 ? th+1 : y)
 
+// Find the rows of column slab [sx1,sx2] that the ray can touch, a tile's
+// segments reach one pixel past its edges. Returns 0 if it misses the slab.
+static int ray_rows(int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                    int32_t sx1, int32_t sx2, int32_t th,
+                    int32_t &row1, int32_t &row2)
+{
+  int32_t ylo,yhi;
+  if (x1==x2)
+  {
+    if (x1<sx1 || x1>sx2) return 0;
+    ylo=Min(y1,y2);
+    yhi=Max(y1,y2);
+  } else
+  {
+    int32_t xa=Max(sx1,Min(x1,x2)),xb=Min(sx2,Max(x1,x2));
+    if (xa>xb) return 0;
+    int32_t ya=y1+(xa-x1)*(y2-y1)/(x2-x1),
+            yb=y1+(xb-x1)*(y2-y1)/(x2-x1);
+    ylo=Min(ya,yb)-1;     // allow for the rounding of the divisions
+    yhi=Max(ya,yb)+1;
+  }
+  row1=(ylo-1)/th-1;
+  row2=(yhi+1)/th;
+  return 1;
+}
+
 void level::foreground_intersect(int32_t x1, int32_t y1, int32_t &x2, int32_t &y2)
 {
 /*  if (x1==x2)
@@ -2611,7 +2778,7 @@ void level::foreground_intersect(int32_t x1, int32_t y1, int32_t &x2, int32_t &y
     j,
     xp1,yp1,xp2,yp2,    // starting and ending points of block line segment
     swap;               // temp var
-  int32_t blockx1,blocky1,blockx2,blocky2,block,bx,by;
+  int32_t blockx1,blocky1,blockx2,blocky2,block,bx,by,row1,row2;
   point_list *block_list;
   unsigned char *bdat;
 
@@ -2634,14 +2801,29 @@ void level::foreground_intersect(int32_t x1, int32_t y1, int32_t &x2, int32_t &y
 
   if ((blockx1>blockx2) || (blocky1>blocky2)) return ;
 
-  // now check all the map positions this line could intersect
+  // Tiles past the map are BLACK and have no points
+  blockx2=Min(blockx2,foreground_width()-1);
+  blocky2=Min(blocky2,foreground_height()-1);
+
+  // Walk the columns of the box in the same order as always, since each
+  // setback starts from the previous one, but only check the tiles the ray
+  // still passes through. Every hit shortens it, so the rows are found
+  // again after one and the walk ends once the ray is behind us.
   for (bx=blockx1; bx<=blockx2; bx++)
   {
-    for (by=blocky1; by<=blocky2; by++)
+    if (!ray_rows(x1,y1,x2,y2,bx*tl-1,bx*tl+tl+1,th,row1,row2))
+    {
+      if (bx*tl-1>Max(x1,x2)) break;
+      continue;
+    }
+
+    for (by=Max(blocky1,row1); by<=Min(blocky2,row2); by++)
     {
       block=the_game->GetMapFg(ivec2(bx, by));
       if (block>BLACK)        // don't check BLACK, should be no points in it
       {
+        int32_t hitx2=x2,hity2=y2;
+
         // now check the all the line segments in the block
         foretile *f=the_game->get_fg(block);
         block_list=f->points;
@@ -2674,6 +2856,13 @@ void level::foreground_intersect(int32_t x1, int32_t y1, int32_t &x2, int32_t &y
       }
 
         }
+
+        if (hitx2!=x2 || hity2!=y2)
+        {
+          if (!ray_rows(x1,y1,x2,y2,bx*tl-1,bx*tl+tl+1,th,row1,row2))
+            break;
+          by=Max(by,row1-1);
+        }
       }
     }
   }
@@ -3241,6 +3430,377 @@ object_node *level::make_not_list(object_node *list)
   return f;
 }
 
+// Rollback snapshots.  Objects and lights are saved along with their
+// address so that restoring reuses the ones still alive (lisp code and
+// views hold on to them), and only what was created or deleted since the
+// save gets replaced.  Links between objects are saved as list indices.
+
+struct snap_ptr
+{
+  void *ptr;
+  int32_t index;
+};
+
+static snap_ptr *snap_objs=NULL,*snap_lights=NULL;
+static int snap_objs_size=0,snap_lights_size=0;
+static game_object **snap_obj_list=NULL;
+static int snap_obj_list_size=0;
+static light_source **snap_light_list=NULL;
+static int snap_light_list_size=0;
+
+#define SNAP_VIEW_FIELDS(F) \
+  F(suggest) F(god) F(_tint) F(_team) F(draw_solid) F(current_weapon) \
+  F(x_suggestion) F(y_suggestion) F(b1_suggestion) F(b2_suggestion) \
+  F(b3_suggestion) F(b4_suggestion) F(pointer_x) F(pointer_y) F(freeze_time) \
+  F(ambient) F(pan_x) F(pan_y) F(no_xleft) F(no_xright) F(no_ytop) \
+  F(no_ybottom) F(view_percent) F(last_left) F(last_right) F(last_up) \
+  F(last_down) F(last_b1) F(last_b2) F(last_b3) F(last_b4) F(last_hp) \
+  F(last_ammo) F(last_type) F(secrets) F(kills) F(tsecrets) F(tkills) \
+  F(m_aa) F(m_bb) F(m_shift) F(m_lastpos) F(m_lastlastpos) F(m_keymap) \
+  F(m_chat_buf)
+
+#define SNAP_AREA_FIELDS(F) \
+  F(x) F(y) F(w) F(h) F(active) F(ambient) F(view_xoff) F(view_yoff) \
+  F(ambient_speed) F(view_xoff_speed) F(view_yoff_speed)
+
+static void snap_put(level_snapshot *s, void const *p, int n)
+{
+  if (s->size+n>s->alloc)
+  {
+    s->alloc=Max(s->alloc*2,s->size+n+4096);
+    s->data=(uint8_t *)realloc(s->data,s->alloc);
+  }
+  memcpy(s->data+s->size,p,n);
+  s->size+=n;
+}
+
+static void snap_get(uint8_t const *&p, void *dst, int n)
+{
+  memcpy(dst,p,n);
+  p+=n;
+}
+
+static int snap_ptr_cmp(void const *a, void const *b)
+{
+  uintptr_t x=(uintptr_t)((snap_ptr const *)a)->ptr;
+  uintptr_t y=(uintptr_t)((snap_ptr const *)b)->ptr;
+  return x<y ? -1 : x>y;
+}
+
+static snap_ptr *snap_find(snap_ptr *list, int total, void *ptr)
+{
+  snap_ptr key={ ptr, 0 };
+  return (snap_ptr *)bsearch(&key,list,total,sizeof(snap_ptr),snap_ptr_cmp);
+}
+
+template<class T> static T *snap_grow(T *list, int &size, int need)
+{
+  if (need>size)
+  {
+    size=need+need/2+16;
+    list=(T *)realloc(list,size*sizeof(T));
+  }
+  return list;
+}
+
+// sorts the addresses of the current objects and lights for snap_find
+static int snap_index_objects(game_object *first)
+{
+  int total=0;
+  for (game_object *o=first; o; o=o->next) total++;
+  snap_objs=snap_grow(snap_objs,snap_objs_size,total);
+  total=0;
+  for (game_object *o=first; o; o=o->next,total++)
+  {
+    snap_objs[total].ptr=o;
+    snap_objs[total].index=total;
+  }
+  qsort(snap_objs,total,sizeof(snap_ptr),snap_ptr_cmp);
+  return total;
+}
+
+static int snap_index_lights()
+{
+  int total=0;
+  for (light_source *l=first_light_source; l; l=l->next) total++;
+  snap_lights=snap_grow(snap_lights,snap_lights_size,total);
+  total=0;
+  for (light_source *l=first_light_source; l; l=l->next,total++)
+  {
+    snap_lights[total].ptr=l;
+    snap_lights[total].index=total;
+  }
+  qsort(snap_lights,total,sizeof(snap_ptr),snap_ptr_cmp);
+  return total;
+}
+
+void level::save_snapshot(level_snapshot *s)
+{
+  level *me=this;
+  int32_t x;
+  s->size=0;
+
+  // everything load_snapshot() checks before it changes anything
+  snap_put(s,&me,sizeof(me));
+  x=0;
+  for (view *v=player_list; v; v=v->next) x++;
+  snap_put(s,&x,4);
+  for (view *v=player_list; v; v=v->next)
+    snap_put(s,&v->player_number,sizeof(v->player_number));
+  x=0;
+  for (area_controller *a=area_list; a; a=a->next) x++;
+  snap_put(s,&x,4);
+
+  snap_put(s,&ctick,sizeof(ctick));
+  snap_put(s,&rand_on,sizeof(rand_on));
+  snap_put(s,map_fg,fg_width*fg_height*sizeof(uint16_t));
+  snap_put(s,map_bg,bg_width*bg_height*sizeof(uint16_t));
+
+  int nlights=snap_index_lights();
+  snap_put(s,&nlights,4);
+  for (light_source *l=first_light_source; l; l=l->next)
+  {
+    snap_put(s,&l,sizeof(l));
+    snap_put(s,l,sizeof(*l));
+  }
+
+  int nobjs=snap_index_objects(first);
+  snap_put(s,&nobjs,4);
+  for (game_object *o=first; o; o=o->next)
+  {
+    snap_put(s,&o,sizeof(o));
+    snap_put(s,(simple_object *)o,sizeof(simple_object));
+    x=o->controller() ? o->controller()->player_number : -1;
+    snap_put(s,&x,4);
+    if (o->otype<0xffff && figures[o->otype]->tv)
+      snap_put(s,o->lvars,figures[o->otype]->tv*4);
+    for (int i=0; i<o->tobjs; i++)
+    {
+      snap_ptr *f=snap_find(snap_objs,nobjs,o->objs[i]);
+      x=f ? f->index : -1;
+      snap_put(s,&x,4);
+    }
+    for (int i=0; i<o->tlights; i++)
+    {
+      snap_ptr *f=snap_find(snap_lights,nlights,o->lights[i]);
+      x=f ? f->index : -1;
+      snap_put(s,&x,4);
+    }
+  }
+
+  for (view *v=player_list; v; v=v->next)
+  {
+    // -2 keeps a focus that is not in the object list
+    snap_ptr *f=v->m_focus ? snap_find(snap_objs,nobjs,v->m_focus) : NULL;
+    x=f ? f->index : v->m_focus ? -2 : -1;
+    snap_put(s,&x,4);
+#define F(name) snap_put(s,&v->name,sizeof(v->name));
+    SNAP_VIEW_FIELDS(F)
+#undef F
+    if (v->weapons)
+      snap_put(s,v->weapons,total_weapons*sizeof(int32_t));
+  }
+
+  for (area_controller *a=area_list; a; a=a->next)
+  {
+#define F(name) snap_put(s,&a->name,sizeof(a->name));
+    SNAP_AREA_FIELDS(F)
+#undef F
+  }
+}
+
+int level::load_snapshot(level_snapshot *s)
+{
+  uint8_t const *p=s->data;
+  level *owner;
+  int32_t x;
+
+  if (!s->size)
+    return 0;
+  snap_get(p,&owner,sizeof(owner));
+  if (owner!=this)
+    return 0;
+  snap_get(p,&x,4);
+  view *v=player_list;
+  for (; v && x; v=v->next,x--)
+  {
+    int pn;
+    snap_get(p,&pn,sizeof(pn));
+    if (pn!=v->player_number)
+      return 0;
+  }
+  if (v || x)
+    return 0;
+  snap_get(p,&x,4);
+  for (area_controller *a=area_list; a; a=a->next) x--;
+  if (x)
+    return 0;
+
+  snap_get(p,&ctick,sizeof(ctick));
+  snap_get(p,&rand_on,sizeof(rand_on));
+  int fg_size=fg_width*fg_height*sizeof(uint16_t);
+  int bg_size=bg_width*bg_height*sizeof(uint16_t);
+  if (memcmp(map_fg,p,fg_size) || memcmp(map_bg,p+fg_size,bg_size))
+  {
+    memcpy(map_fg,p,fg_size);
+    memcpy(map_bg,p+fg_size,bg_size);
+    level_tile_changes++;
+  }
+  p+=fg_size+bg_size;
+
+  // lights: reuse the live ones, index 1 marks them as kept
+  int nlive=snap_index_lights();
+  for (int i=0; i<nlive; i++)
+    snap_lights[i].index=0;
+  int32_t nlights;
+  snap_get(p,&nlights,4);
+  snap_light_list=snap_grow(snap_light_list,snap_light_list_size,nlights);
+  light_source *last_light=NULL;
+  for (int i=0; i<nlights; i++)
+  {
+    // placeholders, overwritten below; calc_range() divides by the
+    // difference of the radii
+    light_source *l,rec(0,0,0,0,1,0,0,NULL);
+    snap_get(p,&l,sizeof(l));
+    snap_get(p,&rec,sizeof(rec));
+    snap_ptr *f=snap_find(snap_lights,nlive,l);
+    if (f)
+      f->index=1;
+    else
+      l=new light_source(0,0,0,0,1,0,0,NULL);
+    *l=rec;
+    l->next=NULL;
+    if (last_light)
+      last_light->next=l;
+    else
+      first_light_source=l;
+    last_light=l;
+    snap_light_list[i]=l;
+  }
+  if (!last_light)
+    first_light_source=NULL;
+  for (int i=0; i<nlive; i++)
+    if (!snap_lights[i].index)
+    {
+      if (dev_cont)
+        dev_cont->notify_deleted_light((light_source *)snap_lights[i].ptr);
+      delete (light_source *)snap_lights[i].ptr;
+    }
+
+  // objects, same again; links are stored as indices until all exist
+  nlive=snap_index_objects(first);
+  for (int i=0; i<nlive; i++)
+    snap_objs[i].index=0;
+  int32_t nobjs;
+  snap_get(p,&nobjs,4);
+  snap_obj_list=snap_grow(snap_obj_list,snap_obj_list_size,nobjs);
+  first=last=NULL;
+  for (int i=0; i<nobjs; i++)
+  {
+    game_object *o;
+    simple_object rec;
+    snap_get(p,&o,sizeof(o));
+    snap_get(p,&rec,sizeof(rec));
+    int tv=rec.otype<0xffff ? figures[rec.otype]->tv : 0;
+    snap_ptr *f=snap_find(snap_objs,nlive,o);
+    morph_char *mc=NULL;
+    if (f)
+    {
+      f->index=1;
+      mc=o->mc;
+      if (o->tobjs) free(o->objs);
+      if (o->tlights) free(o->lights);
+      if (o->otype!=rec.otype)
+      {
+        free(o->lvars);
+        o->lvars=tv ? (int32_t *)malloc(tv*sizeof(int32_t)) : NULL;
+      }
+    } else
+      o=new game_object(rec.otype,1);
+    *(simple_object *)o=rec;
+    o->mc=mc;
+    o->link=NULL;
+    snap_get(p,&x,4);
+    v=player_list;
+    for (; v && v->player_number!=x; v=v->next);
+    o->Controller=v;
+    if (tv)
+      snap_get(p,o->lvars,tv*4);
+    o->objs=o->tobjs ? (game_object **)malloc(o->tobjs*sizeof(game_object *)) : NULL;
+    for (int j=0; j<o->tobjs; j++)
+    {
+      snap_get(p,&x,4);
+      o->objs[j]=(game_object *)(intptr_t)x;
+    }
+    o->lights=o->tlights ? (light_source **)malloc(o->tlights*sizeof(light_source *)) : NULL;
+    for (int j=0; j<o->tlights; j++)
+    {
+      snap_get(p,&x,4);
+      o->lights[j]=x>=0 && x<nlights ? snap_light_list[x] : NULL;
+    }
+
+    o->next=NULL;
+    if (last)
+      last->next=o;
+    else
+      first=o;
+    last=o;
+    snap_obj_list[i]=o;
+  }
+  total_objs=nobjs;
+  for (int i=0; i<nlive; i++)
+    if (!snap_objs[i].index)
+    {
+      game_object *o=(game_object *)snap_objs[i].ptr;
+      if (dev_cont)
+        dev_cont->notify_deleted_object(o);
+      delete o;
+    }
+
+  for (game_object *o=first; o; o=o->next)
+  {
+    int t=0;
+    for (int j=0; j<o->tobjs; j++)
+    {
+      intptr_t n=(intptr_t)o->objs[j];
+      if (n>=0 && n<nobjs)
+        o->objs[t++]=snap_obj_list[n];
+    }
+    o->tobjs=t;
+    t=0;
+    for (int j=0; j<o->tlights; j++)
+      if (o->lights[j])
+        o->lights[t++]=o->lights[j];
+    o->tlights=t;
+    if (!o->tobjs) { free(o->objs); o->objs=NULL; }
+    if (!o->tlights) { free(o->lights); o->lights=NULL; }
+  }
+
+  for (v=player_list; v; v=v->next)
+  {
+    snap_get(p,&x,4);
+    if (x>=0 && x<nobjs)
+      v->m_focus=snap_obj_list[x];
+    else if (x==-1)
+      v->m_focus=NULL;
+#define F(name) snap_get(p,&v->name,sizeof(v->name));
+    SNAP_VIEW_FIELDS(F)
+#undef F
+    if (v->weapons)
+      snap_get(p,v->weapons,total_weapons*sizeof(int32_t));
+  }
+
+  for (area_controller *a=area_list; a; a=a->next)
+  {
+#define F(name) snap_get(p,&a->name,sizeof(a->name));
+    SNAP_AREA_FIELDS(F)
+#undef F
+  }
+
+  unactivate_all();
+  return 1;
+}
+
 void level::write_object_info(char *filename)
 {
   FILE *fp=open_FILE(filename,"wb");
@@ -28,6 +28,12 @@
 #define ACTIVE_RIGHT (280+500)
 #define ACTIVE_TOP 200
 #define ACTIVE_BOTTOM (180+200)
+
+// objects are bucketed into square cells of this many pixels so activation
+// only has to look at the part of the level around each view.  objects whose
+// range is wider than a cell are kept on a separate list and always checked
+#define GRID_SHIFT 9
+#define GRID_SIZE (1<<GRID_SHIFT)
 #define fgvalue(y) ((y) & 0x3fff)
 #define above_tile(y) ((y) & 0x4000)
 #define bgvalue(y) (y)
@@ -43,7 +49,18 @@ class area_controller
 } ;
 
 extern int32_t last_tile_hit_x,last_tile_hit_y;
+extern int32_t level_tile_changes;   // bumped whenever map tiles may have changed
+extern int32_t collide_pairs,collide_candidates,collide_hits;  // from the last check_collisions
 extern int dev;
+
+// a copy of everything a level tick can change, kept by the rollback code
+// (see rollback.h) so a tick can be re-simulated with corrected input
+struct level_snapshot
+{
+  uint8_t *data;
+  int size,alloc;
+};
+
 class level        // contain map info and objects
 {
   uint16_t *map_fg,        // just big 2d arrays
@@ -72,6 +89,14 @@ class level        // contain map info and objects
   game_object **all_block_list;            // list of characters who can block a character or can be hurt
   int all_block_list_size,all_block_total;
   void add_all_block(game_object *who);
+
+  game_object **grid;                      // spatial index, one object list per GRID_SIZE cell
+  int grid_width,grid_height;
+  game_object *grid_big;                   // objects with a range bigger than a grid cell
+  game_object **grid_hits;                 // results of the last grid_query, in level order
+  int grid_hits_size;
+  void rebuild_grid();
+  int grid_query(int32_t x1, int32_t y1, int32_t x2, int32_t y2);
   uint32_t ctick;
 
 public :
@@ -80,7 +105,7 @@ public :
   void set_tick_counter(uint32_t x);
   area_controller *area_list;
 
-  void clear_active_list() { first_active=NULL; }
+  void clear_active_list();
   char *name() { return Name; }
   game_object *attacker(game_object *who);
   int is_attacker(game_object *who);
@@ -97,6 +122,7 @@ public :
   void load_fail();
   level(int width, int height, char const *name);
   int save(char const *filename, int save_all);  // save_all includes player and view information (1 = success)
+  int save(bFILE *fp);  // like save_all without the thumb nail, for sending a running game (1 = success)
   void set_name(char const *name) { Name=strcpy((char *)realloc(Name,strlen(name)+1),name); }
   void set_size(int w, int h);
   void remove_light(light_source *which);
@@ -124,8 +150,8 @@ public :
                       return *(map_bg+pos.x+pos.y*bg_width);
                                      else return 0;
                     }
-  void PutFg(ivec2 pos, uint16_t tile) { *(map_fg+pos.x+pos.y*fg_width)=tile; }
-  void PutBg(ivec2 pos, uint16_t tile) { *(map_bg+pos.x+pos.y*bg_width)=tile; }
+  void PutFg(ivec2 pos, uint16_t tile) { *(map_fg+pos.x+pos.y*fg_width)=tile; level_tile_changes++; }
+  void PutBg(ivec2 pos, uint16_t tile) { *(map_bg+pos.x+pos.y*bg_width)=tile; level_tile_changes++; }
   void draw_objects(view *v);
   void interpolate_draw_objects(view *v);
   void draw_areas(view *v);
@@ -145,6 +171,8 @@ public :
   void write_thumb_nail(bFILE *fp, image *im);
   void write_cache_prof_info();
   void restart();
+  void save_snapshot(level_snapshot *s);
+  int load_snapshot(level_snapshot *s);      // returns 0 if the snapshot no longer fits
 
 
   void unactivate_all();
@@ -189,6 +217,10 @@ public :
 
   bFILE *create_dir(char *filename, int save_all,
             object_node *save_list, object_node *exclude_list);
+  int write_dir(bFILE *fp, int save_all, int thumb,
+            object_node *save_list, object_node *exclude_list);
+  void write_contents(bFILE *fp, int save_all, int thumb,
+            object_node *save_list, object_node *exclude_list);
   view *make_view_list(int nplayers);
   int32_t total_light_links(object_node *list);
   int32_t total_object_links(object_node *save_list);
@@ -26,6 +26,8 @@
 #include "filter.h"
 #include "status.h"
 #include "dev.h"
+#include "workers.h"
+#include "trace.h"
 
 light_source *first_light_source=NULL;
 uint8_t *white_light,*white_light_initial,*green_light,*trans_table;
@@ -749,65 +751,85 @@ inline void put_8line(uint8_t *in_line, uint8_t *out_line, uint8_t *remap, uint8
 }
 
 
-void light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *light_lookup, uint16_t ambient)
+// The screen is lit in horizontal bands that start on light block rows,
+// so they can be done by different threads and the result does not
+// depend on how it was split.
+struct light_band_job
 {
-  int lx_run=0,ly_run;                     // light block x & y run size in pixels ==  (1<<lx_run)
-
-  if (shutdown_lighting && !disable_autolight)
-    ambient=shutdown_lighting_value;
-
-  switch (light_detail)
-  {
-    case HIGH_DETAIL :
-    { lx_run=2; ly_run=1; } break;       // 4 x 2 patches
-    case MEDIUM_DETAIL :
-    { lx_run=3; ly_run=2; } break;       // 8 x 4 patches  (default)
-    case LOW_DETAIL :
-    { lx_run=4; ly_run=3; } break;       // 16 x 8 patches
-    case POOR_DETAIL :                   // poor detail is no lighting
-    return ;
-  }
-  if ((int)ambient+ambient_ramp<0)
-    min_light_level=0;
-  else if ((int)ambient+ambient_ramp>63)
-    min_light_level=63;
-  else min_light_level=(int)ambient+ambient_ramp;
-
-  if (ambient==63) return ;
-  ivec2 caa, cbb;
-  sc->GetClip(caa, cbb);
-
-  light_patch *first = make_patch_list(cbb.x - caa.x, cbb.y - caa.y, screenx, screeny);
-
-  int prefix_x=(screenx&7);
-  int prefix=screenx&7;
-  if (prefix)
-    prefix=8-prefix;
-  int suffix_x = cbb.x - 1 - caa.x - (screenx & 7);
+  image *sc,*out;
+  int32_t screenx,screeny,out_x,out_y;
+  uint8_t *light_lookup;
+  ivec2 caa,cbb;
+  int prefix,prefix_x,suffix,suffix_x;
+  int32_t remap_size;
+  light_patch *first;
+  int top,band_h,bands;                // top is the first block row, may be above caa.y
+};
+
+static void setup_bands(light_band_job *j, int lx_run)
+{
+  j->first=make_patch_list(j->cbb.x-j->caa.x,j->cbb.y-j->caa.y,j->screenx,j->screeny);
+
+  j->prefix_x=(j->screenx&7);
+  j->prefix=j->screenx&7;
+  if (j->prefix)
+    j->prefix=8-j->prefix;
+  j->suffix_x=j->cbb.x-1-j->caa.x-(j->screenx&7);
+  j->suffix=(j->cbb.x-j->caa.x-j->prefix)&7;
+  j->remap_size=((j->cbb.x-j->caa.x-j->prefix-j->suffix)>>lx_run);
+
+  // bands of at least 32 rows, one per thread
+  j->top=j->caa.y-((j->screeny+j->caa.y)&3);
+  int rows=j->cbb.y-j->top;
+  j->bands=Max(1,Min(workers_total(),rows/32));
+  j->band_h=Max(4,((rows+j->bands-1)/j->bands+3)&~3);
+  j->bands=rows>0 ? (rows+j->band_h-1)/j->band_h : 0;
+}
 
-  int suffix = (cbb.x - caa.x - prefix) & 7;
+// Rows [y1, y2) of band, and the patches touching them in the same order
+// as the full list, so searches find the same patch
+static light_patch *band_patches(light_band_job *j, int band, int &y1, int &y2)
+{
+  y1=Max(j->caa.y,j->top+band*j->band_h);
+  y2=Min(j->cbb.y,j->top+(band+1)*j->band_h);
+  if (j->bands==1)
+    return j->first;
+
+  light_patch *ret=NULL,**last=&ret;
+  for (light_patch *p=j->first; p; p=p->next)
+    if (p->y1<=y2-1-j->caa.y && p->y2>=y1-j->caa.y)
+    {
+      *last=p->copy(NULL);
+      last=&(*last)->next;
+    }
+  return ret;
+}
 
-  int32_t remap_size=((cbb.x - caa.x - prefix - suffix)>>lx_run);
+static void light_band(void *data, int band)
+{
+  trace_zone tz("light band");
+  light_band_job *j=(light_band_job *)data;
+  int32_t screenx=j->screenx,screeny=j->screeny;
+  uint8_t *light_lookup=j->light_lookup;
+  ivec2 caa=j->caa,cbb=j->cbb;
+  int prefix=j->prefix,prefix_x=j->prefix_x,suffix=j->suffix,suffix_x=j->suffix_x;
+  int32_t remap_size=j->remap_size;
+  int y1,y2;
+  light_patch *f=band_patches(j,band,y1,y2);
 
   uint8_t *remap_line=(uint8_t *)malloc(remap_size);
 
-  light_patch *f=first;
-
-  main_screen->Lock();
+  int scr_w=j->sc->Size().x;
+  uint8_t *screen_line=j->sc->scan_line(y1)+caa.x;
 
-  int scr_w=main_screen->Size().x;
-  uint8_t *screen_line=main_screen->scan_line(caa.y)+caa.x;
-
-  for (int y = caa.y; y < cbb.y; )
+  for (int y = y1; y < y2; )
   {
     int x,count;
-//    while (f->next && f->y2<y)
-//      f=f->next;
     uint8_t *rem=remap_line;
 
     int todoy=4-((screeny+y)&3);
-    if (y + todoy >= cbb.y)
-      todoy = cbb.y - y;
+    if (y + todoy >= y2)
+      todoy = y2 - y;
 
     int calcy=((y+screeny)&(~3))-caa.y;
 
@@ -886,27 +908,20 @@ void light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *light_lo
 
     screen_line-=prefix;
   }
-  main_screen->Unlock();
 
-  while (first)
-  {
-    light_patch *p=first;
-    first=first->next;
-    delete p;
-  }
+  if (f!=j->first)
+    delete_patch_list(f);
   free(remap_line);
 }
 
-
-void double_light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *light_lookup, uint16_t ambient,
-             image *out, int32_t out_x, int32_t out_y)
+void light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *light_lookup, uint16_t ambient)
 {
-  if (sc->Size().x*2+out_x>out->Size().x ||
-      sc->Size().y*2+out_y>out->Size().y)
-    return ;   // screen was resized and small_render has not changed size yet
+  trace_zone tz("light_screen");
+  int lx_run=0,ly_run;                     // light block x & y run size in pixels ==  (1<<lx_run)
 
+  if (shutdown_lighting && !disable_autolight)
+    ambient=shutdown_lighting_value;
 
-  int lx_run=0,ly_run;                     // light block x & y run size in pixels ==  (1<<lx_run)
   switch (light_detail)
   {
     case HIGH_DETAIL :
@@ -924,65 +939,53 @@ void double_light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *l
     min_light_level=63;
   else min_light_level=(int)ambient+ambient_ramp;
 
-  ivec2 caa, cbb;
-  sc->GetClip(caa, cbb);
-
-
-  if (ambient==63)      // lights off, just double the pixels
-  {
-    uint8_t *src=sc->scan_line(0);
-    uint8_t *dst=out->scan_line(out_y+caa.y*2)+caa.x*2+out_x;
-    int d_skip=out->Size().x-sc->Size().x*2;
-    int x,y;
-    uint16_t v;
-    for (y=sc->Size().y; y; y--)
-    {
-      for (x=sc->Size().x; x; x--)
-      {
-    v=*(src++);
-    *(dst++)=v;
-    *(dst++)=v;
-      }
-      dst=dst+d_skip;
-      memcpy(dst,dst-out->Size().x,sc->Size().x*2);
-      dst+=out->Size().x;
-    }
-
-    return ;
-  }
+  if (ambient==63) return ;
 
-  light_patch *first = make_patch_list(cbb.x - caa.x, cbb.y - caa.y, screenx, screeny);
+  light_band_job j;
+  j.sc=main_screen; j.out=NULL;
+  j.screenx=screenx; j.screeny=screeny;
+  j.out_x=j.out_y=0;
+  j.light_lookup=light_lookup;
+  sc->GetClip(j.caa, j.cbb);
+  setup_bands(&j,lx_run);
 
-  int scr_w=sc->Size().x;
-  int dscr_w=out->Size().x;
+  main_screen->Lock();
+  workers_run(light_band,&j,j.bands);
+  main_screen->Unlock();
 
-  int prefix_x=(screenx&7);
-  int prefix=screenx&7;
-  if (prefix)
-    prefix=8-prefix;
-  int suffix_x = cbb.x - 1 - caa.x - (screenx & 7);
+  delete_patch_list(j.first);
+}
 
-  int suffix = (cbb.x - caa.x - prefix) & 7;
 
-  int32_t remap_size = ((cbb.x - caa.x - prefix - suffix)>>lx_run);
+static void double_light_band(void *data, int band)
+{
+  trace_zone tz("light band");
+  light_band_job *j=(light_band_job *)data;
+  int32_t screenx=j->screenx,screeny=j->screeny;
+  uint8_t *light_lookup=j->light_lookup;
+  ivec2 caa=j->caa,cbb=j->cbb;
+  int prefix=j->prefix,prefix_x=j->prefix_x,suffix=j->suffix,suffix_x=j->suffix_x;
+  int32_t remap_size=j->remap_size;
+  int y1,y2;
+  light_patch *f=band_patches(j,band,y1,y2);
+
+  int scr_w=j->sc->Size().x;
+  int dscr_w=j->out->Size().x;
 
   uint8_t *remap_line=(uint8_t *)malloc(remap_size);
 
-  light_patch *f=first;
-  uint8_t *in_line=sc->scan_line(caa.y)+caa.x;
-  uint8_t *out_line=out->scan_line(caa.y*2+out_y)+caa.x*2+out_x;
+  uint8_t *in_line=j->sc->scan_line(y1)+caa.x;
+  uint8_t *out_line=j->out->scan_line(y1*2+j->out_y)+caa.x*2+j->out_x;
 
 
-  for (int y = caa.y; y < cbb.y; )
+  for (int y = y1; y < y2; )
   {
     int x,count;
-//    while (f->next && f->y2<y)
-//      f=f->next;
     uint8_t *rem=remap_line;
 
     int todoy=4-((screeny+y)&3);
-    if (y + todoy >= cbb.y)
-      todoy = cbb.y - y;
+    if (y + todoy >= y2)
+      todoy = y2 - y;
 
     int calcy=((y+screeny)&(~3))-caa.y;
 
@@ -1098,18 +1101,77 @@ void double_light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *l
     out_line-=prefix*2;
   }
 
+  if (f!=j->first)
+    delete_patch_list(f);
+  free(remap_line);
+}
 
-  while (first)
+void double_light_screen(image *sc, int32_t screenx, int32_t screeny, uint8_t *light_lookup, uint16_t ambient,
+             image *out, int32_t out_x, int32_t out_y)
+{
+  trace_zone tz("double_light_screen");
+  if (sc->Size().x*2+out_x>out->Size().x ||
+      sc->Size().y*2+out_y>out->Size().y)
+    return ;   // screen was resized and small_render has not changed size yet
+
+
+  int lx_run=0,ly_run;                     // light block x & y run size in pixels ==  (1<<lx_run)
+  switch (light_detail)
   {
-    light_patch *p=first;
-    first=first->next;
-    delete p;
+    case HIGH_DETAIL :
+    { lx_run=2; ly_run=1; } break;       // 4 x 2 patches
+    case MEDIUM_DETAIL :
+    { lx_run=3; ly_run=2; } break;       // 8 x 4 patches  (default)
+    case LOW_DETAIL :
+    { lx_run=4; ly_run=3; } break;       // 16 x 8 patches
+    case POOR_DETAIL :                   // poor detail is no lighting
+    return ;
   }
-  free(remap_line);
-}
+  if ((int)ambient+ambient_ramp<0)
+    min_light_level=0;
+  else if ((int)ambient+ambient_ramp>63)
+    min_light_level=63;
+  else min_light_level=(int)ambient+ambient_ramp;
+
+  ivec2 caa, cbb;
+  sc->GetClip(caa, cbb);
+
+
+  if (ambient==63)      // lights off, just double the pixels
+  {
+    uint8_t *src=sc->scan_line(0);
+    uint8_t *dst=out->scan_line(out_y+caa.y*2)+caa.x*2+out_x;
+    int d_skip=out->Size().x-sc->Size().x*2;
+    int x,y;
+    uint16_t v;
+    for (y=sc->Size().y; y; y--)
+    {
+      for (x=sc->Size().x; x; x--)
+      {
+    v=*(src++);
+    *(dst++)=v;
+    *(dst++)=v;
+      }
+      dst=dst+d_skip;
+      memcpy(dst,dst-out->Size().x,sc->Size().x*2);
+      dst+=out->Size().x;
+    }
 
+    return ;
+  }
 
+  light_band_job j;
+  j.sc=sc; j.out=out;
+  j.screenx=screenx; j.screeny=screeny;
+  j.out_x=out_x; j.out_y=out_y;
+  j.light_lookup=light_lookup;
+  j.caa=caa; j.cbb=cbb;
+  setup_bands(&j,lx_run);
 
+  workers_run(double_light_band,&j,j.bands);
+
+  delete_patch_list(j.first);
+}
 
 void add_light_spec(spec_directory *sd, char const *level_name)
 {
@@ -24,6 +24,7 @@
 
 #include "lisp.h"
 #include "lisp_gc.h"
+#include "lisp_vm.h"
 #include "symbols.h"
 
 #include "status.h"
@@ -37,7 +38,7 @@
  * variables will reside in permanant space.  Eveything else will reside in
  * tmp space which gets thrown away after completion of eval.  system
  * functions reside in permant space. */
-LSpace LSpace::Tmp, LSpace::Perm, LSpace::Gc;
+LSpace LSpace::Tmp, LSpace::Perm, LSpace::Gc, LSpace::Nursery;
 
 /* Normally set to Tmp, unless compiling or other needs. */
 LSpace *LSpace::Current;
@@ -46,6 +47,9 @@ bFILE *current_print_file = NULL;
 
 LSymbol *LSymbol::root = NULL;
 size_t LSymbol::count = 0;
+size_t LSymbol::lookups = 0, LSymbol::probes = 0;
+LSymbol **LSymbol::m_table = NULL;
+size_t LSymbol::m_table_size = 0;
 
 int print_level = 0, trace_level = 0, trace_print_level = 1000;
 int total_user_functions;
@@ -169,7 +173,12 @@ void *LSpace::Mark()
 
 void LSpace::Restore(void *val)
 {
+    uint8_t *end = m_free;
     m_free = (uint8_t *)val;
+    // The objects above the mark are gone, so are their entries in the
+    // lists minor collections scan
+    if (this == &LSpace::Tmp && LSpace::Nursery.m_size)
+        Lisp::ForgetTmp(m_free, end);
 }
 
 size_t LSpace::GetFree()
@@ -183,10 +192,16 @@ void *LSpace::Alloc(size_t size)
     // Align allocation
     size = (size + sizeof(intptr_t) - 1) & ~(sizeof(intptr_t) - 1);
 
+    // Young permanent objects live in the nursery until promoted
+    if (this == &LSpace::Perm && size <= LSpace::Nursery.m_size)
+        return LSpace::Nursery.Alloc(size);
+
     // Collect garbage if necessary
     if (size > GetFree())
     {
-        if (this == &LSpace::Perm || this == &LSpace::Tmp)
+        if (this == &LSpace::Nursery)
+            Lisp::CollectNursery();
+        else if (this == &LSpace::Perm || this == &LSpace::Tmp)
             Lisp::CollectSpace(this, 0);
 
         if (size > GetFree())
@@ -228,6 +243,7 @@ LArray *LArray::Create(size_t len, void *rest)
     p->m_len = len;
     LObject **data = p->GetData();
     memset(data, 0, len * sizeof(LObject *));
+    Lisp::TmpBarrier(p);
     PtrRef r1(p);
 
     if (rest)
@@ -246,6 +262,7 @@ LArray *LArray::Create(size_t len, void *rest)
                     exit(0);
                 }
                 data[i] = (LObject *)CAR(x);
+                Lisp::WriteBarrier(p, data[i]);
             }
             if (x)
             {
@@ -260,6 +277,7 @@ LArray *LArray::Create(size_t len, void *rest)
             data = p->GetData();
             for (size_t i = 0; i < len; i++)
                 data[i] = (LObject *)x;
+            Lisp::WriteBarrier(p, x);
         }
         else
         {
@@ -349,6 +367,9 @@ LUserFunction *new_lisp_user_function(LList *arg_list, LList *block_list)
     lu->m_type = L_USER_FUNCTION;
     lu->arg_list = arg_list;
     lu->block_list = block_list;
+    lu->code = NULL;
+    lu->consts = NULL;
+    Lisp::TmpBarrier(lu);
     return lu;
 }
 
@@ -423,6 +444,7 @@ LList *LList::Create()
     c->m_type = L_CONS_CELL;
     c->m_car = NULL;
     c->m_cdr = NULL;
+    Lisp::TmpBarrier(c);
     return c;
 }
 
@@ -607,6 +629,27 @@ LObject *LArray::Get(int x)
     return m_data[x];
 }
 
+// Numbers are updated in place, object variables go through l_obj_set
+void *lisp_setq(void *sym, void *set_to)
+{
+    LSymbol *s = (LSymbol *)sym;
+    switch (item_type(s->m_value))
+    {
+    case L_NUMBER:
+        if (item_type(set_to) == L_NUMBER && s->m_value != l_undefined)
+            s->SetNumber(lnumber_value(set_to));
+        else
+            s->SetValue((LNumber *)set_to);
+        break;
+    case L_OBJECT_VAR:
+        l_obj_set(((LObjectVar *)s->m_value)->m_index, set_to);
+        break;
+    default:
+        s->SetValue((LObject *)set_to);
+    }
+    return s->m_value;
+}
+
 void *lisp_equal(void *n1, void *n2)
 {
     if(!n1 && !n2) // if both nil, then equal
@@ -781,7 +824,16 @@ LSymbol *make_find_symbol(char const *name)    // find a symbol, if it doesn't e
 
 */
 
-LSymbol *LSymbol::Find(char const *name)
+uint32_t LSymbol::Hash(char const *name)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+LSymbol *LSymbol::FindInTree(char const *name)
 {
     LSymbol *p = root;
     while (p)
@@ -794,18 +846,61 @@ LSymbol *LSymbol::Find(char const *name)
     return NULL;
 }
 
-LSymbol *LSymbol::FindOrCreate(char const *name)
+void LSymbol::AddToTable(LSymbol *sym)
 {
-    LSymbol *p = root;
-    LSymbol **parent = &root;
-    while (p)
+    // Keep the table at most half full, growing by powers of two
+    if ((count + 1) * 2 > m_table_size)
     {
-        int cmp = strcmp(name, p->m_name->GetString());
-        if (cmp == 0)
+        size_t old_size = m_table_size;
+        LSymbol **old_table = m_table;
+
+        m_table_size = old_size ? old_size * 2 : 1024;
+        m_table = (LSymbol **)calloc(m_table_size, sizeof(LSymbol *));
+        for (size_t i = 0; i < old_size; i++)
+            if (old_table[i])
+            {
+                size_t j = old_table[i]->m_hash & (m_table_size - 1);
+                while (m_table[j])
+                    j = (j + 1) & (m_table_size - 1);
+                m_table[j] = old_table[i];
+            }
+        free(old_table);
+    }
+
+    size_t j = sym->m_hash & (m_table_size - 1);
+    while (m_table[j])
+        j = (j + 1) & (m_table_size - 1);
+    m_table[j] = sym;
+}
+
+LSymbol *LSymbol::Find(char const *name)
+{
+    lookups++;
+    if (!m_table_size)
+        return NULL;
+
+    uint32_t h = Hash(name);
+    for (size_t j = h & (m_table_size - 1); m_table[j];
+         j = (j + 1) & (m_table_size - 1))
+    {
+        probes++;
+        LSymbol *p = m_table[j];
+        if (p->m_hash == h && !strcmp(name, p->m_name->GetString()))
             return p;
-        parent = (cmp < 0) ? &p->m_left : &p->m_right;
-        p = *parent;
     }
+    return NULL;
+}
+
+LSymbol *LSymbol::FindOrCreate(char const *name)
+{
+    LSymbol *p = Find(name);
+    if (p)
+        return p;
+
+    LSymbol **parent = &root;
+    for (p = root; p; p = *parent)
+        parent = (strcmp(name, p->m_name->GetString()) < 0) ? &p->m_left
+                                                             : &p->m_right;
 
     // Make sure all symbols get defined in permanant space
     LSpace *sp = LSpace::Current;
@@ -824,13 +919,56 @@ LSymbol *LSymbol::FindOrCreate(char const *name)
     p->time_taken = 0;
 #endif
     p->m_left = p->m_right = NULL;
+    p->m_hash = Hash(name);
     *parent = p;
+    AddToTable(p);
     count++;
 
     LSpace::Current = sp;
     return p;
 }
 
+static void CollectNames(LSymbol *root, char const **names, size_t &n)
+{
+    if (root)
+    {
+        CollectNames(root->m_left, names, n);
+        names[n++] = root->GetName()->GetString();
+        CollectNames(root->m_right, names, n);
+    }
+}
+
+// Look up every defined symbol by name through both the hash index and the
+// tree it indexes, and report how long each took.
+void LSymbol::Benchmark(int rounds)
+{
+    size_t n = 0;
+    char const **names = (char const **)malloc(count * sizeof(char const *));
+    CollectNames(root, names, n);
+
+    size_t old_lookups = lookups, old_probes = probes;
+    Timer t;
+    for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < n; i++)
+            if (Find(names[i]) == NULL)
+                dprintf("Lisp: symbol %s missing from hash index\n", names[i]);
+    float hash_ms = t.GetMs();
+    size_t bench_lookups = lookups - old_lookups;
+    size_t bench_probes = probes - old_probes;
+
+    t.GetMs();
+    for (int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < n; i++)
+            FindInTree(names[i]);
+    float tree_ms = t.GetMs();
+
+    dprintf("Lisp: %d symbols, %d lookups, %.2f probes per lookup\n",
+            (int)n, (int)bench_lookups,
+            bench_lookups ? (float)bench_probes / bench_lookups : 0.f);
+    dprintf("Lisp: hash index %.2f ms, tree %.2f ms\n", hash_ms, tree_ms);
+    free(names);
+}
+
 static void DeleteAllSymbols(LSymbol *root)
 {
     if (root)
@@ -921,6 +1059,21 @@ void *pairlis(void *list1, void *list2, void *list3)
 
 void LSymbol::SetFunction(LObject *function)
 {
+    switch (item_type(m_function))
+    {
+    case L_SYS_FUNCTION:
+    case L_C_FUNCTION:
+    case L_C_BOOL:
+    case L_L_FUNCTION:
+        if (m_function != function)
+            LBytecode::Redefined(this);
+        break;
+    case L_USER_FUNCTION:
+        // the old body may still be referenced, it gets interpreted
+        if (m_function != function)
+            LBytecode::Release((LUserFunction *)m_function);
+        break;
+    }
     m_function = function;
 }
 
@@ -1921,25 +2074,10 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
         PtrRef r1(set_to), r2(i);
         i = CAR(arg_list);
 
-        ltype x = item_type(set_to);
         switch (item_type(i))
         {
         case L_SYMBOL:
-            switch (item_type(((LSymbol *)i)->m_value))
-            {
-            case L_NUMBER:
-                if (x == L_NUMBER && ((LSymbol *)i)->m_value != l_undefined)
-                    ((LSymbol *)i)->SetNumber(lnumber_value(set_to));
-                else
-                    ((LSymbol *)i)->SetValue((LNumber *)set_to);
-                break;
-            case L_OBJECT_VAR:
-                l_obj_set(((LObjectVar *)(((LSymbol *)i)->m_value))->m_index, set_to);
-                break;
-            default:
-                ((LSymbol *)i)->SetValue((LObject *)set_to);
-            }
-            ret = ((LSymbol *)i)->m_value;
+            ret = (LObject *)lisp_setq(i, set_to);
             break;
         case L_CONS_CELL:   // this better be an 'aref'
         {
@@ -1955,6 +2093,7 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
                     exit(0);
                 }
                 ((LList *)car)->m_car = set_to;
+                Lisp::WriteBarrier(car, set_to);
             }
             else if (car == cdr_symbol)
             {
@@ -1966,6 +2105,7 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
                     exit(0);
                 }
                 ((LList *)car)->m_cdr = set_to;
+                Lisp::WriteBarrier(car, set_to);
             }
             else if (car != aref_symbol)
             {
@@ -1994,6 +2134,7 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
                 }
 #endif
                 a->GetData()[num] = set_to;
+                Lisp::WriteBarrier(a, set_to);
 #ifdef TYPE_CHECKING
             }
 #endif
@@ -2115,9 +2256,15 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
             exit(0);
         }
 #endif
+        // Compile first so the function is never older than its constants
+        LArray *consts = NULL;
+        PtrRef r2(consts);
+        uintptr_t *code = LBytecode::Compile((LList *)CDR(CDR(arg_list)), consts);
         LObject *block_list = CDR(CDR(arg_list));
 
         LUserFunction *ufun = new_lisp_user_function((LList *)lcar(lcdr(arg_list)), (LList *)block_list);
+        ufun->code = code;
+        ufun->consts = consts;
         symbol->SetFunction(ufun);
         ret = symbol;
         break;
@@ -2858,6 +3005,7 @@ LObject *LSysFunction::EvalFunction(LList *arg_list)
             }
             LObject *tmp = CAR(arg_list)->Eval();
             ((LList *)l1)->m_cdr = tmp;
+            Lisp::WriteBarrier(l1, tmp);
             arg_list = (LList *)CDR(arg_list);
         } while (arg_list);
         ret = first;
@@ -2965,6 +3113,7 @@ LObject *LSymbol::EvalUserFunction(LList *arg_list)
 #endif
 
     LUserFunction *fun = (LUserFunction *)m_function;
+    PtrRef r2(fun);
 
 #ifdef TYPE_CHECKING
     if (item_type(fun) != L_USER_FUNCTION)
@@ -3024,10 +3173,15 @@ LObject *LSymbol::EvalUserFunction(LList *arg_list)
     }
 
     // now evaluate the function block
-    while (block_list)
+    if (fun->code && LBytecode::enabled && !trace_level)
+        ret = LBytecode::Run(fun);
+    else
     {
-        ret = CAR(block_list)->Eval();
-        block_list = (LList *)CDR(block_list);
+        while (block_list)
+        {
+            ret = CAR(block_list)->Eval();
+            block_list = (LList *)CDR(block_list);
+        }
     }
 
     long cur_stack = stack_start;
@@ -3152,16 +3306,27 @@ void Lisp::Init()
 
 void Lisp::Uninit()
 {
+    LBytecode::Uninit();
+    LSpace::Nursery.Clear(); // nothing left worth promoting
+    SetNursery(0);
     free(LSpace::Tmp.m_data);
     free(LSpace::Perm.m_data);
     DeleteAllSymbols(LSymbol::root);
     LSymbol::root = NULL;
     LSymbol::count = 0;
+    free(LSymbol::m_table);
+    LSymbol::m_table = NULL;
+    LSymbol::m_table_size = 0;
 }
 
 void LSpace::Clear()
 {
     m_free = m_data;
+    if (this == &LSpace::Tmp)
+    {
+        Lisp::ForgetTmp();
+        Lisp::PruneRemembered();
+    }
 }
 
 LString *LSymbol::GetName()
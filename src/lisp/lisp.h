@@ -28,6 +28,7 @@ extern uint16_t atan_table[TBS];
 #define NILP(x) ((x)==NULL)
 #define DEFINEDP(x) ((x)!=l_undefined)
 class bFILE;
+struct LArray;
 extern bFILE *current_print_file;
 
 enum
@@ -62,7 +63,14 @@ struct LSpace
     void Restore(void *val);
     void Clear();
 
-    static LSpace Tmp, Perm, Gc;
+    inline bool Contains(void const *p)
+    {
+        return (uint8_t const *)p >= m_data && (uint8_t const *)p < m_free;
+    }
+
+    // When the nursery is enabled, small permanent allocations go there
+    // first and only survivors are promoted to Perm by a minor collection
+    static LSpace Tmp, Perm, Gc, Nursery;
     static LSpace *Current;
 
     uint8_t *m_data;
@@ -141,6 +149,7 @@ struct LSymbol : LObject
     /* Factories */
     static LSymbol *Find(char const *name);
     static LSymbol *FindOrCreate(char const *name);
+    static void Benchmark(int rounds);
 
     /* Methods */
     LObject *EvalFunction(void *arg_list);
@@ -162,10 +171,21 @@ struct LSymbol : LObject
     LObject *m_function;
     LString *m_name;
     LSymbol *m_left, *m_right; // tree structure
+    uint32_t m_hash;
 
     /* Static members */
     static LSymbol *root;
     static size_t count;
+    static size_t lookups, probes; // hash index statistics
+
+    static uint32_t Hash(char const *name);
+    static LSymbol *FindInTree(char const *name);
+    static void AddToTable(LSymbol *sym);
+
+    // Open addressed hash index over the tree, so lookups by name don't
+    // have to walk the (badly balanced) tree with strcmp at every node.
+    static LSymbol **m_table;
+    static size_t m_table_size;
 };
 
 struct LSysFunction : LObject
@@ -181,6 +201,10 @@ struct LSysFunction : LObject
 struct LUserFunction : LObject
 {
     LList *arg_list, *block_list;
+
+    // Bytecode for block_list (see lisp_vm.cpp), NULL if not compiled
+    uintptr_t *code;
+    LArray *consts;
 };
 
 struct LArray : LObject
@@ -240,12 +264,49 @@ public:
     // Collect temporary or permanent spaces
     static void CollectSpace(LSpace *which_space, int grow);
 
+    // Generational collection of permanent space, size 0 disables it
+    static void SetNursery(size_t size);
+    static void CollectNursery();
+
+    // Must be called when a pointer is stored into an existing object
+    static inline void WriteBarrier(void *container, void *value)
+    {
+        if (LSpace::Nursery.m_size && LSpace::Perm.Contains(container)
+             && (LSpace::Nursery.Contains(value)
+                  || LSpace::Tmp.Contains(value)))
+            Remember((LObject *)container);
+    }
+    static void Remember(LObject *container);
+    static void PruneRemembered();
+
+    // Must be called on every object that can hold pointers once it is
+    // created in temporary space, which minor collections do not traverse
+    static inline void TmpBarrier(void *x)
+    {
+        if (LSpace::Nursery.m_size && LSpace::Current == &LSpace::Tmp)
+            RememberTmp((LObject *)x);
+    }
+    static void RememberTmp(LObject *x);
+    static void ForgetTmp();
+    static void ForgetTmp(void const *start, void const *end);
+
+    // Garbage collection statistics: nursery and whole space collections,
+    // bytes copied and pause time of the last one, worst pause so far
+    static int gc_minor, gc_full;
+    static size_t gc_copied;
+    static float gc_last_ms, gc_max_ms;
+
 private:
     static LArray *CollectArray(LArray *x);
     static LList *CollectList(LList *x);
     static LObject *CollectObject(LObject *x);
     static void CollectSymbols(LSymbol *root);
     static void CollectStacks();
+    static void CollectFields(LObject *x);
+    static void CollectRemembered();
+    static void CollectTmp();
+    static void RememberStacks();
+    static void RememberRoot(LObject *x);
 };
 
 static inline LObject *&CAR(void *x) { return ((LList *)x)->m_car; }
@@ -283,6 +344,7 @@ LObject *lcdr(void *c);
 LObject *lcar(void *c);
 void *lisp_eq(void *n1, void *n2);
 void *lisp_equal(void *n1, void *n2);
+void *lisp_setq(void *sym, void *set_to);
 void *eval_block(void *list);
 void resize_tmp(size_t new_size);
 void resize_perm(size_t new_size);
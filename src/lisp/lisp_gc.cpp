@@ -19,6 +19,7 @@
 
 #include "lisp.h"
 #include "lisp_gc.h"
+#include "lisp_vm.h"
 
 #include "stack.h"
 
@@ -29,6 +30,14 @@
     functions
     names
       stack
+
+    With a nursery, small permanent objects are allocated there first and
+    a minor collection promotes the survivors to the end of permanent space.
+    Old objects are not traversed; the ones that were handed pointers to
+    young or temporary objects are remembered by Lisp::WriteBarrier().
+    Temporary space is not traversed either, so every temporary object
+    that can hold pointers is remembered by Lisp::TmpBarrier() until the
+    space is cleared.
 */
 
 // Stack where user programs can push data and have it GCed
@@ -40,17 +49,140 @@ GrowStack<void *> PtrRef::stack(1500);
 static size_t reg_ptr_total = 0;
 static void ***reg_ptr_list = NULL;
 
-static uint8_t *cstart, *cend, *collected_start, *collected_end;
+// Permanent objects that may point into the nursery or temporary space
+static LObject **remembered = NULL;
+static size_t remembered_total = 0, remembered_max = 0;
+
+// Temporary objects that can hold pointers, see Lisp::TmpBarrier()
+static LObject **tmp_objects = NULL;
+static size_t tmp_total = 0, tmp_max = 0;
+static bool tmp_copying = false; // a collection of temporary space is on
+
+static uint8_t *cstart, *cend, *nstart, *nend, *collected_start, *collected_end;
 static int gcdepth, maxgcdepth;
 
+int Lisp::gc_minor = 0, Lisp::gc_full = 0;
+size_t Lisp::gc_copied = 0;
+float Lisp::gc_last_ms = 0.0f, Lisp::gc_max_ms = 0.0f;
+
+static inline bool in_from_space(void *x)
+{
+    return ((uint8_t *)x >= cstart && (uint8_t *)x < cend)
+            || ((uint8_t *)x >= nstart && (uint8_t *)x < nend);
+}
+
+static inline bool is_young(void *x)
+{
+    return LSpace::Nursery.Contains(x) || LSpace::Tmp.Contains(x);
+}
+
+// Does this permanent object still need to be scanned by minor collections?
+static bool points_young(LObject *x)
+{
+    switch (item_type(x))
+    {
+    case L_CONS_CELL:
+        return is_young(CAR(x)) || is_young(CDR(x));
+    case L_1D_ARRAY:
+    {
+        LObject **data = ((LArray *)x)->GetData();
+        for (size_t i = 0; i < ((LArray *)x)->m_len; i++)
+            if (is_young(data[i]))
+                return true;
+        break;
+    }
+    }
+    return false;
+}
+
+static int remembered_compare(void const *a, void const *b)
+{
+    uintptr_t x = (uintptr_t)*(LObject * const *)a;
+    uintptr_t y = (uintptr_t)*(LObject * const *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+void Lisp::Remember(LObject *container)
+{
+    if (remembered_total && remembered[remembered_total - 1] == container)
+        return;
+
+    if (remembered_total == remembered_max)
+    {
+        remembered_max = Max(remembered_max * 2, (size_t)256);
+        remembered = (LObject **)realloc(remembered,
+                                         remembered_max * sizeof(LObject *));
+    }
+    remembered[remembered_total++] = container;
+}
+
+void Lisp::PruneRemembered()
+{
+    if (!remembered_total)
+        return;
+
+    qsort(remembered, remembered_total, sizeof(LObject *), remembered_compare);
+
+    size_t n = 0;
+    for (size_t i = 0; i < remembered_total; i++)
+    {
+        LObject *x = remembered[i];
+        if (n && remembered[n - 1] == x)
+            continue;
+        if (LSpace::Perm.Contains(x) && points_young(x))
+            remembered[n++] = x;
+    }
+    remembered_total = n;
+}
+
+void Lisp::RememberTmp(LObject *x)
+{
+    if (tmp_total == tmp_max)
+    {
+        tmp_max = Max(tmp_max * 2, (size_t)256);
+        tmp_objects = (LObject **)realloc(tmp_objects,
+                                          tmp_max * sizeof(LObject *));
+    }
+    tmp_objects[tmp_total++] = x;
+}
+
+void Lisp::ForgetTmp()
+{
+    tmp_total = 0;
+}
+
+// Temporary objects are remembered as they are created or copied, in
+// address order, so the ones in [start, end) are the last entries. The
+// remembered list only holds some while temporary space is collected.
+void Lisp::ForgetTmp(void const *start, void const *end)
+{
+    while (tmp_total && (void const *)tmp_objects[tmp_total - 1] >= start
+            && (void const *)tmp_objects[tmp_total - 1] < end)
+        tmp_total--;
+    while (remembered_total
+            && (void const *)remembered[remembered_total - 1] >= start
+            && (void const *)remembered[remembered_total - 1] < end)
+        remembered_total--;
+}
+
 LArray *Lisp::CollectArray(LArray *x)
 {
     size_t s = x->m_len;
     LArray *a = LArray::Create(s, NULL);
     LObject **src = x->GetData();
     LObject **dst = a->GetData();
+    bool tmp = false;
     for (size_t i = 0; i < s; i++)
+    {
         dst[i] = CollectObject(src[i]);
+        tmp = tmp || LSpace::Tmp.Contains(dst[i]);
+    }
+
+    // A promoted array still pointing to temporary space must be rescanned
+    if (tmp && LSpace::Nursery.m_size)
+        Remember(a);
+    if (tmp_copying)
+        RememberTmp(a);
 
     return a;
 }
@@ -59,9 +191,13 @@ LList *Lisp::CollectList(LList *x)
 {
     LList *prev = NULL, *first = NULL;
 
-    for (; x && item_type(x) == L_CONS_CELL; )
+    // Only copy the cells that lie in the space being collected; a shared
+    // tail elsewhere is left alone and handled by CollectObject()
+    for (; x && item_type(x) == L_CONS_CELL && in_from_space(x); )
     {
         LList *p = LList::Create();
+        if (tmp_copying)
+            RememberTmp(p);
         LObject *old_car = x->m_car;
         LObject *old_x = x;
         x = (LList *)CDR(x);
@@ -69,6 +205,8 @@ LList *Lisp::CollectList(LList *x)
         ((LRedirect *)old_x)->m_ref = p;
 
         p->m_car = CollectObject(old_car);
+        if (LSpace::Nursery.m_size && LSpace::Tmp.Contains(p->m_car))
+            Remember(p);
 
         if (prev)
             prev->m_cdr = p;
@@ -77,7 +215,11 @@ LList *Lisp::CollectList(LList *x)
         prev = p;
     }
     if (x)
+    {
         prev->m_cdr = CollectObject(x);
+        if (LSpace::Nursery.m_size && LSpace::Tmp.Contains(prev->m_cdr))
+            Remember(prev);
+    }
 
     return first; // we already set the collection pointers
 }
@@ -88,7 +230,7 @@ LObject *Lisp::CollectObject(LObject *x)
 
     maxgcdepth = Max(maxgcdepth, ++gcdepth);
 
-    if ((uint8_t *)x >= cstart && (uint8_t *)x < cend)
+    if (in_from_space(x))
     {
         switch (item_type(x))
         {
@@ -108,7 +250,13 @@ LObject *Lisp::CollectObject(LObject *x)
             LUserFunction *fun = (LUserFunction *)x;
             LList *arg = (LList *)CollectObject(fun->arg_list);
             LList *block = (LList *)CollectObject(fun->block_list);
+            LArray *consts = (LArray *)CollectObject(fun->consts);
+            uintptr_t *code = fun->code;
             ret = new_lisp_user_function(arg, block);
+            ((LUserFunction *)ret)->code = code;
+            ((LUserFunction *)ret)->consts = consts;
+            if (tmp_copying)
+                RememberTmp(ret);
             break;
         }
         case L_STRING:
@@ -189,12 +337,84 @@ void Lisp::CollectSymbols(LSymbol *root)
     CollectSymbols(root->m_right);
 }
 
+void Lisp::CollectFields(LObject *x)
+{
+    switch (item_type(x))
+    {
+    case L_CONS_CELL:
+        CAR(x) = CollectObject(CAR(x));
+        CDR(x) = CollectObject(CDR(x));
+        break;
+    case L_1D_ARRAY:
+    {
+        LObject **data = ((LArray *)x)->GetData();
+        for (size_t j = 0; j < ((LArray *)x)->m_len; j++)
+            data[j] = CollectObject(data[j]);
+        break;
+    }
+    case L_USER_FUNCTION:
+    {
+        LUserFunction *fun = (LUserFunction *)x;
+        fun->arg_list = (LList *)CollectObject(fun->arg_list);
+        fun->block_list = (LList *)CollectObject(fun->block_list);
+        fun->consts = (LArray *)CollectObject(fun->consts);
+        break;
+    }
+    }
+}
+
+void Lisp::CollectRemembered()
+{
+    // Entries may be appended while we scan, so index the array every time
+    for (size_t i = 0; i < remembered_total; i++)
+        CollectFields(remembered[i]);
+}
+
+void Lisp::CollectTmp()
+{
+    for (size_t i = 0; i < tmp_total; i++)
+        CollectFields(tmp_objects[i]);
+}
+
+// C code may hold a permanent object across a collection and then store
+// freshly allocated objects into it without a write barrier, so anything
+// the stacks point to is remembered until the next collection.
+void Lisp::RememberStacks()
+{
+    void **d = l_user_stack.sdata;
+    for (size_t i = 0; i < l_user_stack.m_size; i++, d++)
+        RememberRoot((LObject *)*d);
+
+    d = LBytecode::stack.sdata;
+    for (size_t i = 0; i < LBytecode::stack.m_size; i++, d++)
+        RememberRoot((LObject *)*d);
+
+    void ***d2 = PtrRef::stack.sdata;
+    for (size_t i = 0; i < PtrRef::stack.m_size; i++, d2++)
+        RememberRoot((LObject *)**d2);
+
+    void ***d3 = reg_ptr_list;
+    for (size_t i = 0; i < reg_ptr_total; i++, d3++)
+        RememberRoot((LObject *)**d3);
+}
+
+void Lisp::RememberRoot(LObject *x)
+{
+    if (LSpace::Perm.Contains(x) && (item_type(x) == L_CONS_CELL
+                                      || item_type(x) == L_1D_ARRAY))
+        Remember(x);
+}
+
 void Lisp::CollectStacks()
 {
     void **d = l_user_stack.sdata;
     for (size_t i = 0; i < l_user_stack.m_size; i++, d++)
         *d = CollectObject((LObject *)*d);
 
+    d = LBytecode::stack.sdata;
+    for (size_t i = 0; i < LBytecode::stack.m_size; i++, d++)
+        *d = CollectObject((LObject *)*d);
+
     void ***d2 = PtrRef::stack.sdata;
     for (size_t i = 0; i < PtrRef::stack.m_size; i++, d2++)
     {
@@ -213,12 +433,25 @@ void Lisp::CollectStacks()
 void Lisp::CollectSpace(LSpace *which_space, int grow)
 {
     LSpace *sp = LSpace::Current;
+    Timer t;
 
     maxgcdepth = gcdepth = 0;
 
     cstart = which_space->m_data;
     cend = which_space->m_free;
     LSpace::Gc.m_size = which_space->m_size;
+
+    // A full collection of permanent space also empties the nursery, whose
+    // survivors may all need to fit in the new space.
+    bool full = which_space == &LSpace::Perm && LSpace::Nursery.m_size;
+    if (full)
+    {
+        nstart = LSpace::Nursery.m_data;
+        nend = LSpace::Nursery.m_free;
+        LSpace::Gc.m_size += nend - nstart;
+        remembered_total = 0;
+    }
+
     if (grow)
     {
         LSpace::Gc.m_size += which_space->m_size >> 1;
@@ -231,8 +464,18 @@ void Lisp::CollectSpace(LSpace *which_space, int grow)
     collected_start = new_data;
     collected_end = new_data + LSpace::Gc.m_size;
 
+    // Temporary objects are either roots or being moved, in which case
+    // the copies take their place
+    tmp_copying = which_space == &LSpace::Tmp && LSpace::Nursery.m_size;
+    if (tmp_copying)
+        tmp_total = 0;
+
+    CollectRemembered();
+    if (!tmp_copying)
+        CollectTmp();
     CollectSymbols(LSymbol::root);
     CollectStacks();
+    tmp_copying = false;
 
     free(which_space->m_data);
     which_space->m_data = new_data;
@@ -240,5 +483,91 @@ void Lisp::CollectSpace(LSpace *which_space, int grow)
     which_space->m_free = new_data + (LSpace::Gc.m_free - LSpace::Gc.m_data);
 
     LSpace::Current = sp;
+    nstart = nend = NULL;
+
+    if (full)
+        LSpace::Nursery.m_free = LSpace::Nursery.m_data;
+    if (LSpace::Nursery.m_size)
+    {
+        PruneRemembered();
+        if (full)
+            RememberStacks();
+    }
+
+    gc_full++;
+    gc_copied = LSpace::Gc.m_free - LSpace::Gc.m_data;
+    gc_last_ms = t.PollMs();
+    gc_max_ms = Max(gc_max_ms, gc_last_ms);
 }
 
+void Lisp::CollectNursery()
+{
+    size_t used = LSpace::Nursery.m_free - LSpace::Nursery.m_data;
+
+    // Promotion needs room for the whole nursery in the worst case
+    if (used > LSpace::Perm.GetFree())
+    {
+        CollectSpace(&LSpace::Perm, 0);
+        return;
+    }
+
+    LSpace *sp = LSpace::Current;
+    Timer t;
+
+    maxgcdepth = gcdepth = 0;
+
+    cstart = cend = NULL;
+    nstart = LSpace::Nursery.m_data;
+    nend = LSpace::Nursery.m_free;
+
+    // Survivors are copied right after the last permanent object
+    LSpace::Gc.m_data = LSpace::Gc.m_free = LSpace::Perm.m_free;
+    LSpace::Gc.m_size = LSpace::Perm.GetFree();
+    LSpace::Current = &LSpace::Gc;
+
+    collected_start = LSpace::Perm.m_data;
+    collected_end = LSpace::Perm.m_data + LSpace::Perm.m_size;
+
+    CollectRemembered();
+    CollectTmp();
+    CollectSymbols(LSymbol::root);
+    CollectStacks();
+
+    LSpace::Perm.m_free = LSpace::Gc.m_free;
+    LSpace::Nursery.m_free = LSpace::Nursery.m_data;
+
+    LSpace::Current = sp;
+    nstart = nend = NULL;
+
+    PruneRemembered();
+    RememberStacks();
+
+    gc_minor++;
+    gc_copied = LSpace::Gc.m_free - LSpace::Gc.m_data;
+    gc_last_ms = t.PollMs();
+    gc_max_ms = Max(gc_max_ms, gc_last_ms);
+}
+
+void Lisp::SetNursery(size_t size)
+{
+    size -= (size & 7);
+
+    if (LSpace::Nursery.m_free != LSpace::Nursery.m_data)
+        CollectNursery();
+
+    free(LSpace::Nursery.m_data);
+    LSpace::Nursery.m_data = LSpace::Nursery.m_free
+                           = size ? (uint8_t *)malloc(size) : NULL;
+    LSpace::Nursery.m_size = size;
+    LSpace::Nursery.m_name = "nursery space";
+
+    if (!size)
+    {
+        free(remembered);
+        remembered = NULL;
+        remembered_total = remembered_max = 0;
+        free(tmp_objects);
+        tmp_objects = NULL;
+        tmp_total = tmp_max = 0;
+    }
+}
@@ -0,0 +1,1008 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "lisp.h"
+#include "lisp_gc.h"
+#include "lisp_vm.h"
+
+#define SYS_FUNC_INDEX_ONLY
+#include "symbols.h"
+
+#include "dprint.h"
+
+/*  Bytecode for user functions
+
+    Each form leaves exactly one value on LBytecode::stack. Code is an
+    array of machine words: an opcode followed by its operands. Symbols are
+    never moved by the collector so they are stored directly in the code;
+    every other object goes through the function's consts array, which the
+    collector keeps up to date.
+
+    The first word is the offset of a NULL terminated list, after the
+    final OP_RETURN, of the builtins the code calls or inlines: those are
+    compiled for the function they had at the time, so redefining one
+    releases the code that depends on it, see LBytecode::Redefined().
+
+    The semantics are those of LObject::Eval(), including its quirks:
+    dynamic binding through the symbol values, setq updating numbers in
+    place, and, or and not returning T instead of their argument.
+*/
+
+enum
+{
+    OP_NIL,
+    OP_CONST,         // k
+    OP_SYMBOL,        // sym: push the symbol itself
+    OP_VAR,           // sym: push the symbol value
+    OP_POP,
+    OP_DUP,
+    OP_JUMP,          // target
+    OP_JUMP_NIL,      // target
+    OP_JUMP_NOT_NIL,  // target
+    OP_NOT,
+    OP_SETQ,          // sym
+    OP_SAVE,          // sym: push old value on l_user_stack for let
+    OP_SET,           // sym
+    OP_UNBIND,        // n, sym...
+    OP_ADD,           // n
+    OP_SUB,           // n
+    OP_MUL,           // n
+    OP_DIV,           // n
+    OP_BIT_AND,       // n
+    OP_BIT_OR,        // n
+    OP_BIT_XOR,       // n
+    OP_LIST,          // n
+    OP_GT,
+    OP_LT,
+    OP_GE,
+    OP_LE,
+    OP_EQ,
+    OP_EQUAL,
+    OP_EQ0,
+    OP_CAR,
+    OP_CDR,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+    OP_MOD,
+    OP_CONS,
+    OP_NTH,
+    OP_AREF,
+    OP_CALL_BEGIN,    // sym, n, k, target
+    OP_CALL,          // n
+    OP_CCALL,         // sym, n
+    OP_LCALL,         // sym, k
+    OP_SYSCALL,       // sym, k
+    OP_EVAL,          // k
+    OP_RETURN,
+};
+
+bool LBytecode::enabled = true;
+GrowStack<void> LBytecode::stack(2048);
+int LBytecode::functions = 0, LBytecode::fallbacks = 0;
+int LBytecode::released = 0, LBytecode::runs = 0;
+
+// Code released while Run() was active, see LBytecode::Release()
+static uintptr_t **retired = NULL;
+static int retired_count = 0, retired_max = 0;
+static int run_depth = 0;
+
+extern int trace_level;
+
+//
+// Compiler
+//
+
+struct LCompiler
+{
+    uintptr_t *code;
+    size_t len, size;
+    LArray *consts; // NULL while counting
+    size_t nconsts;
+    uintptr_t *deps; // builtins called or inlined, see Depend()
+    size_t ndeps, deps_size;
+
+    void Emit(uintptr_t x)
+    {
+        if (len == size)
+        {
+            size = Max(size * 2, (size_t)64);
+            code = (uintptr_t *)realloc(code, size * sizeof(uintptr_t));
+        }
+        code[len++] = x;
+    }
+
+    void EmitConst(LObject *x)
+    {
+        if (consts)
+        {
+            consts->GetData()[nconsts] = x;
+            Lisp::WriteBarrier(consts, x);
+        }
+        Emit(nconsts++);
+    }
+
+    // Jumps are emitted with a placeholder and patched once the target
+    // is known
+    size_t EmitJump(int op)
+    {
+        Emit(op);
+        Emit(0);
+        return len - 1;
+    }
+
+    void Patch(size_t at) { code[at] = len; }
+
+    void Depend(LSymbol *sym)
+    {
+        for (size_t i = 0; i < ndeps; i++)
+            if (deps[i] == (uintptr_t)sym)
+                return;
+        if (ndeps == deps_size)
+        {
+            deps_size = Max(deps_size * 2, (size_t)16);
+            deps = (uintptr_t *)realloc(deps, deps_size * sizeof(uintptr_t));
+        }
+        deps[ndeps++] = (uintptr_t)sym;
+    }
+
+    void Form(LObject *x);
+    void Block(LObject *list);
+    void Fallback(LObject *x);
+    bool Call(LObject *form);
+    bool SysCall(int fun_number, LObject *args, int n);
+    void Args(LObject *args);
+};
+
+// Number of elements of a proper list, -1 otherwise
+static int list_length(LObject *list)
+{
+    int n = 0;
+    for (; list; list = CDR(list), n++)
+        if (item_type(list) != L_CONS_CELL)
+            return -1;
+    return n;
+}
+
+// (* ...) evaluates its arguments twice, so only side-effect free ones
+// can be compiled
+static bool is_pure(LObject *x)
+{
+    if (item_type(x) != L_CONS_CELL || !x)
+        return true;
+
+    LSymbol *sym = (LSymbol *)CAR(x);
+    if (item_type(sym) != L_SYMBOL
+         || item_type(sym->m_function) != L_SYS_FUNCTION
+         || list_length(CDR(x)) < 0)
+        return false;
+
+    switch (((LSysFunction *)sym->m_function)->fun_number)
+    {
+    case SYS_FUNC_QUOTE:
+        return true;
+    case SYS_FUNC_PLUS:
+    case SYS_FUNC_MINUS:
+    case SYS_FUNC_TIMES:
+    case SYS_FUNC_CAR:
+    case SYS_FUNC_CDR:
+        for (LObject *l = CDR(x); l; l = CDR(l))
+            if (!is_pure(CAR(l)))
+                return false;
+        return true;
+    }
+    return false;
+}
+
+void LCompiler::Fallback(LObject *x)
+{
+    Emit(OP_EVAL);
+    EmitConst(x);
+    if (consts)
+        LBytecode::fallbacks++;
+}
+
+void LCompiler::Block(LObject *list)
+{
+    if (!list)
+        Emit(OP_NIL);
+    for (; list; list = CDR(list))
+    {
+        Form(CAR(list));
+        if (CDR(list))
+            Emit(OP_POP);
+    }
+}
+
+void LCompiler::Args(LObject *args)
+{
+    for (; args; args = CDR(args))
+        Form(CAR(args));
+}
+
+void LCompiler::Form(LObject *x)
+{
+    switch (item_type(x))
+    {
+    case L_CONS_CELL:
+        if (!x)
+            Emit(OP_NIL);
+        else if (!Call(x))
+            Fallback(x);
+        break;
+    case L_SYMBOL:
+        Emit(x == true_symbol ? OP_SYMBOL : OP_VAR);
+        Emit((uintptr_t)x);
+        break;
+    case L_CHARACTER:
+    case L_STRING:
+    case L_NUMBER:
+    case L_POINTER:
+    case L_FIXED_POINT:
+        Emit(OP_CONST);
+        EmitConst(x);
+        break;
+    default:
+        Fallback(x);
+        break;
+    }
+}
+
+bool LCompiler::Call(LObject *form)
+{
+    LSymbol *sym = (LSymbol *)CAR(form);
+    LObject *args = CDR(form);
+    int n = list_length(args);
+
+    if (item_type(sym) != L_SYMBOL || n < 0)
+        return false;
+
+    LObject *fun = sym->m_function;
+    ltype t = item_type(fun);
+
+    // Builtins check their argument count at run time, leave the error
+    // to the interpreter
+    if (t == L_SYS_FUNCTION || t == L_C_FUNCTION || t == L_C_BOOL
+         || t == L_L_FUNCTION)
+    {
+        LSysFunction *f = (LSysFunction *)fun;
+        if (f->min_args != -1 && (n < f->min_args
+                                   || (f->max_args != -1 && n > f->max_args)))
+            return false;
+        Depend(sym);
+    }
+
+    switch (t)
+    {
+    case L_SYS_FUNCTION:
+        if (!SysCall(((LSysFunction *)fun)->fun_number, args, n))
+        {
+            Emit(OP_SYSCALL);
+            Emit((uintptr_t)sym);
+            EmitConst(args);
+        }
+        return true;
+    case L_C_FUNCTION:
+    case L_C_BOOL:
+        Args(args);
+        Emit(OP_CCALL);
+        Emit((uintptr_t)sym);
+        Emit(n);
+        return true;
+    case L_L_FUNCTION:
+        Emit(OP_LCALL);
+        Emit((uintptr_t)sym);
+        EmitConst(args);
+        return true;
+    default:
+    {
+        // User functions may be defined or redefined later, so the call
+        // checks the callee and falls back to the interpreter if needed
+        Emit(OP_CALL_BEGIN);
+        Emit((uintptr_t)sym);
+        Emit(n);
+        EmitConst(form);
+        size_t skip = len;
+        Emit(0);
+        Args(args);
+        Emit(OP_CALL);
+        Emit(n);
+        Patch(skip);
+        return true;
+    }
+    }
+}
+
+bool LCompiler::SysCall(int fun_number, LObject *args, int n)
+{
+    switch (fun_number)
+    {
+    case SYS_FUNC_QUOTE:
+    {
+        LObject *x = CAR(args);
+        if (!x)
+            Emit(OP_NIL);
+        else if (item_type(x) == L_SYMBOL)
+        {
+            Emit(OP_SYMBOL);
+            Emit((uintptr_t)x);
+        }
+        else
+        {
+            Emit(OP_CONST);
+            EmitConst(x);
+        }
+        return true;
+    }
+    case SYS_FUNC_PROGN:
+        Block(args);
+        return true;
+    case SYS_FUNC_IF:
+    case SYS_FUNC_IF_1PROGN:
+    case SYS_FUNC_IF_2PROGN:
+    case SYS_FUNC_IF_12PROGN:
+    {
+        bool block1 = fun_number == SYS_FUNC_IF_1PROGN
+                       || fun_number == SYS_FUNC_IF_12PROGN;
+        bool block2 = fun_number == SYS_FUNC_IF_2PROGN
+                       || fun_number == SYS_FUNC_IF_12PROGN;
+        if (fun_number != SYS_FUNC_IF && n != 3)
+            return false;
+        if ((block1 && list_length(CAR(CDR(args))) < 0)
+             || (block2 && list_length(CAR(CDR(CDR(args)))) < 0))
+            return false;
+
+        Form(CAR(args));
+        size_t to_else = EmitJump(OP_JUMP_NIL);
+        if (block1)
+            Block(CAR(CDR(args)));
+        else
+            Form(CAR(CDR(args)));
+        size_t to_end = EmitJump(OP_JUMP);
+        Patch(to_else);
+        if (n < 3)
+            Emit(OP_NIL);
+        else if (block2)
+            Block(CAR(CDR(CDR(args))));
+        else
+            Form(CAR(CDR(CDR(args))));
+        Patch(to_end);
+        return true;
+    }
+    case SYS_FUNC_AND:
+    case SYS_FUNC_OR:
+    {
+        int op = fun_number == SYS_FUNC_AND ? OP_JUMP_NIL : OP_JUMP_NOT_NIL;
+        size_t *jumps = (size_t *)malloc(Max(n, 1) * sizeof(size_t));
+        int i = 0;
+        for (LObject *l = args; l; l = CDR(l))
+        {
+            Form(CAR(l));
+            jumps[i++] = EmitJump(op);
+        }
+        // Fall through means no argument short-circuited
+        Emit(fun_number == SYS_FUNC_AND ? OP_SYMBOL : OP_NIL);
+        if (fun_number == SYS_FUNC_AND)
+            Emit((uintptr_t)true_symbol);
+        size_t to_end = EmitJump(OP_JUMP);
+        for (i = 0; i < n; i++)
+            Patch(jumps[i]);
+        Emit(fun_number == SYS_FUNC_AND ? OP_NIL : OP_SYMBOL);
+        if (fun_number == SYS_FUNC_OR)
+            Emit((uintptr_t)true_symbol);
+        Patch(to_end);
+        free(jumps);
+        return true;
+    }
+    case SYS_FUNC_NOT:
+    case SYS_FUNC_NULL:
+        Form(CAR(args));
+        Emit(OP_NOT);
+        return true;
+    case SYS_FUNC_SETQ:
+    case SYS_FUNC_SETF:
+        if (item_type(CAR(args)) != L_SYMBOL)
+            return false;
+        Form(CAR(CDR(args)));
+        Emit(OP_SETQ);
+        Emit((uintptr_t)CAR(args));
+        return true;
+    case SYS_FUNC_LET:
+    {
+        LObject *vars = CAR(args);
+        int nvars = list_length(vars);
+        if (nvars < 0)
+            return false;
+        for (LObject *l = vars; l; l = CDR(l))
+            if (!CAR(l) || item_type(CAR(l)) != L_CONS_CELL
+                 || item_type(CAR(CAR(l))) != L_SYMBOL
+                 || !CDR(CAR(l)) || item_type(CDR(CAR(l))) != L_CONS_CELL)
+                return false;
+
+        for (LObject *l = vars; l; l = CDR(l))
+        {
+            Emit(OP_SAVE);
+            Emit((uintptr_t)CAR(CAR(l)));
+            Form(CAR(CDR(CAR(l))));
+            Emit(OP_SET);
+            Emit((uintptr_t)CAR(CAR(l)));
+        }
+        Block(CDR(args));
+        Emit(OP_UNBIND);
+        Emit(nvars);
+        for (LObject *l = vars; l; l = CDR(l))
+            Emit((uintptr_t)CAR(CAR(l)));
+        return true;
+    }
+    case SYS_FUNC_SELECT:
+    {
+        for (LObject *l = CDR(args); l; l = CDR(l))
+            if (!CAR(l) || item_type(CAR(l)) != L_CONS_CELL
+                 || list_length(CAR(l)) < 0)
+                return false;
+
+        // The selector stays on the stack while the keys are compared
+        Form(CAR(args));
+        size_t nclauses = list_length(CDR(args));
+        size_t *ends = (size_t *)malloc(Max(nclauses, (size_t)1)
+                                        * sizeof(size_t));
+        int i = 0;
+        for (LObject *l = CDR(args); l; l = CDR(l))
+        {
+            Emit(OP_DUP);
+            Form(CAR(CAR(l)));
+            Emit(OP_EQUAL);
+            size_t next = EmitJump(OP_JUMP_NIL);
+            Emit(OP_POP);
+            Block(CDR(CAR(l)));
+            ends[i++] = EmitJump(OP_JUMP);
+            Patch(next);
+        }
+        Emit(OP_POP);
+        Emit(OP_NIL);
+        for (i = 0; i < (int)nclauses; i++)
+            Patch(ends[i]);
+        free(ends);
+        return true;
+    }
+    case SYS_FUNC_TIMES:
+        if (n < 1)
+            return false;
+        for (LObject *l = args; l; l = CDR(l))
+            if (!is_pure(CAR(l)))
+                return false;
+        Args(args);
+        Emit(OP_MUL);
+        Emit(n);
+        return true;
+    case SYS_FUNC_PLUS:
+    case SYS_FUNC_MINUS:
+    case SYS_FUNC_SLASH:
+    case SYS_FUNC_BIT_AND:
+    case SYS_FUNC_BIT_OR:
+    case SYS_FUNC_BIT_XOR:
+    case SYS_FUNC_LIST:
+        Args(args);
+        switch (fun_number)
+        {
+        case SYS_FUNC_PLUS: Emit(OP_ADD); break;
+        case SYS_FUNC_MINUS: Emit(OP_SUB); break;
+        case SYS_FUNC_SLASH: Emit(OP_DIV); break;
+        case SYS_FUNC_BIT_AND: Emit(OP_BIT_AND); break;
+        case SYS_FUNC_BIT_OR: Emit(OP_BIT_OR); break;
+        case SYS_FUNC_BIT_XOR: Emit(OP_BIT_XOR); break;
+        case SYS_FUNC_LIST: Emit(OP_LIST); break;
+        }
+        Emit(n);
+        return true;
+    case SYS_FUNC_AREF:
+        // The index is evaluated before the array
+        Form(CAR(CDR(args)));
+        Form(CAR(args));
+        Emit(OP_AREF);
+        return true;
+    case SYS_FUNC_GT: Args(args); Emit(OP_GT); return true;
+    case SYS_FUNC_LT: Args(args); Emit(OP_LT); return true;
+    case SYS_FUNC_GE: Args(args); Emit(OP_GE); return true;
+    case SYS_FUNC_LE: Args(args); Emit(OP_LE); return true;
+    case SYS_FUNC_EQ: Args(args); Emit(OP_EQ); return true;
+    case SYS_FUNC_EQUAL: Args(args); Emit(OP_EQUAL); return true;
+    case SYS_FUNC_EQ0: Args(args); Emit(OP_EQ0); return true;
+    case SYS_FUNC_CAR: Args(args); Emit(OP_CAR); return true;
+    case SYS_FUNC_CDR: Args(args); Emit(OP_CDR); return true;
+    case SYS_FUNC_ABS: Args(args); Emit(OP_ABS); return true;
+    case SYS_FUNC_MIN: Args(args); Emit(OP_MIN); return true;
+    case SYS_FUNC_MAX: Args(args); Emit(OP_MAX); return true;
+    case SYS_FUNC_MOD: Args(args); Emit(OP_MOD); return true;
+    case SYS_FUNC_CONS: Args(args); Emit(OP_CONS); return true;
+    case SYS_FUNC_NTH: Args(args); Emit(OP_NTH); return true;
+    }
+    return false;
+}
+
+uintptr_t *LBytecode::Compile(LList *block_list, LArray *&consts)
+{
+    consts = NULL;
+    if (!enabled)
+        return NULL;
+
+    PtrRef r1(block_list);
+
+    // First pass counts the constants, which must be allocated before
+    // the second pass stores them because allocating may move them
+    LCompiler c;
+    c.code = NULL;
+    c.len = c.size = 0;
+    c.consts = NULL;
+    c.nconsts = 0;
+    c.deps = NULL;
+    c.ndeps = c.deps_size = 0;
+    c.Emit(0);
+    c.Block(block_list);
+
+    if (c.nconsts)
+        c.consts = consts = LArray::Create(c.nconsts, NULL);
+    c.len = c.nconsts = c.ndeps = 0;
+    c.Emit(0);
+    c.Block(block_list);
+    c.Emit(OP_RETURN);
+
+    c.Patch(0);
+    for (size_t i = 0; i < c.ndeps; i++)
+        c.Emit(c.deps[i]);
+    c.Emit(0);
+    free(c.deps);
+
+    functions++;
+    return (uintptr_t *)realloc(c.code, c.len * sizeof(uintptr_t));
+}
+
+static void free_retired()
+{
+    for (int i = 0; i < retired_count; i++)
+        free(retired[i]);
+    retired_count = 0;
+}
+
+void LBytecode::Release(LUserFunction *fun)
+{
+    if (!fun->code)
+        return;
+    if (run_depth)
+    {
+        if (retired_count == retired_max)
+        {
+            retired_max = retired_max ? retired_max * 2 : 64;
+            retired = (uintptr_t **)realloc(retired,
+                                            sizeof(uintptr_t *) * retired_max);
+        }
+        retired[retired_count++] = fun->code;
+    }
+    else
+        free(fun->code);
+    fun->code = NULL;
+}
+
+static void release_all(LSymbol *root)
+{
+    if (!root)
+        return;
+    if (item_type(root->m_function) == L_USER_FUNCTION)
+        LBytecode::Release((LUserFunction *)root->m_function);
+    release_all(root->m_left);
+    release_all(root->m_right);
+}
+
+static void release_callers(LSymbol *root, LSymbol *sym)
+{
+    if (!root)
+        return;
+    if (item_type(root->m_function) == L_USER_FUNCTION)
+    {
+        LUserFunction *fun = (LUserFunction *)root->m_function;
+        if (fun->code)
+            for (uintptr_t const *d = fun->code + fun->code[0]; *d; d++)
+                if (*d == (uintptr_t)sym)
+                {
+                    LBytecode::Release(fun);
+                    LBytecode::released++;
+                    break;
+                }
+    }
+    release_callers(root->m_left, sym);
+    release_callers(root->m_right, sym);
+}
+
+void LBytecode::Redefined(LSymbol *sym)
+{
+    release_callers(LSymbol::root, sym);
+}
+
+void LBytecode::Uninit()
+{
+    release_all(LSymbol::root);
+    free_retired();
+    free(retired);
+    retired = NULL;
+    retired_max = 0;
+}
+
+//
+// Interpreter
+//
+
+#define TOP(n) ((LObject *)stack.sdata[stack.m_size - 1 - (n)])
+#define ARG(n, i) ((LObject *)stack.sdata[stack.m_size - (n) + (i)])
+
+static size_t arg_count(LUserFunction *fun)
+{
+    size_t n = 0;
+    for (LObject *a = fun->arg_list; a; a = CDR(a))
+        n++;
+    return n;
+}
+
+LObject *LBytecode::Run(LUserFunction *fun)
+{
+    PtrRef r1(fun);
+    uintptr_t const *code = fun->code;
+    uintptr_t const *pc = code + 1;
+    LObject *ret = NULL;
+    run_depth++;
+    runs++;
+
+    for (;;)
+    {
+        switch (*pc++)
+        {
+        case OP_NIL:
+            stack.push(NULL);
+            break;
+        case OP_CONST:
+            stack.push(fun->consts->GetData()[*pc++]);
+            break;
+        case OP_SYMBOL:
+            stack.push((void *)*pc++);
+            break;
+        case OP_VAR:
+        {
+            LObject *v = ((LSymbol *)*pc++)->m_value;
+            if (item_type(v) == L_OBJECT_VAR)
+                v = (LObject *)l_obj_get(((LObjectVar *)v)->m_index);
+            stack.push(v);
+            break;
+        }
+        case OP_POP:
+            stack.m_size--;
+            break;
+        case OP_DUP:
+            stack.push(TOP(0));
+            break;
+        case OP_JUMP:
+            pc = code + *pc;
+            break;
+        case OP_JUMP_NIL:
+            pc = stack.pop(1) ? pc + 1 : code + *pc;
+            break;
+        case OP_JUMP_NOT_NIL:
+            pc = stack.pop(1) ? code + *pc : pc + 1;
+            break;
+        case OP_NOT:
+            stack.sdata[stack.m_size - 1] = TOP(0) ? NULL : true_symbol;
+            break;
+        case OP_SETQ:
+            stack.sdata[stack.m_size - 1] = lisp_setq((LSymbol *)*pc++,
+                                                      TOP(0));
+            break;
+        case OP_SAVE:
+            l_user_stack.push(((LSymbol *)*pc++)->m_value);
+            break;
+        case OP_SET:
+            ((LSymbol *)*pc++)->SetValue((LObject *)stack.pop(1));
+            break;
+        case OP_UNBIND:
+        {
+            size_t n = *pc++;
+            size_t start = l_user_stack.m_size - n;
+            for (size_t i = 0; i < n; i++)
+                ((LSymbol *)*pc++)->SetValue((LObject *)l_user_stack.sdata[start + i]);
+            l_user_stack.m_size = start;
+            break;
+        }
+        case OP_ADD:
+        {
+            size_t n = *pc++;
+            int32_t sum = 0;
+            for (size_t i = 0; i < n; i++)
+                sum += lnumber_value(ARG(n, i));
+            stack.m_size -= n;
+            stack.push(LNumber::Create(sum));
+            break;
+        }
+        case OP_SUB:
+        {
+            size_t n = *pc++;
+            int32_t sub = lnumber_value(ARG(n, 0));
+            for (size_t i = 1; i < n; i++)
+                sub -= lnumber_value(ARG(n, i));
+            stack.m_size -= n;
+            stack.push(LNumber::Create(sub));
+            break;
+        }
+        case OP_MUL:
+        {
+            size_t n = *pc++;
+            int32_t prod;
+            if (item_type(ARG(n, 0)) == L_FIXED_POINT)
+            {
+                prod = 1 << 16;
+                for (size_t i = 0; i < n; i++)
+                    prod = (prod >> 8) * (lfixed_point_value(ARG(n, i)) >> 8);
+                stack.m_size -= n;
+                stack.push(LFixedPoint::Create(prod));
+            }
+            else
+            {
+                prod = 1;
+                for (size_t i = 0; i < n; i++)
+                    prod *= lnumber_value(ARG(n, i));
+                stack.m_size -= n;
+                stack.push(LNumber::Create(prod));
+            }
+            break;
+        }
+        case OP_DIV:
+        {
+            size_t n = *pc++;
+            int32_t quot = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                LObject *x = ARG(n, i);
+                if (item_type(x) != L_NUMBER)
+                {
+                    x->Print();
+                    lbreak("/ only defined for numbers, cannot divide ");
+                    exit(0);
+                }
+                else if (i == 0)
+                    quot = ((LNumber *)x)->m_num;
+                else
+                    quot /= ((LNumber *)x)->m_num;
+            }
+            stack.m_size -= n;
+            stack.push(LNumber::Create(quot));
+            break;
+        }
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        {
+            uintptr_t op = pc[-1];
+            size_t n = *pc++;
+            int32_t first = lnumber_value(ARG(n, 0));
+            for (size_t i = 1; i < n; i++)
+            {
+                int32_t x = lnumber_value(ARG(n, i));
+                first = op == OP_BIT_AND ? first & x
+                      : op == OP_BIT_OR ? first | x : first ^ x;
+            }
+            stack.m_size -= n;
+            stack.push(LNumber::Create(first));
+            break;
+        }
+        case OP_LIST:
+        {
+            size_t n = *pc++;
+            LList *first = NULL;
+            PtrRef r2(first);
+            for (size_t i = n; i--; )
+            {
+                LList *c = LList::Create();
+                c->m_car = ARG(n, i);
+                c->m_cdr = first;
+                first = c;
+            }
+            stack.m_size -= n;
+            stack.push(first);
+            break;
+        }
+        case OP_GT:
+        case OP_LT:
+        case OP_GE:
+        case OP_LE:
+        {
+            int32_t n1 = lnumber_value(TOP(1));
+            int32_t n2 = lnumber_value(TOP(0));
+            bool r = pc[-1] == OP_GT ? n1 > n2 : pc[-1] == OP_LT ? n1 < n2
+                   : pc[-1] == OP_GE ? n1 >= n2 : n1 <= n2;
+            stack.m_size -= 2;
+            stack.push(r ? true_symbol : NULL);
+            break;
+        }
+        case OP_EQ:
+            ret = (LObject *)lisp_eq(TOP(1), TOP(0));
+            stack.m_size -= 2;
+            stack.push(ret);
+            break;
+        case OP_EQUAL:
+            ret = (LObject *)lisp_equal(TOP(1), TOP(0));
+            stack.m_size -= 2;
+            stack.push(ret);
+            break;
+        case OP_EQ0:
+        {
+            LObject *v = TOP(0);
+            bool zero = item_type(v) == L_NUMBER && ((LNumber *)v)->m_num == 0;
+            stack.sdata[stack.m_size - 1] = zero ? true_symbol : NULL;
+            break;
+        }
+        case OP_CAR:
+            stack.sdata[stack.m_size - 1] = lcar(TOP(0));
+            break;
+        case OP_CDR:
+            stack.sdata[stack.m_size - 1] = lcdr(TOP(0));
+            break;
+        case OP_ABS:
+        {
+            int32_t x = abs(lnumber_value(TOP(0)));
+            stack.m_size--;
+            stack.push(LNumber::Create(x));
+            break;
+        }
+        case OP_MIN:
+        case OP_MAX:
+        {
+            int32_t x = lnumber_value(TOP(1));
+            int32_t y = lnumber_value(TOP(0));
+            int32_t r = pc[-1] == OP_MIN ? (x < y ? x : y) : (x > y ? x : y);
+            stack.m_size -= 2;
+            stack.push(LNumber::Create(r));
+            break;
+        }
+        case OP_MOD:
+        {
+            int32_t x = lnumber_value(TOP(1));
+            int32_t y = lnumber_value(TOP(0));
+            if (y == 0)
+            {
+                lbreak("mod: division by zero\n");
+                y = 1;
+            }
+            stack.m_size -= 2;
+            stack.push(LNumber::Create(x % y));
+            break;
+        }
+        case OP_CONS:
+        {
+            LList *c = LList::Create();
+            c->m_car = TOP(1);
+            c->m_cdr = TOP(0);
+            stack.m_size -= 2;
+            stack.push(c);
+            break;
+        }
+        case OP_NTH:
+            ret = (LObject *)nth(lnumber_value(TOP(1)), TOP(0));
+            stack.m_size -= 2;
+            stack.push(ret);
+            break;
+        case OP_AREF:
+            ret = ((LArray *)TOP(0))->Get(lnumber_value(TOP(1)));
+            stack.m_size -= 2;
+            stack.push(ret);
+            break;
+        case OP_CALL_BEGIN:
+        {
+            LSymbol *sym = (LSymbol *)pc[0];
+            LObject *f = sym->m_function;
+            if (!trace_level && item_type(f) == L_USER_FUNCTION
+                 && arg_count((LUserFunction *)f) == pc[1])
+            {
+                // Old values are saved before the arguments are evaluated
+                stack.push(f);
+                for (LObject *a = ((LUserFunction *)f)->arg_list; a; a = CDR(a))
+                    l_user_stack.push(((LSymbol *)CAR(a))->m_value);
+                pc += 4;
+            }
+            else
+            {
+                stack.push(fun->consts->GetData()[pc[2]]->Eval());
+                pc = code + pc[3];
+            }
+            break;
+        }
+        case OP_CALL:
+        {
+            size_t n = *pc++;
+            LUserFunction *f = (LUserFunction *)TOP(n);
+            long stack_start = l_user_stack.m_size - n;
+
+            size_t i = 0;
+            for (LObject *a = f->arg_list; a; a = CDR(a))
+                ((LSymbol *)CAR(a))->SetValue(ARG(n, i++));
+            stack.m_size -= n;
+
+            if (f->code && enabled && !trace_level)
+                ret = Run(f);
+            else
+                ret = (LObject *)eval_block(f->block_list);
+
+            // The function object may have moved during the call
+            f = (LUserFunction *)TOP(0);
+            i = stack_start;
+            for (LObject *a = f->arg_list; a; a = CDR(a))
+                ((LSymbol *)CAR(a))->SetValue((LObject *)l_user_stack.sdata[i++]);
+            l_user_stack.m_size = stack_start;
+
+            stack.sdata[stack.m_size - 1] = ret;
+            break;
+        }
+        case OP_CCALL:
+        {
+            LSysFunction *f = (LSysFunction *)((LSymbol *)*pc++)->m_function;
+            size_t n = *pc++;
+            int fun_number = f->fun_number;
+            ltype t = item_type(f);
+
+            LList *first = NULL;
+            PtrRef r2(first);
+            for (size_t i = n; i--; )
+            {
+                LList *c = LList::Create();
+                c->m_car = ARG(n, i);
+                c->m_cdr = first;
+                first = c;
+            }
+            stack.m_size -= n;
+
+            long r = c_caller(fun_number, first);
+            if (t == L_C_FUNCTION)
+                stack.push(LNumber::Create(r));
+            else
+                stack.push(r ? true_symbol : NULL);
+            break;
+        }
+        case OP_LCALL:
+        {
+            LSysFunction *f = (LSysFunction *)((LSymbol *)*pc++)->m_function;
+            LObject *args = fun->consts->GetData()[*pc++];
+            stack.push(l_caller(f->fun_number, args));
+            break;
+        }
+        case OP_SYSCALL:
+        {
+            LSysFunction *f = (LSysFunction *)((LSymbol *)*pc++)->m_function;
+            LObject *args = fun->consts->GetData()[*pc++];
+            stack.push(f->EvalFunction((LList *)args));
+            break;
+        }
+        case OP_EVAL:
+            stack.push(fun->consts->GetData()[*pc++]->Eval());
+            break;
+        case OP_RETURN:
+            if (!--run_depth)
+                free_retired();
+            return (LObject *)stack.pop(1);
+        default:
+            lbreak("bytecode: bad opcode %d\n", (int)pc[-1]);
+            exit(0);
+        }
+    }
+}
+
@@ -0,0 +1,53 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __LISP_VM_HPP_
+#define __LISP_VM_HPP_
+
+#include "lisp.h"
+#include "stack.h"
+
+// Stack machine running the bytecode of user functions. Forms the
+// compiler does not know about are kept as constants and handed back to
+// LObject::Eval(), so compiled and interpreted code can be mixed freely.
+class LBytecode
+{
+public:
+    // Compile a function body; consts receives the objects the code
+    // refers to, NULL is returned only when bytecode is disabled
+    static uintptr_t *Compile(LList *block_list, LArray *&consts);
+
+    // Run the body of fun, whose arguments are already bound
+    static LObject *Run(LUserFunction *fun);
+
+    // Builtins are called or inlined as they were at compile time, so
+    // redefining sym releases every function that depends on it
+    static void Redefined(LSymbol *sym);
+
+    // Frees the code of fun, which is interpreted from then on. Code that
+    // may still be running is only freed once the outermost Run() returns.
+    static void Release(LUserFunction *fun);
+
+    // Frees the code of every function, for Lisp::Uninit()
+    static void Uninit();
+
+    static bool enabled;
+
+    // Operand stack, scanned by the garbage collector
+    static GrowStack<void> stack;
+
+    // Statistics: compiled functions, forms left to the interpreter,
+    // functions released because a builtin they use was redefined, and
+    // calls that ran bytecode
+    static int functions, fallbacks, released, runs;
+};
+
+#endif
+
@@ -6,6 +6,8 @@
  *  domain software, no warranty is made or implied by Sam Hocevar.
  */
 
+/* lisp.cpp owns the table, other files only want the indices */
+#if !defined SYS_FUNC_INDEX_ONLY
 struct func
 {
     char const *name;
@@ -116,6 +118,7 @@ struct func sys_funcs[] =
     { "substr", 3, 3 }, /* 97 */
     { "local_load", 1, 1 }, /* 98 */
 };
+#endif
 
 enum sys_func_index
 {
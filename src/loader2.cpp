@@ -21,6 +21,7 @@
 #include "chars.h"
 #include "specs.h"
 #include "lisp.h"
+#include "lisp_vm.h"
 #include "jrand.h"
 #include "menu.h"
 #include "dev.h"
@@ -314,6 +315,17 @@ void load_data(int argc, char **argv)
     delete load;
 #endif
 
+  int lisp_bench=0, gc_nursery=0;
+  for (int i=1; i<argc; i++)
+  {
+    if (!strcmp(argv[i],"-lisp-bench"))
+      lisp_bench=1;
+    else if (!strcmp(argv[i],"-gc-nursery") && i+1<argc)
+      gc_nursery=atoi(argv[++i]);
+    else if (!strcmp(argv[i],"-no-bytecode"))
+      LBytecode::enabled=false;
+  }
+
   // don't let them specify a startup file we are connect elsewhere
   if (!net_start())
   {
@@ -348,14 +360,31 @@ void load_data(int argc, char **argv)
   snprintf(prog, sizeof(prog), "(load \"%s\")\n", lsf);
 
   cs=prog;
+  Timer lsf_timer;
+  size_t lsf_lookups=LSymbol::lookups;
   if (!LObject::Compile(cs)->Eval())
   {
     printf("unable to open file '%s'\n",lsf);
     exit(0);
   }
+  dprintf("Lisp: loaded %s in %.1f ms, %d symbol lookups\n", lsf,
+          lsf_timer.PollMs(), (int)(LSymbol::lookups-lsf_lookups));
+  if (LBytecode::enabled)
+    dprintf("Lisp: %d functions compiled to bytecode, %d forms left to the interpreter, %d released\n",
+            LBytecode::functions, LBytecode::fallbacks, LBytecode::released);
+  if (lisp_bench)
+    LSymbol::Benchmark(100);
   compiled_init();
   LSpace::Tmp.Clear();
 
+  // startup code stays in one block, only objects made later go through
+  // the nursery
+  if (gc_nursery>0)
+  {
+    Lisp::SetNursery((size_t)gc_nursery*1024);
+    dprintf("Lisp: %d KB nursery for permanent space\n", gc_nursery);
+  }
+
   dprintf("Engine : Registering base graphics\n");
   for (int z=0; z<=11; z++)
   {
@@ -0,0 +1,151 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+
+// A compressed stream is a list of sequences: a token byte (literal count
+// in the high nibble, match length - 4 in the low one, 15 meaning more
+// follows in 255 steps), the literals, then a 16 bit little endian match
+// offset. The last sequence stops after its literals.
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+
+static inline uint32_t lz_hash(uint8_t const *p)
+{
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_write_len(uint8_t *op, size_t n)
+{
+    for (n -= 15; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+static uint8_t *lz_literals(uint8_t *op, uint8_t const *src, size_t n,
+                            int match)
+{
+    *op++ = (uint8_t)(((n < 15 ? n : 15) << 4) | (match < 15 ? match : 15));
+    if (n >= 15)
+        op = lz_write_len(op, n);
+    memcpy(op, src, n);
+    return op + n;
+}
+
+size_t lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t lz_compress(uint8_t const *src, size_t len, uint8_t *dst)
+{
+    uint32_t *table = (uint32_t *)calloc(1 << LZ_HASH_BITS, sizeof(uint32_t));
+    uint8_t *op = dst;
+    size_t anchor = 0, i = 0;
+
+    while (len >= LZ_MIN_MATCH && i <= len - LZ_MIN_MATCH)
+    {
+        uint32_t h = lz_hash(src + i);
+        size_t cand = table[h];
+        table[h] = (uint32_t)i;
+
+        if (cand >= i || i - cand > 0xffff || memcmp(src + cand, src + i, LZ_MIN_MATCH))
+        {
+            i++;
+            continue;
+        }
+
+        size_t m = LZ_MIN_MATCH;
+        while (i + m < len && src[cand + m] == src[i + m])
+            m++;
+
+        op = lz_literals(op, src + anchor, i - anchor, (int)(m - LZ_MIN_MATCH));
+        *op++ = (uint8_t)(i - cand);
+        *op++ = (uint8_t)((i - cand) >> 8);
+        if (m - LZ_MIN_MATCH >= 15)
+            op = lz_write_len(op, m - LZ_MIN_MATCH);
+
+        i += m;
+        anchor = i;
+    }
+
+    op = lz_literals(op, src + anchor, len - anchor, 0);
+    free(table);
+    return op - dst;
+}
+
+// Reads the rest of a length whose nibble was 15, 0 on a truncated stream
+static int lz_read_len(uint8_t const *&ip, uint8_t const *iend, size_t &n)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= iend)
+            return 0;
+        b = *ip++;
+        n += b;
+    } while (b == 255);
+    return 1;
+}
+
+int lz_decompress(uint8_t const *src, size_t size, uint8_t *dst, size_t len)
+{
+    uint8_t const *ip = src, *iend = src + size;
+    uint8_t *op = dst, *oend = dst + len;
+
+    for (;;)
+    {
+        if (ip >= iend)
+            return 0;
+        uint8_t token = *ip++;
+
+        size_t n = token >> 4;
+        if (n == 15 && !lz_read_len(ip, iend, n))
+            return 0;
+        if (n > (size_t)(iend - ip) || n > (size_t)(oend - op))
+            return 0;
+        memcpy(op, ip, n);
+        ip += n;
+        op += n;
+
+        if (op == oend)
+            return ip == iend;
+
+        if (iend - ip < 2)
+            return 0;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst))
+            return 0;
+
+        n = token & 15;
+        if (n == 15 && !lz_read_len(ip, iend, n))
+            return 0;
+        n += LZ_MIN_MATCH;
+        if (n > (size_t)(oend - op))
+            return 0;
+
+        // the match may overlap what it is writing, copy byte by byte
+        uint8_t const *match = op - offset;
+        while (n--)
+            *op++ = *match++;
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __LZ_HPP_
+#define __LZ_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Small LZ77 byte compressor used for level snapshots sent over the net.
+// Level data is mostly runs of tile numbers and zeroed object fields, so
+// this gets most of what a real compressor would at a fraction of the code.
+
+// Worst case output size for len bytes of input
+size_t lz_bound(size_t len);
+
+// Returns the compressed size, dst must hold lz_bound(len) bytes
+size_t lz_compress(uint8_t const *src, size_t len, uint8_t *dst);
+
+// Returns 0 unless src decodes to exactly len bytes
+int lz_decompress(uint8_t const *src, size_t size, uint8_t *dst, size_t len);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef WIN32
+# include <WinSock2.h>
+# include <Windows.h>
+#undef CreateWindow
+#endif
+
+// SDL may need to override main()
+#include "SDL.h"
+
+#include "common.h"
+
+#include "dev.h"
+#include "game.h"
+
+#include "cache.h"
+#include "lisp.h"
+#include "jrand.h"
+#include "light.h"
+#include "dprint.h"
+#include "nfserver.h"
+#include "guistat.h"
+#include "compiled.h"
+#include "pmenu.h"
+#include "chat.h"
+#include "demo.h"
+#include "netcfg.h"
+#include "netface.h"
+#include "bench.h"
+#include "dedicated.h"
+#include "workers.h"
+#include "trace.h"
+#include "crc.h"
+#include "lol/timer.h"
+
+#if (defined(__APPLE__) && !defined(__MACH__))
+#include "tcpip.h"
+extern tcpip_protocol tcpip;
+#endif
+
+extern CrcManager *net_crcs;
+extern palette *old_pal;
+extern pmenu *dev_menu;
+
+void setup(int argc, char **argv);
+void show_end();
+
+int main(int argc, char *argv[])
+{
+    start_argc = argc;
+    start_argv = argv;
+
+    for (int i = 0; i < argc; i++)
+    {
+        // a dedicated server's console is never shown, print to the terminal
+        if (!strcmp(argv[i], "-cprint") || !strcmp(argv[i], "-dedicated"))
+            external_print = 1;
+    }
+
+#if (defined(__APPLE__) && !defined(__MACH__))
+    unsigned char km[16];
+
+    fprintf(stderr, "Mac Options: ");
+    xres = 320; yres = 200;
+    GetKeys((uint32_t*)&km);
+    if ((km[ 0x3a >>3] >> (0x3a & 7)) &1 != 0)
+    {
+        dev|=EDIT_MODE;
+        start_edit = 1;
+        start_running = 1;
+        disable_autolight = 1;
+        fprintf(stderr, "Edit Mode...");
+    }
+    if ((km[ 0x3b >>3] >> (0x3b & 7)) &1 != 0)
+    {
+        PixMult = 1;
+        fprintf(stderr, "Single Pixel...");
+    }
+    else
+    {
+        PixMult = 2;
+        fprintf(stderr, "Double Pixel...");
+    }
+    if ((km[ 0x38 >>3] >> (0x38 & 7)) &1 != 0)
+    {
+        xres *= 2;  yres *= 2;
+        fprintf(stderr, "Double Size...");
+    }
+    fprintf(stderr, "\n");
+
+    if (tcpip.installed())
+        fprintf(stderr, "Using %s\n", tcpip.name());
+#endif
+
+    set_dprinter(game_printer);
+    set_dgetter(game_getter);
+    set_no_space_handler(handle_no_space);
+
+    setup(argc, argv);
+
+    show_startup();
+
+    start_sound(argc, argv);
+
+    stat_man = new text_status_manager();
+
+#if !defined __CELLOS_LV2__
+    // look to see if we are supposed to fetch the data elsewhere
+    if (getenv("ABUSE_PATH"))
+        set_filename_prefix(getenv("ABUSE_PATH"));
+
+    // look to see if we are supposed to save the data elsewhere
+    if (getenv("ABUSE_SAVE_PATH"))
+        set_save_filename_prefix(getenv("ABUSE_SAVE_PATH"));
+#endif
+
+    jrand_init();
+    jrand(); // so compiler doesn't complain
+
+    set_spec_main_file("abuse.spe");
+    check_for_lisp(argc, argv);
+    bench_init(argc, argv);
+    trace_init(argc, argv);
+    dedicated_init(argc, argv);
+    workers_init(argc, argv);
+    cache.prefetch_init(argc, argv);
+    cache.budget_init(argc, argv);
+
+    do
+    {
+        if (main_net_cfg && !main_net_cfg->notify_reset())
+        {
+            sound_uninit();
+            exit(0);
+        }
+
+        game_net_init(argc, argv);
+        Lisp::Init();
+
+        dev_init(argc, argv);
+
+        Game *g = new Game(argc, argv);
+
+        dev_cont = new dev_controll();
+        dev_cont->load_stuff();
+
+        g->get_input(); // prime the net
+
+        for (int i = 1; i + 1 < argc; i++)
+        {
+            if (!strcmp(argv[i], "-server"))
+            {
+                if (!become_server(argv[i + 1]))
+                {
+                    dprintf("unable to become a server\n");
+                    exit(0);
+                }
+                break;
+            }
+        }
+
+        if (main_net_cfg)
+            wait_min_players();
+
+        if (bench_on && !bench_start())
+            exit(1);
+
+        net_send(1);
+        if (net_start())
+        {
+            g->step(); // process all the objects in the world
+            g->calc_speed();
+            g->update_screen(); // redraw the screen with any changes
+        }
+
+        while (!g->done())
+        {
+            if (dedicated_on)
+                dedicated_tick_start();
+
+            music_check();
+
+            if (req_end)
+            {
+                delete current_level; current_level = NULL;
+
+                show_end();
+
+                the_game->set_state(MENU_STATE);
+                req_end = 0;
+            }
+
+            if (demo_man.current_state() == demo_manager::NORMAL)
+                net_receive();
+
+            // see if a request for a level load was made during the last tick
+            if (req_name[0])
+            {
+                g->load_level(req_name);
+                req_name[0] = 0;
+                if (!dedicated_on)
+                    g->draw(g->state == SCENE_STATE);
+            }
+
+            //if (demo_man.current_state() != demo_manager::PLAYING)
+                g->get_input();
+
+            if (demo_man.current_state() == demo_manager::NORMAL)
+                net_send();
+            else
+                demo_man.do_inputs();
+
+            // stop before the main menu comes back when the demo ends
+            if (bench_on && bench_done())
+                break;
+
+            // nobody is there to pick from the menu once the game is over
+            if (dedicated_on && g->state == MENU_STATE)
+                break;
+
+            service_net_request();
+
+            // process all the objects in the world
+            g->step();
+            server_check();
+            if (dedicated_on)
+                dedicated_tick_end();
+            else if (!bench_on)
+                g->calc_speed();
+
+            // see if a request for a level load was made during the last tick
+            if (!req_name[0] && !dedicated_on)
+                g->update_screen(); // redraw the screen with any changes
+
+            if (bench_on)
+                bench_tick();
+        }
+
+        if (bench_on)
+            bench_report();
+        if (trace_on)
+            trace_write();
+        if (dedicated_on)
+            dedicated_report();
+
+        net_uninit();
+
+        if (net_crcs)
+            net_crcs->clean_up();
+        delete net_crcs; net_crcs = NULL;
+
+        delete chat;
+
+        Timer tmp; tmp.WaitMs(500);
+
+        delete small_render; small_render = NULL;
+
+        if (current_song)
+            current_song->stop();
+        delete current_song; current_song = NULL;
+
+        cache.empty();
+
+        delete dev_console; dev_console = NULL;
+        delete dev_menu; dev_menu = NULL;
+        delete g; g = NULL;
+        delete old_pal; old_pal = NULL;
+
+        compiled_uninit();
+        delete_all_lights();
+        free(white_light_initial);
+
+        for (int i = 0; i < TTINTS; i++)
+            free(tints[i]);
+
+        dev_cleanup();
+        delete dev_cont; dev_cont = NULL;
+        delete stat_man; stat_man = new text_status_manager();
+
+        if (!(main_net_cfg && main_net_cfg->restart_state()))
+        {
+            LSymbol *end_msg = LSymbol::FindOrCreate("end_msg");
+            if (DEFINEDP(end_msg->GetValue()))
+                printf("%s\n", lstring_value(end_msg->GetValue()));
+        }
+
+        Lisp::Uninit();
+
+        base->packet.packet_reset();
+    }
+    while (main_net_cfg && main_net_cfg->restart_state());
+
+    delete stat_man;
+    delete main_net_cfg; main_net_cfg = NULL;
+
+    set_filename_prefix(NULL);  // dealloc this mem if there was any
+    set_save_filename_prefix(NULL);
+
+    sound_uninit();
+
+    return 0;
+}
@@ -23,6 +23,9 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #ifdef WIN32
 # include <io.h>
 #endif
@@ -42,11 +45,30 @@ typedef unsigned short ushort;
 
 file_manager *fman=NULL;
 
+// requests and answers can come in split anywhere
+static int read_fully(net_socket *sock, void *buf, int32_t size)
+{
+  while (size)
+  {
+    int ret=sock->read(buf,size);
+    if (ret<=0) return 0;
+    buf=(void *)(((char *)buf)+ret);
+    size-=ret;
+  }
+  return 1;
+}
+
 file_manager::file_manager(int argc, char **argv, net_protocol *proto) : proto(proto)
 {
   default_fs=NULL;
   no_security=0;
   nfs_list=NULL;
+  remote_list=NULL;
+#ifdef SIGPIPE
+  // clients close files with streamed reads still on their way, which is
+  // a failed write for us and not a reason to quit
+  signal(SIGPIPE,SIG_IGN);
+#endif
 
   int i;
   for (i=1; i<argc; i++)
@@ -74,7 +96,7 @@ void file_manager::process_net()
     }
     else if (nc->size_to_read && nc->sock->ready_to_write())
       ok=nc->send_read();
-    else if (nc->sock->ready_to_read())
+    else if (!nc->size_to_read && nc->sock->ready_to_read())
       ok=process_nfs_command(nc);    // if we couldn't process the packet, delete the connection
 
     if (ok)
@@ -102,12 +124,33 @@ int file_manager::process_nfs_command(nfs_client *c)
     case NFCMD_READ :
     {
       int32_t size;
-      if (c->sock->read(&size,sizeof(size))!=sizeof(size)) return 0;
+      if (!read_fully(c->sock,&size,sizeof(size))) return 0;
       size=lltl(size);
 
       c->size_to_read=size;
+      c->raw=0;
       return c->send_read();
     } break;
+    case NFCMD_READ_BLOCK :
+    {
+      int32_t size;
+      if (!read_fully(c->sock,&size,sizeof(size))) return 0;
+      size=lltl(size);
+
+      // the answer starts with how much will follow, which is all of it
+      // unless the file ends first
+      struct stat st;
+      int32_t cur=lseek(c->file_fd,0,SEEK_CUR);
+      if (cur<0 || fstat(c->file_fd,&st)<0) return 0;
+      if (size>st.st_size-cur) size=st.st_size-cur;
+      if (size<0) size=0;
+      int32_t tmp=lltl(size);
+      if (c->sock->write(&tmp,sizeof(tmp))!=sizeof(tmp)) return 0;
+
+      c->size_to_read=size;
+      c->raw=1;
+      return size ? c->send_read() : 1;
+    } break;
     case NFCMD_CLOSE :
     {
       return 0;
@@ -115,7 +158,7 @@ int file_manager::process_nfs_command(nfs_client *c)
     case NFCMD_SEEK :
     {
       int32_t offset;
-      if (c->sock->read(&offset,sizeof(offset))!=sizeof(offset)) return 0;
+      if (!read_fully(c->sock,&offset,sizeof(offset))) return 0;
       offset=lltl(offset);
       offset=lseek(c->file_fd,offset,0);
       offset=lltl(offset);
@@ -139,6 +182,41 @@ int file_manager::process_nfs_command(nfs_client *c)
 
 int file_manager::nfs_client::send_read()   // return 0 if failure on socket, not failure to read
 {
+  if (file_fd>=0 && sock && raw)
+  {
+    while (size_to_read)
+    {
+      if (!sock->ready_to_write())
+      {
+        sock->read_unselectable();
+        sock->write_selectable();
+        return 1;    // not ok to write anymore, try again latter
+      }
+
+      int32_t chunk=size_to_read>READ_BLOCK_SIZE ? READ_BLOCK_SIZE : size_to_read;
+#ifdef HAVE_SYS_SENDFILE_H
+      // straight from the page cache, the file offset moves with it
+      int32_t sent=sendfile(sock->get_fd(),file_fd,NULL,chunk);
+#else
+      char buf[READ_PACKET_SIZE*16];
+      if (chunk>(int32_t)sizeof(buf)) chunk=sizeof(buf);
+      int32_t sent=read(file_fd,buf,chunk);
+      if (sent>0 && sock->write(buf,sent)!=sent) sent=-1;
+#endif
+      if (sent<=0)
+      {
+        fprintf(stderr,"write failed\n");
+        return 0;
+      }
+      size_to_read-=sent;
+    }
+
+    raw=0;
+    sock->read_selectable();
+    sock->write_unselectable();
+    return 1;
+  }
+
   if (file_fd>=0 && sock)
   {
     // first make sure the socket isn't 'full'
@@ -220,7 +298,7 @@ void file_manager::secure_filename(char *filename, char *mode)
 
 
 file_manager::nfs_client::nfs_client(net_socket *sock, int file_fd, nfs_client *next) :
-  sock(sock),file_fd(file_fd),next(next),size_to_read(0)
+  sock(sock),file_fd(file_fd),next(next),size_to_read(0),raw(0)
 {
   sock->read_selectable();
 }
@@ -238,9 +316,9 @@ void file_manager::add_nfs_client(net_socket *sock)
 {
   uint8_t size[2];
   char filename[300],mode[20],*mp;
-  if (sock->read(size,2)!=2) { delete sock; return ; }
-  if (sock->read(filename,size[0])!=size[0]) { delete sock; return ; }
-  if (sock->read(mode,size[1])!=size[1]) { delete sock; return ; }
+  if (!read_fully(sock,size,2)) { delete sock; return ; }
+  if (!read_fully(sock,filename,size[0])) { delete sock; return ; }
+  if (!read_fully(sock,mode,size[1])) { delete sock; return ; }
 
 
   secure_filename(filename,mode);  // make sure this filename isn't a security risk
@@ -306,6 +384,8 @@ file_manager::remote_file::remote_file(net_socket *sock, char const *filename, c
 {
   next=Next;
   open_local=0;
+  pos=sent_end=left=0;
+  inflight=0;
 
   uint8_t sizes[3]={ CLIENT_NFS,strlen(filename)+1,strlen(mode)+1};
   if (sock->write(sizes,3)!=3) { r_close("could not send open info"); return ; }
@@ -313,88 +393,109 @@ file_manager::remote_file::remote_file(net_socket *sock, char const *filename, c
   if (sock->write(mode,sizes[2])!=sizes[2]) { r_close("could not send mode"); return ; }
 
   int32_t remote_file_fd;
-  if (sock->read(&remote_file_fd,sizeof(remote_file_fd))!=sizeof(remote_file_fd))
+  if (!read_fully(sock,&remote_file_fd,sizeof(remote_file_fd)))
   { r_close("could not read remote fd"); return ; }
   remote_file_fd=lltl(remote_file_fd);
   if (remote_file_fd<0) { r_close("remote fd is bad"); return ; }
 
-  if (sock->read(&size,sizeof(size))!=sizeof(size)) { r_close("could not read remote filesize"); return ; }
+  if (!read_fully(sock,&size,sizeof(size))) { r_close("could not read remote filesize"); return ; }
 
   size=lltl(size);
 }
 
-int file_manager::remote_file::unbuffered_read(void *buffer, size_t count)
+// Keeps READ_WINDOW block requests on their way until the end of the file,
+// so the server never waits for us to ask for the next one.
+int file_manager::remote_file::request_more()
 {
-  if (sock && count)
+  while (sock && inflight<READ_WINDOW && sent_end<size)
   {
-    uint8_t cmd=NFCMD_READ;
-    if (sock->write(&cmd,sizeof(cmd))!=sizeof(cmd)) { r_close("read : could not send command"); return 0; }
+    uint8_t cmd[5]={ NFCMD_READ_BLOCK };
+    int32_t rsize=lltl(READ_BLOCK_SIZE);
+    memcpy(cmd+1,&rsize,sizeof(rsize));
+    if (sock->write(cmd,sizeof(cmd))!=sizeof(cmd)) { r_close("read : could not send command"); return 0; }
 
-    int32_t rsize=lltl(count);
-    if (sock->write(&rsize,sizeof(rsize))!=sizeof(rsize)) { r_close("read : could not send size"); return 0; }
-
-    int32_t total_read=0;
-    char buf[READ_PACKET_SIZE];
-
-    ushort packet_size;
-    do
-    {
-      if (sock->read(&packet_size,sizeof(packet_size))!=sizeof(packet_size))
-      {
-    fprintf(stderr,"could not read packet size\n");
-    return 0;
-      }
-
-      packet_size=lstl(packet_size);
-
-      ushort size_read=sock->read(buf,packet_size);
+    inflight++;
+    sent_end+=size-sent_end<READ_BLOCK_SIZE ? size-sent_end : READ_BLOCK_SIZE;
+  }
+  return sock!=NULL;
+}
 
-      if (size_read!=packet_size)
-      {
-    if (sock->read(buf+2+size_read,packet_size-size_read)!=packet_size-size_read)
-    {
-      fprintf(stderr,"incomplete packet\n");
-      return 0;
-    }
-      }
+// starts on the next answer, returns 0 if it is empty, at the end of the file
+int file_manager::remote_file::next_block()
+{
+  if (!inflight) return 0;
 
-      memcpy(buffer,buf,packet_size);
-      buffer=(void *)(((char *)buffer)+packet_size);
+  int32_t got;
+  if (!read_fully(sock,&got,sizeof(got))) { r_close("read : could not read block size"); return 0; }
+  inflight--;
+  left=lltl(got);
+  return left>0;
+}
 
-      total_read+=packet_size;
-      count-=packet_size;
-    } while (packet_size==READ_PACKET_SIZE-2 && count);
-    return total_read;
+int file_manager::remote_file::unbuffered_read(void *buffer, size_t count)
+{
+  int total_read=0;
+  while (sock && count)
+  {
+    if (!left && (!request_more() || !next_block())) break;
+
+    int32_t n=count<(size_t)left ? count : left;
+    if (!read_fully(sock,buffer,n)) { r_close("read : incomplete block"); break; }
+    buffer=(void *)(((char *)buffer)+n);
+    left-=n;
+    pos+=n;
+    count-=n;
+    total_read+=n;
   }
-  return 0;
+  return total_read;
 }
 
-int32_t file_manager::remote_file::unbuffered_tell()   // ask server where the offset of the file pointer is
+// reads past what has already been asked for, 0 if it ended first
+int file_manager::remote_file::skip(int32_t count)
 {
-  if (sock)
+  char buf[READ_PACKET_SIZE*16];
+  while (sock && count)
   {
-    uint8_t cmd=NFCMD_TELL;
-    if (sock->write(&cmd,sizeof(cmd))!=sizeof(cmd)) { r_close("tell : could not send command"); return 0; }
-
-    int32_t offset;
-    if (sock->read(&offset,sizeof(offset))!=sizeof(offset)) { r_close("tell : could not read offset"); return 0; }
-    return lltl(offset);
+    if (!left && !next_block()) return 0;
+    int32_t n=count>(int32_t)sizeof(buf) ? sizeof(buf) : count;
+    if (n>left) n=left;
+    if (!read_fully(sock,buf,n)) { r_close("seek : incomplete block"); return 0; }
+    left-=n;
+    pos+=n;
+    count-=n;
   }
-  return 0;
+  return sock!=NULL;
+}
+
+int32_t file_manager::remote_file::unbuffered_tell()   // the server is ahead of us, so this is ours
+{
+  return pos;
 }
 
 int32_t file_manager::remote_file::unbuffered_seek(int32_t offset)  // tell server to seek to a spot in a file
 {
   if (sock)
   {
+    // a bit further on is usually already on its way, so read up to it
+    if (offset>=pos && offset<=sent_end && skip(offset-pos))
+      return pos;
+
+    // otherwise let everything still coming go by and start over there
+    skip(sent_end-pos);
+    while (sock && inflight)
+      if (next_block()) skip(left);
+    if (!sock) return 0;
+
     uint8_t cmd=NFCMD_SEEK;
     if (sock->write(&cmd,sizeof(cmd))!=sizeof(cmd)) { r_close("seek : could not send command"); return 0; }
 
     int32_t off=lltl(offset);
     if (sock->write(&off,sizeof(off))!=sizeof(off)) { r_close("seek : could not send offset"); return 0; }
 
-    if (sock->read(&offset,sizeof(offset))!=sizeof(offset)) { r_close("seek : could not read offset"); return 0; }
-    return lltl(offset);
+    if (!read_fully(sock,&offset,sizeof(offset))) { r_close("seek : could not read offset"); return 0; }
+    pos=sent_end=lltl(offset);
+    left=0;
+    return pos;
   }
   return 0;
 }
@@ -500,9 +601,9 @@ int file_manager::rf_open_file(char const *&filename, char const *mode)
 file_manager::remote_file *file_manager::find_rf(int fd)
 {
   remote_file *r=remote_list;
-  for (; r && r->sock->get_fd()!=fd; r=r->next)
+  for (; r && r->fd()!=fd; r=r->next)
   {
-    if (r->sock->get_fd()==-1)
+    if (r->fd()==-1)
     {
       fprintf(stderr,"bad sock\n");
     }
@@ -536,7 +637,7 @@ int file_manager::rf_read(int fd, void *buffer, size_t count)
 int file_manager::rf_close(int fd)
 {
   remote_file *rf=remote_list,*last=NULL;
-  while (rf && rf->sock->get_fd()!=fd) rf=rf->next;
+  while (rf && rf->fd()!=fd) { last=rf; rf=rf->next; }
   if (rf)
   {
     if (last) last->next=rf->next;
@@ -23,6 +23,7 @@ class file_manager
     nfs_client *next;
     int32_t size_to_read;
     int32_t size;
+    int raw;             // size_to_read answers NFCMD_READ_BLOCK, no packet headers
     nfs_client(net_socket *sock, int file_fd, nfs_client *next);
     int send_read();     // flushes as much of size_to_read as possible
     ~nfs_client();
@@ -37,6 +38,16 @@ class file_manager
     int32_t size;   // server tells us the size of the file when we open it
     int open_local;
     remote_file *next;
+
+    // reads are streamed: up to READ_WINDOW requests are kept in flight
+    int32_t pos;         // where the caller is in the file
+    int32_t sent_end;    // where the server will be once it answered everything
+    int32_t left;        // bytes of the current answer still on the socket
+    int inflight;        // requests whose answer has not started yet
+    int request_more();
+    int next_block();
+    int skip(int32_t count);
+
     remote_file(net_socket *sock, char const *filename, char const *mode, remote_file *Next);
 
     int unbuffered_read(void *buffer, size_t count);
@@ -29,6 +29,8 @@
 #include "netface.h"
 #include "undrv.h"
 #include "timing.h"
+#include "rollback.h"
+#include "lz.h"
 
 extern base_memory_struct *base;
 extern net_socket *comm_sock,*game_sock;
@@ -36,6 +38,18 @@ extern net_protocol *prot;
 extern char lsf[256];
 extern int start_running;
 
+static int read_fully(net_socket *sock, void *buf, int32_t size)
+{
+  while (size)
+  {
+    int ret=sock->read(buf,size);
+    if (ret<=0) return 0;
+    buf=(void *)(((char *)buf)+ret);
+    size-=ret;
+  }
+  return 1;
+}
+
 int game_client::process_server_command()
 {
   uint8_t cmd;
@@ -47,6 +61,14 @@ int game_client::process_server_command()
       uint8_t tick;
       if (client_sock->read(&tick,1)!=1) return 0;
 
+      if (rollback_on)
+      {
+        net_packet pack;
+        if (pack.write_bundle(tick,-1,1))
+          game_sock->write(pack.data,pack.packet_size()+pack.packet_prefix_size(),server_data_port);
+        return 1;
+      }
+
       fprintf(stderr,"request for resend tick %d (game cur=%d, pack=%d, last=%d)\n",
           tick,base->current_tick,base->packet.tick_received(),base->last_packet.tick_received());
 
@@ -61,6 +83,17 @@ int game_client::process_server_command()
       }
       return 1;
     } break;
+    case CLCMD_TICK :
+    {
+      net_packet *pack=&backlog;
+      if (!read_fully(client_sock,pack->data,pack->packet_prefix_size()) ||
+          pack->packet_size()>PACKET_MAX_SIZE-pack->packet_prefix_size() ||
+          !read_fully(client_sock,pack->packet_data(),pack->packet_size()))
+        return 0;
+      have_backlog=1;
+      use_backlog();
+      return 1;
+    } break;
     default :
     {
       fprintf(stderr,"unknown command from server %d\n",cmd);
@@ -70,6 +103,46 @@ int game_client::process_server_command()
   return 0;
 }
 
+// Backlog packets come in order, hold on to the next one until the
+// engine asks for that tick
+void game_client::use_backlog()
+{
+  if (!have_backlog)
+    return;
+  int8_t ahead=(int8_t)(backlog.tick_received()-(uint8_t)base->current_tick);
+  if (ahead<0)          // we got that one some other way
+    have_backlog=0;
+  else if (!ahead && base->input_state==INPUT_COLLECTING)
+  {
+    base->packet=backlog;
+    have_backlog=0;
+    wait_local_input=1;
+    base->input_state=INPUT_PROCESSING;
+  }
+}
+
+uint8_t *game_client::receive_level(int &raw_size)
+{
+  uint8_t cmd;
+  uint32_t sizes[2];
+  if (!read_fully(client_sock,&cmd,1) || cmd!=CLCMD_SNAPSHOT ||
+      !read_fully(client_sock,sizes,sizeof(sizes)))
+    return NULL;
+  raw_size=lltl(sizes[0]);
+  int size=lltl(sizes[1]);
+
+  uint8_t *packed=(uint8_t *)malloc(size),*buf=(uint8_t *)malloc(raw_size);
+  if (!read_fully(client_sock,packed,size) || !lz_decompress(packed,size,buf,raw_size))
+  {
+    fprintf(stderr,"bad level snapshot from server\n");
+    free(buf);
+    buf=NULL;
+  }
+  free(packed);
+  joining=buf!=NULL;
+  return buf;
+}
+
 int game_client::process_net()
 {
   if (client_sock->error())
@@ -85,9 +158,12 @@ int game_client::process_net()
       uint16_t rec_crc=tmp.get_checksum();
       if (rec_crc==tmp.calc_checksum())
       {
-    if (base->current_tick==tmp.tick_received())
+    if (rollback_on)
+      rollback_unbundle(tmp.tick_received(),tmp.packet_data(),tmp.packet_size());
+    else if (base->current_tick==tmp.tick_received())
     {
       base->packet=tmp;
+      joining=0;                            // the server sends it to us directly now
       wait_local_input=1;
       base->input_state=INPUT_PROCESSING;   // tell engine to start processing
     }
@@ -97,7 +173,8 @@ int game_client::process_net()
 
   }
 
-  if (client_sock->ready_to_read())
+  use_backlog();
+  if (!have_backlog && client_sock->ready_to_read())
   {
     if (!process_server_command())
     {
@@ -121,10 +198,22 @@ game_client::game_client(net_socket *client_sock, net_address *server_addr) :
  server_data_port=server_addr->copy();
   client_sock->read_selectable();
   wait_local_input=1;
+  have_backlog=joining=0;
 }
 
 int game_client::input_missing()
 {
+  if (rollback_on)
+  {
+    // ask the server for what we are missing and make sure it has ours
+    uint8_t cmd[2]={ CLCMD_REQUEST_RESEND, rollback_waiting_tick() };
+    if (client_sock->write(cmd,2)!=2) return 0;
+    net_packet pack;
+    if (pack.write_bundle(cmd[1],-1,1))
+      game_sock->write(pack.data,pack.packet_size()+pack.packet_prefix_size(),server_data_port);
+    return 1;
+  }
+
   if (prot->debug_level(net_protocol::DB_IMPORTANT_EVENT))
     fprintf(stderr,"(resending %d)\n",base->packet.tick_received());
   net_packet *pack=&base->packet;
@@ -139,9 +228,21 @@ int game_client::input_missing()
   return 1;
 }
 
+void game_client::send_input()
+{
+  net_packet pack;
+  if (pack.write_bundle(base->current_tick,-1,0))
+    game_sock->write(pack.data,pack.packet_size()+pack.packet_prefix_size(),server_data_port);
+}
+
 void game_client::add_engine_input()
 {
   net_packet *pack=&base->packet;
+  if (rollback_on)      // sent by send_input() once rollback has it
+  {
+    base->input_state=INPUT_PROCESSING;
+    return;
+  }
   base->input_state=INPUT_COLLECTING;
   wait_local_input=0;
   pack->set_tick_received(base->current_tick);
@@ -12,6 +12,11 @@ class game_client : public game_handler
   net_socket *client_sock;             // connection to server as a client
   int wait_local_input;
   int process_server_command();
+
+  // late join: packets the server sent over client_sock while we loaded
+  net_packet backlog;
+  int have_backlog,joining;
+  void use_backlog();
   net_address *server_data_port;
   public :
 
@@ -19,10 +24,13 @@ class game_client : public game_handler
   int process_net();
   int input_missing();
   void add_engine_input();
+  void send_input();
   virtual int start_reload();
   virtual int end_reload(int disconnect=0);
   virtual int kill_slackers();
   virtual int quit();
+  virtual uint8_t *receive_level(int &raw_size);
+  virtual int catching_up() { return joining; }
   virtual ~game_client();
 } ;
 
@@ -15,6 +15,7 @@ class game_handler     // game_client and game_serevr are derived from here
   public :
   virtual int process_net()      { return 1; }     // return 0 if net-shutdown need to happen
   virtual void add_engine_input() { base->input_state=INPUT_PROCESSING; }
+  virtual void send_input()      { ; }      // rollback: send our newest input to everyone
   virtual int input_missing()    { return 1; }  // request input re-send  ( return 0 if net-shutdown needs to happen)
   virtual int start_reload()      { return 1; }
   virtual int end_reload(int disconenct=0) { return 1; }
@@ -22,6 +23,9 @@ class game_handler     // game_client and game_serevr are derived from here
   virtual int kill_slackers()     { return 1; }
   virtual int quit()              { return 1; }  // should disconnect from everone and close all sockets
   virtual void game_start_wait()  { ; }
+  virtual void send_level(int client_id, uint8_t const *buf, int size, int raw_size) { ; }  // compressed snapshot for a late joiner
+  virtual uint8_t *receive_level(int &raw_size) { return NULL; }  // late joiner: wait for the snapshot, malloc'ed
+  virtual int catching_up()       { return 0; }  // late joiner still replaying the ticks it missed
   virtual ~game_handler()         { ; }
 } ;
 
@@ -33,13 +33,14 @@
 #include "input.h"
 #include "dev.h"
 #include "game.h"
+#include "rollback.h"
 
 extern base_memory_struct *base;
 extern net_socket *comm_sock,*game_sock;
 
 extern net_protocol *prot;
 extern join_struct *join_array;
-extern void service_net_request();
+extern void service_net_request(int wait_ms=0);
 
 game_server::game_server()
 {
@@ -86,7 +87,7 @@ void game_server::game_start_wait()
         abort=1;
     }
 
-    service_net_request();
+    service_net_request(10);
   }
   if (stat)
   {
@@ -99,10 +100,83 @@ game_server::player_client::~player_client()
 {
   delete comm;
   delete data_address;
+  free(out);
+}
+
+void game_server::player_client::queue(void const *buf, int size)
+{
+  if (out_sent)     // drop what already went out
+  {
+    memmove(out,out+out_sent,out_size-out_sent);
+    out_size-=out_sent;
+    out_sent=0;
+  }
+  if (out_size+size>out_max)
+  {
+    out_max=(out_size+size)*2;
+    out=(uint8_t *)realloc(out,out_max);
+  }
+  memcpy(out+out_size,buf,size);
+  out_size+=size;
+  send_queued();
+}
+
+int game_server::player_client::send_queued()
+{
+  if (out_sent==out_size)
+    return 1;
+
+  while (out_sent<out_size)
+  {
+    if (!comm->ready_to_write())
+    {
+      comm->write_selectable();
+      return 1;     // the rest goes once the socket drains
+    }
+    int chunk=out_size-out_sent>4096 ? 4096 : out_size-out_sent;
+    int sent=comm->write(out+out_sent,chunk);
+    if (sent<=0)
+      return 0;
+    out_sent+=sent;
+  }
+  out_size=out_sent=0;
+  comm->write_unselectable();
+  return 1;
+}
+
+void game_server::remove_deleted()
+{
+  player_client *c,*last=NULL;
+  for (c=player_list; c; )
+  {
+    if (c->delete_me())
+    {
+      base->packet.write_uint8(SCMD_DELETE_CLIENT);
+      base->packet.write_uint8(c->client_id);
+      if (c->wait_reload())
+      {
+        c->set_wait_reload(0);
+        check_reload_wait();
+      }
+
+      if (last) last->next=c->next;
+      else player_list=c->next;
+      player_client *d=c;
+      c=c->next;
+      delete d;
+    } else
+    {
+      last=c;
+      c=c->next;
+    }
+  }
 }
 
 void game_server::check_collection_complete()
 {
+  if (rollback_on)       // nothing to collect, deletes go out with our next input
+    return;
+
   player_client *c;
   int got_all=waiting_server_input==0;
   int add_deletes=0;
@@ -115,32 +189,7 @@ void game_server::check_collection_complete()
   }
 
   if (add_deletes)
-  {
-    player_client *last=NULL;
-    for (c=player_list; c; )
-    {
-      if (c->delete_me())
-      {
-    base->packet.write_uint8(SCMD_DELETE_CLIENT);
-    base->packet.write_uint8(c->client_id);
-    if (c->wait_reload())
-    {
-      c->set_wait_reload(0);
-      check_reload_wait();
-    }
-
-    if (last) last->next=c->next;
-    else player_list=c->next;
-    player_client *d=c;
-    c=c->next;
-    delete d;
-      } else
-      {
-    last=c;
-    c=c->next;
-      }
-    }
-  }
+    remove_deleted();
 
   if (got_all)    // see if we have input from everyone, if so send it out
   {
@@ -153,6 +202,11 @@ void game_server::check_collection_complete()
     c->set_wait_input(1);
     game_sock->write(base->packet.data,base->packet.packet_size()+base->packet.packet_prefix_size(),c->data_address);
 
+      } else if (c->catching_up())     // goes after the snapshot, in order
+      {
+        uint8_t cmd=CLCMD_TICK;
+        c->queue(&cmd,1);
+        c->queue(base->packet.data,base->packet.packet_size()+base->packet.packet_prefix_size());
       }
     }
 
@@ -164,6 +218,15 @@ void game_server::check_collection_complete()
 
 void game_server::add_engine_input()
 {
+  if (rollback_on)
+  {
+    // nobody waits for a complete packet, our input goes out in
+    // send_input() and clients relay theirs through process_net()
+    remove_deleted();
+    base->input_state=INPUT_PROCESSING;
+    return;
+  }
+
   waiting_server_input=0;
   base->input_state=INPUT_COLLECTING;
   base->packet.set_tick_received(base->current_tick);
@@ -171,6 +234,15 @@ void game_server::add_engine_input()
   check_collection_complete();
 }
 
+void game_server::send_input()
+{
+  net_packet pack;
+  if (!pack.write_bundle(base->current_tick,-1,0)) return;
+  for (player_client *c=player_list; c; c=c->next)
+    if (c->has_joined())
+      game_sock->write(pack.data,pack.packet_size()+pack.packet_prefix_size(),c->data_address);
+}
+
 void game_server::add_client_input(char *buf, int size, player_client *c)
 {
   if (c->wait_input())  // don't add if we already have it
@@ -200,6 +272,16 @@ int game_server::process_client_command(player_client *c)
       uint8_t tick;
       if (c->comm->read(&tick,1)!=1) return 0;
 
+      if (rollback_on)
+      {
+        // everything we have for that tick that did not come from them
+        net_packet pack;
+        for (int p=-1; p<ROLLBACK_PLAYERS; p++)
+          if (p!=c->client_id && pack.write_bundle(tick,p,1))
+            game_sock->write(pack.data,pack.packet_size()+pack.packet_prefix_size(),c->data_address);
+        return 1;
+      }
+
       fprintf(stderr,"request for resend tick %d (game cur=%d, pack=%d, last=%d)\n",
           tick,base->current_tick,base->packet.tick_received(),base->last_packet.tick_received());
 
@@ -241,7 +323,8 @@ int game_server::process_net()
 {
   int ret=0;
   /**************************       Any game data waiting?       **************************/
-  if ((base->input_state==INPUT_COLLECTING ||
+  if ((rollback_on ||
+       base->input_state==INPUT_COLLECTING ||
        base->input_state==INPUT_RELOAD)
        && game_sock->ready_to_read())
   {
@@ -260,9 +343,30 @@ int game_server::process_net()
     {
       player_client *f=player_list,*found=NULL;
       for (; !found &&f; f=f->next)
-      if (f->has_joined() && from->equal(f->data_address))
+      if ((f->has_joined() || f->catching_up()) && from->equal(f->data_address))
         found=f;
-      if (found)
+
+      // a late joiner is in once its input is for the tick we are collecting,
+      // everything before that went to it over comm
+      if (found && found->catching_up())
+      {
+        if (base->input_state==INPUT_COLLECTING && base->current_tick==use->tick_received())
+        {
+          found->set_catching_up(0);
+          found->set_has_joined(1);
+        } else found=NULL;
+      }
+
+      if (found && rollback_on)
+      {
+        // pass it on to the other clients, then use it ourselves
+        for (player_client *c=player_list; c; c=c->next)
+          if (c!=found && c->has_joined())
+            game_sock->write(use->data,use->packet_size()+use->packet_prefix_size(),c->data_address);
+        if (base->input_state!=INPUT_RELOAD)
+          rollback_unbundle(use->tick_received(),use->packet_data(),use->packet_size());
+      }
+      else if (found)
       {
         if (base->current_tick==use->tick_received())
         {
@@ -313,7 +417,8 @@ int game_server::process_net()
   /**************************       Any client with commands?       **************************/
   player_client *c;
   for (c=player_list; c; c=c->next)
-    if (c->comm->error() || (c->comm->ready_to_read() && !process_client_command(c)))
+    if (c->comm->error() || (c->comm->ready_to_read() && !process_client_command(c)) ||
+        !c->send_queued())
     {
       c->set_delete_me(1);
       check_collection_complete();
@@ -326,7 +431,15 @@ int game_server::process_net()
 
 int game_server::input_missing()
 {
-
+  if (rollback_on)
+  {
+    uint32_t missing=rollback_missing();
+    uint8_t cmd[2]={ CLCMD_REQUEST_RESEND, rollback_waiting_tick() };
+    for (player_client *c=player_list; c; c=c->next)
+      if (c->has_joined() && c->client_id<ROLLBACK_PLAYERS && (missing&(1u<<c->client_id))
+          && c->comm->write(cmd,2)!=2)
+        c->set_delete_me(1);
+  }
   return 1;
 }
 
@@ -452,8 +565,33 @@ int game_server::add_client(int type, net_socket *sock, net_address *from)
     }
 }
 
+void game_server::send_level(int client_id, uint8_t const *buf, int size, int raw_size)
+{
+  player_client *c=player_list;
+  for (; c && c->client_id!=client_id; c=c->next);
+  if (!c || c->delete_me())
+    return;
+
+  uint8_t cmd=CLCMD_SNAPSHOT;
+  uint32_t sizes[2]={ lltl(raw_size), lltl(size) };
+  c->queue(&cmd,1);
+  c->queue(sizes,sizeof(sizes));
+  c->queue(buf,size);
+  c->set_catching_up(1);
+}
+
 int game_server::kill_slackers()
 {
+  if (rollback_on)
+  {
+    uint32_t missing=rollback_missing();
+    for (player_client *c=player_list; c; c=c->next)
+      if (c->client_id<ROLLBACK_PLAYERS && (missing&(1u<<c->client_id)))
+        c->set_delete_me(1);
+    rollback_skip();
+    return 1;
+  }
+
   player_client *c=player_list;
   for (; c; c=c->next)
     if (c->wait_input())
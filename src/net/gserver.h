@@ -15,7 +15,8 @@ class game_server : public game_handler
        Wait_reload=2,
        Wait_input=4,
        Need_reload_start_ok=8,
-       Delete_me=16 };
+       Delete_me=16,
+       Catching_up=32 };
     int get_flag(int flag)         { return flags&flag; }
     void set_flag(int flag, int x) { if (x) flags|=flag; else flags&=~flag; }
 
@@ -35,6 +36,16 @@ class game_server : public game_handler
     int need_reload_start_ok() { return get_flag(Need_reload_start_ok); }
     void set_need_reload_start_ok(int x) { set_flag(Need_reload_start_ok,x); }
 
+    // sent the level snapshot, gets every packet over comm until its input shows up
+    int catching_up() { return get_flag(Catching_up); }
+    void set_catching_up(int x) { set_flag(Catching_up,x); }
+
+    // what is waiting to go out over comm, sent as the socket allows
+    uint8_t *out;
+    int out_size,out_sent,out_max;
+    void queue(void const *buf, int size);
+    int send_queued();       // 0 if the socket failed
+
     int client_id;
     net_socket *comm;
     net_address *data_address;
@@ -43,6 +54,8 @@ class game_server : public game_handler
       client_id(client_id), comm(comm), data_address(data_address), next(next)
       {
     flags=0;
+    out=NULL;
+    out_size=out_sent=out_max=0;
     set_wait_input(1);
     comm->read_selectable();
       };
@@ -54,6 +67,7 @@ class game_server : public game_handler
 
   void add_client_input(char *buf, int size, player_client *c);
   void check_collection_complete();
+  void remove_deleted();
   void check_reload_wait();
   int process_client_command(player_client *c);
   int isa_client(int client_id);
@@ -62,12 +76,14 @@ class game_server : public game_handler
   int total_players();
   int process_net();
   void add_engine_input();
+  void send_input();
   int input_missing();
   virtual int start_reload();
   virtual int end_reload(int disconnect=0);
   virtual int add_client(int type, net_socket *sock, net_address *from);
   virtual int kill_slackers();
   virtual int quit();
+  virtual void send_level(int client_id, uint8_t const *buf, int size, int raw_size);
   game_server();
   ~game_server();
 } ;
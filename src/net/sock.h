@@ -72,6 +72,9 @@ public:
   virtual int installed() = 0;
   virtual char const *name() = 0;
   virtual int select(int block) = 0;          // return # of sockets available for read & writing
+  // Like select(0) but sleeps up to ms milliseconds (-1 for ever) until a
+  // socket is ready, for protocols that can wait without spinning
+  virtual int wait(int ms) { return select(0); }
   virtual void cleanup() { ; }                // should do any needed pre-exit cleanup stuff
   net_socket *connect_to_server(char const *&server_name, int port, int force_port=0,
                 net_socket::socket_type sock_type=net_socket::SOCKET_SECURE);
@@ -30,6 +30,11 @@ extern tcpip_protocol tcpip;
 
 //{{{ net logging stuff
 
+// dumps every byte read and written to /tmp/abuse*.log, far too slow to
+// leave on when transferring files
+//#define TCPIP_LOG_TRAFFIC
+
+#ifdef TCPIP_LOG_TRAFFIC
 FILE *log_file=NULL;
 extern int net_start();
 
@@ -60,6 +65,9 @@ static void net_log(char const *st, void *buf, long size)
     fflush(log_file);
 
 }
+#else
+static inline void net_log(char const *st, void *buf, long size) { }
+#endif
 //}}}
 
 ////////////////////////////////////////////////////////////////////////
@@ -97,6 +105,17 @@ int unix_fd::write(void const *buf, int size, net_address *addr)
 }
 //}}}///////////////////////////////////
 
+int unix_fd::ready_to_write()
+//{{{
+{
+  pollfd p;
+  p.fd=fd;
+  p.events=POLLOUT;
+  p.revents=0;
+  return poll(&p,1,0)>0 && (p.revents&POLLOUT);    // don't wait
+}
+//}}}///////////////////////////////////
+
 void unix_fd::broadcastable()
 //{{{
 {
@@ -621,48 +640,150 @@ tcpip_protocol::tcpip_protocol()
   GUSISetup(GUSIwithSIOUXSockets);
   GUSISetup(GUSIwithPPCSockets);
 #endif
-  FD_ZERO(&master_set);
-  FD_ZERO(&master_write_set);
-  FD_ZERO(&read_set);
-  FD_ZERO(&exception_set);
-  FD_ZERO(&write_set);
+#if defined HAVE_SYS_EPOLL_H
+  epoll_fd=-1;
+#else
+  polls=NULL;
+  poll_owner=NULL;
+  total_polls=max_polls=0;
+#endif
+  ready=NULL;
+  total_ready=max_ready=0;
 }
 //}}}///////////////////////////////////
 
-int tcpip_protocol::select(int block)
+void tcpip_protocol::set_events(unix_fd *s, int events)
 //{{{
 {
-  int ret;
+  if (events==s->events)
+    return;
 
-  memcpy(&read_set,&master_set,sizeof(master_set));
-  memcpy(&exception_set,&master_set,sizeof(master_set));
-  memcpy(&write_set,&master_write_set,sizeof(master_set));
-  if (block)
+#if defined HAVE_SYS_EPOLL_H
+  if (epoll_fd<0)
+    epoll_fd=epoll_create(16);
+  epoll_event ev;
+  memset(&ev,0,sizeof(ev));
+  ev.events=((events&TCPIP_READ) ? EPOLLIN : 0) | ((events&TCPIP_WRITE) ? EPOLLOUT : 0);
+  ev.data.ptr=s;
+  int op=!s->events ? EPOLL_CTL_ADD : !events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(epoll_fd,op,s->fd,&ev)<0)
+    fprintf(stderr,"net driver : could not watch socket %d\n",s->fd);
+#else
+  if (!events)
   {
-    ret = 0;
-    while (ret == 0) {
-      // get number of sockets ready from system call
-      ret = ::select(FD_SETSIZE,&read_set,&write_set,&exception_set,NULL);
-
-      // remove notifier & responder events from the count of sockets selected
-      if (handle_notification())
-        ret--;
-      if (handle_responder())
-        ret--;
+    // move the last entry into the hole
+    total_polls--;
+    if (s->slot!=total_polls)
+    {
+      polls[s->slot]=polls[total_polls];
+      poll_owner[s->slot]=poll_owner[total_polls];
+      poll_owner[s->slot]->slot=s->slot;
     }
+    s->slot=-1;
+  } else
+  {
+    if (s->slot<0)
+    {
+      if (total_polls==max_polls)
+      {
+        max_polls=max_polls ? max_polls*2 : 16;
+        polls=(pollfd *)realloc(polls,max_polls*sizeof(pollfd));
+        poll_owner=(unix_fd **)realloc(poll_owner,max_polls*sizeof(unix_fd *));
+      }
+      s->slot=total_polls++;
+      polls[s->slot].fd=s->fd;
+      poll_owner[s->slot]=s;
+    }
+    polls[s->slot].events=((events&TCPIP_READ) ? POLLIN : 0) | ((events&TCPIP_WRITE) ? POLLOUT : 0);
   }
-  else
+#endif
+  s->events=events;
+}
+//}}}///////////////////////////////////
+
+void tcpip_protocol::add_ready(unix_fd *s, int events)
+//{{{
+{
+  // a hang up or an error is reported to whoever reads or writes, the
+  // same way select() marks the socket readable
+  int broken=(events&(POLLERR | POLLHUP)) ? 1 : 0;
+  s->found=0;
+  if ((s->events&TCPIP_READ) && ((events&POLLIN) || broken))
+    s->found|=TCPIP_READ;
+  if ((s->events&TCPIP_WRITE) && ((events&POLLOUT) || broken))
+    s->found|=TCPIP_WRITE;
+  if (events&POLLERR)
+    s->found|=TCPIP_ERROR;
+  if (!s->found)
+    return;
+
+  if (total_ready==max_ready)
+  {
+    max_ready=max_ready ? max_ready*2 : 16;
+    ready=(unix_fd **)realloc(ready,max_ready*sizeof(unix_fd *));
+  }
+  ready[total_ready++]=s;
+}
+//}}}///////////////////////////////////
+
+void tcpip_protocol::forget(unix_fd *s)
+//{{{
+{
+  set_events(s,0);
+  for (int i=0; i<total_ready; i++)
+    if (ready[i]==s)
+      ready[i]=ready[--total_ready];
+}
+//}}}///////////////////////////////////
+
+int tcpip_protocol::wait(int ms)
+//{{{
+{
+  int i;
+  for (i=0; i<total_ready; i++)
+    ready[i]->found=0;
+  total_ready=0;
+
+#if defined HAVE_SYS_EPOLL_H
+  if (epoll_fd<0)
+    epoll_fd=epoll_create(16);
+  epoll_event ev[64];
+  int n=epoll_wait(epoll_fd,ev,64,ms);     // the rest will still be there next time
+  for (i=0; i<n; i++)
   {
-    timeval tv={ 0,0};
-    // get number of sockets ready from system call
-    ret = ::select(FD_SETSIZE,&read_set,&write_set,&exception_set,&tv);
-
-    // remove notifier & responder events from the count of sockets selected
-    if (handle_notification())
-      ret--;
-    if (handle_responder())
-      ret--;
+    int e=ev[i].events;
+    add_ready((unix_fd *)ev[i].data.ptr,((e&EPOLLIN) ? POLLIN : 0) | ((e&EPOLLOUT) ? POLLOUT : 0) |
+                                        ((e&EPOLLERR) ? POLLERR : 0) | ((e&EPOLLHUP) ? POLLHUP : 0));
   }
+#else
+  int n=poll(polls,total_polls,ms);
+  for (i=0; n>0 && i<total_polls; i++)
+    if (polls[i].revents)
+    {
+      add_ready(poll_owner[i],polls[i].revents);
+      n--;
+    }
+#endif
+  if (n<0)
+    return n;
+
+  int ret=total_ready;
+  // remove notifier & responder events from the count of sockets selected
+  if (handle_notification())
+    ret--;
+  if (handle_responder())
+    ret--;
+  return ret;
+}
+//}}}///////////////////////////////////
+
+int tcpip_protocol::select(int block)
+//{{{
+{
+  int ret;
+  do
+    ret=wait(block ? -1 : 0);
+  while (block && ret==0);
   return ret;
 }
 //}}}///////////////////////////////////
@@ -12,6 +12,7 @@
 #   include <WinSock2.h>
 #   include <Windows.h>
 #   include <stdio.h>
+#   define poll WSAPoll
 // FIXME: Where is socklen_t in Windows?
 typedef int socklen_t;
 #endif
@@ -30,6 +31,7 @@ typedef int socklen_t;
 #elif defined HAVE_NETINET_IN_H
 #   include <netdb.h>
 #   include <netinet/in.h>
+#   include <netinet/tcp.h>
 #   include <stdio.h>
 #   include <string.h>
 #   include <sys/time.h>
@@ -39,15 +41,20 @@ typedef int socklen_t;
 #   include <unistd.h>
 #   ifdef HAVE_BSTRING_H
 #       include <bstring.h>
-#   else
-#       include <sys/select.h>
+#   endif
+#   include <poll.h>
+#   if defined HAVE_SYS_EPOLL_H
+#       include <sys/epoll.h>
 #   endif
 #endif
 
 #include "sock.h"
 #include "isllist.h"
 
-extern fd_set master_set, master_write_set, read_set, exception_set, write_set;
+class unix_fd;
+
+// What a unix_fd waits for and what the last select() found
+enum { TCPIP_READ=1, TCPIP_WRITE=2, TCPIP_ERROR=4 };
 
 class ip_address : public net_address
 {
@@ -110,9 +117,25 @@ protected:
 
   int handle_notification();
   int handle_responder();
-public :
-  fd_set master_set,master_write_set,read_set,exception_set,write_set;
 
+  // Sockets are registered once, when they become selectable, rather than
+  // gathered into fd_sets on every select(). The sockets the last select()
+  // found ready are kept so only their flags need clearing next time.
+  friend class unix_fd;
+#if defined HAVE_SYS_EPOLL_H
+  int epoll_fd;
+#else
+  pollfd *polls;
+  unix_fd **poll_owner;
+  int total_polls,max_polls;
+#endif
+  unix_fd **ready;
+  int total_ready,max_ready;
+
+  void set_events(unix_fd *s, int events);
+  void add_ready(unix_fd *s, int events);
+  void forget(unix_fd *s);
+public :
   tcpip_protocol();
   net_address *get_local_address();
   net_address *get_node_address(char const *&server_name, int def_port, int force_port);
@@ -123,6 +146,7 @@ public :
   char const *name() { return "UNIX generic TCPIP"; }
   void cleanup();
   int select(int block);          // return # of sockets available for read & writing
+  int wait(int ms);
 
   // Notification methods
   virtual net_socket *start_notify(int port, void *data, int len);
@@ -138,33 +162,28 @@ extern tcpip_protocol tcpip;
 
 class unix_fd : public net_socket
 {
+  friend class tcpip_protocol;
   protected :
   int fd;
+  int events,found;   // TCPIP_READ/WRITE we wait for, what select() found
+  int slot;           // index in the poll array, -1 if not in it
   public :
-  unix_fd(int fd) : fd(fd) { };
-  virtual int error()                             { return FD_ISSET(fd,&tcpip.exception_set); }
-  virtual int ready_to_read()                     { return FD_ISSET(fd,&tcpip.read_set); }
-  virtual int ready_to_write()
-  {
-    struct timeval tv={ 0,0};     // don't wait
-    fd_set write_check;
-    FD_ZERO(&write_check);
-    FD_SET(fd,&write_check);
-    select(FD_SETSIZE,NULL,&write_check,NULL,&tv);
-    return FD_ISSET(fd,&write_check);
-  }
+  unix_fd(int fd) : fd(fd), events(0), found(0), slot(-1) { };
+  virtual int error()                             { return found&TCPIP_ERROR; }
+  virtual int ready_to_read()                     { return found&TCPIP_READ; }
+  virtual int ready_to_write();
   virtual int write(void const *buf, int size, net_address *addr=NULL);
   virtual int read(void *buf, int size, net_address **addr);
 
 #ifdef WIN32
-  virtual ~unix_fd()                            { read_unselectable();  write_unselectable(); closesocket(fd); }
+  virtual ~unix_fd()                            { tcpip.forget(this); closesocket(fd); }
 #else
-  virtual ~unix_fd()                            { read_unselectable();  write_unselectable(); close(fd); }
+  virtual ~unix_fd()                            { tcpip.forget(this); close(fd); }
 #endif
-  virtual void read_selectable()                   { FD_SET(fd,&tcpip.master_set); }
-  virtual void read_unselectable()                 { FD_CLR(fd,&tcpip.master_set); }
-  virtual void write_selectable()                  { FD_SET(fd,&tcpip.master_write_set); }
-  virtual void write_unselectable()                { FD_CLR(fd,&tcpip.master_write_set); }
+  virtual void read_selectable()                   { tcpip.set_events(this,events|TCPIP_READ); }
+  virtual void read_unselectable()                 { tcpip.set_events(this,events&~TCPIP_READ); }
+  virtual void write_selectable()                  { tcpip.set_events(this,events|TCPIP_WRITE); }
+  virtual void write_unselectable()                { tcpip.set_events(this,events&~TCPIP_WRITE); }
   int get_fd() { return fd; }
 
   void broadcastable();
@@ -174,7 +193,14 @@ class tcp_socket : public unix_fd
 {
   int listening;
   public :
-  tcp_socket(int fd) : unix_fd(fd) { listening=0; };
+  tcp_socket(int fd) : unix_fd(fd)
+  {
+    listening=0;
+    // everything over tcp is a small request waiting for its answer, don't
+    // let it sit out a delayed ack
+    int on=1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,(char *)&on,sizeof(on));
+  };
   virtual int listen(int port)
   {
     sockaddr_in host;
@@ -17,6 +17,8 @@
 
 #define PACKET_MAX_SIZE 1024    // this is a game data packet (udp/ipx)
 #define READ_PACKET_SIZE 1024   // this is a file service packet (tcp/spx)
+#define READ_BLOCK_SIZE  65536  // a streamed file read (NFCMD_READ_BLOCK)
+#define READ_WINDOW      4      // streamed reads a client keeps in flight
 #define NET_CRC_FILENAME "#net_crc"
 #define NET_STARTFILE    "netstart.spe"
 
@@ -44,7 +46,8 @@ enum { NFCMD_OPEN,
        NFCMD_SEND_INPUT,
        NFCMD_INPUT_MISSING,     // when engine is waiting for input and suspects packets are missing
        NFCMD_KILL_SLACKERS,     // when the user decides the clients are taking too long to respond
-       EGCMD_DIE
+       EGCMD_DIE,
+       NFCMD_READ_BLOCK         // like NFCMD_READ but answered by the size and then the raw bytes
      };
 
 // client commands
@@ -53,7 +56,9 @@ enum { CLCMD_JOIN_FAILED,
        CLCMD_RELOAD_START,           // will you please load netstart.spe
        CLCMD_RELOAD_END,            // netstart.spe has been loaded, please continue
        CLCMD_REQUEST_RESEND,        // input didn't arrive, please resend
-       CLCMD_UNJOIN                 // causes server to delete you (addes your delete command to next out packet)
+       CLCMD_UNJOIN,                // causes server to delete you (addes your delete command to next out packet)
+       CLCMD_SNAPSHOT,              // the running level for a late joiner: raw size, compressed size, data
+       CLCMD_TICK                   // a whole game packet the late joiner missed while loading
      } ;
 
 
@@ -94,7 +99,8 @@ enum {
        SCMD_EXT_KEYPRESS,
        SCMD_EXT_KEYRELEASE,
        SCMD_CHAT_KEYPRESS,
-       SCMD_SYNC
+       SCMD_SYNC,
+       SCMD_JOIN                // player number, name length, name : add a player without reloading
      };
 
 
@@ -146,6 +152,10 @@ struct net_packet
 
   void set_packet_size(uint16_t x) { uint16_t tmp = lstl(x); memcpy(data, &tmp, sizeof(tmp)); }
 
+  // fills the packet with a player's rollback input for tick and the ticks
+  // before it (see rollback.h), returns 0 if there is nothing to send
+  int write_bundle(uint8_t tick, int player, int resend);
+
 
 } ;
 
@@ -20,6 +20,10 @@
 # include <unistd.h>
 #endif
 #include <ctype.h>
+#include <sys/stat.h>
+#ifdef WIN32
+# include <direct.h>
+#endif
 
 #include "common.h"
 
@@ -60,6 +64,103 @@ bFILE *open_nfs_file(char const *filename, char const *mode)
   return new nfs_file(filename,mode);
 }
 
+// Server files that differ from ours are kept in netcache/ in the save
+// directory, named after their CRC, so joining a server again only fetches
+// what changed. A cached copy is used only if its own CRC still matches.
+static CrcManager cache_crcs;
+
+// Returns 0 if there is no save directory to keep the cache in
+static int cache_name(char *dst, size_t max, char const *filename, uint32_t crc)
+{
+  char const *prefix=get_save_filename_prefix();
+  if (!prefix || strlen(prefix)+strlen(filename)+24>max)
+    return 0;
+  char *c=dst+sprintf(dst,"%snetcache/%08x-",prefix,crc);
+  for (; *filename; filename++)
+    *(c++)=(*filename=='/' || *filename=='\\' || *filename==':') ? '_' : *filename;
+  *c=0;
+  return 1;
+}
+
+static jFILE *open_cached(char const *filename, uint32_t crc)
+{
+  char name[512];
+  if (!cache_name(name,sizeof(name),filename,crc))
+    return NULL;
+  jFILE *fp=new jFILE(name,"rb");
+  if (fp->open_failure()) { delete fp; return NULL; }
+
+  int num=cache_crcs.get_filenumber(name),failed;
+  uint32_t got=cache_crcs.get_crc(num,failed);
+  if (failed)
+  {
+    got=crc_file(fp);
+    cache_crcs.set_crc(num,got);
+  }
+  if (got!=crc)
+  {
+    delete fp;
+    unlink(name);
+    return NULL;
+  }
+  return fp;
+}
+
+#if HAVE_NETWORK
+// Copies the whole file from the server into the cache, 0 on failure
+static int fetch_cached(char const *filename, char const *local_filename, uint32_t crc)
+{
+  char name[512],part[512],nm[256];
+  if (!cache_name(name,sizeof(name),local_filename,crc))
+    return 0;
+  sprintf(part,"%s.part",name);
+
+  strcpy(nm,filename);
+  int fd=NF_open_file(nm,"rb");
+  if (fd<0) return 0;
+
+  FILE *out=fopen(part,"wb");
+  if (!out)
+  {
+    char dir[512];
+    sprintf(dir,"%snetcache",get_save_filename_prefix());
+#ifdef WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir,S_IRUSR | S_IWUSR | S_IXUSR);
+#endif
+    out=fopen(part,"wb");
+  }
+  if (!out) { NF_close(fd); return 0; }
+
+  int size=0x10000,ok=1;
+  uint8_t *buffer=(uint8_t *)malloc(size);
+  uint32_t got=0;
+  long nr;
+  while ((nr=NF_read(fd,buffer,size))>0)
+  {
+    got=crc_update(got,buffer,nr);
+    if (fwrite(buffer,1,nr,out)!=(size_t)nr) { ok=0; break; }
+  }
+  free(buffer);
+  NF_close(fd);
+  if (fclose(out)) ok=0;
+
+  if (ok && got==crc)
+  {
+    unlink(name);
+    if (!rename(part,name))
+    {
+      cache_crcs.set_crc(cache_crcs.get_filenumber(name),crc);
+      return 1;
+    }
+  }
+  dprintf("netcache: could not fetch %s\n",local_filename);
+  unlink(part);
+  return 0;
+}
+#endif
+
 
 nfs_file::nfs_file(char const *filename, char const *mode)
 {
@@ -111,6 +212,17 @@ nfs_file::nfs_file(char const *filename, char const *mode)
     if (local_crc==remote_crc)
           local_only=1;
       }
+
+      if (!local_only)
+      {
+        local=open_cached(local_filename,remote_crc);
+#if HAVE_NETWORK
+        if (!local && fetch_cached(filename,local_filename,remote_crc))
+          local=open_cached(local_filename,remote_crc);
+#endif
+        if (local)
+          return;
+      }
     }
   }
 
@@ -17,7 +17,7 @@
 
 int net_init(int argc, char **argv);
 void net_uninit();
-void service_net_request();
+void service_net_request(int wait_ms=0);   // wait_ms: sleep that long at most if nothing is ready
 void wait_min_players();
 void server_check();
 void remove_client(int client_number);
@@ -36,6 +36,10 @@ int NF_set_file_server(net_address *addr);
 int request_server_entry();
 int server_entry_continue();
 void net_reload();
+void write_join_commands();                 // SCMD_JOIN for everyone waiting to get in
+void net_join(int client_id, char const *name);
+void send_join_snapshots();                 // after the packet with the joins was processed
+int net_catching_up();                      // late joiner still replaying what it missed
 void read_new_views();
 int set_file_server(char const *name);
 int set_file_server(net_address *addr);
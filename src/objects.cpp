@@ -28,6 +28,7 @@
 #include "clisp.h"
 #include "lisp_gc.h"
 #include "profile.h"
+#include "bench.h"
 
 char **object_names;
 int total_objects;
@@ -412,16 +413,12 @@ int game_object::decide()
     current_object=this;
     void *m = LSpace::Tmp.Mark();
 
-    time_marker *prof1=NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    LObject *ret = ((LSymbol *)figures[otype]->get_fun(OFUN_AI))->EvalFunction(NULL);
-    if (profiling())
+    LObject *ret;
     {
-      time_marker now;
-      profile_add_time(this->otype,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp ai", object_names[otype]);
+      bench_scope bs(BENCH_LISP);
+      ret = ((LSymbol *)figures[otype]->get_fun(OFUN_AI))->EvalFunction(NULL);
     }
 
     LSpace::Tmp.Restore(m);
@@ -516,16 +513,10 @@ void game_object::do_damage(int amount, game_object *from, int32_t hitx, int32_t
     frm->m_cdr = hx;
     am->m_cdr = frm;
 
-    time_marker *prof1 = NULL;
-    if (profiling())
-      prof1 = new time_marker;
-
-    ((LSymbol *)d)->EvalUserFunction(am);
-    if (profiling())
     {
-      time_marker now;
-      profile_add_time(this->otype, now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp damage", object_names[otype]);
+      ((LSymbol *)d)->EvalUserFunction(am);
     }
 
     LSpace::Tmp.Restore(m);
@@ -625,16 +616,11 @@ void game_object::draw()
     current_object=this;
 
     void *m = LSpace::Tmp.Mark();
-    time_marker *prof1=NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    ((LSymbol *)figures[otype]->get_fun(OFUN_DRAW))->EvalFunction(NULL);
-    if (profiling())
     {
-      time_marker now;
-      profile_add_time(this->otype,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp draw", object_names[otype]);
+      bench_scope bs(BENCH_LISP);
+      ((LSymbol *)figures[otype]->get_fun(OFUN_DRAW))->EvalFunction(NULL);
     }
 
     LSpace::Tmp.Restore(m);
@@ -650,16 +636,10 @@ void game_object::map_draw()
     current_object=this;
 
     void *m = LSpace::Tmp.Mark();
-    time_marker *prof1=NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    ((LSymbol *)figures[otype]->get_fun(OFUN_MAP_DRAW))->EvalFunction(NULL);
-    if (profiling())
     {
-      time_marker now;
-      profile_add_time(this->otype,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp map draw", object_names[otype]);
+      ((LSymbol *)figures[otype]->get_fun(OFUN_MAP_DRAW))->EvalFunction(NULL);
     }
 
     LSpace::Tmp.Restore(m);
@@ -1156,16 +1136,10 @@ game_object *create(int type, int32_t x, int32_t y, int skip_constructor, int ai
 
     void *m = LSpace::Tmp.Mark();
 
-    time_marker *prof1=NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    ((LSymbol *)figures[type]->get_fun(OFUN_CONSTRUCTOR))->EvalFunction(NULL);
-    if (profiling())
     {
-      time_marker now;
-      profile_add_time(type,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(type);
+      trace_zone tz("lisp constructor", object_names[type]);
+      ((LSymbol *)figures[type]->get_fun(OFUN_CONSTRUCTOR))->EvalFunction(NULL);
     }
 
     LSpace::Tmp.Restore(m);
@@ -1218,16 +1192,12 @@ int game_object::move(int cx, int cy, int button)
 
     void *m = LSpace::Tmp.Mark();
 
-    time_marker *prof1 = NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    LObject *r = ((LSymbol *)figures[otype]->get_fun(OFUN_MOVER))->EvalFunction(lcx);
-    if (profiling())
+    LObject *r;
     {
-      time_marker now;
-      profile_add_time(this->otype,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp mover", object_names[otype]);
+      bench_scope bs(BENCH_LISP);
+      r = ((LSymbol *)figures[otype]->get_fun(OFUN_MOVER))->EvalFunction(lcx);
     }
 
     LSpace::Tmp.Restore(m);
@@ -1538,6 +1508,8 @@ int32_t object_list_length(object_node *list)
 game_object::game_object(int Type, int load)
 {
   lvars = NULL;
+  grid_next = NULL;
+  grid_order = 0;
 
   if (Type<0xffff)
   {
@@ -1578,17 +1550,10 @@ void game_object::change_aitype(int new_type)
       game_object *o=current_object;
       current_object=(game_object *)this;
 
-      time_marker *prof1=NULL;
-      if (profiling())
-        prof1=new time_marker;
-
-      ((LSymbol *)f)->EvalUserFunction(NULL);
-
-      if (profiling())
       {
-    time_marker now;
-    profile_add_time(this->otype,now.diff_time(prof1));
-    delete prof1;
+        profile_scope ps(otype);
+        trace_zone tz("lisp change type", object_names[otype]);
+        ((LSymbol *)f)->EvalUserFunction(NULL);
       }
 
 
@@ -1622,16 +1587,10 @@ void game_object::change_type(int new_type)
 
     void *m = LSpace::Tmp.Mark();
 
-    time_marker *prof1=NULL;
-    if (profiling())
-      prof1=new time_marker;
-
-    ((LSymbol *)figures[new_type]->get_fun(OFUN_CONSTRUCTOR))->EvalFunction(NULL);
-    if (profiling())
     {
-      time_marker now;
-      profile_add_time(otype,now.diff_time(prof1));
-      delete prof1;
+      profile_scope ps(otype);
+      trace_zone tz("lisp constructor", object_names[otype]);
+      ((LSymbol *)figures[new_type]->get_fun(OFUN_CONSTRUCTOR))->EvalFunction(NULL);
     }
 
     LSpace::Tmp.Restore(m);
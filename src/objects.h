@@ -57,6 +57,8 @@ class game_object : public simple_object
   sequence *current_sequence() { return figures[otype]->get_sequence(state); }
 public :
   game_object *next,*next_active;
+  game_object *grid_next;    // next object in the same level grid cell
+  int32_t grid_order;        // position in the level object list at the last grid rebuild
   int32_t *lvars;
 
   int size();
@@ -0,0 +1,265 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "pack.h"
+#include "crc.h"
+
+static int source_compare(void const *a, void const *b)
+{
+    uint32_t x = (*(PackEntry * const *)a)->source;
+    uint32_t y = (*(PackEntry * const *)b)->source;
+    return x < y ? -1 : x > y;
+}
+
+PackFile::PackFile(char const *filename)
+{
+    fp = new mFILE(filename);
+    base = NULL;
+    entries = NULL;
+    by_source = NULL;
+    count = 0;
+    source_size = source_crc = 0;
+    error = NULL;
+
+    long size = fp->file_size();
+    uint8_t const *p = NULL;
+    if (!fp->open_failure() && size >= PACK_HEADER_SIZE)
+        p = (uint8_t const *)fp->mapped(0, size);
+    if (!p || memcmp(p, PACK_MAGIC, 8))
+    {
+        error = "not a pack file";
+        return;
+    }
+
+    base = p;
+    p += 8;
+    if (pack_u32(p) != PACK_VERSION)
+    {
+        error = "unknown pack version";
+        return;
+    }
+    uint32_t n = pack_u32(p);
+    source_size = pack_u32(p);
+    source_crc = pack_u32(p);
+    uint32_t names_size = pack_u32(p);
+    uint32_t index_crc = pack_u32(p);
+
+    if (n > (uint32_t)(size - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE)
+    {
+        error = "truncated index";
+        return;
+    }
+    uint32_t names = PACK_HEADER_SIZE + n * PACK_ENTRY_SIZE;
+    if (!names_size || names_size > size - names || base[names + names_size - 1])
+    {
+        error = "truncated name table";
+        return;
+    }
+    if (crc_update(0, base + PACK_HEADER_SIZE, names + names_size
+                                               - PACK_HEADER_SIZE) != index_crc)
+    {
+        error = "index CRC mismatch";
+        return;
+    }
+
+    entries = (PackEntry *)malloc(sizeof(PackEntry) * (n ? n : 1));
+    by_source = (PackEntry **)malloc(sizeof(PackEntry *) * (n ? n : 1));
+    p = base + PACK_HEADER_SIZE;
+    for (count = 0; count < (int)n; count++)
+    {
+        PackEntry *e = entries + count;
+        uint32_t name = pack_u32(p);
+        e->type = pack_u8(p);
+        p += 3;
+        e->source = pack_u32(p);
+        e->offset = pack_u32(p);
+        e->size = pack_u32(p);
+        e->crc = pack_u32(p);
+        e->checked = 0;
+        p += 8;
+
+        if (name >= names_size || e->offset % PACK_ALIGN
+             || e->offset > size || e->size > size - e->offset)
+        {
+            error = "bad index entry";
+            return;
+        }
+        e->name = (char const *)base + names + name;
+        by_source[count] = e;
+    }
+    qsort(by_source, count, sizeof(PackEntry *), source_compare);
+}
+
+PackFile::~PackFile()
+{
+    free(entries);
+    free(by_source);
+    delete fp;
+}
+
+// Every byte of the .spe counts, the directory alone does not change when
+// an item is replaced by one of the same size
+int PackFile::matches(bFILE *spe)
+{
+    if (error || spe->open_failure() || spe->file_size() != (long)source_size)
+        return 0;
+    return crc_file(spe) == source_crc;
+}
+
+PackEntry *PackFile::find(char const *name, int type)
+{
+    int lo = 0, hi = count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(entries[mid].name, name);
+        if (!cmp)
+            cmp = entries[mid].type - type;
+        if (!cmp)
+            return entries + mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+PackEntry *PackFile::find_source(uint32_t source)
+{
+    int lo = 0, hi = count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (by_source[mid]->source == source)
+            return by_source[mid];
+        if (by_source[mid]->source < source)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+int PackFile::check(PackEntry *e)
+{
+    if (!e->checked)
+        e->checked = crc_update(0, base + e->offset, e->size) == e->crc ? 1 : -1;
+    return e->checked > 0;
+}
+
+char *pack_filename(char const *spe_name)
+{
+    size_t len = strlen(spe_name);
+    char *name = (char *)malloc(len + 5);
+    memcpy(name, spe_name, len);
+    strcpy(name + len, ".pak");
+    return name;
+}
+
+int pack_type(int type)
+{
+    switch (type)
+    {
+        case SPEC_IMAGE :
+        case SPEC_BACKTILE :
+        case SPEC_FORETILE :
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 : return 1;
+    }
+    return 0;
+}
+
+// image: width, height (16 bits), the pixels
+void pack_write_image(bFILE *fp, image *im)
+{
+    ivec2 size = im->Size();
+    fp->write_uint16(size.x);
+    fp->write_uint16(size.y);
+    im->Lock();
+    for (int y = 0; y < size.y; y++)
+        fp->write(im->scan_line(y), size.x);
+    im->Unlock();
+}
+
+image *pack_read_image(uint8_t const *&p)
+{
+    ivec2 size;
+    size.x = pack_u16(p);
+    size.y = pack_u16(p);
+    image *im = new image(size);
+    im->Lock();
+    for (int y = 0; y < size.y; y++, p += size.x)
+        memcpy(im->scan_line(y), p, size.x);
+    im->Unlock();
+    return im;
+}
+
+// TransImage: width, height (16 bits), RLE size (32 bits), the RLE data
+void pack_write_trans(bFILE *fp, TransImage *im)
+{
+    size_t bytes = im->DataSize();
+    fp->write_uint16(im->Size().x);
+    fp->write_uint16(im->Size().y);
+    fp->write_uint32(bytes);
+    fp->write(im->Data(), bytes);
+}
+
+TransImage *pack_read_trans(uint8_t const *&p)
+{
+    ivec2 size;
+    size.x = pack_u16(p);
+    size.y = pack_u16(p);
+    uint32_t bytes = pack_u32(p);
+    TransImage *im = new TransImage(size, p, bytes);
+    p += bytes;
+    return im;
+}
+
+// point_list: count, then x and y of every point
+void pack_write_points(bFILE *fp, point_list *p)
+{
+    fp->write_uint8(p->tot);
+    if (p->tot)
+        fp->write(p->data, p->tot * 2);
+}
+
+point_list *pack_read_points(uint8_t const *&p)
+{
+    unsigned char tot = pack_u8(p);
+    point_list *ret = new point_list(tot, (unsigned char *)p);
+    p += tot * 2;
+    return ret;
+}
+
+// boundary: the points, then the inside side of every segment
+void pack_write_boundary(bFILE *fp, boundary *b)
+{
+    pack_write_points(fp, b);
+    if (b->tot)
+        fp->write(b->inside, b->tot);
+}
+
+boundary *pack_read_boundary(uint8_t const *&p)
+{
+    unsigned char tot = pack_u8(p);
+    boundary *ret = new boundary(tot, p, p + tot * 2);
+    p += tot * 3;
+    return ret;
+}
@@ -0,0 +1,122 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __PACK_HPP_
+#define __PACK_HPP_
+
+#include "specs.h"
+#include "image.h"
+#include "transimage.h"
+#include "points.h"
+
+/*  A pack holds the tiles, images and characters of one .spe file in the
+ *  form the game keeps them in memory: RLE sprites already built, both
+ *  sides of every collision boundary worked out. "abuse-tool <spe> pack"
+ *  writes it as <spe>.pak and the cache uses it instead of the .spe when
+ *  it was made from the same file. All numbers are little endian.
+ *
+ *   header  (64 bytes)   "ABUSEPAK", version, entry count, size and
+ *                        crc_file() of the .spe, index CRC
+ *   index   (32 bytes    name offset, type, offset of the item in the .spe,
+ *            per entry)  blob offset, size and CRC; sorted by name, type
+ *   names                NUL terminated
+ *   blobs                each one starts on a 64 byte boundary
+ *
+ *  Blobs are made of the pieces below, in this order:
+ *
+ *   image      the image
+ *   backtile   the image, next (16 bits)
+ *   foretile   the TransImage, next (16 bits), damage (8 bits), boundary
+ *   character  forward and backward TransImage, hit_damage, xcfg and
+ *              advance (8 bits each), front and back boundary, hit points
+ */
+
+#define PACK_MAGIC "ABUSEPAK"
+#define PACK_VERSION 2
+#define PACK_ALIGN 64
+#define PACK_HEADER_SIZE 64
+#define PACK_ENTRY_SIZE 32
+
+struct PackEntry
+{
+    char const *name;
+    uint8_t type;
+    uint32_t source;      // offset of the item in the .spe
+    uint32_t offset, size;
+    uint32_t crc;
+    int8_t checked;       // 0 until check() has looked at the blob
+};
+
+class PackFile
+{
+public:
+    PackFile(char const *filename);
+    ~PackFile();
+
+    int open_failure() { return error != NULL; }
+    char const *error;    // why the pack can't be used
+
+    // Whether the pack was made from this .spe
+    int matches(bFILE *spe);
+
+    int total() { return count; }
+    PackEntry *entry(int i) { return entries + i; }
+    PackEntry *find(char const *name, int type);
+    PackEntry *find_source(uint32_t source);
+    uint8_t const *blob(PackEntry *e) { return base + e->offset; }
+    int check(PackEntry *e);  // does the blob match its CRC, checked once
+
+    uint32_t source_size, source_crc;
+
+private:
+    mFILE *fp;
+    uint8_t const *base;
+    PackEntry *entries;
+    int count;
+    PackEntry **by_source;
+};
+
+// Pack name for a .spe file, returns a malloc'd string
+char *pack_filename(char const *spe_name);
+
+// Whether items of this type are stored in packs
+int pack_type(int type);
+
+// Blob pieces. The writers append to fp, the readers advance p.
+void pack_write_image(bFILE *fp, image *im);
+void pack_write_trans(bFILE *fp, TransImage *im);
+void pack_write_points(bFILE *fp, point_list *p);
+void pack_write_boundary(bFILE *fp, boundary *b);
+
+image *pack_read_image(uint8_t const *&p);
+TransImage *pack_read_trans(uint8_t const *&p);
+point_list *pack_read_points(uint8_t const *&p);
+boundary *pack_read_boundary(uint8_t const *&p);
+
+static inline uint8_t pack_u8(uint8_t const *&p)
+{
+    return *p++;
+}
+
+static inline uint16_t pack_u16(uint8_t const *&p)
+{
+    uint16_t x = p[0] | (p[1] << 8);
+    p += 2;
+    return x;
+}
+
+static inline uint32_t pack_u32(uint8_t const *&p)
+{
+    uint32_t x = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    p += 4;
+    return x;
+}
+
+#endif
@@ -50,5 +50,189 @@ void point_list::save(bFILE *fp)
   if (tot) fp->write(data,(int)tot*2);
 }
 
+boundary::boundary(bFILE *fp, char const *er_name) : point_list(fp)
+{
+  int x1,y1,x2,y2,checkx,checky,i;
+  if (tot)
+  {
+    if (!(data[0]==data[(tot-1)*2] &&
+      data[1]==data[tot*2-1]))
+    {
+      printf("%s : Endpoints of foretile do not match start points\n",er_name);
+      exit(0);
+    }
+
+    inside=(uint8_t *)calloc(tot,1);  // the closing point has no segment
+  }
+
+  uint8_t *point_on;
+
+  for (i=0,point_on=data; i<tot-1; i++)
+  {
+    x1=*(point_on++);
+    y1=*(point_on++);
+    x2=point_on[0];
+    y2=point_on[1];
+
+    checkx=(x1+x2)/2;
+    checky=(y1+y2)/2;
+
+    int j,xp1,yp1,xp2,yp2,maxx,maxy,minx,miny;
+    uint8_t *point2,segs_left=0,segs_right=0,segs_down=0;
+    int skip_next=0;
+    int check_left=0,check_right=0,check_down=0;
 
 
+    if (y1==y2) check_down=1;
+    else if (x1==x2) check_left=1;
+    else
+    {
+      check_down=1;
+      if (x1<x2)
+        if (y1<y2) check_left=1;
+        else check_right=1;
+      else if (y1<y2) check_right=1;
+      else check_left=1;
+    }
+
+    maxx=Max(x1,x2);
+    maxy=Max(y1,y2);
+    minx=Min(x1,x2);
+    miny=Min(y1,y2);
+
+    if (skip_next)
+      skip_next=0;
+    else
+    {
+      for (j=0,point2=data; j<tot-1; j++,point2+=2)
+      {
+    if (skip_next)
+      skip_next=0;
+    else
+    {
+      if (j!=i)           // make sure we are not looking at ourself
+      {
+        xp1=point2[0];
+        yp1=point2[1];
+        xp2=point2[2];
+        yp2=point2[3];
+
+        if ((checkx>=xp1 && checkx<=xp2) || (checkx>=xp2 &&  checkx<=xp1))
+            {
+            if (check_down && (yp1>miny && yp2>miny))
+        segs_down++;
+          if (checkx==xp2) skip_next=1;
+        } else if ((checky>=yp1 && checky<=yp2) || (checky>=yp2 &&  checky<=yp1))
+        {
+          if (check_left && xp1<maxx && xp2<maxx)
+        segs_left++;
+          if (check_right && xp1>minx && xp2>minx)
+            segs_right++;
+          if (checky==yp2) skip_next=1;
+        }
+      }
+    }
+      }
+    }
+    if (!check_down) segs_down=1;
+    if (!check_right) segs_right=1;
+    if (!check_left) segs_left=1;
+
+    inside[i]=!(((segs_left&1)&&(segs_right&1)&&(segs_down&1)));
+  }
+}
+
+boundary::boundary(boundary *p) : point_list(p->tot,p->data)
+{
+  int x1,y1,x2,y2,checkx,checky,i;
+  uint8_t *point_on;
+  if (tot)
+  {
+    inside=(uint8_t *)calloc(tot,1);
+  } else inside=NULL;
+  for (i=0,point_on=data; i<tot-1; i++)
+  {
+    x1=*(point_on++);
+    y1=*(point_on++);
+    x2=point_on[0];
+    y2=point_on[1];
+
+    checkx=(x1+x2)/2;
+    checky=(y1+y2)/2;
+
+    int j,xp1,yp1,xp2,yp2,maxx,maxy,minx,miny;
+    uint8_t *point2,segs_left=0,segs_right=0,segs_down=0;
+    int skip_next=0;
+    int check_left=0,check_right=0,check_down=0;
+
+
+    if (y1==y2) check_down=1;
+    else if (x1==x2) check_right=1;
+    else
+    {
+      check_down=1;
+      if (x1<x2)
+        if (y1<y2) check_left=1;
+        else check_right=1;
+      else if (y1<y2) check_right=1;
+      else check_left=1;
+    }
+
+
+
+    maxx=Max(x1,x2);
+    maxy=Max(y1,y2);
+    minx=Min(x1,x2);
+    miny=Min(y1,y2);
+
+    if (skip_next)
+      skip_next=0;
+    else
+    {
+      for (j=0,point2=data; j<tot-1; j++,point2+=2)
+      {
+    if (skip_next)
+      skip_next=0;
+    else
+    {
+      if (j!=i)           // make sure we are not looking at ourself
+      {
+        xp1=point2[0];
+        yp1=point2[1];
+        xp2=point2[2];
+        yp2=point2[3];
+
+        if ((checkx>=xp1 && checkx<=xp2) || (checkx>=xp2 &&  checkx<=xp1))
+            {
+            if (check_down && (yp1>miny && yp2>miny))
+        segs_down++;
+          if (checkx==xp2) skip_next=1;
+        } else if ((checky>=yp1 && checky<=yp2) || (checky>=yp2 &&  checky<=yp1))
+        {
+          if (check_left && xp1<maxx && xp2<maxx)
+        segs_left++;
+          if (check_right && xp1>minx && xp2>minx)
+            segs_right++;
+          if (checky==yp2) skip_next=1;
+        }
+      }
+    }
+      }
+    }
+    if (!check_down) segs_down=1;
+    if (!check_right) segs_right=1;
+    if (!check_left) segs_left=1;
+
+    inside[i]=!(((segs_left&1)&&(segs_right&1)&&(segs_down&1)));
+  }
+}
+
+boundary::boundary(unsigned char how_many, uint8_t const *points,
+                   uint8_t const *sides) : point_list(how_many,(unsigned char *)points)
+{
+  if (tot)
+  {
+    inside=(uint8_t *)malloc(tot);
+    memcpy(inside,sides,tot);
+  } else inside=NULL;
+}
@@ -30,6 +30,16 @@ public :
   ~point_list() { if (tot) { free(data); } }
 } ;
 
+class boundary : public point_list      //  a list of points with
+{
+public :
+  boundary(bFILE *fp,char const *er_name);
+  uint8_t *inside;     // tells which side of the line is on the inside
+  boundary(boundary *p);      // flips the *inside list
+  boundary(unsigned char how_many, uint8_t const *points, uint8_t const *sides);
+  ~boundary() { if (tot) free(inside); }
+} ;
+
 #endif
 
 
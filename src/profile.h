@@ -12,6 +12,7 @@
 #define __JPROF_HPP_
 
 #include "event.h"
+#include "trace.h"
 
 void profile_init();
 void profile_reset();
@@ -22,5 +23,24 @@ void profile_toggle();
 int profile_handle_event(Event &ev);
 int profiling();
 
+// Charges the time until the end of the block to an object type. Only
+// reads the clock while the profile window is open.
+class profile_scope
+{
+public:
+    profile_scope(int type) : type(profiling() ? type : -1)
+    {
+        if (this->type >= 0)
+            start = trace_now();
+    }
+    ~profile_scope()
+    {
+        if (type >= 0)
+            profile_add_time(type, trace_seconds(trace_now() - start));
+    }
+private:
+    int type;
+    uint64_t start;
+};
 
 #endif
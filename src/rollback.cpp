@@ -0,0 +1,673 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "common.h"
+
+#include "netface.h"
+#include "rollback.h"
+#include "dprint.h"
+
+int rollback_on = 0;
+
+// Ticks are kept as 32 bit counts, packets only carry the low 8 bits which
+// are expanded relative to our newest tick. Every tick has a slot in a
+// ring holding the input we have for it; a state snapshot for the same
+// tick is kept by the game in the slot of the same number.
+
+struct rb_buf
+{
+    uint8_t *data;
+    int size, alloc;
+};
+
+struct rb_slot
+{
+    int32_t tick;
+    uint32_t players;   // remote players that take part in this tick
+    uint32_t have;      // players whose real input arrived
+    uint32_t guessed;   // players the tick was last simulated without
+    int has_local;
+    rb_buf local;
+    rb_buf got[ROLLBACK_PLAYERS], guess[ROLLBACK_PLAYERS];
+};
+
+static rb_slot slots[ROLLBACK_MAX];
+static int window = 8, redundancy = 3;
+static int started = 0, stalled = 0, reload_pending = 0;
+static int local_player = 0;
+static uint32_t players = 0;
+static int32_t first_tick,  // oldest tick we have a snapshot for
+               last_tick,   // our newest tick
+               sim_tick,    // newest tick handed to the game
+               confirmed,   // all input up to here is real
+               replay_from; // oldest simulated tick whose input changed
+
+// Our sync at the start of each tick, for the desync check. The ones up
+// to checked + 1 were taken with real input only.
+static struct
+{
+    int32_t tick;
+    uint16_t sync;
+} syncs[ROLLBACK_MAX];
+static int32_t checked;
+
+// Last SCMD_SET_INPUT seen from each player, for when the ring has none
+static uint8_t known[ROLLBACK_PLAYERS][7];
+static int32_t known_tick[ROLLBACK_PLAYERS];
+
+static struct
+{
+    int ticks, predicted, wrong, rollbacks, replayed, deepest, failed,
+        stalls, dups, recovered, resent, desyncs;
+} stats;
+
+int rollback_init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-rollback"))
+        {
+            rollback_on = 1;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+                window = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-redundancy") && i + 1 < argc)
+            redundancy = atoi(argv[++i]);
+    if (redundancy < 0)
+        redundancy = 0;
+    if (redundancy > ROLLBACK_MAX / 2 - 1)
+        redundancy = ROLLBACK_MAX / 2 - 1;
+    if (window > ROLLBACK_MAX / 2 - 1)
+        window = ROLLBACK_MAX / 2 - 1;
+    if (rollback_on)
+        printf("Net: rollback, up to %d ticks ahead, %d ticks resent in "
+               "every packet\n", window, redundancy);
+    return rollback_on;
+}
+
+void rollback_reset()
+{
+    started = 0;
+    stalled = 0;
+    reload_pending = 0;
+    for (int i = 0; i < ROLLBACK_MAX; i++)
+        slots[i].tick = syncs[i].tick = INT_MIN;
+    for (int i = 0; i < ROLLBACK_PLAYERS; i++)
+        known_tick[i] = INT_MIN;
+}
+
+void rollback_report()
+{
+    if (!rollback_on)
+        return;
+    dprintf("rollback: %d ticks, %d predicted (%d wrong), %d rollbacks "
+            "replaying %d ticks (deepest %d, %d failed), %d stalls, "
+            "%d duplicates, %d inputs recovered from later packets, "
+            "%d resent, %d out of sync\n", stats.ticks, stats.predicted,
+            stats.wrong, stats.rollbacks, stats.replayed, stats.deepest,
+            stats.failed, stats.stalls, stats.dups, stats.recovered,
+            stats.resent, stats.desyncs);
+}
+
+void rollback_players(uint32_t mask)
+{
+    players = mask;
+}
+
+// Size of a packet command, 0 if unknown
+static int command_size(uint8_t const *pk)
+{
+    switch (*pk)
+    {
+    case SCMD_DELETE_CLIENT: return 2;
+    case SCMD_VIEW_RESIZE: return 2 + 8 * 4;
+    case SCMD_SET_INPUT: return 3 + 2 * 2;
+    case SCMD_WEAPON_CHANGE: return 2 + 4;
+    case SCMD_RELOAD: return 1;
+    case SCMD_KEYPRESS:
+    case SCMD_KEYRELEASE:
+    case SCMD_EXT_KEYPRESS:
+    case SCMD_EXT_KEYRELEASE:
+    case SCMD_CHAT_KEYPRESS: return 3;
+    case SCMD_SYNC: return 3;
+    }
+    return 0;
+}
+
+// Player that sent a packet, from the first command that names one
+static int packet_player(uint8_t const *pk, int size)
+{
+    for (int i = 0, n; i < size; i += n)
+    {
+        n = command_size(pk + i);
+        if (!n || i + n > size)
+            break;
+        if (pk[i] != SCMD_DELETE_CLIENT && pk[i] != SCMD_RELOAD
+             && pk[i] != SCMD_SYNC)
+            return pk[i + 1] < ROLLBACK_PLAYERS ? pk[i + 1] : -1;
+    }
+    return -1;
+}
+
+static void buf_set(rb_buf *b, uint8_t const *data, int size)
+{
+    if (size > b->alloc)
+    {
+        b->alloc = size;
+        b->data = (uint8_t *)realloc(b->data, size);
+    }
+    memcpy(b->data, data, size);
+    b->size = size;
+}
+
+static rb_slot *slot_for(int32_t tick)
+{
+    rb_slot *s = &slots[tick & (ROLLBACK_MAX - 1)];
+    if (s->tick != tick)
+    {
+        s->tick = tick;
+        s->players = players;
+        s->have = s->guessed = 0;
+        s->has_local = 0;
+    }
+    return s;
+}
+
+static int32_t expand_tick(uint8_t tick)
+{
+    return last_tick + (int8_t)(tick - (uint8_t)last_tick);
+}
+
+// Notes reloads and player deletions in a real packet for tick
+static void scan_packet(int32_t tick, uint8_t const *pk, int size)
+{
+    for (int i = 0, n; i < size; i += n)
+    {
+        n = command_size(pk + i);
+        if (!n || i + n > size)
+            break;
+        if (pk[i] == SCMD_RELOAD)
+            reload_pending = 1;
+        else if (pk[i] == SCMD_DELETE_CLIENT && pk[i + 1] < ROLLBACK_PLAYERS)
+        {
+            // the player is gone for every later tick, even ones that
+            // were already set up
+            uint32_t bit = 1u << pk[i + 1];
+            players &= ~bit;
+            for (int j = 0; j < ROLLBACK_MAX; j++)
+                if (slots[j].tick > tick)
+                    slots[j].players &= ~bit;
+        } else if (pk[i] == SCMD_SET_INPUT
+                    && tick > known_tick[pk[i + 1] & (ROLLBACK_PLAYERS - 1)])
+        {
+            int p = pk[i + 1] & (ROLLBACK_PLAYERS - 1);
+            memcpy(known[p], pk + i, n);
+            known_tick[p] = tick;
+        }
+    }
+}
+
+void rollback_local(uint32_t tick, int player, uint8_t const *pk, int size)
+{
+    if (!started || (int32_t)tick != last_tick + 1)
+    {
+        // first tick or the level changed under us, start over
+        rollback_reset();
+        started = 1;
+        first_tick = tick;
+        sim_tick = confirmed = checked = tick - 1;
+        replay_from = INT_MAX;
+    }
+    last_tick = tick;
+    local_player = player;
+
+    rb_slot *s = slot_for(tick);
+    s->players = players & ~(1u << player);
+    s->has_local = 1;
+    buf_set(&s->local, pk, size);
+    scan_packet(tick, pk, size);
+}
+
+int rollback_sync(uint32_t tick)
+{
+    int32_t at = (int32_t)tick - ROLLBACK_SYNC_LAG;
+    if (!started || (int32_t)tick != last_tick + 1 || at > checked + 1
+         || syncs[at & (ROLLBACK_MAX - 1)].tick != at)
+        return -1;
+    return syncs[at & (ROLLBACK_MAX - 1)].sync;
+}
+
+// how an input reached us, for the stats
+enum { ARRIVED, RECOVERED, RESENT };
+
+static void add_remote(int32_t t, uint8_t const *pk, int size, int how)
+{
+    int p = packet_player(pk, size);
+    if (t < first_tick || t <= last_tick - ROLLBACK_MAX / 2
+         || t >= last_tick + ROLLBACK_MAX / 2 || p < 0 || p == local_player)
+        return;
+
+    rb_slot *s = slot_for(t);
+    uint32_t bit = 1u << p;
+    if (!(s->players & bit))
+        return;
+    if (s->have & bit)
+    {
+        if (how != RECOVERED)   // the older inputs in a bundle usually are
+            stats.dups++;
+        return;
+    }
+    s->have |= bit;
+    buf_set(&s->got[p], pk, size);
+    scan_packet(t, pk, size);
+    if (how == RECOVERED)
+        stats.recovered++;
+    else if (how == RESENT)
+        stats.resent++;
+
+    if (t <= sim_tick && (s->guessed & bit))
+    {
+        rb_buf *g = &s->guess[p];
+        if (g->size != size || memcmp(g->data, pk, size))
+        {
+            stats.wrong++;
+            if (t < replay_from)
+                replay_from = t;
+        }
+    }
+}
+
+// A bundle is a count byte (bit 7 set for an answer to a resend request)
+// and that many inputs, newest first, for consecutive ticks. Each one is
+// its size in two bytes and a mode byte, then for mode 0 the bytes as
+// they are, or for mode 1 runs over the newer input of the same size:
+// a count of bytes that are the same, then a count of bytes that differ
+// followed by those bytes.
+
+static int put_input(uint8_t *dst, int max, uint8_t const *pk, int size,
+                     uint8_t const *newer, int newer_size)
+{
+    int n = 0;
+    if (max < 3)
+        return -1;
+    dst[n++] = size & 0xff;
+    dst[n++] = size >> 8;
+    if (!newer || newer_size != size)
+    {
+        if (n + 1 + size > max)
+            return -1;
+        dst[n++] = 0;
+        memcpy(dst + n, pk, size);
+        return n + size;
+    }
+
+    dst[n++] = 1;
+    for (int i = 0; i < size; )
+    {
+        int same = 0, diff = 0;
+        while (i + same < size && same < 255 && pk[i + same] == newer[i + same])
+            same++;
+        i += same;
+        while (i + diff < size && diff < 255 && pk[i + diff] != newer[i + diff])
+            diff++;
+        if (n + 2 + diff > max)
+            return -1;
+        dst[n++] = same;
+        dst[n++] = diff;
+        memcpy(dst + n, pk + i, diff);
+        n += diff;
+        i += diff;
+    }
+    return n;
+}
+
+static int get_input(uint8_t const *src, int max, uint8_t *pk, int &size,
+                     uint8_t const *newer, int newer_size)
+{
+    int n = 0;
+    if (max < 3)
+        return -1;
+    size = src[0] | (src[1] << 8);
+    n = 3;
+    if (size > PACKET_MAX_SIZE)
+        return -1;
+    if (src[2] == 0)
+    {
+        if (n + size > max)
+            return -1;
+        memcpy(pk, src + n, size);
+        return n + size;
+    }
+    if (src[2] != 1 || !newer || newer_size != size)
+        return -1;
+
+    for (int i = 0; i < size; )
+    {
+        if (n + 2 > max)
+            return -1;
+        int same = src[n], diff = src[n + 1];
+        n += 2;
+        if (i + same + diff > size || n + diff > max || !(same + diff))
+            return -1;
+        memcpy(pk + i, newer + i, same);
+        i += same;
+        memcpy(pk + i, src + n, diff);
+        n += diff;
+        i += diff;
+    }
+    return n;
+}
+
+int rollback_bundle(uint8_t tick, int player, int resend, uint8_t *buf, int max)
+{
+    uint8_t in[2][PACKET_MAX_SIZE];
+    int in_size[2] = { 0, 0 }, total = 0, size = 1;
+
+    for (int i = 0; i <= redundancy && max > size; i++)
+    {
+        uint8_t *pk = in[i & 1], *newer = in[(i & 1) ^ 1];
+        in_size[i & 1] = rollback_get(tick - i, player, pk);
+        if (in_size[i & 1] < 0)
+            break;
+        int n = put_input(buf + size, max - size, pk, in_size[i & 1],
+                          i ? newer : NULL, in_size[(i & 1) ^ 1]);
+        if (n < 0)
+            break;
+        size += n;
+        total++;
+    }
+    buf[0] = total | (resend ? 0x80 : 0);
+    return total ? size : 0;
+}
+
+void rollback_unbundle(uint8_t tick, uint8_t const *pk, int size)
+{
+    uint8_t in[2][PACKET_MAX_SIZE];
+    int in_size[2] = { 0, 0 };
+
+    if (!started || size < 1)
+        return;
+    int total = pk[0] & 0x7f, resend = pk[0] & 0x80, n = 1;
+    for (int i = 0; i < total; i++)
+    {
+        uint8_t *cur = in[i & 1], *newer = in[(i & 1) ^ 1];
+        int used = get_input(pk + n, size - n, cur, in_size[i & 1],
+                             i ? newer : NULL, in_size[(i & 1) ^ 1]);
+        if (used < 0)
+            break;
+        n += used;
+        add_remote(expand_tick(tick - i), cur, in_size[i & 1],
+                   resend ? RESENT : i ? RECOVERED : ARRIVED);
+    }
+}
+
+int rollback_get(uint8_t tick, int player, uint8_t *buf)
+{
+    if (!started || player >= ROLLBACK_PLAYERS)
+        return -1;
+    int32_t t = expand_tick(tick);
+    rb_slot *s = &slots[t & (ROLLBACK_MAX - 1)];
+    if (s->tick != t)
+        return -1;
+    rb_buf *b;
+    if (player < 0)
+    {
+        if (!s->has_local)
+            return -1;
+        b = &s->local;
+    } else
+    {
+        if (!(s->have & (1u << player)))
+            return -1;
+        b = &s->got[player];
+    }
+    memcpy(buf, b->data, b->size);
+    return b->size;
+}
+
+static void advance_confirmed()
+{
+    while (confirmed < last_tick)
+    {
+        rb_slot *s = &slots[(confirmed + 1) & (ROLLBACK_MAX - 1)];
+        if (s->tick != confirmed + 1 || !s->has_local
+             || (s->players & ~s->have))
+            break;
+        confirmed++;
+    }
+}
+
+int rollback_ready()
+{
+    if (!started)
+        return 1;
+    advance_confirmed();
+    if (last_tick - confirmed <= window)
+        return 1;
+    stalled = 1;
+    return 0;
+}
+
+uint8_t rollback_waiting_tick()
+{
+    return (uint8_t)(confirmed + 1);
+}
+
+uint32_t rollback_missing()
+{
+    rb_slot *s = &slots[(confirmed + 1) & (ROLLBACK_MAX - 1)];
+    if (!started || confirmed >= last_tick || s->tick != confirmed + 1)
+        return 0;
+    return s->players & ~s->have;
+}
+
+void rollback_skip()
+{
+    // players still missing are dropped from the ticks they held up
+    for (int32_t t = confirmed + 1; started && t <= last_tick; t++)
+    {
+        rb_slot *s = slot_for(t);
+        s->players &= s->have;
+    }
+}
+
+// Guess: the player's input from the newest earlier tick we have
+static void make_guess(int32_t tick, int p, rb_buf *g)
+{
+    for (int32_t t = tick - 1; t >= first_tick && t > tick - ROLLBACK_MAX; t--)
+    {
+        rb_slot *s = &slots[t & (ROLLBACK_MAX - 1)];
+        if (s->tick != t || !(s->have & (1u << p)))
+            continue;
+        uint8_t const *pk = s->got[p].data;
+        int size = s->got[p].size;
+        for (int i = 0, n; i < size; i += n)
+        {
+            n = command_size(pk + i);
+            if (!n || i + n > size)
+                break;
+            if (pk[i] == SCMD_SET_INPUT)
+            {
+                buf_set(g, pk + i, n);
+                return;
+            }
+        }
+    }
+    if (known_tick[p] != INT_MIN && known_tick[p] < tick)
+        buf_set(g, known[p], sizeof(known[p]));
+    else
+        g->size = 0;
+}
+
+// Appends the commands of one player's packet, leaving out the ones that
+// only make sense once: reloads go with the newest tick, deletions at the
+// end so the rest of the tick still finds the player
+static int add_commands(uint8_t *buf, int size, uint8_t *tail, int &tail_size,
+                        uint8_t const *pk, int pk_size)
+{
+    for (int i = 0, n; i < pk_size; i += n)
+    {
+        n = command_size(pk + i);
+        if (!n || i + n > pk_size)
+            break;
+        if (pk[i] == SCMD_RELOAD || pk[i] == SCMD_SYNC)
+            continue;
+        if (pk[i] == SCMD_DELETE_CLIENT)
+        {
+            if (tail_size + n <= PACKET_MAX_SIZE / 2)
+            {
+                memcpy(tail + tail_size, pk + i, n);
+                tail_size += n;
+            }
+        } else if (size + n <= PACKET_MAX_SIZE - PACKET_MAX_SIZE / 2 - 1)
+        {
+            memcpy(buf + size, pk + i, n);
+            size += n;
+        }
+    }
+    return size;
+}
+
+// Combined input for a tick, in player order so every peer builds the same
+static int build_packet(int32_t tick, uint8_t *buf, int newest)
+{
+    rb_slot *s = slot_for(tick);
+    uint8_t tail[PACKET_MAX_SIZE / 2];
+    int size = 0, tail_size = 0;
+
+    s->guessed = 0;
+    for (int p = 0; p < ROLLBACK_PLAYERS; p++)
+    {
+        uint32_t bit = 1u << p;
+        if (p == local_player)
+        {
+            if (s->has_local)
+                size = add_commands(buf, size, tail, tail_size,
+                                    s->local.data, s->local.size);
+        } else if (s->have & bit)
+            size = add_commands(buf, size, tail, tail_size,
+                                s->got[p].data, s->got[p].size);
+        else if (s->players & bit)
+        {
+            make_guess(tick, p, &s->guess[p]);
+            s->guessed |= bit;
+            size = add_commands(buf, size, tail, tail_size,
+                                s->guess[p].data, s->guess[p].size);
+        }
+    }
+    if (s->guessed && newest)
+        stats.predicted++;
+
+    memcpy(buf + size, tail, tail_size);
+    size += tail_size;
+    if (newest && reload_pending)
+    {
+        buf[size++] = SCMD_RELOAD;
+        reload_pending = 0;
+    }
+    return size;
+}
+
+static void note_sync(int32_t tick)
+{
+    syncs[tick & (ROLLBACK_MAX - 1)].tick = tick;
+    syncs[tick & (ROLLBACK_MAX - 1)].sync = rollback_state_sync();
+}
+
+// Compares the syncs the others sent with a confirmed tick to ours
+static void check_sync(int32_t tick)
+{
+    rb_slot *s = &slots[tick & (ROLLBACK_MAX - 1)];
+    int32_t at = tick - ROLLBACK_SYNC_LAG;
+    if (s->tick != tick || syncs[at & (ROLLBACK_MAX - 1)].tick != at)
+        return;
+    uint16_t ours = syncs[at & (ROLLBACK_MAX - 1)].sync;
+
+    for (int p = 0; p < ROLLBACK_PLAYERS; p++)
+    {
+        if (!(s->have & (1u << p)))
+            continue;
+        uint8_t const *pk = s->got[p].data;
+        int size = s->got[p].size;
+        for (int i = 0, n; i < size; i += n)
+        {
+            n = command_size(pk + i);
+            if (!n || i + n > size)
+                break;
+            if (pk[i] != SCMD_SYNC)
+                continue;
+            uint16_t x;
+            memcpy(&x, pk + i + 1, 2);
+            x = lstl(x);
+            if (x != ours)
+            {
+                dprintf("rollback: out of sync at tick %d with player %d "
+                        "(packet=%d, calced=%d)\n", at, p, x, ours);
+                stats.desyncs++;
+                reload_pending = 1;
+            }
+        }
+    }
+}
+
+int rollback_inputs(uint8_t *buf)
+{
+    advance_confirmed();
+    int32_t t = last_tick;
+    stats.ticks++;
+    if (stalled)
+    {
+        stats.stalls++;
+        stalled = 0;
+    }
+
+    if (replay_from <= sim_tick)
+    {
+        int32_t from = replay_from;
+        if (rollback_load_state(from & (ROLLBACK_MAX - 1)))
+        {
+            uint8_t tmp[PACKET_MAX_SIZE + 1];
+            for (int32_t k = from; k < t; k++)
+            {
+                if (k > from)
+                    rollback_save_state(k & (ROLLBACK_MAX - 1));
+                note_sync(k);
+                rollback_replay_tick(tmp, build_packet(k, tmp, 0));
+            }
+            stats.rollbacks++;
+            stats.replayed += t - from;
+            if (t - from > stats.deepest)
+                stats.deepest = t - from;
+        } else
+            stats.failed++;
+    }
+    replay_from = INT_MAX;
+
+    // input that is all in already can never be replayed
+    if (confirmed < t)
+        rollback_save_state(t & (ROLLBACK_MAX - 1));
+    sim_tick = t;
+
+    // everything up to confirmed was simulated with real input now
+    note_sync(t);
+    while (checked < confirmed)
+        check_sync(++checked);
+
+    return build_packet(t, buf, 1);
+}
+
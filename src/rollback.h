@@ -0,0 +1,74 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __ROLLBACK_HPP_
+#define __ROLLBACK_HPP_
+
+#include <stdint.h>
+
+// Rollback networking. "-rollback [N]" lets a net game run up to N ticks
+// (default 8) ahead of the slowest peer instead of waiting for everyone's
+// input every tick. Missing remote input is guessed by repeating that
+// player's last SCMD_SET_INPUT; when the real input turns out different,
+// the level goes back to the snapshot taken before that tick and the
+// ticks since are simulated again. Every peer in a game must use it.
+//
+// The SCMD_SYNC in our input for tick t is the sync of the state at the
+// start of tick t - ROLLBACK_SYNC_LAG, which every peer has simulated with
+// real input by then. They are compared once tick t is confirmed and a
+// mismatch reloads the level, as it does without rollback.
+
+#define ROLLBACK_MAX      32     // ticks of input and snapshots kept
+#define ROLLBACK_PLAYERS  32     // player numbers 0..31
+#define ROLLBACK_SYNC_LAG (ROLLBACK_MAX / 2)
+
+extern int rollback_on;
+
+int rollback_init(int argc, char **argv);  // returns non 0 if -rollback was given
+void rollback_reset();                     // forget everything, e.g. after a level load
+void rollback_report();
+
+// Remote players in the game, one bit per player number
+void rollback_players(uint32_t mask);
+
+// Our input for a tick, once it is complete
+void rollback_local(uint32_t tick, int player, uint8_t const *pk, int size);
+
+// The sync to send with our input for tick, -1 if there is none yet
+int rollback_sync(uint32_t tick);
+
+// A stored input, player -1 is ours. Returns its size or -1 if unknown.
+int rollback_get(uint8_t tick, int player, uint8_t *buf);
+
+// What goes over the wire: a player's input for a tick bundled with the
+// inputs for the ticks before it ("-redundancy N", default 3), so a lost
+// packet is usually made up for by the next one without asking again.
+// Returns the size used in buf or 0 if we have nothing for that tick.
+int rollback_bundle(uint8_t tick, int player, int resend, uint8_t *buf, int max);
+void rollback_unbundle(uint8_t tick, uint8_t const *pk, int size);
+
+int rollback_ready();           // 0 if we are too far ahead to go on
+uint8_t rollback_waiting_tick();   // oldest tick that is missing input
+uint32_t rollback_missing();    // players missing from that tick
+void rollback_skip();           // stop waiting for the missing input
+
+// Rewinds and replays if needed, then fills buf with the combined input
+// for our newest tick and returns its size
+int rollback_inputs(uint8_t *buf);
+
+// Provided by the game: snapshots are kept in ROLLBACK_MAX slots and a
+// replayed tick must do everything a normal one does except drawing
+void rollback_save_state(int slot);
+int rollback_load_state(int slot);         // 0 if the snapshot is unusable
+void rollback_replay_tick(uint8_t *pk, int size);
+uint16_t rollback_state_sync();            // make_sync() of the level now
+
+#endif
+
@@ -57,7 +57,8 @@ void EventHandler::SysWarpMouse(ivec2 pos)
     // This should take into account mouse scaling.
     pos.x = ((pos.x * mouse_xscale + 0x8000) >> 16) + mouse_xpad;
     pos.y = ((pos.y * mouse_yscale + 0x8000) >> 16) + mouse_ypad;
-    SDL_WarpMouseInWindow(window, pos.x, pos.y);
+    if (window)
+        SDL_WarpMouseInWindow(window, pos.x, pos.y);
 }
 
 //
@@ -63,7 +63,20 @@ void showHelp(const char* executableName)
     printf( "  -a <arg>          Use addon named <arg>\n" );
     printf( "  -f <arg>          Load map file named <arg>\n" );
     printf( "  -lisp             Startup in lisp interpreter mode\n" );
+    printf( "  -lisp-bench       Time symbol lookups after loading the lisp files\n" );
+    printf( "  -gc-nursery <kb>  Collect permanent lisp space generationally\n" );
+    printf( "  -no-bytecode      Interpret lisp functions instead of compiling them\n" );
     printf( "  -nodelay          Run at maximum speed\n" );
+    printf( "  -bench <demo>     Replay a demo headless and print timings, a level\n" );
+    printf( "                    (.spe) is run with no input for -ticks ticks\n" );
+    printf( "  -ticks <n>        Stop the benchmark after <n> ticks\n" );
+    printf( "  -dedicated        With -server, host without a window, sound or drawing\n" );
+    printf( "  -tickrate <n>     Dedicated server ticks per second (default 15)\n" );
+    printf( "  -threads <n>      Use <n> extra threads for lighting (0 disables)\n" );
+    printf( "  -prefetch         Load graphics in the background before they are seen\n" );
+    printf( "  -cache-mb <n>     Keep at most <n> MB of tiles and sprites loaded\n" );
+    printf( "  -rollback [n]     Net game: run up to <n> ticks ahead of peers (default 8)\n" );
+    printf( "  -redundancy <n>   Rollback: repeat each input in <n> later packets (default 3)\n" );
     printf( "\n" );
     printf( "** Abuse-SDL Options **\n" );
     printf( "  -datadir <arg>    Set the location of the game data to <arg>\n" );
@@ -372,6 +385,19 @@ void setup( int argc, char **argv )
     keys.b3                  = key_value( "CTRL_R" );
     keys.b4                  = key_value( "INSERT" );
     scale                    = 2;    // Default scale amount
+    flags.headless           = 0;    // Open a window
+
+    // Benchmark runs and dedicated servers have no window and no sound,
+    // tell SDL before it looks for a display
+    for( int ii = 1; ii < argc; ii++ )
+    {
+        if( !strcasecmp( argv[ii], "-bench" ) || !strcasecmp( argv[ii], "-dedicated" ) )
+        {
+            flags.headless = 1;
+            SDL_setenv( "SDL_VIDEODRIVER", "dummy", 1 );
+            SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+        }
+    }
 
     // Display our name and version
     printf( "%s %s\n", PACKAGE_NAME, PACKAGE_VERSION );
@@ -479,6 +505,8 @@ void setup( int argc, char **argv )
 
     // Handle command-line parameters
     parseCommandLine( argc, argv );
+    if( flags.headless )
+        flags.nosound = 1;
 
     // Calculate the scaled window size.
     flags.xres = xres * scale;
@@ -22,6 +22,7 @@ struct flags_struct
     short overlay;
     int antialias;
     int software;
+    int headless;
 };
 
 struct keys_struct
@@ -114,18 +114,31 @@ void sound_uninit()
 //
 sound_effect::sound_effect(char const *filename)
 {
+    m_chunk = NULL;
     if (!sound_enabled)
         return;
 
-    jFILE fp(filename, "rb");
-    if (fp.open_failure())
+    bFILE *fp = open_mapped_file(filename);
+    if (fp->open_failure())
+    {
+        delete fp;
         return;
+    }
 
-    void *temp_data = malloc(fp.file_size());
-    fp.read(temp_data, fp.file_size());
-    SDL_RWops *rw = SDL_RWFromMem(temp_data, fp.file_size());
+    // Decode straight from the mapping when there is one
+    int size = fp->file_size();
+    void const *data = fp->mapped(0, size);
+    void *temp_data = NULL;
+    if (!data)
+    {
+        temp_data = malloc(size);
+        fp->read(temp_data, size);
+        data = temp_data;
+    }
+    SDL_RWops *rw = SDL_RWFromConstMem(data, size);
     m_chunk = Mix_LoadWAV_RW(rw, 1);
     free(temp_data);
+    delete fp;
 }
 
 //
@@ -150,6 +163,11 @@ sound_effect::~sound_effect()
     Mix_FreeChunk(m_chunk);
 }
 
+size_t sound_effect::MemUsage()
+{
+    return sound_enabled && m_chunk ? m_chunk->alen : 0;
+}
+
 //
 // sound_effect::play
 //
@@ -31,6 +31,7 @@ public:
     ~sound_effect();
 
     void play(int volume = 127, int pitch = 128, int panpot = 128);
+    size_t MemUsage();
 
 private:
 #if !defined __CELLOS_LV2__
@@ -35,7 +35,6 @@
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
 SDL_Surface *surface = NULL;
-SDL_Surface *screen = NULL;
 SDL_Texture *texture = NULL;
 image *main_screen = NULL;
 int mouse_xpad, mouse_ypad, mouse_xscale, mouse_yscale;
@@ -44,7 +43,11 @@ int xres, yres;
 extern palette *lastl;
 extern flags_struct flags;
 
+// The current palette as texture pixels
+static uint32_t rgb_lut[256];
+
 void calculate_mouse_scaling();
+static void present_rect(int x, int y, int w, int h);
 
 //
 // set_mode()
@@ -68,6 +71,25 @@ void set_mode(int argc, char **argv)
     // FIXME: Set the icon for this window.  Looks nice on taskbars etc.
     //SDL_WM_SetIcon(SDL_LoadBMP("abuse.bmp"), NULL);
 
+    // Headless runs only need the offscreen image and the 8-bit surface
+    // that palette::load() and put_part_image() write to
+    if (flags.headless)
+    {
+        main_screen = new image(ivec2(xres, yres), NULL, 2);
+        main_screen->clear();
+        surface = SDL_CreateRGBSurface(0, xres, yres, 8, 0, 0, 0, 0);
+        if (surface == NULL)
+        {
+            show_startup_error("Video : Unable to create 8-bit surface: %s", SDL_GetError());
+            exit(1);
+        }
+        mouse_xscale = mouse_yscale = 1 << 16;
+        mouse_xpad = mouse_ypad = 0;
+        printf("Video : %dx%d headless\n", xres, yres);
+        update_dirty(main_screen);
+        return;
+    }
+
     window = SDL_CreateWindow("Abuse",
         SDL_WINDOWPOS_UNDEFINED,
         SDL_WINDOWPOS_UNDEFINED,
@@ -112,14 +134,8 @@ void set_mode(int argc, char **argv)
         show_startup_error("Video : Unable to create 8-bit surface: %s", SDL_GetError());
         exit(1);
     }
-    // Create our surface for the OpenGL texture
-    screen = SDL_CreateRGBSurface(0, xres, yres, 32, 0, 0, 0, 0);
-    if (screen == NULL)
-    {
-        show_startup_error("Video : Unable to create 32-bit surface: %s", SDL_GetError());
-        exit(1);
-    }
-    // And create our OpenGL texture
+    // And create our OpenGL texture, the dirty parts of the 8-bit surface
+    // are expanded straight into it
     texture = SDL_CreateTexture(renderer,
         SDL_PIXELFORMAT_ARGB8888,
         SDL_TEXTUREACCESS_STREAMING,
@@ -148,6 +164,8 @@ void set_mode(int argc, char **argv)
 
 void video_change_settings(void)
 {
+    if (!window)
+        return;
     SDL_SetWindowFullscreen(window,
         flags.fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0);
     calculate_mouse_scaling();
@@ -185,8 +203,6 @@ void close_graphics()
     // Free our 8-bit surface
     if(surface)
         SDL_FreeSurface(surface);
-    if (screen)
-        SDL_FreeSurface(screen);
     if (texture)
         SDL_DestroyTexture(texture);
     delete main_screen;
@@ -269,6 +285,29 @@ void put_part_image(image *im, int x, int y, int x1, int y1, int x2, int y2)
     // Unlock the surface if we locked it.
     if(SDL_MUSTLOCK(surface))
         SDL_UnlockSurface(surface);
+
+    present_rect(x, y, srcrect.w, srcrect.h);
+}
+
+//
+// present_rect()
+// Convert part of the 8-bit surface into the texture
+//
+static void present_rect(int x, int y, int w, int h)
+{
+    if (!texture)
+        return;
+
+    SDL_Rect rect = { x, y, w, h };
+    void *pixels;
+    int pitch;
+    // The locked area is write-only, all of it must be filled
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0)
+        return;
+    expand_rect((uint32_t *)pixels, pitch,
+                (uint8_t *)surface->pixels + y * surface->pitch + x,
+                surface->pitch, w, h, rgb_lut);
+    SDL_UnlockTexture(texture);
 }
 
 //
@@ -298,10 +337,12 @@ void palette::load()
         colors[ii].g = green(ii);
         colors[ii].b = blue(ii);
         colors[ii].a = 255;
+        rgb_lut[ii] = 0xff000000 | (red(ii) << 16) | (green(ii) << 8) | blue(ii);
     }
     SDL_SetPaletteColors(surface->format->palette, colors, 0, ncolors);
 
-    // Now redraw the surface
+    // Now redraw the whole surface with the new colours
+    present_rect(0, 0, xres, yres);
     update_window_done();
 }
 
@@ -317,10 +358,9 @@ void palette::load_nice()
 
 void update_window_done()
 {
-    // Convert to match the OpenGL texture
-    SDL_BlitSurface(surface, NULL, screen, NULL);
-    // Copy over to the OpenGL texture
-    SDL_UpdateTexture(texture, NULL, screen->pixels, screen->pitch);
+    if (flags.headless)
+        return;
+    // put_part_image() already updated the texture
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
@@ -76,6 +76,7 @@ spec_directory *spec_directory_cache::get_spec_directory(char const *filename, b
   }
 
   filename_node *f=new filename_node(filename,new spec_directory(fp));
+  f->sd->build_index();       // cached directories are searched by name a lot
   f->next=fn_list;
   fn_list=f;
 
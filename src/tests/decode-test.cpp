@@ -0,0 +1,202 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// Level load decoding, one item at a time against the batch. The game is
+// started with no window, then every tile, figure and image in the .spe
+// files given on the command line is registered in the cache twice with
+// CacheList::reg(). One set is loaded with CacheList::decode_batch(), the
+// way level loads do, the other one item at a time through backt(),
+// foret(), fig() and img(). Pixels, boundaries and hit points have to be
+// the same. Files are relative to the data directory.
+//
+//   decode-test -datadir <dir> [-threads <n>] <file.spe>...
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "SDL.h"
+
+#include "common.h"
+
+#include "specs.h"
+#include "image.h"
+#include "items.h"
+#include "cache.h"
+#include "workers.h"
+
+#include "harness.h"
+
+static void *load(int id, int type)
+{
+    switch (type)
+    {
+        case SPEC_BACKTILE : return cache.backt(id);
+        case SPEC_FORETILE : return cache.foret(id);
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 : return cache.fig(id);
+        case SPEC_IMAGE : return cache.img(id);
+    }
+    return NULL;
+}
+
+static uint32_t hash_image(uint32_t h, image *im)
+{
+    for (int y = 0; y < im->Size().y; y++)
+        for (int x = 0; x < im->Size().x; x++)
+            h = h * 31 + im->scan_line(y)[x];
+    return h + im->Size().x * 7 + im->Size().y;
+}
+
+static uint32_t hash_trans(uint32_t h, TransImage *im)
+{
+    image *tmp = im->ToImage();
+    h = hash_image(h, tmp);
+    delete tmp;
+    return h;
+}
+
+static uint32_t hash_boundary(uint32_t h, boundary *b)
+{
+    h = h * 31 + b->tot;
+    for (int i = 0; i < b->tot * 2; i++)
+        h = h * 31 + b->data[i];
+    for (int i = 0; i < b->tot; i++)
+        h = h * 31 + b->inside[i];
+    return h;
+}
+
+static uint32_t hash_part(void *data, int type)
+{
+    uint32_t h = 0;
+    switch (type)
+    {
+        case SPEC_BACKTILE :
+            return hash_image(((backtile *)data)->next, ((backtile *)data)->im);
+        case SPEC_FORETILE :
+        {
+            foretile *f = (foretile *)data;
+            h = hash_trans(f->next * 256 + f->damage, f->im);
+            h = hash_boundary(h, f->points);
+            return f->micro_image ? hash_image(h, f->micro_image) : h;
+        }
+        case SPEC_CHARACTER :
+        case SPEC_CHARACTER2 :
+        {
+            figure *f = (figure *)data;
+            h = hash_trans(f->hit_damage * 256 + f->xcfg, f->forward);
+            h = hash_trans(h * 31 + f->advance, f->backward);
+            h = h * 31 + f->hit->tot;
+            for (int i = 0; i < f->hit->tot * 2; i++)
+                h = h * 31 + f->hit->data[i];
+            h = hash_boundary(h, f->f_damage);
+            return hash_boundary(h, f->b_damage);
+        }
+        case SPEC_IMAGE :
+            return hash_image(0, (image *)data);
+    }
+    return h;
+}
+
+struct Part
+{
+    char const *file, *name;
+    int type, batch, single;
+};
+
+int main(int argc, char **argv)
+{
+    harness_init(argc, argv);
+
+    std::vector<Part> parts;
+    int files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-datadir") || !strcmp(argv[i], "-threads"))
+        {
+            i++;
+            continue;
+        }
+        bFILE *fp = open_file(argv[i], "rb");
+        if (fp->open_failure())
+        {
+            printf("%s: cannot open\n", argv[i]);
+            return 1;
+        }
+        spec_directory sd(fp);
+        delete fp;
+        files++;
+        for (int j = 0; j < sd.total; j++)
+        {
+            // reg() picks the first entry of that name and type
+            Part p = { argv[i], strdup(sd.entries[j]->name),
+                       sd.entries[j]->type, -1, -1 };
+            if (sd.find(p.name, p.type) != sd.entries[j])
+                continue;
+            switch (p.type)
+            {
+                case SPEC_BACKTILE :
+                case SPEC_FORETILE :
+                case SPEC_CHARACTER :
+                case SPEC_CHARACTER2 :
+                case SPEC_IMAGE : parts.push_back(p); break;
+            }
+        }
+    }
+    if (parts.empty())
+    {
+        printf("nothing to decode\n");
+        return 1;
+    }
+
+    // Without rm_dups every reg() is a new item that is not loaded yet
+    std::vector<int> ids;
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        parts[i].batch = cache.reg(parts[i].file, parts[i].name, parts[i].type);
+        parts[i].single = cache.reg(parts[i].file, parts[i].name, parts[i].type);
+        ids.push_back(parts[i].batch);
+    }
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for (size_t i = 0; i < parts.size(); i++)
+        load(parts[i].single, parts[i].type);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    cache.decode_batch(&ids[0], (int)ids.size());
+    Uint64 t2 = SDL_GetPerformanceCounter();
+
+    int bad = 0;
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        Part &p = parts[i];
+        if (!cache.loaded(p.batch)
+             || hash_part(load(p.batch, p.type), p.type)
+                 != hash_part(load(p.single, p.type), p.type))
+        {
+            if (bad++ < 5)
+                printf("%s: %s of type %d differs\n", p.file, p.name, p.type);
+        }
+        cache.unreg(p.batch);
+        cache.unreg(p.single);
+        free((void *)p.name);
+    }
+
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+    printf("%d items from %d files: one by one %.1f ms, batch on %d "
+           "threads %.1f ms, %s\n", (int)parts.size(), files,
+           (t1 - t0) * ms, workers_total(), (t2 - t1) * ms,
+           bad ? "DIFFERENT" : "identical");
+    return bad != 0;
+}
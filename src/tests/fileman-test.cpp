@@ -0,0 +1,395 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// Loopback test for net/fileman.cpp: a server process serves a directory,
+// a proxy process delays everything by half the given round trip each way,
+// and the client reads every file through file_manager in 8 kB reads the
+// way bFILE does, checking the bytes against the disk. Then it reads 2 kB
+// at 20 offsets in each of the larger files, like loading a few entries
+// of a .spe. Prints the throughput, fails on any difference. The server
+// appends to open.log in the current directory.
+//
+//   fileman-test [-rtt <ms>] [-dir <directory>]
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include <deque>
+#include <algorithm>
+
+#include "common.h"
+
+#include "netface.h"
+#include "net/sock.h"
+#include "net/tcpip.h"
+#include "net/fileman.h"
+
+net_protocol *prot;
+tcpip_protocol tcpip;
+int net_start() { return 0; }
+
+static pid_t server = 0, proxy = 0;
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The client asks for full paths, which only -bastard lets through
+static void serve(int port)
+{
+    char const *args[] = { "fileman-test", "-bastard" };
+    prot = &tcpip;
+    fman = new file_manager(2, (char **)args, prot);
+    net_socket *listener = prot->create_listen_socket(port,
+                                                net_socket::SOCKET_SECURE);
+    listener->read_selectable();
+    for (;;)
+    {
+        prot->select(1);
+        if (listener->ready_to_read())
+        {
+            net_address *addr;
+            net_socket *s = listener->accept(addr);
+            if (s)
+            {
+                uint8_t type;
+                if (s->read(&type, 1) == 1 && type == CLIENT_NFS)
+                    fman->add_nfs_client(s);
+                else
+                    delete s;
+                delete addr;
+            }
+        }
+        fman->process_net();
+    }
+}
+
+// The proxy: every byte read on one side is written to the other one
+// delay seconds later
+struct chunk
+{
+    double at;
+    std::string data;
+};
+
+struct pipe_half
+{
+    int from, to, done;
+    double delay;
+    std::deque<chunk> queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void *pipe_writer(void *arg)
+{
+    pipe_half *h = (pipe_half *)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&h->mutex);
+        while (h->queue.empty() && !h->done)
+            pthread_cond_wait(&h->cond, &h->mutex);
+        if (h->queue.empty())
+        {
+            pthread_mutex_unlock(&h->mutex);
+            break;
+        }
+        chunk c = h->queue.front();
+        h->queue.pop_front();
+        pthread_mutex_unlock(&h->mutex);
+
+        double wait = c.at - now();
+        if (wait > 0)
+            usleep((useconds_t)(wait * 1e6));
+        for (size_t off = 0; off < c.data.size(); )
+        {
+            ssize_t n = write(h->to, c.data.data() + off, c.data.size() - off);
+            if (n <= 0)
+                return NULL;
+            off += n;
+        }
+    }
+    shutdown(h->to, SHUT_WR);
+    return NULL;
+}
+
+static void *pipe_reader(void *arg)
+{
+    pipe_half *h = (pipe_half *)arg;
+    int on = 1;
+    setsockopt(h->to, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    pthread_t writer;
+    pthread_create(&writer, NULL, pipe_writer, h);
+
+    char buf[65536];
+    for (;;)
+    {
+        ssize_t n = read(h->from, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        chunk c;
+        c.at = now() + h->delay;
+        c.data.assign(buf, n);
+        pthread_mutex_lock(&h->mutex);
+        h->queue.push_back(c);
+        pthread_cond_signal(&h->cond);
+        pthread_mutex_unlock(&h->mutex);
+    }
+    pthread_mutex_lock(&h->mutex);
+    h->done = 1;
+    pthread_cond_signal(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+    pthread_join(writer, NULL);
+    return NULL;
+}
+
+// Both directions finish before either socket is closed, so a reused fd
+// never gets shut down by a stale thread
+static void *pipe_connection(void *arg)
+{
+    pipe_half *h = (pipe_half *)arg;
+    pthread_t t[2];
+    for (int i = 0; i < 2; i++)
+        pthread_create(&t[i], NULL, pipe_reader, &h[i]);
+    for (int i = 0; i < 2; i++)
+        pthread_join(t[i], NULL);
+    close(h[0].from);
+    close(h[1].from);
+    delete[] h;
+    return NULL;
+}
+
+static void delay_proxy(int port, int target, double delay)
+{
+    signal(SIGPIPE, SIG_IGN);
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(l, (sockaddr *)&a, sizeof(a)) || listen(l, 16))
+        exit(1);
+
+    for (;;)
+    {
+        int c = accept(l, NULL, NULL);
+        if (c < 0)
+            continue;
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        a.sin_port = htons(target);
+        if (connect(s, (sockaddr *)&a, sizeof(a)))
+        {
+            close(c);
+            close(s);
+            continue;
+        }
+        pipe_half *h = new pipe_half[2];
+        for (int i = 0; i < 2; i++)
+        {
+            h[i].from = i ? s : c;
+            h[i].to = i ? c : s;
+            h[i].done = 0;
+            h[i].delay = delay;
+            pthread_mutex_init(&h[i].mutex, NULL);
+            pthread_cond_init(&h[i].cond, NULL);
+        }
+        pthread_t t;
+        pthread_create(&t, NULL, pipe_connection, h);
+        pthread_detach(t);
+    }
+}
+
+static void stop_children()
+{
+    if (server > 0)
+    {
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+    }
+    if (proxy > 0)
+    {
+        kill(proxy, SIGKILL);
+        waitpid(proxy, NULL, 0);
+    }
+}
+
+static int read_file(char const *dir, std::string const &name, double &bytes)
+{
+    std::string path = std::string(dir) + "/" + name;
+    char const *fname = path.c_str();
+    int fd = fman->rf_open_file(fname, "rb");
+    if (fd < 0)
+    {
+        printf("%s: open failed\n", name.c_str());
+        return 0;
+    }
+    int32_t size = fman->rf_file_size(fd);
+    std::vector<char> got(size + 8192), want(size + 1);
+    int32_t n = 0;
+    for (;;)
+    {
+        int r = fman->rf_read(fd, &got[n], 8192);
+        n += r;
+        if (r < 8192)
+            break;
+    }
+    fman->rf_close(fd);
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    int ok = fp && fread(&want[0], 1, size, fp) == (size_t)size
+              && n == size && !memcmp(&got[0], &want[0], size);
+    if (fp)
+        fclose(fp);
+    if (!ok)
+        printf("%s: got %d bytes of %d, or different ones\n", name.c_str(),
+               n, size);
+    bytes += size;
+    return ok;
+}
+
+static int seek_file(char const *dir, std::string const &name, int &seeks)
+{
+    std::string path = std::string(dir) + "/" + name;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size < 256 * 1024)
+    {
+        fclose(fp);
+        return 1;
+    }
+
+    // 16 offsets going forward, then 4 anywhere
+    std::vector<long> offsets;
+    for (int i = 0; i < 20; i++)
+    {
+        offsets.push_back((long)((double)rand() / RAND_MAX * (size - 2048)));
+        if (i == 15)
+            std::sort(offsets.begin(), offsets.end());
+    }
+
+    char const *fname = path.c_str();
+    int fd = fman->rf_open_file(fname, "rb"), ok = fd >= 0;
+    for (size_t i = 0; ok && i < offsets.size(); i++)
+    {
+        char got[2048], want[2048];
+        long o = offsets[i];
+        ok = fman->rf_seek(fd, o) == o && fman->rf_tell(fd) == o
+              && fman->rf_read(fd, got, 2048) == 2048
+              && !fseek(fp, o, SEEK_SET) && fread(want, 1, 2048, fp) == 2048
+              && !memcmp(got, want, 2048);
+        if (!ok)
+            printf("%s: wrong data after seeking to %ld\n", name.c_str(), o);
+        seeks++;
+    }
+    if (fd >= 0)
+        fman->rf_close(fd);
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    double rtt = 0;
+    char const *dir = ".";
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-rtt") && i + 1 < argc)
+            rtt = atof(argv[++i]) / 1000;
+        else if (!strcmp(argv[i], "-dir") && i + 1 < argc)
+            dir = argv[++i];
+    }
+
+    std::vector<std::string> files;
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "cd '%s' && find . -type f | sed 's|^\\./||' "
+             "| sort", dir);
+    FILE *fp = popen(cmd, "r");
+    char line[512];
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = 0;
+        files.push_back(line);
+    }
+    if (fp)
+        pclose(fp);
+    if (files.empty())
+    {
+        printf("no files in %s\n", dir);
+        return 1;
+    }
+
+    int sport = 23000 + getpid() % 1000, pport = sport + 1000;
+    server = fork();
+    if (!server)
+    {
+        serve(sport);
+        return 0;
+    }
+    proxy = fork();
+    if (!proxy)
+    {
+        delay_proxy(pport, sport, rtt / 2);
+        return 0;
+    }
+    atexit(stop_children);
+    usleep(200000);
+
+    prot = &tcpip;
+    fman = new file_manager(0, NULL, prot);
+    char name[64];
+    sprintf(name, "127.0.0.1:%d", pport);
+    char const *s = name;
+    net_address *addr = prot->get_node_address(s, pport, 0);
+    fman->set_default_fs(addr);
+
+    double t0 = now(), bytes = 0;
+    int ok = 1;
+    for (size_t i = 0; ok && i < files.size(); i++)
+        ok = read_file(dir, files[i], bytes);
+    double t1 = now();
+
+    int seeks = 0;
+    srand(1);
+    for (size_t i = 0; ok && i < files.size(); i++)
+        ok = seek_file(dir, files[i], seeks);
+    double t2 = now();
+
+    if (ok)
+        printf("rtt %3.0f ms  %d files %.1f MB in %.2f s = %6.2f MB/s   "
+               "%d seeks in %.2f s (%.1f ms each)\n", rtt * 1000,
+               (int)files.size(), bytes / 1e6, t1 - t0,
+               bytes / 1e6 / (t1 - t0), seeks, t2 - t1,
+               seeks ? (t2 - t1) * 1000 / seeks : 0.);
+    return !ok;
+}
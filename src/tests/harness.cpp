@@ -0,0 +1,120 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <string.h>
+#include <vector>
+
+#include "SDL.h"
+
+#include "common.h"
+
+#include "sdlport/setup.h"
+
+#include "dev.h"
+#include "view.h"
+#include "netface.h"
+#include "rollback.h"
+#include "game.h"
+#include "cache.h"
+#include "lisp.h"
+#include "jrand.h"
+#include "dprint.h"
+#include "guistat.h"
+#include "nfserver.h"
+#include "workers.h"
+#include "bench.h"
+
+#include "harness.h"
+
+extern flags_struct flags;
+void setup(int argc, char **argv);
+
+static std::vector<std::vector<uint8_t> > inputs;
+
+void harness_init(int argc, char **argv)
+{
+    // Like a -bench run: no gamma menu and no title screen waiting for keys
+    bench_on = 1;
+    start_argc = argc;
+    start_argv = argv;
+
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+
+    set_dprinter(game_printer);
+    set_dgetter(game_getter);
+    set_no_space_handler(handle_no_space);
+    setup(argc, argv);
+    flags.headless = 1;
+    flags.nosound = 1;
+    start_sound(argc, argv);
+    stat_man = new text_status_manager();
+
+    jrand_init();
+    set_spec_main_file("abuse.spe");
+    workers_init(argc, argv);
+    cache.prefetch_init(argc, argv);
+    cache.budget_init(argc, argv);
+
+    game_net_init(argc, argv);
+    Lisp::Init();
+    dev_init(argc, argv);
+    new Game(argc, argv);
+    dev_cont = new dev_controll();
+    dev_cont->load_stuff();
+}
+
+void harness_load(char const *name)
+{
+    the_game->load_level(name);
+    the_game->set_state(RUN_STATE);
+    inputs.clear();
+    // the main loop sends once before its first tick, or nothing comes back
+    net_send(1);
+}
+
+void harness_tick(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        // net_receive(), keeping a copy of what came in
+        uint8_t buf[PACKET_MAX_SIZE + 1];
+        int size = get_inputs_from_server(buf);
+        inputs.push_back(std::vector<uint8_t>(buf, buf + size));
+        process_packet_commands(buf, size);
+        send_join_snapshots();
+
+        the_game->get_input();
+        net_send();
+        service_net_request();
+        the_game->step();
+    }
+}
+
+int harness_ticks()
+{
+    return (int)inputs.size();
+}
+
+void harness_replay(int first, int n)
+{
+    for (int i = first; i < first + n && i < (int)inputs.size(); i++)
+    {
+        uint8_t buf[PACKET_MAX_SIZE + 1];
+        int size = (int)inputs[i].size();
+        if (size)
+            memcpy(buf, &inputs[i][0], size);
+        rollback_replay_tick(buf, size);
+    }
+}
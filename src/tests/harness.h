@@ -0,0 +1,31 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __HARNESS_HPP_
+#define __HARNESS_HPP_
+
+// The game with no window and no sound, for the tests that need real
+// levels. harness_init() does what main() does before its loop, argv is
+// handed to every part of it, so -datadir and the like work as usual.
+void harness_init(int argc, char **argv);
+
+// Load a level and play it, nobody is at the controls
+void harness_load(char const *name);
+
+// Run n ticks the way the main loop does, without drawing. The input of
+// every tick since the level was loaded is kept for harness_replay().
+void harness_tick(int n);
+int harness_ticks();
+
+// Play ticks first to first + n - 1 again on their recorded input, the way
+// rollback re-simulates them
+void harness_replay(int first, int n);
+
+#endif
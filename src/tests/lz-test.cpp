@@ -0,0 +1,122 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// Round trips for lz.cpp, the coder of the late join level snapshots.
+// First 3000 random, low entropy and periodic buffers: each one has to come
+// back unchanged, stay within lz_bound(), and be refused when truncated;
+// bit flipped copies only have to decode without writing past the end
+// (run it under ASan or valgrind for that). Then every file given on the
+// command line, usually the stock levels, which are in the same format as
+// the snapshots: prints the sizes and how long each side takes.
+//
+//   lz-test [file...]
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "lz.h"
+
+static int round_trip(uint8_t const *src, size_t len)
+{
+    std::vector<uint8_t> packed(lz_bound(len) + 1), back(len + 1);
+    size_t size = lz_compress(src, len, &packed[0]);
+    if (size > lz_bound(len))
+    {
+        printf("%d bytes compressed to %d, more than lz_bound()\n",
+               (int)len, (int)size);
+        return 0;
+    }
+    if (!lz_decompress(&packed[0], size, &back[0], len)
+         || memcmp(&back[0], src, len))
+    {
+        printf("%d bytes did not come back\n", (int)len);
+        return 0;
+    }
+    if (len && lz_decompress(&packed[0], size - 1, &back[0], len))
+    {
+        printf("%d bytes decoded from a truncated stream\n", (int)len);
+        return 0;
+    }
+    for (int i = 0; i < 20 && size; i++)
+    {
+        std::vector<uint8_t> bad(packed);
+        bad[rand() % size] ^= 1 << (rand() % 8);
+        lz_decompress(&bad[0], size, &back[0], len);
+    }
+    return 1;
+}
+
+static int time_file(char const *name)
+{
+    FILE *fp = fopen(name, "rb");
+    if (!fp)
+    {
+        printf("%s: cannot open\n", name);
+        return 0;
+    }
+    std::vector<uint8_t> src;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        src.insert(src.end(), buf, buf + n);
+    fclose(fp);
+    if (src.empty() || !round_trip(&src[0], src.size()))
+        return src.empty();
+
+    size_t len = src.size(), size = 0;
+    std::vector<uint8_t> packed(lz_bound(len)), back(len);
+    int reps = 20;
+    clock_t t0 = clock();
+    for (int i = 0; i < reps; i++)
+        size = lz_compress(&src[0], len, &packed[0]);
+    clock_t t1 = clock();
+    for (int i = 0; i < reps; i++)
+        lz_decompress(&packed[0], size, &back[0], len);
+    clock_t t2 = clock();
+
+    char const *base = strrchr(name, '/');
+    printf("%-16s %7d -> %6d bytes  compress %.2f ms  decompress %.2f ms\n",
+           base ? base + 1 : name, (int)len, (int)size,
+           1000.0 * (t1 - t0) / CLOCKS_PER_SEC / reps,
+           1000.0 * (t2 - t1) / CLOCKS_PER_SEC / reps);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    srand(3);
+    for (int t = 0; t < 3000; t++)
+    {
+        size_t len = rand() % (t < 100 ? 20 : 70000);
+        std::vector<uint8_t> src(len + 1);
+        for (size_t i = 0; i < len; i++)
+            switch (t % 3)
+            {
+            case 0: src[i] = rand(); break;
+            case 1: src[i] = rand() % 4; break;
+            default: src[i] = (i / 7) % 13; break;
+            }
+        if (!round_trip(&src[0], len))
+            return 1;
+    }
+    printf("3000 buffers ok\n");
+
+    int ok = 1;
+    for (int i = 1; i < argc; i++)
+        ok &= time_file(argv[i]);
+    return !ok;
+}
@@ -0,0 +1,160 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// level::foreground_intersect() against the walk it did before it learnt
+// to skip the rows a ray cannot reach. Each level given on the command line
+// is loaded in the real game, with no window, and gets random rays, long
+// and short ones, some of them vertical or horizontal; where they stop and
+// which tile they hit last have to be the same both ways.
+//
+//   raycheck-test -datadir <dir> [-rays <n>] <level.spe>...
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#include "game.h"
+#include "level.h"
+#include "intsect.h"
+
+#include "harness.h"
+
+// The full walk: every tile of the padded box is checked
+#define remapx(x) (x==0 ? -1 : x==tl-1 ? tl+1 : x)
+#define remapy(y) (y==0 ? -1 : y==th-1 ? th+1 : y)
+
+static void ray_reference(level *l, int32_t x1, int32_t y1,
+                          int32_t &x2, int32_t &y2)
+{
+    int32_t tl = the_game->ftile_width(), th = the_game->ftile_height();
+    int32_t bx1 = Min(x1, x2), bx2 = Max(x1, x2);
+    int32_t by1 = Min(y1, y2), by2 = Max(y1, y2);
+    bx1 = (bx1 - 2) / tl - 1;
+    bx2 = (bx2 + tl + 2) / tl + 1;
+    by1 = (by1 - 2) / th - 1;
+    by2 = (by2 + th + 2) / th + 1;
+
+    if (bx2 >= l->foreground_width())
+        x2 = tl * l->foreground_width() - 1;
+    if (by2 >= l->foreground_height())
+        y2 = th * l->foreground_height() - 1;
+    bx1 = Max(bx1, 0);
+    by1 = Max(by1, 0);
+    if (bx1 > bx2 || by1 > by2)
+        return;
+
+    for (int32_t bx = bx1; bx <= bx2; bx++)
+        for (int32_t by = by1; by <= by2; by++)
+        {
+            int block = the_game->GetMapFg(ivec2(bx, by));
+            if (block <= BLACK)
+                continue;
+
+            foretile *f = the_game->get_fg(block);
+            uint8_t *bdat = f->points->data, *ins = f->points->inside;
+            int32_t xo = bx * tl, yo = by * th;
+            for (int j = 0; j < f->points->tot - 1; j++, ins++, bdat += 2)
+            {
+                int32_t ox2 = x2, oy2 = y2;
+                setback_intersect(x1, y1, x2, y2,
+                                  xo + remapx(bdat[0]), yo + remapy(bdat[1]),
+                                  xo + remapx(bdat[2]), yo + remapy(bdat[3]),
+                                  *ins ? 1 : -1);
+                if (ox2 != x2 || oy2 != y2)
+                {
+                    last_tile_hit_x = bx;
+                    last_tile_hit_y = by;
+                }
+            }
+        }
+}
+
+// Returns the number of rays that stopped somewhere else
+static int check_rays(char const *name, int rays)
+{
+    level *l = current_level;
+    int32_t w = l->foreground_width() * the_game->ftile_width();
+    int32_t h = l->foreground_height() * the_game->ftile_height();
+    uint32_t seed = 1234;
+    int hits = 0, bad = 0;
+
+    for (int r = 0; r < rays; r++)
+    {
+        uint32_t v[6];
+        for (int i = 0; i < 6; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            v[i] = seed >> 8;
+        }
+        int32_t x1 = v[0] % (w + 40) - 20, y1 = v[1] % (h + 40) - 20;
+        int kind = v[2] % 4, len = kind == 0 ? 2000 : kind == 1 ? 400 : 60;
+        int32_t x2 = kind == 3 ? x1 : x1 + (int32_t)(v[3] % (2 * len + 1)) - len;
+        int32_t y2 = y1 + (int32_t)(v[4] % (2 * len + 1)) - len;
+        if (v[5] % 8 == 0)
+            y2 = y1;
+
+        int32_t ax2 = x2, ay2 = y2, bx2 = x2, by2 = y2;
+        last_tile_hit_x = last_tile_hit_y = -1;
+        ray_reference(l, x1, y1, ax2, ay2);
+        int32_t hx = last_tile_hit_x, hy = last_tile_hit_y;
+        last_tile_hit_x = last_tile_hit_y = -1;
+        l->foreground_intersect(x1, y1, bx2, by2);
+
+        if (ax2 != x2 || ay2 != y2)
+            hits++;
+        if (ax2 != bx2 || ay2 != by2
+             || hx != last_tile_hit_x || hy != last_tile_hit_y)
+        {
+            if (bad++ < 10)
+                printf("%s: ray %d,%d -> %d,%d stops at %d,%d (tile %d,%d)"
+                       " instead of %d,%d (tile %d,%d)\n", name, x1, y1, x2,
+                       y2, bx2, by2, last_tile_hit_x, last_tile_hit_y,
+                       ax2, ay2, hx, hy);
+        }
+    }
+
+    printf("%s: %d rays, %d hits, %d different\n", name, rays, hits, bad);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    int rays = 20000;
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-rays") && i + 1 < argc)
+            rays = atoi(argv[i + 1]);
+
+    harness_init(argc, argv);
+
+    int levels = 0, bad = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-datadir") || !strcmp(argv[i], "-rays"))
+        {
+            i++;
+            continue;
+        }
+        harness_load(argv[i]);
+        if (!current_level)
+        {
+            printf("%s: cannot load\n", argv[i]);
+            return 1;
+        }
+        bad += check_rays(argv[i], rays);
+        levels++;
+    }
+    return !levels || bad;
+}
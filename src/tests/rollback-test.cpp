@@ -0,0 +1,518 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// Loopback test for rollback.cpp: two peers, each with its own copy of the
+// rollback engine, play a small deterministic game over a simulated network
+// with latency and packet loss. Both must end on the state of a reference
+// run that had every input on time, without a desync being reported. With
+// -corrupt <tick> one peer gets that tick wrong, every time it plays it,
+// and both must notice through SCMD_SYNC and ask for a reload. With
+// -compare every game is played again without input bundling, which must
+// not stall the peers for less time than the bundled one.
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+#include "netface.h"
+#include "rollback.h"
+#include "dprint.h"
+
+static int verbose = 0;
+
+void dprintf(const char *format, ...)
+{
+    if (!verbose)
+        return;
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+// Each copy gets its own declarations, so calls between the engine's own
+// functions stay inside that copy. The game hooks go to the toy game.
+#undef __ROLLBACK_HPP_
+namespace peer0 {
+#include "rollback.cpp"
+}
+#undef __ROLLBACK_HPP_
+namespace peer1 {
+#include "rollback.cpp"
+}
+
+#define PEER(ns) \
+    void ns::rollback_save_state(int slot) { ::rollback_save_state(slot); } \
+    int ns::rollback_load_state(int slot) { return ::rollback_load_state(slot); } \
+    void ns::rollback_replay_tick(uint8_t *pk, int size) { ::rollback_replay_tick(pk, size); } \
+    uint16_t ns::rollback_state_sync() { return ::rollback_state_sync(); }
+
+struct engine
+{
+    int (*init)(int, char **);
+    void (*reset)();
+    void (*report)();
+    void (*players)(uint32_t);
+    void (*local)(uint32_t, int, uint8_t const *, int);
+    int (*bundle)(uint8_t, int, int, uint8_t *, int);
+    void (*unbundle)(uint8_t, uint8_t const *, int);
+    int (*ready)();
+    uint8_t (*waiting)();
+    int (*inputs)(uint8_t *);
+    int (*sync)(uint32_t);
+    int *desyncs;
+};
+
+#define ENGINE(ns) { ns::rollback_init, ns::rollback_reset, \
+    ns::rollback_report, ns::rollback_players, ns::rollback_local, \
+    ns::rollback_bundle, ns::rollback_unbundle, ns::rollback_ready, \
+    ns::rollback_waiting_tick, ns::rollback_inputs, ns::rollback_sync, \
+    &ns::stats.desyncs }
+
+static engine engines[2] = { ENGINE(peer0), ENGINE(peer1) };
+
+// The game: two players moving and bumping into each other, with a shared
+// random number
+struct toy
+{
+    int32_t tick;
+    uint32_t rnd;
+    int32_t x[2], y[2], vx[2], vy[2], score[2], keys[2];
+};
+
+static int reloads;
+
+static void apply(toy &g, uint8_t const *pk, int size)
+{
+    for (int i = 0; i < size; )
+    {
+        switch (pk[i])
+        {
+        case SCMD_SET_INPUT:
+        {
+            int p = pk[i + 1] & 1, b = pk[i + 2];
+            g.vx[p] = (b & 1) ? 1 : (b & 2) ? -1 : 0;
+            g.vy[p] = (b & 4) ? 1 : (b & 8) ? -1 : 0;
+            if (b & 16)
+                g.score[p] += g.x[p] & 7;
+            i += 7;
+            break;
+        }
+        case SCMD_KEYPRESS:
+        {
+            int p = pk[i + 1] & 1;
+            g.keys[p] = (int32_t)((uint32_t)g.keys[p] * 31 + pk[i + 2]);
+            i += 3;
+            break;
+        }
+        case SCMD_SYNC:
+            i += 3;
+            break;
+        case SCMD_RELOAD:
+            reloads++;
+            i++;
+            break;
+        default:
+            printf("unexpected command %d\n", pk[i]);
+            exit(1);
+        }
+    }
+}
+
+static void step(toy &g)
+{
+    for (int p = 0; p < 2; p++)
+    {
+        g.rnd = g.rnd * 1103515245 + 12345;
+        g.x[p] += g.vx[p] * 3 + (int)((g.rnd >> 16) % 3) - 1;
+        g.y[p] += g.vy[p] * 3;
+    }
+    if (abs(g.x[0] - g.x[1]) < 8 && abs(g.y[0] - g.y[1]) < 8)
+    {
+        int w = g.rnd >> 31;
+        g.score[w] += 10;
+        g.x[w ^ 1] += w ? -20 : 20;
+    }
+    g.tick++;
+}
+
+static void start(toy &g)
+{
+    memset(&g, 0, sizeof(g));
+    g.x[1] = 100;
+    g.rnd = 42;
+}
+
+// Scripted player: holds a direction for a while, sometimes fires or types
+static int make_input(int p, int32_t tick, uint8_t *pk)
+{
+    uint32_t h = (tick / (7 + 5 * p)) * 2654435761u + p * 40503;
+    h ^= h >> 13;
+    uint8_t bits = (uint8_t)(h & 0x0f);
+    if ((bits & 3) == 3)
+        bits &= ~2;
+    if ((bits & 12) == 12)
+        bits &= ~8;
+    if (tick % 11 == p * 3)
+        bits |= 16;
+
+    int n = 0;
+    if (tick % 37 == 5 + p)
+    {
+        pk[n++] = SCMD_KEYPRESS;
+        pk[n++] = p;
+        pk[n++] = 'a' + tick % 26;
+    }
+    pk[n++] = SCMD_SET_INPUT;
+    pk[n++] = p;
+    pk[n++] = bits;
+    int16_t px = 160, py = 100;
+    memcpy(pk + n, &px, 2); n += 2;
+    memcpy(pk + n, &py, 2); n += 2;
+    return n;
+}
+
+struct peer
+{
+    toy state, snaps[ROLLBACK_MAX];
+    double next_frame, blocked_since, last_resend, blocked_ms;
+    int32_t tick;       // newest local tick sent
+    int frames;
+    std::vector<double> sent, latency;
+};
+
+static peer peers[2];
+static peer *cur;
+static int corrupt = -1;
+
+static void play(peer &q, uint8_t const *pk, int size)
+{
+    apply(q.state, pk, size);
+    step(q.state);
+    // a bug in the second peer's game, replays make the same mistake
+    if (&q == &peers[1] && q.state.tick == corrupt)
+        q.state.score[0]++;
+}
+
+void rollback_save_state(int slot) { cur->snaps[slot] = cur->state; }
+int rollback_load_state(int slot) { cur->state = cur->snaps[slot]; return 1; }
+void rollback_replay_tick(uint8_t *pk, int size) { play(*cur, pk, size); }
+
+uint16_t rollback_state_sync()
+{
+    uint8_t const *p = (uint8_t const *)&cur->state;
+    uint16_t x = 0;
+    for (size_t i = 0; i < sizeof(toy); i++)
+        x = x * 31 + p[i];
+    return x;
+}
+
+PEER(peer0)
+PEER(peer1)
+
+// The network: every message arrives one_way ms after it was sent, unless
+// it is lost
+struct message
+{
+    double at;
+    int to, resend;
+    uint8_t tick;
+    uint8_t data[PACKET_MAX_SIZE];
+    int size;
+};
+
+static std::vector<message> wire;
+static double one_way, loss;
+static uint32_t net_rnd;
+
+static double frand()
+{
+    net_rnd = net_rnd * 1664525 + 1013904223;
+    return (net_rnd >> 8) / 16777216.0;
+}
+
+static void send_input(int to, double now, uint8_t tick,
+                       uint8_t const *pk, int size, int reliable)
+{
+    if (!reliable && frand() < loss)
+        return;
+    message m;
+    m.at = now + one_way;
+    m.to = to;
+    m.resend = 0;
+    m.tick = tick;
+    memcpy(m.data, pk, size);
+    m.size = size;
+    wire.push_back(m);
+}
+
+static void send_resend(int to, double now, uint8_t tick)
+{
+    message m;
+    m.at = now + one_way;
+    m.to = to;
+    m.resend = 1;
+    m.tick = tick;
+    m.size = 0;
+    wire.push_back(m);
+}
+
+static void deliver(double now)
+{
+    for (size_t i = 0; i < wire.size(); )
+    {
+        message m = wire[i];
+        if (m.at > now)
+        {
+            i++;
+            continue;
+        }
+        wire.erase(wire.begin() + i);
+        cur = &peers[m.to];
+        engine &e = engines[m.to];
+        if (m.resend)
+        {
+            uint8_t buf[PACKET_MAX_SIZE];
+            int size = e.bundle(m.tick, -1, 1, buf, sizeof(buf));
+            if (size > 0)
+                send_input(m.to ^ 1, now, m.tick, buf, size, 0);
+        }
+        else
+            e.unbundle(m.tick, m.data, m.size);
+    }
+}
+
+struct result
+{
+    int match, desyncs[2], reloads;
+    double mean, p95, blocked_ms;
+};
+
+// One game of the given number of frames, a frame every 65 ms
+static result run(char const *redundancy, double rtt, double loss_rate,
+                  int frames)
+{
+    char *argv[] = { (char *)"rollback-test", (char *)"-rollback",
+                     (char *)"8", (char *)"-redundancy",
+                     (char *)redundancy, NULL };
+    int argc = redundancy ? 5 : 3;
+
+    one_way = rtt / 2;
+    loss = loss_rate;
+    net_rnd = 1234;
+    reloads = 0;
+    wire.clear();
+    int desyncs[2];
+    for (int p = 0; p < 2; p++)
+    {
+        desyncs[p] = *engines[p].desyncs;
+        peer &q = peers[p];
+        engine &e = engines[p];
+        cur = &q;
+        e.init(argc, argv);
+        e.reset();
+        start(q.state);
+        q.next_frame = p * 23.0;
+        q.blocked_since = -1;
+        q.blocked_ms = 0;
+        q.tick = 0;
+        q.frames = 0;
+        q.sent.assign(frames + 2, 0);
+        q.latency.clear();
+
+        uint8_t pk[32], buf[PACKET_MAX_SIZE];
+        int n = make_input(p, 0, pk);
+        e.players(1u << (p ^ 1));
+        e.local(0, p, pk, n);
+        n = e.bundle(0, -1, 0, buf, sizeof(buf));
+        send_input(p ^ 1, q.next_frame, 0, buf, n, 0);
+        q.sent[0] = q.next_frame;
+    }
+
+    for (double now = 0; peers[0].frames < frames || peers[1].frames < frames;
+         now += 1)
+    {
+        deliver(now);
+        for (int p = 0; p < 2; p++)
+        {
+            peer &q = peers[p];
+            engine &e = engines[p];
+            cur = &q;
+            if (q.frames >= frames || now < q.next_frame)
+                continue;
+
+            uint8_t buf[PACKET_MAX_SIZE + 1];
+            if (!e.ready())
+            {
+                if (q.blocked_since < 0)
+                    q.blocked_since = q.last_resend = now;
+                if (now - q.last_resend >= 50)
+                {
+                    uint8_t t = e.waiting();
+                    send_resend(p ^ 1, now, t);
+                    int size = e.bundle(t, -1, 1, buf, sizeof(buf));
+                    if (size > 0)
+                        send_input(p ^ 1, now, t, buf, size, 0);
+                    q.last_resend = now;
+                }
+                continue;
+            }
+            if (q.blocked_since >= 0)
+            {
+                q.blocked_ms += now - q.blocked_since;
+                q.blocked_since = -1;
+            }
+
+            int size = e.inputs(buf);
+            play(q, buf, size);
+            // the frame that shows our input for this tick is drawn now
+            q.latency.push_back(now - q.sent[q.tick]);
+            q.frames++;
+
+            uint8_t pk[32];
+            q.tick++;
+            int n = make_input(p, q.tick, pk);
+            int sync = e.sync(q.tick);
+            if (sync >= 0)
+            {
+                uint16_t x = lstl((uint16_t)sync);
+                pk[n++] = SCMD_SYNC;
+                memcpy(pk + n, &x, 2);
+                n += 2;
+            }
+            e.players(1u << (p ^ 1));
+            e.local(q.tick, p, pk, n);
+            n = e.bundle(q.tick, -1, 0, buf, sizeof(buf));
+            send_input(p ^ 1, now, q.tick, buf, n, 0);
+            q.sent[q.tick] = now;
+            q.next_frame = std::max(q.next_frame + 65, now);
+        }
+    }
+
+    // Settle: everything up to the last tick played arrives, then each peer
+    // rewinds as needed before its next tick
+    int32_t last = frames - 1;
+    for (int p = 0; p < 2; p++)
+        for (int32_t t = 0; t <= last; t++)
+        {
+            uint8_t buf[PACKET_MAX_SIZE];
+            int size = engines[p ^ 1].bundle(t, -1, 1, buf, sizeof(buf));
+            cur = &peers[p];
+            if (size > 0)
+                engines[p].unbundle(t, buf, size);
+        }
+
+    toy ref;
+    start(ref);
+    for (int32_t t = 0; t <= last; t++)
+    {
+        uint8_t pk[64];
+        int n = make_input(0, t, pk);
+        n += make_input(1, t, pk + n);
+        apply(ref, pk, n);
+        step(ref);
+    }
+
+    result r;
+    r.match = 1;
+    for (int p = 0; p < 2; p++)
+    {
+        uint8_t buf[PACKET_MAX_SIZE + 1];
+        cur = &peers[p];
+        engines[p].inputs(buf);
+        r.match &= !memcmp(&cur->state, &ref, sizeof(toy));
+        r.desyncs[p] = *engines[p].desyncs - desyncs[p];
+    }
+    r.reloads = reloads;
+
+    std::vector<double> l = peers[0].latency;
+    l.insert(l.end(), peers[1].latency.begin(), peers[1].latency.end());
+    std::sort(l.begin(), l.end());
+    r.mean = 0;
+    for (size_t i = 0; i < l.size(); i++)
+        r.mean += l[i];
+    r.mean /= l.size();
+    r.p95 = l[l.size() * 95 / 100];
+    r.blocked_ms = peers[0].blocked_ms + peers[1].blocked_ms;
+
+    if (verbose)
+        for (int p = 0; p < 2; p++)
+            engines[p].report();
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = 900, compare = 0;
+    char const *redundancy = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-redundancy") && i + 1 < argc)
+            redundancy = argv[++i];
+        else if (!strcmp(argv[i], "-compare"))
+            compare = 1;
+        else if (!strcmp(argv[i], "-corrupt") && i + 1 < argc)
+            corrupt = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-v"))
+            verbose = 1;
+    }
+
+    static double const rtts[] = { 0, 50, 100, 200, 300 };
+    static double const losses[] = { 0, 0.05, 0.10, 0.20 };
+    double bundled = 0, unbundled = 0;
+    int failed = 0;
+    for (int l = 0; l < 4; l++)
+        for (int i = 0; i < 5; i++)
+        {
+            result r = run(redundancy, rtts[i], losses[l], frames);
+            int ok = corrupt < 0 ? r.match && !r.desyncs[0] && !r.desyncs[1]
+                                   && !r.reloads
+                                 : r.desyncs[0] && r.desyncs[1] && r.reloads;
+            printf("rtt %3.0f ms  loss %2.0f%%  latency mean %6.1f ms  "
+                   "p95 %6.1f ms  blocked %6.0f ms  desyncs %d/%d  %s\n",
+                   rtts[i], losses[l] * 100, r.mean, r.p95, r.blocked_ms,
+                   r.desyncs[0], r.desyncs[1], !ok ? "FAILED"
+                   : corrupt < 0 ? "states match" : "desync seen");
+            failed += !ok;
+
+            if (compare)
+            {
+                result r0 = run("0", rtts[i], losses[l], frames);
+                int worse = r0.blocked_ms < r.blocked_ms;
+                printf("    without bundling: latency mean %6.1f ms  "
+                       "p95 %6.1f ms  blocked %6.0f ms  %s\n", r0.mean,
+                       r0.p95, r0.blocked_ms, !r0.match ? "FAILED"
+                       : worse ? "FAILED, stalls less" : "states match");
+                failed += !r0.match || worse;
+                bundled += r.blocked_ms;
+                unbundled += r0.blocked_ms;
+            }
+        }
+
+    if (compare)
+    {
+        printf("blocked in total: %.0f ms bundled, %.0f ms without\n",
+               bundled, unbundled);
+        failed += bundled >= unbundled;
+    }
+    return failed != 0;
+}
@@ -0,0 +1,223 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// level::save_snapshot() and load_snapshot() on a real level, the way the
+// rollback code uses them. Each level given on the command line is loaded
+// in the game, with no window, and played for a while. Then a snapshot is
+// taken and the level runs on: objects are created and deleted, and more
+// ticks go by. After load_snapshot() the level has to be what it was when
+// the snapshot was taken, and the ticks after it, replayed on the input
+// they had, have to play out the same as the first time. Levels are
+// compared through a dump of their objects, lights, tiles and views in
+// which links are list positions, so recreated objects at other addresses
+// compare equal.
+//
+//   snapshot-test -datadir <dir> [-ticks <n>] <level.spe>...
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "common.h"
+
+#include "game.h"
+#include "level.h"
+#include "objects.h"
+#include "light.h"
+#include "view.h"
+#include "jrand.h"
+#include "lisp.h"
+
+#include "harness.h"
+
+typedef std::vector<int32_t> dump;
+
+static int32_t index_of(game_object *first, game_object *who)
+{
+    int32_t n = 0;
+    for (game_object *o = first; o; o = o->next, n++)
+        if (o == who)
+            return n;
+    return -1;
+}
+
+static int32_t light_index(light_source *l)
+{
+    int32_t n = 0;
+    for (light_source *f = first_light_source; f; f = f->next, n++)
+        if (f == l)
+            return n;
+    return -1;
+}
+
+#define D(x) d.push_back((int32_t)(x));
+
+static dump level_dump(level *l)
+{
+    dump d;
+    D(l->tick_counter()) D(rand_on)
+    for (int y = 0; y < l->foreground_height(); y++)
+        for (int x = 0; x < l->foreground_width(); x++)
+            D(l->get_fgline(y)[x])
+    for (int y = 0; y < l->background_height(); y++)
+        for (int x = 0; x < l->background_width(); x++)
+            D(l->get_bgline(y)[x])
+
+    for (light_source *f = first_light_source; f; f = f->next)
+    {
+        D(f->type) D(f->x) D(f->y) D(f->xshift) D(f->yshift)
+        D(f->inner_radius) D(f->outer_radius)
+    }
+    D(-1)
+
+    // o->active is left out: every tick starts with a new active list, and
+    // load_snapshot() leaves the objects inactive until then
+    game_object *first = l->first_object();
+    for (game_object *o = first; o; o = o->next)
+    {
+        D(o->otype) D(o->x) D(o->y) D(o->direction)
+        D(o->state) D(o->current_frame) D(o->flags()) D(o->gravity())
+        D(o->targetable()) D(o->xvel()) D(o->yvel()) D(o->xacel())
+        D(o->yacel()) D(o->fx()) D(o->fy()) D(o->fxvel()) D(o->fyvel())
+        D(o->fxacel()) D(o->fyacel()) D(o->aitype()) D(o->aistate())
+        D(o->aistate_time()) D(o->hp()) D(o->mp()) D(o->fmp())
+        D(o->fade_dir()) D(o->fade_count()) D(o->fade_max())
+        D(o->frame_dir()) D(o->controller() ? o->controller()->player_number : -1)
+        int tv = o->otype < 0xffff ? figures[o->otype]->tv : 0;
+        for (int i = 0; i < tv; i++)
+            D(o->lvars[i])
+        D(o->total_objects())
+        for (int i = 0; i < o->total_objects(); i++)
+            D(index_of(first, o->get_object(i)))
+        D(o->total_lights())
+        for (int i = 0; i < o->total_lights(); i++)
+            D(light_index(o->get_light(i)))
+    }
+    D(-1)
+
+    for (view *v = player_list; v; v = v->next)
+    {
+        D(v->player_number) D(index_of(first, v->m_focus)) D(v->x_suggestion)
+        D(v->y_suggestion) D(v->b1_suggestion) D(v->b2_suggestion)
+        D(v->pan_x) D(v->pan_y) D(v->ambient) D(v->kills) D(v->secrets)
+    }
+    return d;
+}
+
+// Where two dumps part, so a failure says roughly what differs
+static int differ(dump const &a, dump const &b)
+{
+    int i = 0;
+    while (i < (int)a.size() && i < (int)b.size() && a[i] == b[i])
+        i++;
+    return i == (int)a.size() && i == (int)b.size() ? -1 : i;
+}
+
+static int same(char const *name, char const *what, dump const &a,
+                dump const &b)
+{
+    int i = differ(a, b);
+    if (i >= 0)
+        printf("%s: %s, dumps of %d and %d words differ at word %d\n", name,
+               what, (int)a.size(), (int)b.size(), i);
+    return i < 0;
+}
+
+// Returns 0 if the level did not come back
+static int check_level(char const *name, int ticks)
+{
+    level *l = current_level;
+    harness_tick(ticks);
+
+    level_snapshot snap = { NULL, 0, 0 };
+    dump saved = level_dump(l);
+    l->save_snapshot(&snap);
+    int mark = harness_ticks();
+    harness_tick(ticks);
+    dump later = level_dump(l);
+
+    // Go on from there with objects created and deleted: an explosion,
+    // which goes away by itself, next to every tenth object, then every
+    // seventh object is gone
+    int boom = lnumber_value(LSymbol::FindOrCreate("EXPLODE1")->GetValue());
+    int created = 0, deleted = 0, n = 0;
+    std::vector<game_object *> doomed;
+    for (game_object *o = l->first_object(); o; o = o->next, n++)
+    {
+        if (o->controller())
+            continue;
+        if (n % 10 == 0)
+        {
+            game_object *c = create(boom, o->x, o->y - 8);
+            l->add_object_after(c, o);
+            o = c;
+            created++;
+        }
+        else if (n % 7 == 3)
+            doomed.push_back(o);
+    }
+    for (size_t i = 0; i < doomed.size(); i++, deleted++)
+        l->delete_object(doomed[i]);
+    harness_tick(ticks);
+
+    int ok = 1;
+    if (differ(saved, level_dump(l)) < 0)
+    {
+        printf("%s: the level did not change\n", name);
+        ok = 0;
+    }
+    if (!l->load_snapshot(&snap))
+    {
+        printf("%s: load_snapshot() refused the snapshot\n", name);
+        ok = 0;
+    }
+    ok &= same(name, "not restored", saved, level_dump(l));
+    harness_replay(mark, ticks);
+    ok &= same(name, "replayed differently", later, level_dump(l));
+    free(snap.data);
+
+    printf("%s: %d words, %d created, %d deleted, %s\n", name,
+           (int)saved.size(), created, deleted, ok ? "restored" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int ticks = 50;
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-ticks") && i + 1 < argc)
+            ticks = atoi(argv[i + 1]);
+
+    harness_init(argc, argv);
+
+    int levels = 0, ok = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-datadir") || !strcmp(argv[i], "-ticks"))
+        {
+            i++;
+            continue;
+        }
+        harness_load(argv[i]);
+        if (!current_level)
+        {
+            printf("%s: cannot load\n", argv[i]);
+            return 1;
+        }
+        ok &= check_level(argv[i], ticks);
+        levels++;
+    }
+    return !levels || !ok;
+}
@@ -0,0 +1,125 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+// Checks the spec_directory name index against a plain scan of entries[].
+// Reads the directory of every .spe given on the command line and looks up
+// each entry with find(name, type), find(name) and find_number(name), the
+// calls load_data() and CacheList::reg() make, five times over. Any answer
+// that differs from the first match in directory order is a failure. Prints
+// how long the scans and the indexed lookups took, index builds included.
+//
+//   spec-test <file.spe>...
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "common.h"
+
+#include "specs.h"
+
+int scale_mult = 1, scale_div = 1;
+
+static long scan(spec_directory *sd, char const *name, int type)
+{
+    for (int i = 0; i < sd->total; i++)
+        if (!strcmp(sd->entries[i]->name, name)
+             && (type < 0 || sd->entries[i]->type == type))
+            return i;
+    return -1;
+}
+
+static spec_entry *entry(spec_directory *sd, long i)
+{
+    return i < 0 ? NULL : sd->entries[i];
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<spec_directory *> dirs;
+    long entries = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        jFILE fp(argv[i], "rb");
+        if (fp.open_failure())
+        {
+            printf("%s: cannot open\n", argv[i]);
+            return 1;
+        }
+        dirs.push_back(new spec_directory(&fp));
+        entries += dirs.back()->total;
+    }
+
+    // The answers are kept so that neither loop can be optimised away
+    int reps = 5;
+    std::vector<spec_entry *> want, got;
+    clock_t t0 = clock();
+    for (int r = 0; r < reps; r++)
+    {
+        want.clear();
+        for (size_t d = 0; d < dirs.size(); d++)
+            for (int i = 0; i < dirs[d]->total; i++)
+            {
+                spec_directory *sd = dirs[d];
+                char const *name = sd->entries[i]->name;
+                int type = sd->entries[i]->type;
+                want.push_back(entry(sd, scan(sd, name, type)));
+                want.push_back(entry(sd, scan(sd, name, -1)));
+                want.push_back(entry(sd, scan(sd, name, -1)));
+            }
+    }
+    clock_t t1 = clock();
+    for (int r = 0; r < reps; r++)
+    {
+        got.clear();
+        for (size_t d = 0; d < dirs.size(); d++)
+            for (int i = 0; i < dirs[d]->total; i++)
+            {
+                spec_directory *sd = dirs[d];
+                char const *name = sd->entries[i]->name;
+                int type = sd->entries[i]->type;
+                got.push_back(sd->find(name, type));
+                got.push_back(sd->find(name));
+                got.push_back(entry(sd, sd->find_number(name)));
+            }
+    }
+    clock_t t2 = clock();
+
+    int bad = 0;
+    for (size_t n = 0, d = 0; d < dirs.size(); d++)
+    {
+        for (int i = 0; i < dirs[d]->total; i++, n += 3)
+            if (got[n] != want[n] || got[n + 1] != want[n + 1]
+                 || got[n + 2] != want[n + 2])
+            {
+                printf("%s: wrong entry for \"%s\"\n", argv[d + 1],
+                       dirs[d]->entries[i]->name);
+                bad++;
+            }
+        if (dirs[d]->find("no such entry") || dirs[d]->find_number("") >= 0)
+        {
+            printf("%s: found a name that is not there\n", argv[d + 1]);
+            bad++;
+        }
+    }
+
+    printf("%d files, %ld entries: scan %.2f ms, index %.2f ms\n",
+           (int)dirs.size(), entries,
+           1000.0 * (t1 - t0) / CLOCKS_PER_SEC,
+           1000.0 * (t2 - t1) / CLOCKS_PER_SEC);
+    for (size_t d = 0; d < dirs.size(); d++)
+        delete dirs[d];
+    return bad != 0;
+}
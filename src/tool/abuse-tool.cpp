@@ -18,10 +18,24 @@
 #include "common.h"
 #include "specs.h"
 #include "image.h"
+#include "transimage.h"
+#include "cpu.h"
+#include "filter.h"
 #include "pcxread.h"
 #include "crc.h"
+#include "points.h"
+#include "pack.h"
+#include "lol/timer.h"
+
+/* points.cpp scales collision points like the game does, never here */
+int scale_mult = 1, scale_div = 1;
 
 static void Usage();
+static int Bench(int argc, char *argv[]);
+static int Pack(char const *file, jFILE &fp, spec_directory &dir,
+                char const *pack);
+static int Verify(char const *file, jFILE &fp, spec_directory &dir,
+                  char const *pack);
 
 enum
 {
@@ -35,6 +49,9 @@ enum
     CMD_TYPE,
     CMD_GETPCX,
     CMD_PUTPCX,
+    CMD_BENCH,
+    CMD_PACK,
+    CMD_VERIFY,
 };
 
 int main(int argc, char *argv[])
@@ -54,6 +71,9 @@ int main(int argc, char *argv[])
             : !strcmp(argv[2], "type") ? CMD_TYPE
             : !strcmp(argv[2], "getpcx") ? CMD_GETPCX
             : !strcmp(argv[2], "putpcx") ? CMD_PUTPCX
+            : !strcmp(argv[2], "bench") ? CMD_BENCH
+            : !strcmp(argv[2], "pack") ? CMD_PACK
+            : !strcmp(argv[2], "verify") ? CMD_VERIFY
             : CMD_INVALID;
 
     if (cmd == CMD_INVALID)
@@ -97,6 +117,10 @@ int main(int argc, char *argv[])
     case CMD_PUTPCX:
         minargc = 6;
         break;
+    case CMD_PACK:
+    case CMD_VERIFY:
+        mode = "rb"; // Read-only access
+        break;
     }
 
     if (argc < minargc)
@@ -106,6 +130,10 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    /* The benchmark opens its own files, possibly several */
+    if (cmd == CMD_BENCH)
+        return Bench(argc, argv);
+
     /* Open the SPEC file */
     char tmpfile[4096];
     char const *file = argv[1];
@@ -120,6 +148,16 @@ int main(int argc, char *argv[])
 
     spec_directory dir(&fp);
 
+    /* Packs are written next to the SPEC file unless told otherwise */
+    if (cmd == CMD_PACK || cmd == CMD_VERIFY)
+    {
+        char *pack = argc > 3 ? strdup(argv[3]) : pack_filename(file);
+        int ret = cmd == CMD_PACK ? Pack(file, fp, dir, pack)
+                                  : Verify(file, fp, dir, pack);
+        free(pack);
+        return ret;
+    }
+
     /* Now really execute commands */
     if (cmd == CMD_LIST)
     {
@@ -393,5 +431,476 @@ static void Usage()
         "   type <id> <type>             set entry <id> type to <type>\n"
         "   move <id1> <id2>             move entry <id1> to position <id2>\n"
         "   del <id>                     delete entry <id>\n"
+        "   bench [<spec_file>...]       time drawing every character frame of the\n"
+        "                                given files into a 320x200 image, and\n"
+        "                                palette expansion at three screen sizes\n"
+        "   pack [<pack_file>]           write the images, tiles and characters\n"
+        "                                decoded to <pack_file>, by default the SPEC\n"
+        "                                file name followed by .pak\n"
+        "   verify [<pack_file>]         check a pack against its SPEC file and\n"
+        "                                time loading from both\n"
         "See the abuse-tool(6) manual page for more information.\n");
 }
+
+static int Bench(int argc, char *argv[])
+{
+    TransImage **frames = NULL;
+    int total = 0;
+
+    /* Load every character frame, argv[2] is the command itself */
+    for (int n = 1; n < argc; n = (n == 1) ? 3 : n + 1)
+    {
+        jFILE fp(argv[n], "rb");
+        if (fp.open_failure())
+        {
+            fprintf(stderr, "ERROR - could not open %s\n", argv[n]);
+            return EXIT_FAILURE;
+        }
+
+        spec_directory dir(&fp);
+        for (int i = 0; i < dir.total; i++)
+        {
+            spec_entry *se = dir.entries[i];
+            if (se->type != SPEC_CHARACTER && se->type != SPEC_CHARACTER2)
+                continue;
+
+            image *im = new image(&fp, se);
+            frames = (TransImage **)realloc(frames, (total + 1) * sizeof(TransImage *));
+            frames[total++] = new TransImage(im, se->name);
+            delete im;
+        }
+    }
+
+    if (!total)
+    {
+        fprintf(stderr, "abuse-tool: no character frames found\n");
+        return EXIT_FAILURE;
+    }
+
+    image *screen = new image(ivec2(320, 200));
+    uint8_t map[256], map2[256];
+    for (int i = 0; i < 256; i++)
+    {
+        map[i] = 255 - i;
+        map2[i] = i * 7;
+    }
+
+    static char const *modes[] = { "normal", "remap", "remap2" };
+    static char const *levels[] = { "c", "sse2", "avx2", "avx512" };
+    int const passes = 50;
+
+    printf("%d frames, %d passes\n", total, passes);
+
+    /* The CRC of the last screen must not depend on the kernel */
+    int max = TransImage::SetSpanLevel(CPU_AVX512);
+    for (int level = CPU_C; level <= max; level++)
+    {
+        TransImage::SetSpanLevel(level);
+        for (int mode = 0; mode < 3; mode++)
+        {
+            screen->clear(0);
+            /* A few untimed passes first to warm up the caches */
+            Timer t;
+            for (int pass = -5; pass < passes; pass++)
+            {
+                if (pass == 0)
+                    t.GetMs();
+                for (int i = 0; i < total; i++)
+                {
+                    /* Walk over the screen, partly off its edges */
+                    ivec2 pos((i * 37 + pass * 11) % 360 - 20,
+                              (i * 23 + pass * 7) % 240 - 20);
+                    if (mode == 0)
+                        frames[i]->PutImage(screen, pos);
+                    else if (mode == 1)
+                        frames[i]->PutRemap(screen, pos, map);
+                    else
+                        frames[i]->PutDoubleRemap(screen, pos, map, map2);
+                }
+            }
+            float ms = t.PollMs();
+
+            screen->Lock();
+            uint16_t crc = calc_crc(screen->scan_line(0), 320 * 200);
+            screen->Unlock();
+
+            printf("%-7s %-6s %9.2f ms %8.1f ns/frame  crc %04x\n",
+                   modes[mode], levels[level], ms,
+                   ms * 1e6f / (passes * total), crc);
+        }
+    }
+    TransImage::SetSpanLevel(max);
+
+    delete screen;
+
+    /* Palette expansion, as done for the dirty parts of the screen */
+    static ivec2 const sizes[] = { ivec2(320, 200), ivec2(640, 480),
+                                   ivec2(1920, 1080) };
+    static char const *expand_levels[] = { "c", "avx2" };
+    uint32_t lut[256];
+    for (int i = 0; i < 256; i++)
+        lut[i] = 0xff000000 | (i * 0x010305);
+
+    int expand_max = set_expand_level(1);
+    for (int s = 0; s < 3; s++)
+    {
+        int w = sizes[s].x, h = sizes[s].y;
+        int expand_passes = 100 * 1920 * 1080 / (w * h);
+        uint8_t *src = (uint8_t *)malloc(w * h);
+        uint32_t *dst = (uint32_t *)malloc(w * h * 4);
+        for (int i = 0; i < w * h; i++)
+            src[i] = (i * 31 + i / w * 7) & 0xff;
+
+        for (int level = 0; level <= expand_max; level++)
+        {
+            set_expand_level(level);
+            Timer t;
+            for (int pass = -5; pass < expand_passes; pass++)
+            {
+                if (pass == 0)
+                    t.GetMs();
+                expand_rect(dst, w * 4, src, w, w, h, lut);
+            }
+            float ms = t.PollMs();
+
+            printf("expand  %-5s %4dx%-4d %8.3f ms/screen %6.2f ns/pixel"
+                   "  crc %04x\n", expand_levels[level], w, h,
+                   ms / expand_passes, ms * 1e6f / expand_passes / (w * h),
+                   calc_crc(dst, w * h * 4));
+        }
+        free(src);
+        free(dst);
+    }
+    set_expand_level(expand_max);
+
+    for (int i = 0; i < total; i++)
+        delete frames[i];
+    free(frames);
+    return EXIT_SUCCESS;
+}
+
+/* An item in the form the game holds it, see items.h */
+struct PackItem
+{
+    int type;
+    image *im;                  /* images and back tiles */
+    TransImage *fwd, *bwd;      /* fore tiles only use fwd */
+    boundary *fb, *bb;
+    point_list *hit;
+    uint16_t next;
+    uint8_t damage, hit_damage, xcfg, advance;
+};
+
+/* Same as the backtile, foretile and figure constructors */
+static void ReadSpeItem(bFILE *fp, spec_entry *se, PackItem &it)
+{
+    memset(&it, 0, sizeof(it));
+    it.type = se->type;
+    fp->seek(se->offset, SEEK_SET);
+    image *im = new image(fp);
+
+    switch (se->type)
+    {
+    case SPEC_IMAGE:
+        it.im = im;
+        break;
+    case SPEC_BACKTILE:
+        it.im = im;
+        it.next = fp->read_uint16();
+        break;
+    case SPEC_FORETILE:
+        it.fwd = new TransImage(im, "foretile");
+        delete im;
+        it.next = fp->read_uint16();
+        it.damage = fp->read_uint8();
+        it.fb = new boundary(fp, se->name);
+        break;
+    default:
+        it.fwd = new TransImage(im, "figure data");
+        im->FlipX();
+        it.bwd = new TransImage(im, "figure backward data");
+        delete im;
+        it.hit_damage = fp->read_uint8();
+        it.xcfg = fp->read_uint8();
+        if (se->type == SPEC_CHARACTER)
+            point_list skip(fp);
+        else
+            it.advance = fp->read_uint8();
+        it.fb = new boundary(fp, se->name);
+        it.bb = new boundary(it.fb);
+        it.hit = new point_list(fp);
+        break;
+    }
+}
+
+/* The blob layouts read by pack_decode() in cache.cpp */
+static void WritePackItem(bFILE *fp, PackItem &it)
+{
+    switch (it.type)
+    {
+    case SPEC_IMAGE:
+        pack_write_image(fp, it.im);
+        break;
+    case SPEC_BACKTILE:
+        pack_write_image(fp, it.im);
+        fp->write_uint16(it.next);
+        break;
+    case SPEC_FORETILE:
+        pack_write_trans(fp, it.fwd);
+        fp->write_uint16(it.next);
+        fp->write_uint8(it.damage);
+        pack_write_boundary(fp, it.fb);
+        break;
+    default:
+        pack_write_trans(fp, it.fwd);
+        pack_write_trans(fp, it.bwd);
+        fp->write_uint8(it.hit_damage);
+        fp->write_uint8(it.xcfg);
+        fp->write_uint8(it.advance);
+        pack_write_boundary(fp, it.fb);
+        pack_write_boundary(fp, it.bb);
+        pack_write_points(fp, it.hit);
+        break;
+    }
+}
+
+static void ReadPackItem(uint8_t const *p, int type, PackItem &it)
+{
+    memset(&it, 0, sizeof(it));
+    it.type = type;
+
+    switch (type)
+    {
+    case SPEC_IMAGE:
+        it.im = pack_read_image(p);
+        break;
+    case SPEC_BACKTILE:
+        it.im = pack_read_image(p);
+        it.next = pack_u16(p);
+        break;
+    case SPEC_FORETILE:
+        it.fwd = pack_read_trans(p);
+        it.next = pack_u16(p);
+        it.damage = pack_u8(p);
+        it.fb = pack_read_boundary(p);
+        break;
+    default:
+        it.fwd = pack_read_trans(p);
+        it.bwd = pack_read_trans(p);
+        it.hit_damage = pack_u8(p);
+        it.xcfg = pack_u8(p);
+        it.advance = pack_u8(p);
+        it.fb = pack_read_boundary(p);
+        it.bb = pack_read_boundary(p);
+        it.hit = pack_read_points(p);
+        break;
+    }
+}
+
+static void FreePackItem(PackItem &it)
+{
+    delete it.im;
+    delete it.fwd;
+    delete it.bwd;
+    delete it.fb;
+    delete it.bb;
+    delete it.hit;
+}
+
+static spec_directory *sort_dir;
+
+static int PackCompare(void const *a, void const *b)
+{
+    spec_entry *x = sort_dir->entries[*(int const *)a];
+    spec_entry *y = sort_dir->entries[*(int const *)b];
+    int cmp = strcmp(x->name, y->name);
+    if (!cmp)
+        cmp = x->type - y->type;
+    /* Some files hold the same name twice, keep them in file order */
+    return cmp ? cmp : x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static void PadTo(bFILE *fp, long align)
+{
+    while (fp->tell() % align)
+        fp->write_uint8(0);
+}
+
+static int Pack(char const *file, jFILE &fp, spec_directory &dir,
+                char const *pack)
+{
+    int *order = (int *)malloc(sizeof(int) * (dir.total + 1));
+    int n = 0;
+    for (int i = 0; i < dir.total; i++)
+        if (pack_type(dir.entries[i]->type))
+            order[n++] = i;
+    sort_dir = &dir;
+    qsort(order, n, sizeof(int), PackCompare);
+
+    memFILE names, index, blobs;
+    long names_start = PACK_HEADER_SIZE + n * PACK_ENTRY_SIZE;
+    for (int k = 0; k < n; k++)
+    {
+        char const *name = dir.entries[order[k]]->name;
+        names.write(name, strlen(name) + 1);
+    }
+    if (!n)
+        names.write_uint8(0);
+
+    /* Blobs follow the names, each on its own PACK_ALIGN boundary */
+    long blobs_start = names_start + names.file_size();
+    blobs_start = (blobs_start + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+
+    long name = 0;
+    for (int k = 0; k < n; k++)
+    {
+        spec_entry *se = dir.entries[order[k]];
+        PackItem it;
+        ReadSpeItem(&fp, se, it);
+        PadTo(&blobs, PACK_ALIGN);
+        long start = blobs.tell();
+        WritePackItem(&blobs, it);
+        FreePackItem(it);
+        long size = blobs.tell() - start;
+
+        index.write_uint32(name);
+        index.write_uint8(se->type);
+        for (int i = 0; i < 3; i++)
+            index.write_uint8(0);
+        index.write_uint32(se->offset);
+        index.write_uint32(blobs_start + start);
+        index.write_uint32(size);
+        index.write_uint32(crc_update(0, blobs.data() + start, size));
+        index.write_uint32(0);
+        index.write_uint32(0);
+        name += strlen(se->name) + 1;
+    }
+
+    memFILE header;
+    header.write(PACK_MAGIC, 8);
+    header.write_uint32(PACK_VERSION);
+    header.write_uint32(n);
+    header.write_uint32(fp.file_size());
+    header.write_uint32(crc_file(&fp));
+    header.write_uint32(names.file_size());
+    uint32_t crc = crc_update(0, index.data(), index.file_size());
+    header.write_uint32(crc_update(crc, names.data(), names.file_size()));
+    PadTo(&header, PACK_HEADER_SIZE);
+
+    jFILE out(pack, "wb");
+    if (out.open_failure())
+    {
+        fprintf(stderr, "ERROR - could not open %s\n", pack);
+        free(order);
+        return EXIT_FAILURE;
+    }
+    out.write(header.data(), header.file_size());
+    out.write(index.data(), index.file_size());
+    out.write(names.data(), names.file_size());
+    PadTo(&out, PACK_ALIGN);
+    out.write(blobs.data(), blobs.file_size());
+
+    printf("%s: %d of %d items, %ld bytes\n", pack, n, dir.total,
+           (long)(blobs_start + blobs.file_size()));
+    free(order);
+    return EXIT_SUCCESS;
+}
+
+static int Verify(char const *file, jFILE &fp, spec_directory &dir,
+                  char const *pack)
+{
+    PackFile pk(pack);
+    if (pk.open_failure())
+    {
+        fprintf(stderr, "ERROR - %s: %s\n", pack, pk.error);
+        return EXIT_FAILURE;
+    }
+    if (!pk.matches(&fp))
+    {
+        fprintf(stderr, "ERROR - %s was not made from %s\n", pack, file);
+        return EXIT_FAILURE;
+    }
+
+    int errors = 0;
+    for (int i = 0; i < pk.total(); i++)
+    {
+        PackEntry *e = pk.entry(i);
+        if (i && (strcmp(e[-1].name, e->name) > 0
+                   || (!strcmp(e[-1].name, e->name) && e[-1].type > e->type)))
+        {
+            fprintf(stderr, "%s: index not sorted at %s\n", pack, e->name);
+            errors++;
+        }
+        if (!pk.check(e))
+        {
+            fprintf(stderr, "%s: CRC mismatch for %s\n", pack, e->name);
+            errors++;
+        }
+    }
+
+    /* Every item must be there, and be what packing it again gives */
+    int n = 0;
+    for (int i = 0; i < dir.total; i++)
+    {
+        spec_entry *se = dir.entries[i];
+        if (!pack_type(se->type))
+            continue;
+        n++;
+
+        PackEntry *e = pk.find_source(se->offset);
+        if (!e || e->type != se->type || strcmp(e->name, se->name))
+        {
+            fprintf(stderr, "%s: %s is missing\n", pack, se->name);
+            errors++;
+            continue;
+        }
+
+        PackItem it;
+        memFILE blob;
+        ReadSpeItem(&fp, se, it);
+        WritePackItem(&blob, it);
+        FreePackItem(it);
+        if (blob.file_size() != (long)e->size
+             || memcmp(blob.data(), pk.blob(e), e->size))
+        {
+            fprintf(stderr, "%s: %s differs from the SPEC file\n",
+                    pack, se->name);
+            errors++;
+        }
+    }
+    if (n != pk.total())
+    {
+        fprintf(stderr, "%s: %d items, %d expected\n", pack, pk.total(), n);
+        errors++;
+    }
+
+    if (errors)
+    {
+        fprintf(stderr, "%s: %d errors\n", pack, errors);
+        return EXIT_FAILURE;
+    }
+
+    /* Load everything from both, the way the cache would */
+    Timer t;
+    for (int i = 0; i < dir.total; i++)
+    {
+        if (!pack_type(dir.entries[i]->type))
+            continue;
+        PackItem it;
+        ReadSpeItem(&fp, dir.entries[i], it);
+        FreePackItem(it);
+    }
+    float spe_ms = t.GetMs();
+
+    for (int i = 0; i < pk.total(); i++)
+    {
+        PackItem it;
+        ReadPackItem(pk.blob(pk.entry(i)), pk.entry(i)->type, it);
+        FreePackItem(it);
+    }
+    float pack_ms = t.GetMs();
+
+    printf("%s: %d items OK, loaded in %.2f ms from %s, %.2f ms from the pack\n",
+           pack, n, spe_ms, file, pack_ms);
+    return EXIT_SUCCESS;
+}
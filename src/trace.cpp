@@ -0,0 +1,170 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "common.h"
+
+#include "trace.h"
+#include "dprint.h"
+
+// Every thread writes to its own ring, so recording a zone takes no lock.
+// Once a ring is full the oldest zones make room for new ones.
+#define TRACE_EVENTS 65536
+#define TRACE_THREADS 32
+
+struct trace_event
+{
+    char const *name, *detail;
+    uint64_t start, end;
+};
+
+struct trace_buffer
+{
+    uint32_t written;   // zones ever recorded, the ring holds the last ones
+    trace_event events[TRACE_EVENTS];
+};
+
+int trace_on = 0;
+
+static char *trace_file = NULL;
+static uint64_t trace_start;
+static trace_buffer *trace_buffers[TRACE_THREADS];
+static SDL_atomic_t trace_threads;
+
+static thread_local trace_buffer *trace_local = NULL;
+static thread_local int trace_full = 0;
+
+static trace_buffer *trace_register()
+{
+    int n = SDL_AtomicAdd(&trace_threads, 1);
+    if (n >= TRACE_THREADS)
+    {
+        trace_full = 1;
+        return NULL;
+    }
+    trace_local = (trace_buffer *)calloc(1, sizeof(trace_buffer));
+    trace_buffers[n] = trace_local;
+    return trace_local;
+}
+
+void trace_init(int argc, char **argv)
+{
+    for (int i = 1; i + 1 < argc; i++)
+        if (!strcmp(argv[i], "-trace"))
+            trace_file = argv[++i];
+    if (!trace_file)
+        return;
+
+    trace_start = trace_now();
+    trace_register(); // the main thread comes first
+    trace_on = 1;
+}
+
+uint64_t trace_now()
+{
+    return SDL_GetPerformanceCounter();
+}
+
+double trace_seconds(uint64_t ticks)
+{
+    static double freq = (double)SDL_GetPerformanceFrequency();
+    return ticks / freq;
+}
+
+void trace_add(char const *name, char const *detail, uint64_t start)
+{
+    trace_buffer *b = trace_local;
+    if (!b && (trace_full || !(b = trace_register())))
+        return;
+
+    trace_event *e = b->events + b->written % TRACE_EVENTS;
+    e->name = name;
+    e->detail = detail;
+    e->start = start;
+    e->end = trace_now();
+    b->written++;
+}
+
+static void trace_string(FILE *fp, char const *s)
+{
+    fputc('"', fp);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+void trace_write()
+{
+    FILE *fp = fopen(trace_file, "w");
+    if (!fp)
+    {
+        dprintf("trace: unable to open %s\n", trace_file);
+        return;
+    }
+
+    int threads = Min(SDL_AtomicGet(&trace_threads), TRACE_THREADS);
+    long total = 0, lost = 0;
+
+    // Times are in microseconds from -trace being seen
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int t = 0; t < threads; t++)
+    {
+        trace_buffer *b = trace_buffers[t];
+        if (!b)
+            continue;
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                t ? ",\n" : "", t, t ? "worker" : "main");
+
+        uint32_t written = b->written;
+        uint32_t first = written > TRACE_EVENTS ? written - TRACE_EVENTS : 0;
+        lost += first;
+        for (uint32_t i = first; i < written; i++)
+        {
+            trace_event *e = b->events + i % TRACE_EVENTS;
+            fprintf(fp, ",\n{\"name\":");
+            trace_string(fp, e->name);
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f", t,
+                    trace_seconds(e->start - trace_start) * 1e6,
+                    trace_seconds(e->end - e->start) * 1e6);
+            if (e->detail)
+            {
+                fprintf(fp, ",\"args\":{\"detail\":");
+                trace_string(fp, e->detail);
+                fputc('}', fp);
+            }
+            fputc('}', fp);
+            total++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    dprintf("trace: %ld zones from %d threads written to %s", total, threads,
+            trace_file);
+    if (lost)
+        dprintf(", %ld older ones were overwritten", lost);
+    dprintf("\n");
+}
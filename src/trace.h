@@ -0,0 +1,49 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __TRACE_HPP_
+#define __TRACE_HPP_
+
+#include <stdint.h>
+
+// Tick tracing: "-trace file.json" records nested zones (game step, level
+// tick, collisions, lighting, drawing, lisp calls, cache misses) from every
+// thread and writes them when the game loop ends, in the Chrome trace
+// event format that chrome://tracing and Perfetto open.
+
+extern int trace_on;
+
+void trace_init(int argc, char **argv);
+void trace_write();
+
+// Monotonic clock, in ticks of the SDL performance counter
+uint64_t trace_now();
+double trace_seconds(uint64_t ticks);
+
+// Records a zone that started at "start" and ends now. name and detail
+// must outlive the trace, detail may be NULL.
+void trace_add(char const *name, char const *detail, uint64_t start);
+
+class trace_zone
+{
+public:
+    trace_zone(char const *name, char const *detail = NULL)
+      : name(trace_on ? name : NULL), detail(detail)
+    {
+        if (this->name)
+            start = trace_now();
+    }
+    ~trace_zone() { if (name) trace_add(name, detail, start); }
+private:
+    char const *name, *detail;
+    uint64_t start;
+};
+
+#endif
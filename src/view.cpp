@@ -58,6 +58,8 @@ view::~view()
         free(weapons);
         free(last_weapons);
     }
+
+    delete m_tiles;
 }
 
 
@@ -210,6 +212,9 @@ view::view(game_object *focus, view *Next, int number)
     m_chat_buf[0] = 0;
 
   draw_solid=-1;
+  m_tiles=NULL;
+  m_tiles_pos=m_tiles_bgpos=ivec2(0);
+  m_tiles_changes=0;
   no_xleft=0;
   no_xright=0;
   no_ytop=0;
@@ -1175,6 +1180,17 @@ void process_packet_commands(uint8_t *pk, int size)
     }
       } break;
 
+      case SCMD_JOIN :
+      {
+    uint8_t player_num=*(pk++),len=*(pk++);
+    char name[100];
+    int copy=Min((int)len,(int)sizeof(name)-1);
+    memcpy(name,pk,copy);
+    name[copy]=0;
+    pk+=len;
+    net_join(player_num,name);
+      } break;
+
       case SCMD_SYNC :
       {
     uint16_t x;
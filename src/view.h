@@ -124,9 +124,17 @@ public:
     ivec2 m_shift; // shift of view
     ivec2 m_lastpos, m_lastlastpos;
 
+    // Tiles as last drawn by Game::draw_tile_layer(), with the foreground
+    // and background offsets they were drawn at
+    image *m_tiles;
+    ivec2 m_tiles_pos, m_tiles_bgpos;
+    int32_t m_tiles_changes;
+
     game_object *m_focus; // object we are focusing on (player)
 
 private:
+    friend class level; // level::save_snapshot() copies the keymap and chat line
+
     uint8_t m_keymap[512 / 8];
     char m_chat_buf[60];
 };
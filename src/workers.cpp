@@ -0,0 +1,124 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#if defined HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "common.h"
+
+#include "workers.h"
+#include "dprint.h"
+
+#define MAX_WORKERS 15
+
+static int wanted = -1, started = 0, total_threads = 0;
+static SDL_sem *start_sem, *done_sem;
+
+// The current job, only written by workers_run() while the pool is idle
+static void (*job_func)(void *data, int index);
+static void *job_data;
+static int job_count;
+static SDL_atomic_t job_next;
+
+static void run_parts()
+{
+    int i;
+    while ((i = SDL_AtomicAdd(&job_next, 1)) < job_count)
+        job_func(job_data, i);
+}
+
+static int worker_main(void *)
+{
+    for (;;)
+    {
+        SDL_SemWait(start_sem);
+        run_parts();
+        SDL_SemPost(done_sem);
+    }
+    return 0;
+}
+
+static void start_workers()
+{
+    started = 1;
+
+    int n = wanted >= 0 ? wanted : SDL_GetCPUCount() - 1;
+    n = Max(0, Min(n, MAX_WORKERS));
+    if (!n)
+        return;
+
+    start_sem = SDL_CreateSemaphore(0);
+    done_sem = SDL_CreateSemaphore(0);
+    if (!start_sem || !done_sem)
+    {
+        dprintf("workers: unable to create semaphores: %s\n", SDL_GetError());
+        return;
+    }
+
+    // The threads wait for work until the program exits
+    while (total_threads < n)
+    {
+        SDL_Thread *t = SDL_CreateThread(worker_main, "worker", NULL);
+        if (!t)
+        {
+            dprintf("workers: unable to create thread: %s\n", SDL_GetError());
+            break;
+        }
+        SDL_DetachThread(t);
+        total_threads++;
+    }
+}
+
+void workers_init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            wanted = atoi(argv[++i]);
+    start_workers();
+}
+
+int workers_total()
+{
+    if (!started)
+        start_workers();
+    return total_threads + 1;
+}
+
+void workers_run(void (*job)(void *data, int index), void *data, int count)
+{
+    if (!started)
+        start_workers();
+
+    int wake = Min(total_threads, count - 1);
+    if (wake <= 0)
+    {
+        for (int i = 0; i < count; i++)
+            job(data, i);
+        return;
+    }
+
+    job_func = job;
+    job_data = data;
+    job_count = count;
+    SDL_AtomicSet(&job_next, 0);
+
+    for (int i = 0; i < wake; i++)
+        SDL_SemPost(start_sem);
+    run_parts();
+    for (int i = 0; i < wake; i++)
+        SDL_SemWait(done_sem);
+}
+
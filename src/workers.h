@@ -0,0 +1,29 @@
+/*
+ *  Abuse - dark 2D side-scrolling platform game
+ *  Copyright (c) 1995 Crack dot Com
+ *  Copyright (c) 2005-2011 Sam Hocevar <sam@hocevar.net>
+ *
+ *  This software was released into the Public Domain. As with most public
+ *  domain software, no warranty is made or implied by Crack dot Com, by
+ *  Jonathan Clark, or by Sam Hocevar.
+ */
+
+#ifndef __WORKERS_HPP_
+#define __WORKERS_HPP_
+
+// A small pool of worker threads for splitting one job into independent
+// parts. "-threads N" sets the number of extra threads, the default is
+// one less than the number of CPUs and 0 keeps everything on the caller.
+
+void workers_init(int argc, char **argv);
+
+// Threads that will run parts of a job, the calling one included
+int workers_total();
+
+// Call job(data, i) for every i in [0, count) and return once all are
+// done. Parts run in any order and on any thread, so they must not write
+// to the same memory.
+void workers_run(void (*job)(void *data, int index), void *data, int count);
+
+#endif
+